@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""
+Resident FastCGI backend for fastcgi_pass locations, a local stand-in for php-fpm or flup.
+It accepts multiplexed connections (FCGI_MPXS_CONNS=1) and runs each request's handler on a
+thread pool, so the interpreter starts once instead of once per request.
+
+    python3 cgi-scripts/fastcgi_backend.py [unix:/path | unix:@name | host:port]
+
+The default is unix:/tmp/webserv-fastcgi.sock.
+"""
+
+import asyncio
+import concurrent.futures
+import os
+import socket
+import struct
+import sys
+import time
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_ABORT_REQUEST = 2
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_STDERR = 7
+FCGI_GET_VALUES = 9
+FCGI_GET_VALUES_RESULT = 10
+FCGI_UNKNOWN_TYPE = 11
+FCGI_KEEP_CONN = 1
+FCGI_REQUEST_COMPLETE = 0
+FCGI_UNKNOWN_ROLE = 3
+MAX_REQUESTS = 64
+
+executor = concurrent.futures.ThreadPoolExecutor(max_workers=MAX_REQUESTS)
+
+
+def handle(environ, body):
+    """The application: returns (status, headers, body) for one request."""
+    if environ.get("PATH_INFO", "").startswith("/sleep"):
+        time.sleep(float(environ.get("QUERY_STRING") or 1))
+    page = (
+        "<html><body><h1>Hello from FastCGI</h1>"
+        f"<p>pid {os.getpid()}</p>"
+        f"<p>{environ.get('REQUEST_METHOD')} {environ.get('SCRIPT_NAME')}"
+        f" {environ.get('PATH_INFO')} ?{environ.get('QUERY_STRING')}</p>"
+        f"<p>{len(body)} bytes of body</p>"
+        "</body></html>\n"
+    ).encode()
+    headers = [("Content-Type", "text/html"), ("Content-Length", str(len(page)))]
+    return "200 OK", headers, page
+
+
+def record(record_type, request_id, content=b""):
+    return struct.pack("!BBHHBx", 1, record_type, request_id, len(content), 0) + content
+
+
+def stream(record_type, request_id, data):
+    chunks = [data[i:i + 65535] for i in range(0, len(data), 65535)]
+    return b"".join(record(record_type, request_id, chunk) for chunk in chunks)
+
+
+def encode_pairs(pairs):
+    out = b""
+    for name, value in pairs:
+        for length in (len(name), len(value)):
+            out += struct.pack("!B", length) if length < 128 else struct.pack("!I", length | 0x80000000)
+        out += name + value
+    return out
+
+
+def decode_pairs(data):
+    pairs, offset = {}, 0
+
+    def length():
+        nonlocal offset
+        if data[offset] < 128:
+            offset += 1
+            return data[offset - 1]
+        offset += 4
+        return struct.unpack("!I", data[offset - 4:offset])[0] & 0x7FFFFFFF
+
+    while offset < len(data):
+        name_length, value_length = length(), length()
+        name = data[offset:offset + name_length].decode("latin-1")
+        value = data[offset + name_length:offset + name_length + value_length].decode("latin-1")
+        pairs[name] = value
+        offset += name_length + value_length
+    return pairs
+
+
+async def serve_connection(reader, writer):
+    requests = {}
+    keep_conn = True
+
+    async def respond(request_id, request):
+        try:
+            status, headers, body = await asyncio.get_running_loop().run_in_executor(
+                executor, handle, decode_pairs(bytes(request["params"])), bytes(request["stdin"]))
+            head = f"Status: {status}\r\n" + "".join(f"{k}: {v}\r\n" for k, v in headers) + "\r\n"
+            if request_id in requests:
+                writer.write(stream(FCGI_STDOUT, request_id, head.encode() + body))
+        except Exception as error:
+            writer.write(stream(FCGI_STDERR, request_id, f"{error}\n".encode()))
+            writer.write(stream(FCGI_STDOUT, request_id, b"Status: 500 Internal Server Error\r\n\r\n"))
+        requests.pop(request_id, None)
+        writer.write(record(FCGI_STDOUT, request_id))
+        writer.write(record(FCGI_END_REQUEST, request_id, struct.pack("!IB3x", 0, FCGI_REQUEST_COMPLETE)))
+        await writer.drain()
+        if not request["keep"]:
+            writer.close()
+
+    try:
+        while True:
+            header = await reader.readexactly(8)
+            _, record_type, request_id, length, padding = struct.unpack("!BBHHBx", header)
+            content = await reader.readexactly(length + padding)
+            content = content[:length]
+
+            if record_type == FCGI_GET_VALUES:
+                known = {"FCGI_MAX_CONNS": "16", "FCGI_MAX_REQS": str(MAX_REQUESTS), "FCGI_MPXS_CONNS": "1"}
+                answer = [(k.encode(), known[k].encode()) for k in decode_pairs(content) if k in known]
+                writer.write(record(FCGI_GET_VALUES_RESULT, 0, encode_pairs(answer)))
+            elif record_type == FCGI_BEGIN_REQUEST:
+                role, flags = struct.unpack("!HB5x", content)
+                if role != 1:
+                    writer.write(record(FCGI_END_REQUEST, request_id, struct.pack("!IB3x", 0, FCGI_UNKNOWN_ROLE)))
+                    continue
+                keep_conn = bool(flags & FCGI_KEEP_CONN)
+                requests[request_id] = {"params": bytearray(), "stdin": bytearray(), "keep": keep_conn}
+            elif record_type == FCGI_PARAMS and request_id in requests:
+                requests[request_id]["params"] += content
+            elif record_type == FCGI_STDIN and request_id in requests:
+                if content:
+                    requests[request_id]["stdin"] += content
+                else:
+                    asyncio.ensure_future(respond(request_id, requests[request_id]))
+            elif record_type == FCGI_ABORT_REQUEST and request_id in requests:
+                del requests[request_id]    # respond() still ends it, without a body
+            elif record_type not in (FCGI_PARAMS, FCGI_STDIN, FCGI_ABORT_REQUEST):
+                writer.write(record(FCGI_UNKNOWN_TYPE, 0, struct.pack("!B7x", record_type)))
+            await writer.drain()
+    except (asyncio.IncompleteReadError, ConnectionError):
+        writer.close()
+
+
+async def main(target):
+    if target.startswith("unix:"):
+        path = target[5:]
+        if path.startswith("@"):
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.bind("\0" + path[1:])
+            server = await asyncio.start_unix_server(serve_connection, sock=sock)
+        else:
+            if os.path.exists(path):
+                os.unlink(path)
+            server = await asyncio.start_unix_server(serve_connection, path=path)
+    else:
+        host, port = target.rsplit(":", 1)
+        server = await asyncio.start_server(serve_connection, host, int(port))
+    print(f"FastCGI backend {os.getpid()} listening on {target}", flush=True)
+    async with server:
+        await server.serve_forever()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main(sys.argv[1] if len(sys.argv) > 1 else "unix:/tmp/webserv-fastcgi.sock"))
+    except KeyboardInterrupt:
+        pass
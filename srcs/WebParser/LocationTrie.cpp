@@ -0,0 +1,95 @@
+#include "LocationTrie.hpp"
+
+LocationTrie::LocationTrie()
+{
+    clear();
+}
+
+void LocationTrie::clear(void)
+{
+    _nodes.clear();
+    _nodes.push_back(Node());
+}
+
+ssize_t LocationTrie::findChild(size_t node, char c) const
+{
+    for (size_t child : _nodes[node].children)
+    {
+        if (_nodes[child].label[0] == c)
+            return (child);
+    }
+    return (-1);
+}
+
+//the first location inserted for a URI wins, same as the old linear scan did with duplicates
+void LocationTrie::insert(const std::string &uri, size_t locationIndex)
+{
+    size_t  node = 0;
+    size_t  pos = 0;
+
+    while (pos < uri.length())
+    {
+        ssize_t child = findChild(node, uri[pos]);
+        if (child == -1)
+        {
+            Node leaf;
+            leaf.label = uri.substr(pos);
+            leaf.locationIndex = locationIndex;
+            _nodes.push_back(leaf);
+            _nodes[node].children.push_back(_nodes.size() - 1);
+            return ;
+        }
+
+        const std::string &label = _nodes[child].label;
+        size_t common = 0;
+        while (common < label.length() && pos + common < uri.length() && label[common] == uri[pos + common])
+            common++;
+
+        if (common < label.length())
+        {
+            //split the edge: node -> middle -> child
+            Node middle;
+            middle.label = label.substr(0, common);
+            middle.children.push_back(child);
+            _nodes[child].label = _nodes[child].label.substr(common);
+            _nodes.push_back(middle);
+            for (size_t &c : _nodes[node].children)
+            {
+                if (c == static_cast<size_t>(child))
+                    c = _nodes.size() - 1;
+            }
+            child = _nodes.size() - 1;
+        }
+        node = child;
+        pos += common;
+    }
+    if (_nodes[node].locationIndex == -1)
+        _nodes[node].locationIndex = locationIndex;
+}
+
+ssize_t LocationTrie::findLongestPrefix(const std::string &uri) const
+{
+    ssize_t best = -1;
+    size_t  node = 0;
+    size_t  pos = 0;
+
+    while (pos < uri.length())
+    {
+        ssize_t child = findChild(node, uri[pos]);
+        if (child == -1)
+            break ;
+        const std::string &label = _nodes[child].label;
+        if (uri.compare(pos, label.length(), label) != 0)
+            break ;
+        pos += label.length();
+        node = child;
+        if (_nodes[node].locationIndex != -1 && isSegmentBoundary(uri, pos))
+            best = _nodes[node].locationIndex;
+    }
+    return (best);
+}
+
+bool LocationTrie::isSegmentBoundary(const std::string &uri, size_t matchedLength)
+{
+    return (matchedLength == uri.length() || uri[matchedLength - 1] == '/' || uri[matchedLength] == '/');
+}
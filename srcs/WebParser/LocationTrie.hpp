@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/*
+Compressed radix trie over the location URIs of one server.
+Every node stores the index of the location (in Server::locations) that ends there, or -1.
+A location only matches on a path segment boundary, so '/uploads' matches '/uploads' and
+'/uploads/a' but not '/uploadsX'. Locations ending in '/' match anything below them.
+*/
+class LocationTrie
+{
+public:
+    LocationTrie();
+    ~LocationTrie() = default;
+
+    void        insert(const std::string &uri, size_t locationIndex);
+    ssize_t     findLongestPrefix(const std::string &uri) const;
+    void        clear(void);
+
+private:
+    struct Node
+    {
+        std::string         label;
+        ssize_t             locationIndex = -1;
+        std::vector<size_t> children;
+    };
+
+    std::vector<Node>   _nodes;
+
+    ssize_t             findChild(size_t node, char c) const;
+    static bool         isSegmentBoundary(const std::string &uri, size_t matchedLength);
+};
@@ -1,5 +1,8 @@
 #include "WebParser.hpp"
 #include "WebErrors.hpp"
+#include <sys/un.h>
+#include <algorithm>
+#include <strings.h>
 
 WebParser::WebParser(const std::string &filename) 
 :  _filename(filename), _file(filename)
@@ -42,7 +45,10 @@ bool WebParser::parse()
     if (!_bracePairCheckStack.empty())
         throw WebErrors::ConfigFormatException("Error: unclosed braces");
     _file.close();
+    parseGlobalDirectives();
+    parseUpstreams();
     parseServer();
+    buildLocationTries();
     return true;
 }
 
@@ -51,6 +57,83 @@ const std::vector<Server> &WebParser::getServers(void) const
     return (_servers);
 }
 
+const GlobalConfig &WebParser::getGlobalConfig(void) const
+{
+    return (_globalConfig);
+}
+
+const std::vector<Upstream> &WebParser::getUpstreams(void) const
+{
+    return (_upstreams);
+}
+
+void WebParser::parseGlobalDirectives(void)
+{
+    _globalConfig.event_backend = extractGlobalDirective("event_backend");
+    if (_globalConfig.event_backend.empty())
+        _globalConfig.event_backend = "epoll";
+    if (_globalConfig.event_backend != "epoll" && _globalConfig.event_backend != "io_uring")
+        throw WebErrors::ConfigFormatException("Error: event_backend must be 'epoll' or 'io_uring'");
+    _globalConfig.proxy_keepalive = extractGlobalNumber("proxy_keepalive", 16, 0);
+    _globalConfig.proxy_keepalive_timeout = extractGlobalNumber("proxy_keepalive_timeout", 60, 1);
+    _globalConfig.proxy_keepalive_requests = extractGlobalNumber("proxy_keepalive_requests", 1000, 1);
+    _globalConfig.resolver_valid = extractGlobalNumber("resolver_valid", 30, 0);
+    _globalConfig.fastcgi_connections = extractGlobalNumber("fastcgi_connections", 4, 1);
+
+    const std::string zygote = extractGlobalDirective("cgi_zygote");
+    if (!zygote.empty() && zygote != "on" && zygote != "off")
+        throw WebErrors::ConfigFormatException("Error: cgi_zygote must be 'on' or 'off'");
+    _globalConfig.cgi_zygote = zygote == "on";
+}
+
+long WebParser::extractGlobalNumber(const std::string &key, long defaultValue, long minimum) const
+{
+    const std::string   value = extractGlobalDirective(key);
+    std::stringstream   stream(value);
+    long                number;
+    std::string         leftover;
+
+    if (value.empty())
+        return (defaultValue);
+    stream >> number;
+    if (stream.fail() || (stream >> leftover, !leftover.empty()) || number < minimum || number > INT_MAX)
+        throw WebErrors::ConfigFormatException("Error: invalid value for '" + key + "'");
+    return (number);
+}
+
+//value of a directive written outside of every context, or an empty string if it isn't there
+std::string WebParser::extractGlobalDirective(const std::string &key) const
+{
+    int         depth = 0;
+    ssize_t     directiveLocation = -1;
+
+    for (size_t line = 0; line < _configFile.size(); line++)
+    {
+        const std::string   &current = _configFile[line];
+        size_t              i = 0;
+
+        while (i < current.length() && isspace(current[i]))
+            i++;
+        if (depth == 0 && current.compare(i, key.length(), key) == 0
+            && i + key.length() < current.length() && isspace(current[i + key.length()]))
+        {
+            if (directiveLocation != -1)
+                throw WebErrors::ConfigFormatException("Error: only one '" + key + "' directive is allowed");
+            directiveLocation = line;
+        }
+        for (char c : current)
+        {
+            if (c == '{')
+                depth++;
+            else if (c == '}')
+                depth--;
+        }
+    }
+    if (directiveLocation == -1)
+        return ("");
+    return (trimSpaces(removeDirectiveKey(_configFile[directiveLocation], key)));
+}
+
 //Can we remove this + parseCGIPass now?
 void WebParser::parseProxyPass(const std::string &line)
 {
@@ -132,6 +215,24 @@ ssize_t  WebParser::locateContextEnd(size_t contextStart) const
     return (contextEnd);
 }
 
+//for directives that may repeat: the indexes of every line in the range starting with key
+std::vector<size_t> WebParser::locateDirectives(size_t contextStart, size_t contextEnd, std::string key) const
+{
+    std::vector<size_t> directiveIndexes;
+
+    while (contextStart < contextEnd)
+    {
+        size_t i = 0;
+        while (isspace(_configFile[contextStart][i]))
+            i++;
+        if (_configFile[contextStart].compare(i, key.length(), key) == 0
+            && (i + key.length() == _configFile[contextStart].length() || isspace(_configFile[contextStart][i + key.length()])))
+            directiveIndexes.push_back(contextStart);
+        contextStart++;
+    }
+    return (directiveIndexes);
+}
+
 //should return -1 if there's several in the given range, otherwise the index within the vector
 //if it can't be found, return 0 (it would never be on line 0, since a valid file would at best have the server directive there)
 ssize_t WebParser::locateDirective(size_t contextStart, size_t contextEnd, std::string key) const
@@ -191,15 +292,163 @@ void WebParser::parseServer(void)
         throw WebErrors::ConfigFormatException("Error: configuration file must contain at least one server context");
 }
 
+//upstream blocks live outside of the server contexts, parseServer skips over them
+void WebParser::parseUpstreams(void)
+{
+    int depth = 0;
+
+    for (size_t i = 0; i < _configFile.size(); i++)
+    {
+        std::string name;
+
+        if (depth == 0 && locateUpstreamContextStart(_configFile[i], name))
+        {
+            ssize_t contextEnd = locateContextEnd(i);
+            if (contextEnd == -1)
+                throw WebErrors::ConfigFormatException("Error: context not closed properly");
+            extractUpstreamInfo(name, i, contextEnd);
+            i = contextEnd;
+            continue ;
+        }
+        for (char c : _configFile[i])
+        {
+            if (c == '{')
+                depth++;
+            else if (c == '}')
+                depth--;
+        }
+    }
+}
+
+void WebParser::extractUpstreamInfo(const std::string &name, size_t contextStart, size_t contextEnd)
+{
+    Upstream    upstream;
+    ssize_t     balanceLocation = locateDirective(contextStart + 1, contextEnd, "balance");
+
+    for (const auto &other : _upstreams)
+    {
+        if (other.name == name)
+            throw WebErrors::ConfigFormatException("Error: duplicate upstream '" + name + "'");
+    }
+    upstream.name = name;
+    for (size_t line : locateDirectives(contextStart + 1, contextEnd, "server"))
+        upstream.servers.push_back(parseUpstreamServer(removeDirectiveKey(_configFile[line], "server")));
+    if (upstream.servers.empty())
+        throw WebErrors::ConfigFormatException("Error: upstream '" + name + "' has no server");
+
+    if (balanceLocation == -1)
+        throw WebErrors::ConfigFormatException("Error: only one 'balance' directive per upstream is allowed");
+    const std::string balance = balanceLocation ? trimSpaces(removeDirectiveKey(_configFile[balanceLocation], "balance")) : "round_robin";
+    if (balance == "round_robin")
+        upstream.balance = BALANCE_ROUND_ROBIN;
+    else if (balance == "least_conn")
+        upstream.balance = BALANCE_LEAST_CONN;
+    else if (balance == "uri_hash")
+        upstream.balance = BALANCE_URI_HASH;
+    else
+        throw WebErrors::ConfigFormatException("Error: balance must be 'round_robin', 'least_conn' or 'uri_hash'");
+
+    extractHealthCheck(upstream, contextStart + 1, contextEnd);
+    _upstreams.push_back(upstream);
+}
+
+//'unix:/path' for a socket file, 'unix:@name' for Linux's abstract namespace
+void WebParser::checkUnixTarget(const std::string &target)
+{
+    const std::string path = target.substr(5);
+
+    if (path.length() < 2 || (path[0] != '/' && path[0] != '@'))
+        throw WebErrors::ConfigFormatException("Error: '" + target + "' must be unix:/path or unix:@name");
+    if (path.length() >= sizeof(((struct sockaddr_un *)0)->sun_path))
+        throw WebErrors::ConfigFormatException("Error: unix socket path '" + path + "' is too long");
+}
+
+//<host:port | unix:path> [weight=N] [max_fails=N] [fail_timeout=seconds]
+UpstreamServer WebParser::parseUpstreamServer(const std::string &line) const
+{
+    std::stringstream   stream(line);
+    std::string         option;
+    UpstreamServer      server = {"", 1, 1, 10};
+
+    stream >> server.address;
+    const size_t colon = server.address.rfind(':');
+    if (server.address.compare(0, 5, "unix:") == 0)
+        checkUnixTarget(server.address);
+    else if (colon == std::string::npos || colon == 0 || server.address.find_first_not_of("0123456789", colon + 1) != std::string::npos
+        || colon + 1 == server.address.length() || std::stol(server.address.substr(colon + 1)) > 65535)
+        throw WebErrors::ConfigFormatException("Error: upstream server '" + server.address + "' must be host:port");
+    while (stream >> option)
+    {
+        const size_t        equals = option.find('=');
+        const std::string   name = option.substr(0, equals);
+        std::stringstream   value(equals == std::string::npos ? "" : option.substr(equals + 1));
+        int                 number;
+
+        if (!(value >> number) || number < 0 || !value.eof())
+            throw WebErrors::ConfigFormatException("Error: invalid upstream server parameter '" + option + "'");
+        if (name == "weight" && number > 0)
+            server.weight = number;
+        else if (name == "max_fails")
+            server.max_fails = number;
+        else if (name == "fail_timeout" && number > 0)
+            server.fail_timeout = number;
+        else
+            throw WebErrors::ConfigFormatException("Error: invalid upstream server parameter '" + option + "'");
+    }
+    return (server);
+}
+
+//health_check [interval=seconds] [uri=/path];
+void WebParser::extractHealthCheck(Upstream &upstream, size_t contextStart, size_t contextEnd) const
+{
+    ssize_t     healthCheckLocation = locateDirective(contextStart, contextEnd, "health_check");
+
+    upstream.health_check_interval = 0;
+    upstream.health_check_uri = "/";
+    if (healthCheckLocation == -1)
+        throw WebErrors::ConfigFormatException("Error: only one 'health_check' directive per upstream is allowed");
+    if (healthCheckLocation == 0)
+        return ;
+
+    std::stringstream   stream(removeDirectiveKey(_configFile[healthCheckLocation], "health_check"));
+    std::string         option;
+
+    upstream.health_check_interval = 5;
+    while (stream >> option)
+    {
+        if (option.compare(0, 9, "interval=") == 0)
+        {
+            std::stringstream   value(option.substr(9));
+            if (!(value >> upstream.health_check_interval) || upstream.health_check_interval <= 0 || !value.eof())
+                throw WebErrors::ConfigFormatException("Error: invalid health_check parameter '" + option + "'");
+        }
+        else if (option.compare(0, 4, "uri=") == 0 && option.length() > 4 && option[4] == '/')
+            upstream.health_check_uri = option.substr(4);
+        else
+            throw WebErrors::ConfigFormatException("Error: invalid health_check parameter '" + option + "'");
+    }
+}
+
+//done once all servers are parsed, so the trie indexes match the final locations vectors
+void WebParser::buildLocationTries(void)
+{
+    for (auto &server : _servers)
+    {
+        server.locationTrie.clear();
+        for (size_t i = 0; i < server.locations.size(); i++)
+            server.locationTrie.insert(server.locations[i].uri, i);
+    }
+}
+
 void WebParser::extractServerInfo(size_t contextStart, size_t contextEnd)
 {
     Server  currentServer;
     _servers.push_back(currentServer);
 
-    _servers.back().port = extractPort(contextStart, contextEnd);
+    _servers.back().host = extractHost(contextStart, contextEnd);
+    extractListen(contextStart, contextEnd);
     _servers.back().server_name = extractServerName(contextStart, contextEnd);
     _servers.back().client_max_body_size = extractClientMaxBodySize(contextStart, contextEnd);
-    _servers.back().host = extractHost(contextStart, contextEnd);
     _servers.back().server_root = extractServerRoot(contextStart, contextEnd);
     extractErrorPageInfo(contextStart, contextEnd);
 
@@ -228,7 +477,17 @@ void    WebParser::extractLocationInfo(size_t contextStart, size_t contextEnd)
     currentLocation.allowedGET = false;
     currentLocation.allowedHEAD = false;
     currentLocation.allowedPOST = false;
+    currentLocation.allowedPUT = false;
     currentLocation.autoIndexOn = false;
+    currentLocation.proxy_cache_size = 0;
+    currentLocation.proxy_cache_valid = 0;
+    currentLocation.cgi_collapse = false;
+    currentLocation.cgi_max_concurrency = 0;
+    currentLocation.cgi_queue = 0;
+    currentLocation.cgi_queue_timeout = 0;
+    currentLocation.cgi_adaptive = 0;
+    currentLocation.cgi_cache_valid = 0;
+    currentLocation.cgi_cache_size = 0;
     currentLocation.uri = extractLocationUri(contextStart);
     currentLocation.root = extractRoot(contextStart, contextEnd);
     currentLocation.upload_folder = extractUploadFolder(contextStart, contextEnd);
@@ -237,21 +496,332 @@ void    WebParser::extractLocationInfo(size_t contextStart, size_t contextEnd)
     extractAutoinex(contextStart, contextEnd);
     extractRedirectionAndTarget(contextStart, contextEnd);
     extractIndex(contextStart, contextEnd);
+    extractUploadOn(contextStart, contextEnd);
+    extractProxyCache(contextStart, contextEnd);
+    extractCgiCollapse(contextStart, contextEnd);
+    extractCgiMaxConcurrency(contextStart, contextEnd);
+    extractCgiCacheValid(contextStart, contextEnd);
 }
 
-int WebParser::extractPort(size_t contextStart, size_t contextEnd) const
+//an upload_folder of its own makes a root or alias location store POSTed files and PUT bodies there;
+//PUT needs such a location, or a script or upstream to take it
+void WebParser::extractUploadOn(size_t contextStart, size_t contextEnd)
 {
-    std::string key = "listen";
-    ssize_t directiveLocation = locateDirective(contextStart, contextEnd, key);
-   
+    Location    &location = _servers.back().locations.back();
+    const bool  files = location.type == STANDARD || location.type == ALIAS;
+
+    location.uploadOn = files && locateDirective(contextStart, contextEnd, "upload_folder") > 0;
+    if (location.allowedPUT && (files || location.type == HTTP_REDIR) && !location.uploadOn)
+        throw WebErrors::ConfigFormatException("Error: PUT is only allowed in locations with 'upload_folder', 'cgi_pass', 'fastcgi_pass' or 'proxy_pass'");
+}
+
+//cgi_cache_valid <time ms|s|m> [size=<size K|M>] [vary=<header>|cookie:<name>,...];
+//only in cgi_pass locations; a bare time is in seconds, the size defaults to 10M
+void WebParser::extractCgiCacheValid(size_t contextStart, size_t contextEnd)
+{
+    Location    &location = _servers.back().locations.back();
+    ssize_t     directiveLocation = locateDirective(contextStart, contextEnd, "cgi_cache_valid");
+
     if (directiveLocation == -1)
-        throw WebErrors::ConfigFormatException("Error: multiple listening ports per server");
+        throw WebErrors::ConfigFormatException("Error: only one 'cgi_cache_valid' directive per location context is allowed");
     if (directiveLocation == 0)
+        return ;
+    if (location.type != CGI)
+        throw WebErrors::ConfigFormatException("Error: 'cgi_cache_valid' is only allowed in cgi_pass locations");
+
+    std::stringstream   stream(removeDirectiveKey(_configFile[directiveLocation], "cgi_cache_valid"));
+    std::string         option;
+    std::string         unit;
+    long                number;
+
+    if (!(stream >> number) || number <= 0)
+        throw WebErrors::ConfigFormatException("Error: 'cgi_cache_valid' needs a positive time");
+    if (!stream.eof() && !std::isspace(stream.peek()))
+        stream >> unit;
+    if ((unit.empty() || unit.compare("s") == 0) && number <= INT_MAX / 1000)
+        number *= 1000;
+    else if (unit.compare("m") == 0 && number <= INT_MAX / 60000)
+        number *= 60000;
+    else if (unit.compare("ms") != 0 || number > INT_MAX)
+        throw WebErrors::ConfigFormatException("Error: 'cgi_cache_valid' time must have unit 'ms', 's' or 'm'");
+    location.cgi_cache_valid = number;
+    location.cgi_cache_size = 10000000;
+    while (stream >> option)
+    {
+        const size_t        equals = option.find('=');
+        const std::string   name = option.substr(0, equals);
+        std::string         value = equals == std::string::npos ? "" : option.substr(equals + 1);
+
+        if (name == "size")
+        {
+            std::stringstream   size(value);
+
+            size >> number >> unit;
+            if (size.fail() || number <= 0 || (unit != "K" && unit != "M") || number > LONG_MAX / 1000000)
+                throw WebErrors::ConfigFormatException("Error: 'cgi_cache_valid' size must be a positive number of 'K' or 'M'");
+            location.cgi_cache_size = number * (unit == "K" ? 1000 : 1000000);
+        }
+        else if (name == "vary" && !value.empty())
+        {
+            std::stringstream   names(value);
+
+            while (std::getline(names, value, ','))
+            {
+                const bool cookie = strncasecmp(value.c_str(), "cookie:", 7) == 0;
+
+                std::transform(value.begin(), cookie ? value.begin() + 7 : value.end(), value.begin(), ::tolower);
+                if (value.empty() || value == "cookie:")
+                    throw WebErrors::ConfigFormatException("Error: empty name in cgi_cache_valid vary=");
+                location.cgi_cache_vary.push_back(value);
+            }
+        }
+        else
+            throw WebErrors::ConfigFormatException("Error: invalid cgi_cache_valid parameter '" + option + "'");
+    }
+}
+
+//cgi_max_concurrency <scripts> [queue=<requests>] [queue_timeout=<seconds>] [adaptive=<ms>];
+//only in cgi_pass locations; the queue defaults to 4 requests per script, the timeout to 10 seconds
+void WebParser::extractCgiMaxConcurrency(size_t contextStart, size_t contextEnd)
+{
+    Location    &location = _servers.back().locations.back();
+    ssize_t     directiveLocation = locateDirective(contextStart, contextEnd, "cgi_max_concurrency");
+
+    if (directiveLocation == -1)
+        throw WebErrors::ConfigFormatException("Error: only one 'cgi_max_concurrency' directive per location context is allowed");
+    if (directiveLocation == 0)
+        return ;
+    if (location.type != CGI)
+        throw WebErrors::ConfigFormatException("Error: 'cgi_max_concurrency' is only allowed in cgi_pass locations");
+
+    std::stringstream   stream(removeDirectiveKey(_configFile[directiveLocation], "cgi_max_concurrency"));
+    std::string         option;
+    long                number;
+
+    if (!(stream >> number) || number <= 0 || number > INT_MAX)
+        throw WebErrors::ConfigFormatException("Error: 'cgi_max_concurrency' needs a positive number of scripts");
+    location.cgi_max_concurrency = number;
+    location.cgi_queue = location.cgi_max_concurrency * 4;
+    location.cgi_queue_timeout = 10;
+    while (stream >> option)
+    {
+        const size_t        equals = option.find('=');
+        const std::string   name = option.substr(0, equals);
+        std::stringstream   value(equals == std::string::npos ? "" : option.substr(equals + 1));
+
+        if (!(value >> number) || !value.eof() || number < 0 || number > INT_MAX
+            || (name != "queue" && name != "queue_timeout" && name != "adaptive")
+            || (name == "queue_timeout" && number == 0))
+            throw WebErrors::ConfigFormatException("Error: invalid cgi_max_concurrency parameter '" + option + "'");
+        if (name == "queue")
+            location.cgi_queue = number;
+        else if (name == "queue_timeout")
+            location.cgi_queue_timeout = number;
+        else
+            location.cgi_adaptive = number;
+    }
+}
+
+//cgi_collapse on|off; only in cgi_pass locations
+void WebParser::extractCgiCollapse(size_t contextStart, size_t contextEnd)
+{
+    ssize_t     directiveLocation = locateDirective(contextStart, contextEnd, "cgi_collapse");
+
+    if (directiveLocation == -1)
+        throw WebErrors::ConfigFormatException("Error: only one 'cgi_collapse' directive per location context is allowed");
+    if (directiveLocation == 0)
+        return ;
+    if (_servers.back().locations.back().type != CGI)
+        throw WebErrors::ConfigFormatException("Error: 'cgi_collapse' is only allowed in cgi_pass locations");
+
+    std::string line = removeDirectiveKey(_configFile[directiveLocation], "cgi_collapse");
+    if (line.compare("on") == 0)
+        _servers.back().locations.back().cgi_collapse = true;
+    else if (line.compare("off") != 0)
+        throw WebErrors::ConfigFormatException("Error: 'cgi_collapse' may only have the value 'on' or 'off'");
+}
+
+//proxy_cache <size K|M>; with optional proxy_cache_path <directory>; and proxy_cache_valid <seconds>;
+//only in proxy_pass locations
+void WebParser::extractProxyCache(size_t contextStart, size_t contextEnd)
+{
+    Location                    &location = _servers.back().locations.back();
+    const std::vector<size_t>   cacheLines = locateDirectives(contextStart, contextEnd, "proxy_cache");
+    const std::vector<size_t>   pathLines = locateDirectives(contextStart, contextEnd, "proxy_cache_path");
+    const std::vector<size_t>   validLines = locateDirectives(contextStart, contextEnd, "proxy_cache_valid");
+
+    if (cacheLines.size() > 1 || pathLines.size() > 1 || validLines.size() > 1)
+        throw WebErrors::ConfigFormatException("Error: only one of each proxy_cache directive per location context is allowed");
+    if (cacheLines.empty())
+    {
+        if (!pathLines.empty() || !validLines.empty())
+            throw WebErrors::ConfigFormatException("Error: 'proxy_cache_path' and 'proxy_cache_valid' need a 'proxy_cache' directive");
+        return ;
+    }
+    if (location.type != PROXY)
+        throw WebErrors::ConfigFormatException("Error: 'proxy_cache' is only allowed in proxy_pass locations");
+
+    std::stringstream   size(removeDirectiveKey(_configFile[cacheLines[0]], "proxy_cache"));
+    long                number;
+    std::string         unit;
+
+    size >> number;
+    if (size.fail() || number <= 0)
+        throw WebErrors::ConfigFormatException("Error: 'proxy_cache' needs a positive size");
+    size >> unit;
+    if (unit.compare("K") == 0 && number <= LONG_MAX / 1000)
+        number *= 1000;
+    else if (unit.compare("M") == 0 && number <= LONG_MAX / 1000000)
+        number *= 1000000;
+    else if (!unit.empty())
+        throw WebErrors::ConfigFormatException("Error: 'proxy_cache' size must have unit specified 'K' for kilobytes, 'M' for megabytes");
+    location.proxy_cache_size = number;
+
+    if (!pathLines.empty())
+    {
+        location.proxy_cache_path = removeDirectiveKey(_configFile[pathLines[0]], "proxy_cache_path");
+        if (!std::filesystem::is_directory(location.proxy_cache_path) || access(location.proxy_cache_path.c_str(), W_OK) != 0)
+            throw WebErrors::ConfigFormatException("Error: proxy_cache_path " + location.proxy_cache_path + " is not a writable directory");
+    }
+    if (!validLines.empty())
+    {
+        std::stringstream   valid(removeDirectiveKey(_configFile[validLines[0]], "proxy_cache_valid"));
+
+        if (!(valid >> location.proxy_cache_valid) || location.proxy_cache_valid < 0 || !valid.eof())
+            throw WebErrors::ConfigFormatException("Error: 'proxy_cache_valid' needs a number of seconds");
+    }
+}
+
+//'listen' may repeat. Each one is '[address:]port [default_server];' where address is IPv4, [IPv6] or a host name,
+//or 'unix:/path' for a Unix domain socket. A bare port listens on the server's 'host' address.
+//default_server marks the fallback for unknown Host headers on that listener
+void WebParser::extractListen(size_t contextStart, size_t contextEnd)
+{
+    std::vector<size_t> directiveLocations = locateDirectives(contextStart, contextEnd, "listen");
+
+    if (directiveLocations.empty())
         throw WebErrors::ConfigFormatException("Error: missing listening port");
-    
-    std::string line = removeDirectiveKey(_configFile[directiveLocation], key);
+    _servers.back().port = 0;
+    for (size_t directiveLocation : directiveLocations)
+    {
+        Listen listen = parseListen(removeDirectiveKey(_configFile[directiveLocation], "listen"));
 
-    std::stringstream stream(line);
+        if (_servers.back().port == 0 && listen.family != LISTEN_UNIX)
+            _servers.back().port = listen.port;
+        _servers.back().listens.push_back(listen);
+    }
+}
+
+Listen WebParser::parseListen(const std::string &line) const
+{
+    std::stringstream   stream(line);
+    std::string         addressAndPort;
+    std::string         option;
+    Listen              listen;
+
+    stream >> addressAndPort;
+    if (addressAndPort.empty())
+        throw WebErrors::ConfigFormatException("Error: missing listening port");
+    listen.default_server = false;
+    listen.port = 0;
+    listen.backlog = -1;
+    listen.deferred = 0;
+    listen.fastopen = 0;
+    listen.rcvbuf = 0;
+    listen.sndbuf = 0;
+    listen.nodelay = false;
+    while (stream >> option)
+        parseListenOption(listen, option);
+
+    if (addressAndPort.compare(0, 5, "unix:") == 0)
+    {
+        listen.family = LISTEN_UNIX;
+        listen.address = addressAndPort.substr(5);
+        if (listen.address.empty() || listen.address[0] != '/')
+            throw WebErrors::ConfigFormatException("Error: unix listen path must be absolute");
+        if (listen.address.length() >= sizeof(((struct sockaddr_un *)0)->sun_path))
+            throw WebErrors::ConfigFormatException("Error: unix listen path is too long");
+        if (listen.deferred || listen.fastopen || listen.nodelay)
+            throw WebErrors::ConfigFormatException("Error: deferred, fastopen and nodelay only apply to TCP listen addresses");
+        return (listen);
+    }
+    if (addressAndPort[0] == '[')
+    {
+        size_t closing = addressAndPort.find("]:");
+        if (closing == std::string::npos)
+            throw WebErrors::ConfigFormatException("Error: IPv6 listen address must look like [address]:port");
+        listen.family = LISTEN_INET6;
+        listen.address = addressAndPort.substr(1, closing - 1);
+        listen.port = parsePort(addressAndPort.substr(closing + 2));
+        return (listen);
+    }
+    size_t colon = addressAndPort.rfind(':');
+    listen.family = LISTEN_INET;
+    if (colon == std::string::npos)
+    {
+        listen.address = _servers.back().host;
+        if (listen.address.find(':') != std::string::npos)
+            listen.family = LISTEN_INET6;
+        listen.port = parsePort(addressAndPort);
+    }
+    else
+    {
+        listen.address = addressAndPort.substr(0, colon);
+        listen.port = parsePort(addressAndPort.substr(colon + 1));
+    }
+    return (listen);
+}
+
+//listen parameters after the address: default_server, backlog=N, deferred[=seconds], fastopen=N,
+//rcvbuf=size, sndbuf=size (K or M suffix allowed), nodelay
+void WebParser::parseListenOption(Listen &listen, const std::string &option)
+{
+    size_t              equals = option.find('=');
+    const std::string   name = option.substr(0, equals);
+    const std::string   value = (equals == std::string::npos) ? "" : option.substr(equals + 1);
+
+    if (name.compare("default_server") == 0 && value.empty() && !listen.default_server)
+        listen.default_server = true;
+    else if (name.compare("nodelay") == 0 && value.empty() && !listen.nodelay)
+        listen.nodelay = true;
+    else if (name.compare("deferred") == 0 && listen.deferred == 0)
+        listen.deferred = value.empty() ? 1 : parseListenNumber(name, value, false);
+    else if (name.compare("backlog") == 0 && listen.backlog == -1)
+        listen.backlog = parseListenNumber(name, value, false);
+    else if (name.compare("fastopen") == 0 && listen.fastopen == 0)
+        listen.fastopen = parseListenNumber(name, value, false);
+    else if (name.compare("rcvbuf") == 0 && listen.rcvbuf == 0)
+        listen.rcvbuf = parseListenNumber(name, value, true);
+    else if (name.compare("sndbuf") == 0 && listen.sndbuf == 0)
+        listen.sndbuf = parseListenNumber(name, value, true);
+    else
+        throw WebErrors::ConfigFormatException("Error: unknown or repeated listen parameter '" + option + "'");
+}
+
+int WebParser::parseListenNumber(const std::string &option, const std::string &value, bool allowUnits)
+{
+    std::stringstream   stream(value);
+    long                number;
+    std::string         unit;
+
+    stream >> number;
+    if (value.empty() || stream.fail() || number <= 0)
+        throw WebErrors::ConfigFormatException("Error: listen parameter '" + option + "' needs a positive number");
+    stream >> unit;
+    if (allowUnits && unit.compare("K") == 0)
+        number *= 1000;
+    else if (allowUnits && unit.compare("M") == 0)
+        number *= 1000000;
+    else if (!unit.empty())
+        throw WebErrors::ConfigFormatException("Error: invalid value for listen parameter '" + option + "'");
+    if (number > INT_MAX)
+        throw WebErrors::ConfigFormatException("Error: listen parameter '" + option + "' is too large");
+    return (static_cast<int>(number));
+}
+
+int WebParser::parsePort(const std::string &portString)
+{
+    std::stringstream stream(portString);
     int               portNumber;
     std::string       userInput;
 
@@ -385,9 +955,8 @@ std::string     WebParser::extractServerRoot(size_t contextStart, size_t context
 }
 
 
-//optional field, if not set, will set it to 127.0.0.1
-//should we also test this by pinging the address if it's not 127.0.0.1? (And throw an error if we didn't successfully ping ourselves)
-//if we don't do that, I'll implement further error checks to see if the input corresponds to IP-address format
+//optional field, the address a bare 'listen <port>;' binds to. If not set, all IPv4 interfaces (0.0.0.0)
+//an IPv6 address may be given with or without brackets
 std::string     WebParser::extractHost(size_t contextStart, size_t contextEnd) const
 {
     std::string key = "host";
@@ -396,11 +965,13 @@ std::string     WebParser::extractHost(size_t contextStart, size_t contextEnd) c
     if (directiveLocation == -1)
         throw WebErrors::ConfigFormatException("Error: can only have one 'host' directive per server context");
     if (directiveLocation == 0)
-        return ("127.0.0.1");
+        return ("0.0.0.0");
 
     std::string line = removeDirectiveKey(_configFile[directiveLocation], key);
     if (line.size() == 0)
-        return ("127.0.0.1");
+        return ("0.0.0.0");
+    if (line.front() == '[' && line.back() == ']')
+        line = line.substr(1, line.length() - 2);
     return (line);
 }
 
@@ -458,6 +1029,13 @@ void WebParser::printParsedInfo(void)
         std::cout << "Server nro." << i << std::endl;
         std::cout << "Host: " << servers[i].host << std::endl;
         std::cout << "Listening on port: " << servers[i].port << std::endl;
+        for (const auto &listen : servers[i].listens)
+        {
+            std::cout << "Listen: " << (listen.family == LISTEN_UNIX ? "unix:" : "") << listen.address;
+            if (listen.family != LISTEN_UNIX)
+                std::cout << " port " << listen.port;
+            std::cout << (listen.default_server ? " (default_server)" : "") << std::endl;
+        }
         std::cout << "Server names: " << std::endl;
         for (size_t j = 0; j < servers[i].server_name.size(); j++)
         {
@@ -490,6 +1068,11 @@ void WebParser::printParsedInfo(void)
                 std::cout << "yes" << std::endl;
             else
                 std::cout << "no" << std::endl;
+            std::cout << ">>> PUT: ";
+            if (servers[i].locations[h].allowedPUT == true)
+                std::cout << "yes" << std::endl;
+            else
+                std::cout << "no" << std::endl;
             std::cout << ">>> HEAD: ";
             if (servers[i].locations[h].allowedHEAD == true)
                 std::cout << "yes" << std::endl;
@@ -501,7 +1084,7 @@ void WebParser::printParsedInfo(void)
                 std::cout << "on" << std::endl;
             else
                 std::cout << "off" << std::endl;
-            std::cout << ">>> Redirection type {HTTP, CGI, PROXY, ALIAS, STANDARD}: " << servers[i].locations[h].type << std::endl;
+            std::cout << ">>> Redirection type {HTTP, CGI, PROXY, ALIAS, STANDARD, FASTCGI}: " << servers[i].locations[h].type << std::endl;
             std::cout << ">>> Target: " << servers[i].locations[h].target << std::endl;
             std::cout << ">>> Index files:" << std::endl;
             for (size_t s = 0; s < servers[i].locations[h].index.size(); s++)
@@ -569,8 +1152,14 @@ void    WebParser::extractAllowedMethods(size_t contextStart, size_t contextEnd)
                 throw WebErrors::ConfigFormatException("Error: DELETE is listed twice in the same allowed_methods directive");
             _servers.back().locations.back().allowedDELETE = true;
         }
+        else if (subLine.compare("PUT") == 0)
+        {
+            if (_servers.back().locations.back().allowedPUT == true)
+                throw WebErrors::ConfigFormatException("Error: PUT is listed twice in the same allowed_methods directive");
+            _servers.back().locations.back().allowedPUT = true;
+        }
         else
-            throw WebErrors::ConfigFormatException("Error: allowed_methods directive accepts only 4 values: GET, POST, DELETE, HEAD");
+            throw WebErrors::ConfigFormatException("Error: allowed_methods directive accepts only 5 values: GET, POST, PUT, DELETE, HEAD");
     }   
 }
 
@@ -602,9 +1191,10 @@ std::string WebParser::extractRoot(size_t contextStart, size_t contextEnd) const
     if (directiveLocation == 0)
     {   
         if (locateDirective(contextStart, contextEnd, "alias") != 0 || locateDirective(contextStart, contextEnd, "proxy_pass") != 0
-            || locateDirective(contextStart, contextEnd, "cgi_pass") != 0  || locateDirective(contextStart, contextEnd, "return") != 0)
+            || locateDirective(contextStart, contextEnd, "cgi_pass") != 0  || locateDirective(contextStart, contextEnd, "return") != 0
+            || locateDirective(contextStart, contextEnd, "fastcgi_pass") != 0)
             return ("");
-        throw WebErrors::ConfigFormatException("Error: please add the 'root' directive to all location contexts that do not contain 'proxy_pass', 'cgi_pass', 'return' or 'alias' directives");
+        throw WebErrors::ConfigFormatException("Error: please add the 'root' directive to all location contexts that do not contain 'proxy_pass', 'cgi_pass', 'fastcgi_pass', 'return' or 'alias' directives");
     }
     
     std::string line = removeDirectiveKey(_configFile[directiveLocation], key);
@@ -651,9 +1241,26 @@ void    WebParser::extractRedirectionAndTarget(size_t contextStart, size_t conte
     ssize_t     proxyLocation = locateDirective(contextStart, contextEnd, "proxy_pass");
     ssize_t     cgiLocation = locateDirective(contextStart, contextEnd, "cgi_pass");
     ssize_t     httpRedirLocation = locateDirective(contextStart, contextEnd, "return");
+    ssize_t     fastcgiLocation = locateDirective(contextStart, contextEnd, "fastcgi_pass");
 
-    if (aliasLocation == -1 || proxyLocation == -1 || cgiLocation == -1 || httpRedirLocation == -1)
+    if (aliasLocation == -1 || proxyLocation == -1 || cgiLocation == -1 || httpRedirLocation == -1 || fastcgiLocation == -1)
         throw WebErrors::ConfigFormatException("Error: only one redirection type directive per location context is allowed");
+    else if (fastcgiLocation != 0)
+    {
+        if (aliasLocation > 0 || proxyLocation > 0 || cgiLocation  > 0 || httpRedirLocation > 0)
+            throw WebErrors::ConfigFormatException("Error: only one type of redirection allowed per location context");
+        //fastcgi_pass host:port | unix:/path | unix:@name, the backend runs on its own
+        _servers.back().locations.back().target = removeDirectiveKey(_configFile[fastcgiLocation], "fastcgi_pass");
+        const std::string &target = _servers.back().locations.back().target;
+        const size_t colon = target.rfind(':');
+        if (target.compare(0, 5, "unix:") == 0)
+            checkUnixTarget(target);
+        else if (colon == std::string::npos || colon == 0 || colon + 1 == target.length()
+            || target.find_first_not_of("0123456789", colon + 1) != std::string::npos || std::stol(target.substr(colon + 1)) > 65535)
+            throw WebErrors::ConfigFormatException("Error: fastcgi_pass '" + target + "' must be host:port or unix:path");
+        _servers.back().locations.back().type = FASTCGI;
+        return ;
+    }
     else if (aliasLocation != 0)
     {
         if (proxyLocation > 0 || cgiLocation  > 0 || httpRedirLocation > 0)
@@ -674,6 +1281,8 @@ void    WebParser::extractRedirectionAndTarget(size_t contextStart, size_t conte
         _servers.back().locations.back().target = removeDirectiveKey(_configFile[proxyLocation], "proxy_pass");
         if (_servers.back().locations.back().target.size() == 0)
             throw WebErrors::ConfigFormatException("Error: proxy_pass directive cannot be empty");
+        if (_servers.back().locations.back().target.compare(0, 5, "unix:") == 0)
+            checkUnixTarget(_servers.back().locations.back().target);
         _servers.back().locations.back().type = PROXY;
         return ;
     }
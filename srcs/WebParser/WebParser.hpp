@@ -12,8 +12,9 @@
 #include <unistd.h>
 #include <cstring>
 #include <regex>
+#include "LocationTrie.hpp"
 
-enum LocationType { HTTP_REDIR, CGI, PROXY, ALIAS, STANDARD };
+enum LocationType { HTTP_REDIR, CGI, PROXY, ALIAS, STANDARD, FASTCGI };
 
 struct Location {
     LocationType                type;
@@ -24,20 +25,79 @@ struct Location {
     bool                        allowedPOST;
     bool                        allowedHEAD;
     bool                        allowedDELETE;
+    bool                        allowedPUT;
     bool                        autoIndexOn;
     std::string                 upload_folder;
+    bool                        uploadOn;           //upload_folder in a root or alias location: POST and PUT are stored there
     std::string                 httpRedirection;
     std::vector<std::string>    index;
+    size_t                      proxy_cache_size;   //bytes of responses kept in memory, 0: no cache
+    std::string                 proxy_cache_path;   //directory of the on-disk tier, empty: memory only
+    int                         proxy_cache_valid;  //seconds a response without Cache-Control/Expires stays fresh
+    bool                        cgi_collapse;       //identical concurrent GET/HEAD requests share one script run
+    size_t                      cgi_max_concurrency; //scripts running at once, 0: no limit
+    size_t                      cgi_queue;          //requests waiting for one of them, 503 beyond that
+    int                         cgi_queue_timeout;  //seconds a request waits before its 503
+    int                         cgi_adaptive;       //ms of script latency the limit adapts to (AIMD), 0: fixed
+    int                         cgi_cache_valid;    //ms GET/HEAD responses are served from memory, 0: no cache
+    size_t                      cgi_cache_size;     //bytes of those responses kept
+    std::vector<std::string>    cgi_cache_vary;     //lowercase request headers, "cookie:<name>" for one cookie, the key is made of
+};
+
+enum ListenFamily { LISTEN_INET, LISTEN_INET6, LISTEN_UNIX };
+
+struct Listen {
+    ListenFamily                   family;
+    std::string                    address;
+    int                            port;
+    bool                           default_server;
+    int                            backlog;         //-1: SOMAXCONN
+    int                            deferred;        //TCP_DEFER_ACCEPT seconds, 0: off
+    int                            fastopen;        //TCP_FASTOPEN queue length, 0: off
+    int                            rcvbuf;          //0: kernel default
+    int                            sndbuf;          //0: kernel default
+    bool                           nodelay;         //TCP_NODELAY on accepted client sockets
 };
 
 struct Server {
     int                            port;
+    std::vector<Listen>            listens;
     long                           client_max_body_size;
     std::string                    host;
     std::vector<std::string>       server_name;
     std::map<int, std::string>     error_page;
     std::vector<Location>          locations;
     std::string                    server_root;
+    LocationTrie                   locationTrie;
+};
+
+enum BalanceMethod { BALANCE_ROUND_ROBIN, BALANCE_LEAST_CONN, BALANCE_URI_HASH };
+
+struct UpstreamServer {
+    std::string                    address;         //host:port, also its _proxyInfoMap key
+    int                            weight;
+    int                            max_fails;       //0: failures are not counted
+    int                            fail_timeout;    //seconds
+};
+
+//upstream <name> { ... }, referenced by name from proxy_pass
+struct Upstream {
+    std::string                    name;
+    std::vector<UpstreamServer>    servers;
+    BalanceMethod                  balance;
+    int                            health_check_interval;  //seconds, 0: no active checks
+    std::string                    health_check_uri;
+};
+
+//directives outside of any server context
+struct GlobalConfig {
+    std::string                    event_backend;
+    size_t                         proxy_keepalive;          //idle upstream connections kept per proxy_pass target, 0: off
+    int                            proxy_keepalive_timeout;  //seconds
+    size_t                         proxy_keepalive_requests; //requests per upstream connection
+    int                            resolver_valid;           //seconds between re-resolutions of upstream names, 0: off
+    size_t                         fastcgi_connections;      //connections kept open per fastcgi_pass backend
+    bool                           cgi_zygote;               //CGI scripts are forked from a preloaded python3
 };
 
 class WebParser
@@ -54,6 +114,8 @@ public:
     const std::string         &getProxyPass() const;
     const std::string         &getCgiPass() const;
     const std::vector<Server> &getServers() const;
+    const GlobalConfig        &getGlobalConfig() const;
+    const std::vector<Upstream> &getUpstreams() const;
     static std::string               getErrorPage(int errorCode, const Server *server);
 
     //for testing:
@@ -71,16 +133,32 @@ private:
     std::string             _cgiPass;
     std::stack<char>        _bracePairCheckStack;
     std::vector<Server>     _servers;
+    GlobalConfig            _globalConfig;
+    std::vector<Upstream>   _upstreams;
 
     void                        parseProxyPass(const std::string &line);
     void                        parseCgiPass(const std::string &line);
     bool                        checkBracePairs(std::string line);
     ssize_t                     locateContextEnd(size_t contextStart) const;
     ssize_t                     locateDirective(size_t contextStart, size_t contextEnd, std::string key) const;
+    std::vector<size_t>         locateDirectives(size_t contextStart, size_t contextEnd, std::string key) const;
     void                        parseServer(void);
+    void                        parseGlobalDirectives(void);
+    std::string                 extractGlobalDirective(const std::string &key) const;
+    long                        extractGlobalNumber(const std::string &key, long defaultValue, long minimum) const;
+    void                        buildLocationTries(void);
+    void                        parseUpstreams(void);
+    void                        extractUpstreamInfo(const std::string &name, size_t contextStart, size_t contextEnd);
+    UpstreamServer              parseUpstreamServer(const std::string &line) const;
+    void                        extractHealthCheck(Upstream &upstream, size_t contextStart, size_t contextEnd) const;
     void                        extractServerInfo(size_t contextStart, size_t contextEnd);
     void                        extractLocationInfo(size_t contextStart, size_t contextEnd);
-    int                         extractPort(size_t contextStart, size_t contextEnd) const;
+    void                        extractListen(size_t contextStart, size_t contextEnd);
+    Listen                      parseListen(const std::string &line) const;
+    static int                  parsePort(const std::string &portString);
+    static void                 parseListenOption(Listen &listen, const std::string &option);
+    static void                 checkUnixTarget(const std::string &target);
+    static int                  parseListenNumber(const std::string &option, const std::string &value, bool allowUnits);
     std::vector<std::string>    extractServerName(size_t contextStart, size_t contextEnd);
     long                        extractClientMaxBodySize(size_t contextStart, size_t contextEnd) const;
     std::string                 extractServerRoot(size_t contextStart, size_t contextEnd) const;
@@ -92,7 +170,12 @@ private:
     void                        extractAutoinex(size_t contextStart, size_t contextEnd);
     void                        extractRedirectionAndTarget(size_t contextStart, size_t contextEnd);
     void                        extractIndex(size_t contextStart, size_t contextEnd);
+    void                        extractUploadOn(size_t contextStart, size_t contextEnd);
     std::string                 extractUploadFolder(size_t contextStart, size_t contextEnd);
+    void                        extractProxyCache(size_t contextStart, size_t contextEnd);
+    void                        extractCgiCollapse(size_t contextStart, size_t contextEnd);
+    void                        extractCgiMaxConcurrency(size_t contextStart, size_t contextEnd);
+    void                        extractCgiCacheValid(size_t contextStart, size_t contextEnd);
 
     //in WebParserUtils
 
@@ -102,6 +185,7 @@ private:
     static bool                     checkBracesPerLine(std::string line);
     static bool                     locateServerContextStart(std::string line, std::string contextName);
     static bool                     locateLocationContextStart(std::string line, std::string contextName);
+    static bool                     locateUpstreamContextStart(const std::string &line, std::string &name);
     static std::string              removeDirectiveKey(std::string line, std::string key);
     static std::string              createStandardTarget(std::string uri, std::string root);
     static bool                     verifyTarget(std::string path);
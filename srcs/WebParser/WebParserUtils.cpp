@@ -90,6 +90,18 @@ bool    WebParser::locateServerContextStart(std::string line, std::string contex
     return (true);
 }
 
+//"upstream <name> {", the name is written to name
+bool    WebParser::locateUpstreamContextStart(const std::string &line, std::string &name)
+{
+    std::stringstream   stream(line);
+    std::string         keyword;
+    std::string         brace;
+    std::string         extra;
+
+    stream >> keyword >> name >> brace;
+    return (keyword == "upstream" && !name.empty() && brace == "{" && !(stream >> extra));
+}
+
 bool    WebParser::locateLocationContextStart(std::string line, std::string contextName)
 {
     size_t keywordStart = line.find(contextName);
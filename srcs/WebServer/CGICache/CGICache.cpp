@@ -0,0 +1,118 @@
+#include "CGICache.hpp"
+#include "ProxyCache.hpp"
+#include "ResponseFraming.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+CGICache::CGICache(const Location &location)
+    : _validity(std::chrono::milliseconds(location.cgi_cache_valid)), _maxMemory(location.cgi_cache_size),
+      _vary(location.cgi_cache_vary)
+{
+}
+
+//empty when the response may depend on more than the key can tell
+std::string CGICache::makeKey(const RequestData &request) const
+{
+    if (!ProxyCache::isCacheableRequest(request.method, request.headers) || std::atol(request.content_length.c_str()) > 0
+        || !ProxyCache::findHeader(request.headers, "Transfer-Encoding").empty())
+        return "";
+    if (!ProxyCache::findHeader(request.headers, "Cookie").empty() && !isKeyedOn("cookie"))
+        return "";
+
+    std::string key = ProxyCache::makeKey(request.method, request.headers, request.query_string.empty()
+                                          ? request.uri : request.uri + "?" + request.query_string);
+
+    for (const std::string &name : _vary)
+    {
+        if (name.compare(0, 7, "cookie:") != 0)
+        {
+            key += "\n" + name + ": " + ProxyCache::findHeader(request.headers, name);
+            continue ;
+        }
+
+        const auto cookie = request.cookies.find(name.substr(7));
+
+        key += "\n" + name + "=" + (cookie == request.cookies.end() ? "" : cookie->second);
+    }
+    return key;
+}
+
+//nullptr on a miss; an expired entry is dropped on the way
+const std::string *CGICache::lookup(const std::string &key)
+{
+    const auto found = _index.find(key);
+
+    if (found == _index.end())
+        return nullptr;
+    if (Clock::now() >= found->second->expires)
+        return erase(found->second), nullptr;
+    return &found->second->response;
+}
+
+void CGICache::store(const std::string &key, const std::string &response)
+{
+    const Clock::time_point now = Clock::now();
+    const size_t            size = key.size() + response.size();
+
+    if (size > getMaxEntrySize() || !isStorable(key, response))
+        return ;
+
+    const auto found = _index.find(key);
+
+    if (found != _index.end())
+        erase(found->second);
+    while (!_entries.empty() && (now >= _entries.front().expires || _memoryUsed + size > _maxMemory))
+        erase(_entries.begin());
+    _entries.push_back({key, response, now + _validity});
+    _index[key] = std::prev(_entries.end());
+    _memoryUsed += size;
+}
+
+//a quarter of cgi_cache_size, like proxy_cache
+size_t CGICache::getMaxEntrySize() const { return _maxMemory / 4; }
+
+bool CGICache::isStorable(const std::string &key, const std::string &response) const
+{
+    ResponseFraming framing(key.compare(0, 5, "HEAD ") == 0);
+
+    framing.feed(response.data(), response.size());
+
+    const int   status = framing.getStatusCode();
+    std::string cacheControl = framing.getHeaderValue("Cache-Control");
+    std::string vary = framing.getHeaderValue("Vary");
+
+    if (!framing.isComplete() || status < 200 || status > 299 || status == 206
+        || !framing.getHeaderValue("Set-Cookie").empty())
+        return false;
+    std::transform(cacheControl.begin(), cacheControl.end(), cacheControl.begin(), ::tolower);
+    if (cacheControl.find("no-store") != std::string::npos || cacheControl.find("no-cache") != std::string::npos
+        || cacheControl.find("private") != std::string::npos)
+        return false;
+    std::transform(vary.begin(), vary.end(), vary.begin(), ::tolower);
+
+    std::stringstream   names(vary);
+    std::string         name;
+
+    while (std::getline(names, name, ','))
+    {
+        name = WebParser::trimSpaces(name);
+        if (!name.empty() && name != "host" && !isKeyedOn(name))
+            return false;
+    }
+    return true;
+}
+
+//Cookie counts as keyed on when single cookies are
+bool CGICache::isKeyedOn(const std::string &header) const
+{
+    return std::any_of(_vary.begin(), _vary.end(), [&header](const std::string &name)
+                       { return name == header || (header == "cookie" && name.compare(0, 7, "cookie:") == 0); });
+}
+
+void CGICache::erase(EntryList::iterator it)
+{
+    _memoryUsed -= it->key.size() + it->response.size();
+    _index.erase(it->key);
+    _entries.erase(it);
+}
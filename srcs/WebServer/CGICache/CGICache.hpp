@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "WebParser.hpp"
+#include "Request.hpp"
+
+/*
+cgi_cache_valid of one cgi_pass location: complete 2xx responses to GET and HEAD are kept in memory for
+that long and handed to identical requests without running the script. Requests are identical when
+method, Host, URI and query match, along with the vary= request headers and cookies. A request with a
+body, an Authorization header, cookies the key doesn't name, or Cache-Control: no-store always runs the
+script; a response with no-store, no-cache, private, Set-Cookie, or a Vary on a header the key doesn't
+name is not kept.
+All entries live equally long, so the order they were stored in is also the order they expire in: the
+oldest go first, when expired or when room is needed past cgi_cache_size.
+*/
+class CGICache
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit CGICache(const Location &location);
+
+    std::string         makeKey(const RequestData &request) const;
+    const std::string   *lookup(const std::string &key);
+    void                store(const std::string &key, const std::string &response);
+    size_t              getMaxEntrySize() const;
+
+private:
+    struct Entry
+    {
+        std::string         key;
+        std::string         response;
+        Clock::time_point   expires;
+    };
+    using EntryList = std::list<Entry>;
+
+    Clock::duration                                         _validity;
+    size_t                                                  _maxMemory;
+    size_t                                                  _memoryUsed = 0;
+    std::vector<std::string>                                _vary;      //cgi_cache_vary
+    EntryList                                               _entries;   //oldest first
+    std::unordered_map<std::string, EntryList::iterator>    _index;
+
+    bool                isStorable(const std::string &key, const std::string &response) const;
+    bool                isKeyedOn(const std::string &header) const;
+    void                erase(EntryList::iterator it);
+};
@@ -0,0 +1,147 @@
+#include "CGILimiter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+CGILimiter::CGILimiter(const Location &location)
+    : _uri(location.uri), _maxConcurrency(location.cgi_max_concurrency), _queueSize(location.cgi_queue),
+      _queueTimeout(std::chrono::seconds(location.cgi_queue_timeout)),
+      _targetLatency(std::chrono::milliseconds(location.cgi_adaptive)),
+      _limit(location.cgi_max_concurrency), _nextReport(Clock::now() + std::chrono::seconds(CGI_STATS_INTERVAL))
+{
+}
+
+size_t CGILimiter::limit(void) const { return static_cast<size_t>(_limit); }
+
+//takes a slot for a script about to start; false if they are all taken or requests are waiting for one
+bool CGILimiter::acquire(void)
+{
+    if (_running >= limit() || !_queue.empty())
+        return false;
+    _running++;
+    _interval.started++;
+    _total.started++;
+    return true;
+}
+
+void CGILimiter::release(void)
+{
+    if (_running > 0)
+        _running--;
+}
+
+//a script that ran and was reaped: its latency feeds the average and, with adaptive=, the limit
+void CGILimiter::record(Clock::duration latency)
+{
+    const double seconds = std::chrono::duration<double>(latency).count();
+
+    _latency = _latency == 0 ? seconds : _latency + CGI_LATENCY_WEIGHT * (seconds - _latency);
+    if (_targetLatency == Clock::duration::zero())
+        return ;
+    _sinceDecrease++;
+    if (latency <= _targetLatency)
+        _limit = std::min<double>(_maxConcurrency, _limit + 1 / _limit);
+    else if (_sinceDecrease >= limit())
+    {
+        _limit = std::max(1.0, std::floor(_limit / 2));
+        _sinceDecrease = 0;
+    }
+}
+
+//false when the queue is full, the request is to be turned away
+bool CGILimiter::enqueue(int clientSocket)
+{
+    if (_queue.size() >= _queueSize)
+    {
+        _interval.rejected++;
+        _total.rejected++;
+        return false;
+    }
+    _queue.push_back({clientSocket, Clock::now()});
+    _interval.queued++;
+    _total.queued++;
+    _interval.maxDepth = std::max(_interval.maxDepth, _queue.size());
+    _total.maxDepth = std::max(_total.maxDepth, _queue.size());
+    return true;
+}
+
+//the client first in line once a slot is free, which it then holds; -1 if there is none
+int CGILimiter::dequeue(void)
+{
+    if (_queue.empty() || _running >= limit())
+        return -1;
+
+    const Waiting   next = _queue.front();
+    const double    waited = std::chrono::duration<double>(Clock::now() - next.since).count();
+
+    _queue.pop_front();
+    _running++;
+    for (Stats *stats : {&_interval, &_total})
+    {
+        stats->started++;
+        stats->waited++;
+        stats->waitTotal += waited;
+        stats->waitMax = std::max(stats->waitMax, waited);
+    }
+    return next.clientSocket;
+}
+
+//the clients that waited past queue_timeout, taken out of the queue; the oldest are at its front
+std::vector<int> CGILimiter::expire(void)
+{
+    const Clock::time_point now = Clock::now();
+    std::vector<int>        expired;
+
+    while (!_queue.empty() && now - _queue.front().since > _queueTimeout)
+    {
+        expired.push_back(_queue.front().clientSocket);
+        _queue.pop_front();
+    }
+    _interval.expired += expired.size();
+    _total.expired += expired.size();
+    return expired;
+}
+
+void CGILimiter::cancel(int clientSocket)
+{
+    _queue.erase(std::remove_if(_queue.begin(), _queue.end(),
+                                [clientSocket](const Waiting &waiting) { return waiting.clientSocket == clientSocket; }),
+                 _queue.end());
+}
+
+//seconds for the queue to drain at the average script latency, at least 1
+int CGILimiter::retryAfter(void) const
+{
+    return std::max(1, static_cast<int>(std::ceil(_latency * (_queue.size() + 1) / std::max<size_t>(limit(), 1))));
+}
+
+//every CGI_STATS_INTERVAL, when requests had to wait or were turned away since the last report
+bool CGILimiter::isReportDue(void)
+{
+    const Clock::time_point now = Clock::now();
+
+    if (now < _nextReport)
+        return false;
+    _nextReport = now + std::chrono::seconds(CGI_STATS_INTERVAL);
+    if (_interval.queued == 0 && _interval.rejected == 0 && _queue.empty())
+        return _interval = Stats(), false;
+    return true;
+}
+
+//since the last report, or since startup with total; the interval counts start over either way
+std::string CGILimiter::report(bool total)
+{
+    const Stats         &stats = total ? _total : _interval;
+    std::ostringstream  line;
+
+    line << _uri << ": " << _running << " running (limit " << limit() << "/" << _maxConcurrency << "), "
+         << _queue.size() << " queued (max " << stats.maxDepth << "), " << stats.started << " started, "
+         << stats.waited << " waited";
+    if (stats.waited > 0)
+        line << " avg " << static_cast<long>(stats.waitTotal / stats.waited * 1000) << "ms max "
+             << static_cast<long>(stats.waitMax * 1000) << "ms";
+    line << ", " << stats.rejected << " rejected, " << stats.expired << " timed out, latency "
+         << static_cast<long>(_latency * 1000) << "ms";
+    _interval = Stats();
+    return line.str();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include "WebParser.hpp"
+
+#define CGI_STATS_INTERVAL 10       // seconds between queue reports, for locations that saw any queueing
+#define CGI_LATENCY_WEIGHT 0.2      // of each finished script in the average latency
+
+/*
+cgi_max_concurrency of one cgi_pass location: at most that many of its scripts run at once, a slot
+being taken when a script starts and given back once it is reaped. Requests beyond that wait in a
+FIFO queue of cgi_queue entries; a request that finds the queue full, or waits longer than
+cgi_queue_timeout, gets a 503 with a Retry-After of the queue's expected drain time.
+With adaptive=<ms> the limit moves between 1 and cgi_max_concurrency (AIMD): it grows by one for every
+limit's worth of scripts that finish within that latency, and is halved when one takes longer, at most
+once per limit's worth of finished scripts so that a single burst of slow ones doesn't collapse it.
+*/
+class CGILimiter
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit CGILimiter(const Location &location);
+
+    bool                acquire(void);
+    void                release(void);
+    void                record(Clock::duration latency);
+    bool                enqueue(int clientSocket);
+    int                 dequeue(void);
+    std::vector<int>    expire(void);
+    void                cancel(int clientSocket);
+    int                 retryAfter(void) const;
+    bool                isReportDue(void);
+    std::string         report(bool total);
+
+private:
+    struct Waiting
+    {
+        int                 clientSocket;
+        Clock::time_point   since;
+    };
+
+    struct Stats
+    {
+        size_t  started = 0;
+        size_t  queued = 0;
+        size_t  rejected = 0;       //queue full
+        size_t  expired = 0;        //waited past queue_timeout
+        size_t  maxDepth = 0;
+        double  waitTotal = 0;      //seconds, over the queued requests that got a slot
+        size_t  waited = 0;
+        double  waitMax = 0;
+    };
+
+    std::string         _uri;
+    size_t              _maxConcurrency;
+    size_t              _queueSize;
+    Clock::duration     _queueTimeout;
+    Clock::duration     _targetLatency;     //zero: the limit is fixed
+    double              _limit;
+    size_t              _running = 0;
+    size_t              _sinceDecrease = 0; //scripts finished since the limit was last halved
+    double              _latency = 0;       //seconds, moving average
+    std::deque<Waiting> _queue;
+    Stats               _interval;
+    Stats               _total;
+    Clock::time_point   _nextReport;
+
+    size_t              limit(void) const;
+};
@@ -0,0 +1,35 @@
+#include "EpollBackend.hpp"
+#include "WebErrors.hpp"
+#include <cstring>
+#include <unistd.h>
+
+EpollBackend::EpollBackend()
+{
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epollFd == -1)
+        throw WebErrors::ServerException("Error creating epoll");
+}
+
+EpollBackend::~EpollBackend()
+{
+    if (_epollFd != -1)
+        close(_epollFd);
+}
+
+void EpollBackend::control(int fd, int operation, uint32_t events)
+{
+    struct epoll_event event;
+
+    std::memset(&event, 0, sizeof(event));
+    event.data.fd = fd;
+    event.events = events & ~(EVENT_ACCEPT | EVENT_RECV);
+    if (epoll_ctl(_epollFd, operation, fd, &event) == -1)
+        throw std::runtime_error("Error changing epoll state: " + std::string(strerror(errno)));
+}
+
+int EpollBackend::wait(std::vector<struct epoll_event> &events, int timeoutMs)
+{
+    return epoll_wait(_epollFd, events.data(), events.size(), timeoutMs);
+}
+
+const char *EpollBackend::getName() const { return "epoll"; }
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "EventBackend.hpp"
+
+class EpollBackend : public EventBackend
+{
+public:
+    EpollBackend();
+    ~EpollBackend() override;
+    EpollBackend(const EpollBackend &) = delete;
+    EpollBackend &operator=(const EpollBackend &) = delete;
+
+    void        control(int fd, int operation, uint32_t events) override;
+    int         wait(std::vector<struct epoll_event> &events, int timeoutMs) override;
+    const char  *getName() const override;
+
+private:
+    int         _epollFd = -1;
+};
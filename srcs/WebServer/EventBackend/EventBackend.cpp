@@ -0,0 +1,54 @@
+#include "EventBackend.hpp"
+#include "EpollBackend.hpp"
+#include "IoUringBackend.hpp"
+#include "WebErrors.hpp"
+#include "WebServer.hpp"
+#include <fcntl.h>
+#include <sys/socket.h>
+
+std::unique_ptr<EventBackend> EventBackend::create(const std::string &name)
+{
+    if (name == "io_uring")
+    {
+        try
+        {
+            return std::make_unique<IoUringBackend>();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << COLOR_RED_ERROR << "  io_uring unavailable (" << e.what() << "), falling back to epoll\n\n" << COLOR_RESET;
+            errno = 0;
+        }
+    }
+    else if (name != "epoll")
+        throw WebErrors::ServerException("Unknown event backend: " + name);
+    return std::make_unique<EpollBackend>();
+}
+
+int EventBackend::accept(int listenFd)
+{
+    return accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+ssize_t EventBackend::recv(int fd, void *buffer, size_t length)
+{
+    return ::recv(fd, buffer, length, 0);
+}
+
+ssize_t EventBackend::send(int fd, const void *buffer, size_t length, int pipeFd, size_t piped)
+{
+    const ssize_t sent = length > 0 ? ::send(fd, buffer, length, 0) : 0;
+
+    if (sent < 0 || static_cast<size_t>(sent) < length || piped == 0)
+        return sent;
+
+    const ssize_t spliced = splice(pipeFd, nullptr, fd, nullptr, piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+    if (spliced < 0) // after some of buffer, the error comes up on the next call
+        return sent > 0 ? sent : -1;
+    return sent + spliced;
+}
+
+bool EventBackend::readFile(int, const std::string &) { return false; }
+
+bool EventBackend::takeFile(int, std::string &, int &) { return false; }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/types.h>
+
+// Not epoll flags: they let a completion-based backend do the work itself, epoll ignores them
+#define EVENT_ACCEPT    (1u << 20)  // listening socket, its connections are taken with accept()
+#define EVENT_RECV      (1u << 21)  // stream socket only ever read with recv()
+#define EVENT_RECV_SIZE 16384       // a recv() this large takes everything a backend holds for the fd
+
+/*
+Readiness notification used by the server loop. The interface keeps epoll's vocabulary
+(EPOLL_CTL_ADD/MOD/DEL, EPOLLIN/EPOLLOUT masks, level-triggered) so every backend behaves
+like epoll towards the handlers. accept(), recv(), send() and readFile() default to the plain
+syscalls; a backend that already did the operation hands out its result instead.
+*/
+class EventBackend
+{
+public:
+    virtual ~EventBackend() = default;
+
+    virtual void        control(int fd, int operation, uint32_t events) = 0;
+    virtual int         wait(std::vector<struct epoll_event> &events, int timeoutMs) = 0;
+    virtual const char  *getName() const = 0;
+
+    // accept4() with SOCK_NONBLOCK | SOCK_CLOEXEC, and recv(), for fds registered with EVENT_ACCEPT / EVENT_RECV
+    virtual int         accept(int listenFd);
+    virtual ssize_t     recv(int fd, void *buffer, size_t length);
+    // send() of buffer, then splice() of up to piped bytes from pipeFd (-1 for none) to the socket: how much of
+    // the two went out, in that order, or -1 and errno. A backend sending on its own answers EAGAIN and reports
+    // EPOLLOUT once done, to be asked again with the same buffer and pipe (grown at their ends at most, and the
+    // buffer not while the pipe holds anything), which then gets the result.
+    virtual ssize_t     send(int fd, const void *buffer, size_t length, int pipeFd, size_t piped);
+    // Reads the whole file for the registered fd, which gets EPOLLOUT once takeFile() has it (or its errno;
+    // EISDIR and EFBIG are files the backend leaves to the caller). false when the backend doesn't read it.
+    virtual bool        readFile(int fd, const std::string &path);
+    virtual bool        takeFile(int fd, std::string &content, int &error);
+
+    // "epoll" or "io_uring"; io_uring falls back to epoll when the kernel (or a seccomp filter) refuses it
+    static std::unique_ptr<EventBackend> create(const std::string &name);
+};
@@ -0,0 +1,848 @@
+#include "IoUringBackend.hpp"
+#include "WebErrors.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define IGNORED_USER_DATA 0         // cancels and closes, their completion means nothing here
+#define GENERATION_MASK 0x1fffffffu // what fits between the operation and the fd in user_data
+#define FILE_READ_MAX (1u << 30)    // per IORING_OP_READ, its length is 32 bits
+
+IoUringBackend::IoUringBackend(unsigned entries)
+{
+    struct io_uring_params params;
+
+    std::memset(&params, 0, sizeof(params));
+    _ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    if (_ringFd < 0)
+        throw WebErrors::ServerException("io_uring_setup failed: " + std::string(strerror(errno)));
+    // EXT_ARG gives io_uring_enter a timeout, SINGLE_MMAP and NODROP keep the ring handling simple
+    const unsigned required = IORING_FEAT_EXT_ARG | IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP;
+    if ((params.features & required) != required)
+    {
+        close(_ringFd);
+        throw WebErrors::ServerException("kernel io_uring lacks EXT_ARG/SINGLE_MMAP/NODROP");
+    }
+
+    const size_t sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const size_t cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    _ringSize = std::max(sqRingSize, cqRingSize);
+    _ringPtr = mmap(nullptr, _ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+    _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqesPtr = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+    if (_ringPtr == MAP_FAILED || sqesPtr == MAP_FAILED)
+    {
+        if (_ringPtr != MAP_FAILED)
+            munmap(_ringPtr, _ringSize);
+        if (sqesPtr != MAP_FAILED)
+            munmap(sqesPtr, _sqesSize);
+        close(_ringFd);
+        throw WebErrors::ServerException("Error mapping io_uring rings");
+    }
+    _sqes = static_cast<struct io_uring_sqe *>(sqesPtr);
+
+    char *ring = static_cast<char *>(_ringPtr);
+    _sqHead = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+    _sqTail = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+    _sqMask = reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+    _sqArray = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+    _sqEntries = params.sq_entries;
+    _localSqTail = *_sqTail;
+    _cqHead = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+    _cqMask = reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe *>(ring + params.cq_off.cqes);
+    setupBufferRing();
+}
+
+IoUringBackend::~IoUringBackend()
+{
+    for (const auto &queue : _accepted)
+        for (int fd : queue.second.fds)
+            close(fd);
+    for (const auto &file : _fileReads)
+        if (file.second.fileFd != -1)
+            close(file.second.fileFd);
+    unmapRings();
+    if (_ringFd != -1)
+        close(_ringFd);
+}
+
+/*
+The buffers RECV completions land in, handed to the kernel through a ring it takes them from and that
+recycleBuffer() puts them back on. A kernel without IORING_REGISTER_PBUF_RING (before 5.19) leaves
+EVENT_RECV sockets to plain polls.
+*/
+void IoUringBackend::setupBufferRing()
+{
+    const size_t            ringSize = RECV_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    void                    *ring = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void                    *buffers = mmap(nullptr, RECV_BUFFER_COUNT * EVENT_RECV_SIZE, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct io_uring_buf_reg registration;
+
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(ring);
+    registration.ring_entries = RECV_BUFFER_COUNT;
+    registration.bgid = RECV_BUFFER_GROUP;
+    if (ring == MAP_FAILED || buffers == MAP_FAILED
+        || syscall(__NR_io_uring_register, _ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    {
+        if (ring != MAP_FAILED)
+            munmap(ring, ringSize);
+        if (buffers != MAP_FAILED)
+            munmap(buffers, RECV_BUFFER_COUNT * EVENT_RECV_SIZE);
+        errno = 0;
+        return ;
+    }
+    _bufferRing = static_cast<struct io_uring_buf_ring *>(ring);
+    _buffers = static_cast<char *>(buffers);
+    for (int buffer = 0; buffer < RECV_BUFFER_COUNT; buffer++)
+        recycleBuffer(buffer);
+}
+
+// entries start at the ring itself, the tail overlays the first one (bufs[] doesn't: C++ gives its empty struct a size)
+void IoUringBackend::recycleBuffer(int buffer)
+{
+    struct io_uring_buf &entry = reinterpret_cast<struct io_uring_buf *>(_bufferRing)[_bufferTail & (RECV_BUFFER_COUNT - 1)];
+
+    entry.addr = reinterpret_cast<uint64_t>(_buffers + static_cast<size_t>(buffer) * EVENT_RECV_SIZE);
+    entry.len = EVENT_RECV_SIZE;
+    entry.bid = buffer;
+    _bufferTail++;
+    __atomic_store_n(&_bufferRing->tail, _bufferTail, __ATOMIC_RELEASE);
+}
+
+void IoUringBackend::unmapRings()
+{
+    if (_sqes)
+        munmap(_sqes, _sqesSize);
+    if (_ringPtr)
+        munmap(_ringPtr, _ringSize);
+    if (_bufferRing)
+    {
+        munmap(_bufferRing, RECV_BUFFER_COUNT * sizeof(struct io_uring_buf));
+        munmap(_buffers, RECV_BUFFER_COUNT * EVENT_RECV_SIZE);
+    }
+    _sqes = nullptr;
+    _ringPtr = nullptr;
+    _bufferRing = nullptr;
+    _buffers = nullptr;
+}
+
+uint64_t IoUringBackend::makeUserData(Operation operation, uint32_t generation, uint32_t index)
+{
+    return (static_cast<uint64_t>(operation) << 61) | (static_cast<uint64_t>(generation & GENERATION_MASK) << 32) | index;
+}
+
+int IoUringBackend::enter(unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, size_t argSize)
+{
+    return syscall(__NR_io_uring_enter, _ringFd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+// without SQPOLL the kernel consumes every submitted entry inside io_uring_enter, so head..tail is what is left
+unsigned IoUringBackend::unsubmitted() const
+{
+    return _localSqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+}
+
+void IoUringBackend::publishSubmissions()
+{
+    __atomic_store_n(_sqTail, _localSqTail, __ATOMIC_RELEASE);
+}
+
+// when the submission queue is full the queued entries are flushed early with a plain submit; needed keeps
+// room for the rest of a linked chain, which has to go out in one submission
+struct io_uring_sqe *IoUringBackend::getSqe(unsigned needed)
+{
+    if (_localSqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) + needed > _sqEntries)
+    {
+        publishSubmissions();
+        if (enter(unsubmitted(), 0, 0, nullptr, 0) < 0)
+            throw std::runtime_error("Error submitting to io_uring: " + std::string(strerror(errno)));
+    }
+    const unsigned index = _localSqTail & *_sqMask;
+    struct io_uring_sqe *sqe = &_sqes[index];
+
+    std::memset(sqe, 0, sizeof(*sqe));
+    _sqArray[index] = index;
+    _localSqTail++;
+    return sqe;
+}
+
+IoUringBackend::Mode IoUringBackend::modeFor(uint32_t events) const
+{
+    if ((events & EVENT_ACCEPT) && _multishotAccept)
+        return ACCEPT;
+    if ((events & EVENT_RECV) && _bufferRing && (events & ~EVENT_RECV) == EPOLLIN)
+        return RECV;
+    return POLL;
+}
+
+// the request the registration stands for: a poll, or the accept / recv itself. A RECV waits while the last one is unread
+void IoUringBackend::arm(int fd, Registration &registration)
+{
+    uint32_t    pollEvents = registration.events & ~(EVENT_ACCEPT | EVENT_RECV);
+
+    if (registration.mode == RECV && !registration.polled && _received.count(fd) > 0)
+        return ;
+    if ((pollEvents & EPOLLOUT) && _outputIds.count(fd) > 0) // the output's completion stands for EPOLLOUT
+    {
+        pollEvents &= ~EPOLLOUT;
+        if (pollEvents == 0)
+            return ;
+    }
+
+    struct io_uring_sqe *sqe = getSqe();
+    Operation           operation = OP_POLL;
+
+    _generationCounter = (_generationCounter + 1) & GENERATION_MASK;
+    if (_generationCounter == 0)
+        _generationCounter = 1;
+    sqe->fd = fd;
+    if (registration.mode == ACCEPT)
+    {
+        operation = OP_ACCEPT;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC; // close-on-exec right away, see WebServer::acceptAddClientToEpoll
+    }
+    else if (registration.mode == RECV && !registration.polled)
+    {
+        operation = OP_RECV;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RECV_BUFFER_GROUP;
+        sqe->len = EVENT_RECV_SIZE;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->poll32_events = pollEvents;
+    }
+    sqe->user_data = makeUserData(operation, _generationCounter, static_cast<uint32_t>(fd));
+    registration.userData = sqe->user_data;
+    registration.armed = true;
+}
+
+void IoUringBackend::queueCancel(Registration &registration)
+{
+    if (!registration.armed)
+        return ;
+    cancelRequest(registration.userData);
+    registration.armed = false;
+}
+
+void IoUringBackend::cancelRequest(uint64_t userData)
+{
+    struct io_uring_sqe *sqe = getSqe();
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = userData;
+    sqe->user_data = IGNORED_USER_DATA;
+}
+
+//what is held for a removed fd: connections not handed out are closed, buffers go back to the ring
+void IoUringBackend::forget(int fd)
+{
+    auto received = _received.find(fd);
+    auto accepted = _accepted.find(fd);
+    auto fileRead = _fileReadIds.find(fd);
+    auto output = _outputIds.find(fd);
+
+    if (received != _received.end())
+    {
+        if (received->second.buffer != -1)
+            recycleBuffer(received->second.buffer);
+        _received.erase(received);
+    }
+    if (accepted != _accepted.end())
+    {
+        for (int client : accepted->second.fds)
+            close(client);
+        _accepted.erase(accepted);
+    }
+    if (fileRead != _fileReadIds.end())
+    {
+        auto file = _fileReads.find(fileRead->second);
+
+        if (file->second.complete)
+            _fileReads.erase(file);
+        else
+            file->second.clientFd = -1;
+        _fileReadIds.erase(fileRead);
+    }
+    if (output != _outputIds.end())
+    {
+        auto it = _outputs.find(output->second);
+
+        if (it->second.inFlight == 0)
+            _outputs.erase(it);
+        else
+        {
+            // a send waiting for a stalled peer would hold the socket open past its close
+            for (unsigned step = OUTPUT_POLL; step <= OUTPUT_SPLICE; step++)
+                if (it->second.steps & (1u << step))
+                    cancelRequest(makeUserData(OP_OUTPUT, step, it->first));
+            it->second.clientFd = -1;
+        }
+        _outputIds.erase(output);
+    }
+}
+
+void IoUringBackend::control(int fd, int operation, uint32_t events)
+{
+    auto it = _registrations.find(fd);
+
+    switch (operation)
+    {
+        case EPOLL_CTL_ADD:
+        {
+            if (it != _registrations.end())
+                throw std::runtime_error("Error changing io_uring state: fd already registered");
+            Registration registration;
+            registration.events = events;
+            registration.mode = modeFor(events);
+            if (registration.mode == ACCEPT)
+                _accepted[fd];
+            arm(fd, registration);
+            _registrations[fd] = registration;
+            break;
+        }
+        case EPOLL_CTL_MOD:
+            if (it == _registrations.end())
+                throw std::runtime_error("Error changing io_uring state: fd not registered");
+            queueCancel(it->second);
+            it->second.events = events;
+            it->second.mode = modeFor(events);
+            it->second.polled = false;
+            if (!it->second.suspended)
+                arm(fd, it->second);
+            if (hasPending(fd, it->second))
+                pushReady(fd);
+            break;
+        case EPOLL_CTL_DEL:
+            if (it == _registrations.end())
+                throw std::runtime_error("Error changing io_uring state: fd not registered");
+            queueCancel(it->second);
+            forget(fd);
+            _registrations.erase(it);
+            break;
+        default:
+            throw std::runtime_error("Error changing io_uring state: unknown operation");
+    }
+}
+
+int IoUringBackend::accept(int listenFd)
+{
+    auto it = _accepted.find(listenFd);
+
+    if (it == _accepted.end())
+        return EventBackend::accept(listenFd);
+
+    AcceptQueue &queue = it->second;
+
+    if (!queue.fds.empty())
+    {
+        const int fd = queue.fds.front();
+
+        queue.fds.pop_front();
+        return fd;
+    }
+    errno = queue.error != 0 ? queue.error : EAGAIN;
+    queue.error = 0;
+    return -1;
+}
+
+ssize_t IoUringBackend::recv(int fd, void *buffer, size_t length)
+{
+    auto it = _received.find(fd);
+
+    if (it == _received.end())
+        return ::recv(fd, buffer, length, 0);
+
+    Received &received = it->second;
+
+    if (received.buffer != -1)
+    {
+        const size_t taken = std::min(length, received.length - received.offset);
+
+        std::memcpy(buffer, _buffers + static_cast<size_t>(received.buffer) * EVENT_RECV_SIZE + received.offset, taken);
+        received.offset += taken;
+        if (received.offset == received.length)
+        {
+            recycleBuffer(received.buffer);
+            _received.erase(it);
+        }
+        return taken;
+    }
+    if (received.eof)
+        return 0;
+    errno = received.error;
+    _received.erase(it);
+    return -1;
+}
+
+/*
+OPENAT and STATX go out together, by path; READ follows once both are in, into content sized from the
+statx. Directories and large files end it with EISDIR / EFBIG, the caller has its own way with those.
+*/
+bool IoUringBackend::readFile(int fd, const std::string &path)
+{
+    auto it = _registrations.find(fd);
+
+    if (it == _registrations.end() || _fileReadIds.count(fd) > 0 || _fileReads.size() >= FILE_READS_MAX)
+        return false;
+    while (_fileReads.count(++_fileReadCounter) > 0)
+        ;
+
+    const uint32_t  id = _fileReadCounter;
+    FileRead        &file = _fileReads[id];
+
+    file.clientFd = fd;
+    file.path = path;
+    _fileReadIds[fd] = id;
+    queueCancel(it->second);
+    it->second.suspended = true;
+
+    struct io_uring_sqe *sqe = getSqe();
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(file.path.c_str());
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = makeUserData(OP_FILE, FILE_OPEN, id);
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(file.path.c_str());
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = reinterpret_cast<uint64_t>(&file.stat);
+    sqe->user_data = makeUserData(OP_FILE, FILE_STATX, id);
+    file.inFlight = 2;
+    return true;
+}
+
+bool IoUringBackend::takeFile(int fd, std::string &content, int &error)
+{
+    auto id = _fileReadIds.find(fd);
+
+    if (id == _fileReadIds.end() || !_fileReads[id->second].complete)
+        return false;
+
+    auto file = _fileReads.find(id->second);
+
+    content = std::move(file->second.content);
+    error = file->second.error;
+    _fileReads.erase(file);
+    _fileReadIds.erase(id);
+    return true;
+}
+
+/*
+The result of the requests queued last time comes first; with nothing held a new chain goes out with
+the next wait: POLLOUT, then the buffer (a copy, the caller's may move) and the pipe. The caller
+registers a socket it got EAGAIN for with EPOLLOUT, which the completion is reported as. An fd
+registered for anything else is sent to right away with the plain syscalls.
+*/
+ssize_t IoUringBackend::send(int fd, const void *buffer, size_t length, int pipeFd, size_t piped)
+{
+    auto    id = _outputIds.find(fd);
+    auto    it = _registrations.find(fd);
+
+    if (id != _outputIds.end())
+    {
+        auto            held = _outputs.find(id->second);
+        const size_t    done = held->second.done;
+        const int       error = held->second.error;
+
+        if (held->second.inFlight > 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        _outputs.erase(held);
+        _outputIds.erase(id);
+        if (it != _registrations.end())
+            _rearm.push_back(fd); // POLLOUT is polled again, unless more is queued below
+        if (done > 0)
+            return done;
+        if (error != 0)
+        {
+            errno = error;
+            return -1;
+        }
+    }
+    if (it != _registrations.end() && (it->second.mode != POLL || !(it->second.events & EPOLLOUT) || it->second.suspended))
+        return EventBackend::send(fd, buffer, length, pipeFd, piped);
+    while (_outputs.count(++_outputCounter) > 0)
+        ;
+
+    const uint32_t      outputId = _outputCounter;
+    Output              &output = _outputs[outputId];
+    const bool          splicing = piped > 0 && (length == 0 || (length <= OUTPUT_SEND_MAX && _bufferRing));
+    struct io_uring_sqe *sqe = getSqe(1 + (length > 0) + splicing);
+
+    output.clientFd = fd;
+    _outputIds[fd] = outputId;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = makeUserData(OP_OUTPUT, OUTPUT_POLL, outputId);
+    output.steps = 1u << OUTPUT_POLL;
+    if (length > 0)
+    {
+        output.data.assign(static_cast<const char *>(buffer), std::min<size_t>(length, OUTPUT_SEND_MAX));
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = getSqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(output.data.data());
+        sqe->len = output.data.size();
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->user_data = makeUserData(OP_OUTPUT, OUTPUT_SEND, outputId);
+        output.steps |= 1u << OUTPUT_SEND;
+    }
+    if (splicing)
+    {
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = getSqe();
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->fd = fd;
+        sqe->splice_fd_in = pipeFd;
+        sqe->splice_off_in = static_cast<uint64_t>(-1);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->len = std::min<size_t>(piped, UINT32_MAX);
+        sqe->splice_flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+        sqe->user_data = makeUserData(OP_OUTPUT, OUTPUT_SPLICE, outputId);
+        output.steps |= 1u << OUTPUT_SPLICE;
+    }
+    output.inFlight = __builtin_popcount(output.steps);
+    if (it != _registrations.end() && it->second.armed) // without POLLOUT from now on
+    {
+        queueCancel(it->second);
+        arm(fd, it->second);
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+//the poll's result is its mask, only the send and the splice move bytes; a splice finding the socket full moved nothing
+void IoUringBackend::completeOutput(const struct io_uring_cqe &cqe)
+{
+    auto it = _outputs.find(static_cast<uint32_t>(cqe.user_data));
+
+    if (it == _outputs.end())
+        return ;
+
+    Output          &output = it->second;
+    const uint32_t  step = (cqe.user_data >> 32) & GENERATION_MASK;
+
+    output.inFlight--;
+    if (cqe.res > 0 && step != OUTPUT_POLL)
+        output.done += cqe.res;
+    else if (cqe.res < 0 && cqe.res != -ECANCELED && cqe.res != -EAGAIN && output.error == 0)
+        output.error = -cqe.res;
+    if (output.inFlight > 0)
+        return ;
+    if (output.clientFd == -1)
+        return static_cast<void>(_outputs.erase(it));
+    if (_registrations.count(output.clientFd) > 0)
+        pushReady(output.clientFd);
+}
+
+bool IoUringBackend::outputDone(int fd) const
+{
+    auto id = _outputIds.find(fd);
+
+    return id != _outputIds.end() && _outputs.at(id->second).inFlight == 0;
+}
+
+void IoUringBackend::queueRead(uint32_t id, FileRead &file)
+{
+    struct io_uring_sqe *sqe = getSqe();
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file.fileFd;
+    sqe->addr = reinterpret_cast<uint64_t>(&file.content[file.done]);
+    sqe->len = std::min<size_t>(file.content.size() - file.done, FILE_READ_MAX);
+    sqe->off = file.done;
+    sqe->user_data = makeUserData(OP_FILE, FILE_READ, id);
+    file.inFlight++;
+}
+
+void IoUringBackend::completeFileStep(const struct io_uring_cqe &cqe)
+{
+    auto it = _fileReads.find(static_cast<uint32_t>(cqe.user_data));
+
+    if (it == _fileReads.end())
+        return ;
+
+    FileRead        &file = it->second;
+    const uint32_t  step = (cqe.user_data >> 32) & GENERATION_MASK;
+    bool            ended = false; // the file is shorter than its statx said
+
+    file.inFlight--;
+    if (cqe.res < 0)
+        file.error = file.error != 0 ? file.error : -cqe.res;
+    else if (step == FILE_OPEN && cqe.res >= 0)
+        file.fileFd = cqe.res;
+    else if (step == FILE_READ && cqe.res == 0)
+        ended = true;
+    else if (step == FILE_READ)
+        file.done += cqe.res;
+    if (file.inFlight > 0)
+        return ;
+    if (step != FILE_READ && file.error == 0 && file.clientFd != -1)
+    {
+        if (S_ISDIR(file.stat.stx_mode))
+            file.error = EISDIR;
+        else if (file.stat.stx_size > FILE_READ_SIZE_MAX)
+            file.error = EFBIG;
+        else
+            file.content.resize(file.stat.stx_size);
+    }
+    if (ended)
+        file.content.resize(file.done);
+    if (file.error == 0 && file.clientFd != -1 && file.done < file.content.size())
+        return queueRead(it->first, file);
+    finishFileRead(it);
+}
+
+void IoUringBackend::finishFileRead(std::unordered_map<uint32_t, FileRead>::iterator it)
+{
+    FileRead &file = it->second;
+
+    if (file.fileFd != -1)
+    {
+        struct io_uring_sqe *sqe = getSqe();
+
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = file.fileFd;
+        sqe->user_data = IGNORED_USER_DATA;
+        file.fileFd = -1;
+    }
+    if (file.clientFd == -1)
+        return static_cast<void>(_fileReads.erase(it));
+    if (file.error != 0)
+        file.content.clear();
+    file.complete = true;
+    pushReady(file.clientFd);
+}
+
+//a multishot accept keeps going while F_MORE is set; a kernel without it (before 5.19) refuses with EINVAL
+void IoUringBackend::completeAccept(int fd, const struct io_uring_cqe &cqe, Registration *registration)
+{
+    if (!registration)
+    {
+        if (cqe.res >= 0)
+            close(cqe.res);
+        return ;
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+    {
+        registration->armed = false;
+        _rearm.push_back(fd);
+    }
+    if (cqe.res == -EINVAL && _accepted[fd].fds.empty())
+    {
+        _multishotAccept = false;
+        registration->mode = POLL;
+        _accepted.erase(fd);
+        return ;
+    }
+    if (cqe.res >= 0)
+        _accepted[fd].fds.push_back(cqe.res);
+    else
+        _accepted[fd].error = -cqe.res;
+    pushReady(fd);
+}
+
+//ENOBUFS: every buffer is held by an fd, this one is polled until it fires and its handler recv()s itself
+void IoUringBackend::completeRecv(int fd, const struct io_uring_cqe &cqe, Registration *registration)
+{
+    const int buffer = (cqe.flags & IORING_CQE_F_BUFFER) ? static_cast<int>(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    if (!registration)
+    {
+        if (buffer != -1)
+            recycleBuffer(buffer);
+        return ;
+    }
+    registration->armed = false;
+    _rearm.push_back(fd);
+    if (cqe.res == -ENOBUFS)
+    {
+        registration->polled = true;
+        return ;
+    }
+
+    Received &received = _received[fd];
+
+    if (cqe.res > 0)
+    {
+        received.buffer = buffer;
+        received.length = cqe.res;
+    }
+    else if (cqe.res == 0)
+        received.eof = true;
+    else
+        received.error = -cqe.res;
+    pushReady(fd);
+}
+
+bool IoUringBackend::hasPending(int fd, const Registration &registration) const
+{
+    auto fileRead = _fileReadIds.find(fd);
+    auto accepted = _accepted.find(fd);
+
+    if ((registration.events & EPOLLOUT) && outputDone(fd))
+        return true;
+    if (fileRead != _fileReadIds.end())
+        return _fileReads.at(fileRead->second).complete;
+    if (accepted != _accepted.end())
+        return !accepted->second.fds.empty() || accepted->second.error != 0;
+    return (registration.events & EPOLLIN) && _received.count(fd) > 0;
+}
+
+void IoUringBackend::pushReady(int fd)
+{
+    Registration &registration = _registrations.at(fd);
+
+    if (registration.queued)
+        return ;
+    registration.queued = true;
+    _ready.push_back(fd);
+}
+
+int IoUringBackend::reapCompletions(std::vector<struct epoll_event> &events)
+{
+    unsigned    head = *_cqHead;
+    unsigned    tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+    int         count = 0;
+
+    while (head != tail && static_cast<size_t>(count) < events.size())
+    {
+        const struct io_uring_cqe &cqe = _cqes[head & *_cqMask];
+        head++;
+        if (cqe.user_data == IGNORED_USER_DATA)
+            continue;
+
+        const Operation operation = static_cast<Operation>(cqe.user_data >> 61);
+        const int       fd = static_cast<int>(cqe.user_data & 0xffffffff);
+        auto            it = _registrations.find(fd);
+        Registration    *registration = nullptr;
+
+        if (it != _registrations.end() && it->second.armed && it->second.userData == cqe.user_data)
+            registration = &it->second;
+        if (operation == OP_FILE)
+            completeFileStep(cqe);
+        else if (operation == OP_OUTPUT)
+            completeOutput(cqe);
+        else if (operation == OP_ACCEPT)
+            completeAccept(fd, cqe, registration);
+        else if (operation == OP_RECV)
+            completeRecv(fd, cqe, registration);
+        else if (registration && cqe.res != -ECANCELED)
+        {
+            registration->armed = false;
+            registration->polled = false;
+            _rearm.push_back(fd);
+            std::memset(&events[count], 0, sizeof(events[count]));
+            events[count].data.fd = fd;
+            events[count].events = (cqe.res < 0) ? EPOLLERR : static_cast<uint32_t>(cqe.res);
+            count++;
+        }
+    }
+    __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
+
+//what accept(), recv(), takeFile() or send() would hand out: EPOLLIN per queued connection, EPOLLIN for data, EPOLLOUT
+//for a file or an output
+int IoUringBackend::reportReady(std::vector<struct epoll_event> &events, int count)
+{
+    size_t next = 0;
+
+    for (; next < _ready.size() && static_cast<size_t>(count) < events.size(); next++)
+    {
+        const int   fd = _ready[next];
+        auto        it = _registrations.find(fd);
+
+        if (it == _registrations.end() || !it->second.queued)
+            continue;
+        it->second.queued = false;
+        if (!hasPending(fd, it->second))
+            continue;
+
+        uint32_t    ready = EPOLLIN;
+        size_t      times = 1;
+        auto        accepted = _accepted.find(fd);
+
+        if ((it->second.events & EPOLLOUT) && outputDone(fd))
+            ready = EPOLLOUT;
+        else if (_fileReadIds.count(fd) > 0)
+        {
+            ready = EPOLLOUT;
+            it->second.suspended = false;
+        }
+        else if (accepted != _accepted.end())
+            times = std::max<size_t>(accepted->second.fds.size(), 1);
+        for (size_t i = 0; i < times && static_cast<size_t>(count) < events.size(); i++, count++)
+        {
+            std::memset(&events[count], 0, sizeof(events[count]));
+            events[count].data.fd = fd;
+            events[count].events = ready;
+        }
+        _rearm.push_back(fd);
+    }
+    _ready.erase(_ready.begin(), _ready.begin() + next);
+    return count;
+}
+
+int IoUringBackend::wait(std::vector<struct epoll_event> &events, int timeoutMs)
+{
+    // what fired last time is re-armed here, unless the handler removed or re-armed it itself; what is still
+    // held for it is reported again
+    for (int fd : _rearm)
+    {
+        auto it = _registrations.find(fd);
+        if (it == _registrations.end())
+            continue;
+        if (!it->second.armed && !it->second.suspended)
+            arm(fd, it->second);
+        if (hasPending(fd, it->second))
+            pushReady(fd);
+    }
+    _rearm.clear();
+    publishSubmissions();
+
+    const bool  completionsReady = *_cqHead != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE) || !_ready.empty();
+    unsigned    toSubmit = unsubmitted();
+    int         ret;
+
+    if (completionsReady)
+        ret = toSubmit ? enter(toSubmit, 0, 0, nullptr, 0) : 0;
+    else
+    {
+        struct __kernel_timespec            timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000LL };
+        struct io_uring_getevents_arg       arg;
+
+        std::memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        ret = enter(toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        if (ret < 0 && errno == ETIME)
+            ret = 0;
+    }
+    if (ret < 0)
+        return -1;
+    return reportReady(events, reapCompletions(events));
+}
+
+const char *IoUringBackend::getName() const { return "io_uring"; }
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "EventBackend.hpp"
+#include <deque>
+#include <linux/io_uring.h>
+#include <sys/stat.h>
+#include <unordered_map>
+
+#define RECV_BUFFER_COUNT 256   // provided buffers of EVENT_RECV_SIZE bytes, a power of two
+#define RECV_BUFFER_GROUP 0
+#define FILE_READ_SIZE_MAX 1048576  // a file is held whole while it is read, larger ones are left to the caller (EFBIG)
+#define FILE_READS_MAX 64           // in progress at once, readFile() declines past that
+#define OUTPUT_SEND_MAX 1048576     // copied for one IORING_OP_SEND, the rest of a larger buffer waits for the next
+
+/*
+io_uring backend. Plain registrations are one-shot IORING_OP_POLL_ADD requests that are
+re-armed after they fire, which keeps epoll's level-triggered behaviour. Two kinds of fds get
+the operation itself instead of a readiness poll:
+- EVENT_ACCEPT listeners have a multishot IORING_OP_ACCEPT; the connections it brings queue up
+  here, each is reported as one EPOLLIN and accept() hands it out without a syscall;
+- EVENT_RECV sockets waiting for EPOLLIN alone have a one-shot IORING_OP_RECV into a ring of
+  provided buffers (IORING_REGISTER_PBUF_RING), recv() copies out of it. When the ring is empty
+  the fd is polled for that round instead; without the ring (older kernels), always.
+readFile() takes the fd out of the loop while IORING_OP_OPENAT and STATX run side by side, then
+IORING_OP_READ fills the content and IORING_OP_CLOSE drops the file; a directory or a file past
+FILE_READ_SIZE_MAX ends it with EISDIR / EFBIG instead.
+send() on a client socket queues the output itself: an IORING_OP_POLL_ADD for POLLOUT,
+then IORING_OP_SEND of a copy of the buffer and IORING_OP_SPLICE of the pipe, linked with
+IOSQE_IO_LINK so that they run in that order within the same submission. The send has MSG_WAITALL,
+which makes a short send fail the link: the splice never runs after a gap. Until all of them
+completed the fd's own poll leaves out POLLOUT, and EPOLLOUT is reported when the result is in.
+Without the buffer ring (a kernel older than 5.19, which may not honour MSG_WAITALL here) the splice
+is not linked and waits for the next round. Fds registered for anything but EPOLLOUT (a body being read)
+keep the plain syscalls.
+Whatever is still held for an fd is reported again on the next wait without blocking, the way
+epoll keeps reporting a socket with unread data. ADD/MOD/DEL only queue SQEs; they are submitted
+together with the wait, so a loop iteration costs one io_uring_enter no matter how many fds
+changed state. Every arming gets a new generation in user_data, so completions that race with a
+MOD/DEL (or with fd reuse after close) are recognised and dropped, along with the connection or
+buffer they carry.
+*/
+class IoUringBackend : public EventBackend
+{
+public:
+    IoUringBackend(unsigned entries = 256);
+    ~IoUringBackend() override;
+    IoUringBackend(const IoUringBackend &) = delete;
+    IoUringBackend &operator=(const IoUringBackend &) = delete;
+
+    void        control(int fd, int operation, uint32_t events) override;
+    int         wait(std::vector<struct epoll_event> &events, int timeoutMs) override;
+    const char  *getName() const override;
+    int         accept(int listenFd) override;
+    ssize_t     recv(int fd, void *buffer, size_t length) override;
+    bool        readFile(int fd, const std::string &path) override;
+    bool        takeFile(int fd, std::string &content, int &error) override;
+    ssize_t     send(int fd, const void *buffer, size_t length, int pipeFd, size_t piped) override;
+
+private:
+    enum Mode { POLL, ACCEPT, RECV };
+    enum Operation { OP_POLL, OP_ACCEPT, OP_RECV, OP_FILE, OP_OUTPUT };   // top three bits of user_data
+    enum FileStep { FILE_OPEN, FILE_STATX, FILE_READ };
+    enum OutputStep { OUTPUT_POLL, OUTPUT_SEND, OUTPUT_SPLICE };
+
+    struct Registration
+    {
+        uint32_t    events;
+        Mode        mode;
+        uint64_t    userData = 0;       // of the request armed for it
+        bool        armed = false;
+        bool        polled = false;     // RECV found the buffer ring empty, polled until it fires
+        bool        suspended = false;  // readFile() in progress, nothing armed
+        bool        queued = false;     // in _ready
+    };
+
+    struct Received                     // what the last RECV brought, until recv() took all of it
+    {
+        int         buffer = -1;
+        size_t      offset = 0;
+        size_t      length = 0;
+        int         error = 0;
+        bool        eof = false;        // stays until the fd is removed
+    };
+
+    struct AcceptQueue
+    {
+        std::deque<int> fds;
+        int             error = 0;
+    };
+
+    struct FileRead
+    {
+        int         clientFd;           // -1 once removed, the read only finishes to free its buffers
+        std::string path;
+        std::string content;
+        struct statx stat;
+        int         fileFd = -1;
+        int         error = 0;
+        size_t      done = 0;
+        unsigned    inFlight = 0;
+        bool        complete = false;
+    };
+
+    struct Output                       // what send() queued, its result held until send() is called again
+    {
+        int         clientFd;           // -1 once removed, the requests are cancelled and only finish to free data
+        std::string data;               // the bytes IORING_OP_SEND reads from
+        unsigned    steps = 0;          // bit per OutputStep queued
+        unsigned    inFlight = 0;
+        size_t      done = 0;           // sent, then spliced
+        int         error = 0;
+    };
+
+    int                                     _ringFd = -1;
+    void                                    *_ringPtr = nullptr;
+    size_t                                  _ringSize = 0;
+    struct io_uring_sqe                     *_sqes = nullptr;
+    size_t                                  _sqesSize = 0;
+
+    unsigned                                *_sqHead = nullptr;
+    unsigned                                *_sqTail = nullptr;
+    unsigned                                *_sqMask = nullptr;
+    unsigned                                *_sqArray = nullptr;
+    unsigned                                _sqEntries = 0;
+    unsigned                                _localSqTail = 0;
+    unsigned                                *_cqHead = nullptr;
+    unsigned                                *_cqTail = nullptr;
+    unsigned                                *_cqMask = nullptr;
+    struct io_uring_cqe                     *_cqes = nullptr;
+
+    struct io_uring_buf_ring                *_bufferRing = nullptr;
+    char                                    *_buffers = nullptr;
+    uint16_t                                _bufferTail = 0;
+    bool                                    _multishotAccept = true;
+
+    std::unordered_map<int, Registration>   _registrations;
+    std::unordered_map<int, Received>       _received;
+    std::unordered_map<int, AcceptQueue>    _accepted;
+    std::unordered_map<uint32_t, FileRead>  _fileReads;
+    std::unordered_map<int, uint32_t>       _fileReadIds;   // client fd -> _fileReads
+    std::unordered_map<uint32_t, Output>    _outputs;
+    std::unordered_map<int, uint32_t>       _outputIds;     // client fd -> _outputs
+    std::vector<int>                        _rearm;
+    std::vector<int>                        _ready;         // something to report without waiting
+    uint32_t                                _generationCounter = 0;
+    uint32_t                                _fileReadCounter = 0;
+    uint32_t                                _outputCounter = 0;
+
+    struct io_uring_sqe *getSqe(unsigned needed = 1);
+    Mode                modeFor(uint32_t events) const;
+    void                arm(int fd, Registration &registration);
+    void                queueCancel(Registration &registration);
+    void                cancelRequest(uint64_t userData);
+    void                queueRead(uint32_t id, FileRead &file);
+    void                setupBufferRing();
+    void                recycleBuffer(int buffer);
+    void                forget(int fd);
+    bool                hasPending(int fd, const Registration &registration) const;
+    void                pushReady(int fd);
+    void                completeAccept(int fd, const struct io_uring_cqe &cqe, Registration *registration);
+    void                completeRecv(int fd, const struct io_uring_cqe &cqe, Registration *registration);
+    void                completeFileStep(const struct io_uring_cqe &cqe);
+    void                finishFileRead(std::unordered_map<uint32_t, FileRead>::iterator it);
+    void                completeOutput(const struct io_uring_cqe &cqe);
+    bool                outputDone(int fd) const;
+    int                 enter(unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, size_t argSize);
+    unsigned            unsubmitted() const;
+    void                publishSubmissions();
+    int                 reapCompletions(std::vector<struct epoll_event> &events);
+    int                 reportReady(std::vector<struct epoll_event> &events, int count);
+    void                unmapRings();
+
+    static uint64_t     makeUserData(Operation operation, uint32_t generation, uint32_t index);
+};
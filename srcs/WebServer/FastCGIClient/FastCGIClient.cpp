@@ -0,0 +1,595 @@
+#include "FastCGIClient.hpp"
+#include "ProxySocket.hpp"
+#include "WebErrors.hpp"
+#include "WebServer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// FastCGI 1.0 record types, roles, flags and END_REQUEST protocol statuses
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_ABORT_REQUEST 2
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_GET_VALUES 9
+#define FCGI_GET_VALUES_RESULT 10
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+#define FCGI_REQUEST_COMPLETE 0
+#define FCGI_CANT_MPX_CONN 1
+#define FCGI_OVERLOADED 2
+#define FCGI_HEADER_LEN 8
+
+FastCGIClient::FastCGIClient(size_t maxConnections, ControlCallback control, OutputCallback output, ErrorCallback error)
+    : _maxConnections(maxConnections), _control(std::move(control)), _output(std::move(output)), _error(std::move(error))
+{
+}
+
+FastCGIClient::~FastCGIClient()
+{
+    for (const auto &connection : _connections)
+        close(connection.first);
+}
+
+//the request is encoded right away, it goes out on the first connection to the backend with room for it
+void FastCGIClient::start(const Request &request, int clientSocket, const std::string &remoteAddress)
+{
+    Job job;
+
+    job.clientSocket = clientSocket;
+    job.key = request.getLocation()->target;
+    job.addresses = request.getProxyInfo();
+    job.body = request.getRawRequestBuffer();
+    job.bodyOffset = job.body->find("\r\n\r\n");
+    job.bodyOffset = (job.bodyOffset == std::string::npos) ? job.body->size() : job.bodyOffset + 4;
+    job.params = encodeParams(request, remoteAddress, job.body->size() - job.bodyOffset);
+    job.headOnly = request.getRequestData().method == "HEAD";
+    job.queued = std::chrono::steady_clock::now();
+    if (!job.addresses)
+    {
+        WebErrors::printerror("FastCGIClient::start", "No address for FastCGI backend " + job.key);
+        return _error(clientSocket, 502);
+    }
+
+    const std::string key = job.key;
+
+    _clientStreams[clientSocket] = {-1, 0};
+    _queued[key].push_back(std::move(job));
+    dispatch(key);
+}
+
+/*
+Hands the backend's queued requests to its connections: the least busy one with room takes the next
+request, and a new connection is opened while there are fewer than fastcgi_connections. If the
+backend can't even be connected to and has no other connection, its whole queue fails with 502.
+*/
+void FastCGIClient::dispatch(const std::string &key)
+{
+    while (!_queued[key].empty())
+    {
+        Connection  *target = nullptr;
+        size_t      count = 0;
+
+        for (auto &entry : _connections)
+        {
+            Connection &connection = entry.second;
+
+            if (connection.key != key)
+                continue ;
+            count++;
+            if (connection.streams.size() < connection.maxStreams
+                && (!target || connection.streams.size() < target->streams.size()))
+                target = &connection;
+        }
+        if (!target && count < _maxConnections)
+        {
+            const int fd = connect(_queued[key].front());
+
+            if (fd == -1 && count == 0)
+            {
+                std::deque<Job> failed = std::move(_queued[key]);
+
+                _queued[key].clear();
+                for (const Job &job : failed)
+                    fail(job.clientSocket, 502);
+                return ;
+            }
+            if (fd != -1)
+                target = &_connections.at(fd);
+        }
+        if (!target)
+            return ;
+
+        Job job = std::move(_queued[key].front());
+
+        _queued[key].pop_front();
+        assign(*target, std::move(job));
+    }
+}
+
+//BEGIN_REQUEST, PARAMS and STDIN go out back to back under the lowest free request id
+void FastCGIClient::assign(Connection &connection, Job job)
+{
+    const unsigned char begin[8] = {0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0};
+    uint16_t            requestId = 1;
+
+    while (connection.streams.find(requestId) != connection.streams.end())
+        requestId++;
+    connection.out += record(FCGI_BEGIN_REQUEST, requestId, reinterpret_cast<const char *>(begin), sizeof(begin));
+    for (size_t offset = 0; offset < job.params.size(); offset += FASTCGI_RECORD_MAX)
+        connection.out += record(FCGI_PARAMS, requestId, job.params.data() + offset,
+                                 std::min<size_t>(FASTCGI_RECORD_MAX, job.params.size() - offset));
+    connection.out += record(FCGI_PARAMS, requestId, nullptr, 0);
+    for (size_t offset = job.bodyOffset; offset < job.body->size(); offset += FASTCGI_RECORD_MAX)
+        connection.out += record(FCGI_STDIN, requestId, job.body->data() + offset,
+                                 std::min<size_t>(FASTCGI_RECORD_MAX, job.body->size() - offset));
+    connection.out += record(FCGI_STDIN, requestId, nullptr, 0);
+
+    _clientStreams[job.clientSocket] = {connection.fd, requestId};
+    connection.streams[requestId].output = CGIOutput(job.headOnly);
+    connection.streams[requestId].job = std::move(job);
+    if (connection.streams.size() == 1)
+        connection.lastActivity = std::chrono::steady_clock::now(); // an idle connection's read timeout starts now
+    flush(connection);
+    watch(connection);
+}
+
+//a new connection asks first whether the backend multiplexes, the answer may raise its maxStreams
+int FastCGIClient::connect(const Job &job)
+{
+    for (const auto &address : *job.addresses)
+    {
+        try
+        {
+            ProxySocket socket(address, job.key);
+            Connection  connection;
+            std::string query;
+
+            appendPair(query, "FCGI_MAX_CONNS", "");
+            appendPair(query, "FCGI_MAX_REQS", "");
+            appendPair(query, "FCGI_MPXS_CONNS", "");
+            connection.fd = socket.getFd();
+            connection.key = job.key;
+            connection.connecting = !socket.isConnected();
+            connection.out = record(FCGI_GET_VALUES, 0, query.data(), query.size());
+            connection.lastActivity = std::chrono::steady_clock::now();
+
+            Connection &added = _connections.emplace(socket.release(), std::move(connection)).first->second;
+
+            flush(added);
+            watch(added);
+            return added.fd;
+        }
+        catch (const WebErrors::ProxyException &e)
+        {
+            WebErrors::printerror("FastCGIClient::connect", std::string(e.what()) + " " + job.key);
+        }
+    }
+    return -1;
+}
+
+void FastCGIClient::handleEvent(int fd, uint32_t events)
+{
+    auto it = _connections.find(fd);
+
+    if (it == _connections.end())
+        return ;
+
+    Connection &connection = it->second;
+
+    connection.lastActivity = std::chrono::steady_clock::now();
+    if (connection.connecting)
+    {
+        try
+        {
+            ProxySocket::finishConnect(fd);
+            connection.connecting = false;
+        }
+        catch (const WebErrors::ProxyException &e)
+        {
+            WebErrors::printerror("FastCGIClient::handleEvent", std::string(e.what()) + " " + connection.key);
+            return closeConnection(fd, 502, false);
+        }
+    }
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !readRecords(connection))
+        return closeConnection(fd, 502, true);
+    flush(connection);
+    watch(connection);
+}
+
+//false once the backend closed the connection or broke the protocol, after handling what came before
+bool FastCGIClient::readRecords(Connection &connection)
+{
+    char    buffer[65536];
+    bool    open = true;
+    size_t  offset = 0;
+
+    while (true)
+    {
+        const ssize_t bytesRead = recv(connection.fd, buffer, sizeof(buffer), 0);
+
+        if (bytesRead > 0)
+            connection.in.append(buffer, bytesRead);
+        if (bytesRead == static_cast<ssize_t>(sizeof(buffer)))
+            continue ;
+        if (bytesRead == 0 || (bytesRead < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            open = false;
+        break ;
+    }
+    while (connection.in.size() - offset >= FCGI_HEADER_LEN)
+    {
+        const unsigned char *header = reinterpret_cast<const unsigned char *>(connection.in.data() + offset);
+        const uint8_t       type = header[1];
+        const uint16_t      requestId = (header[2] << 8) | header[3];
+        const size_t        contentLength = (header[4] << 8) | header[5];
+        const size_t        recordLength = FCGI_HEADER_LEN + contentLength + header[6];
+
+        if (header[0] != FCGI_VERSION_1)
+        {
+            WebErrors::printerror("FastCGIClient::readRecords", "Unsupported FastCGI version from " + connection.key);
+            return false;
+        }
+        if (connection.in.size() - offset < recordLength)
+            break ;
+
+        const std::string content = connection.in.substr(offset + FCGI_HEADER_LEN, contentLength);
+
+        offset += recordLength;
+        handleRecord(connection, type, requestId, content);
+    }
+    connection.in.erase(0, offset);
+    return open;
+}
+
+void FastCGIClient::handleRecord(Connection &connection, uint8_t type, uint16_t requestId, const std::string &content)
+{
+    if (type == FCGI_STDOUT)
+        handleStdout(connection, requestId, content);
+    else if (type == FCGI_STDERR && !content.empty())
+        std::cerr << COLOR_RED_ERROR << "  FastCGI " << connection.key << ": " << content << "\n" << COLOR_RESET;
+    else if (type == FCGI_END_REQUEST && content.size() >= 5)
+        endStream(connection, requestId, static_cast<uint8_t>(content[4]));
+    else if (type == FCGI_GET_VALUES_RESULT)
+    {
+        size_t  offset = 0;
+        size_t  maxRequests = FASTCGI_MAX_STREAMS;
+
+        //name-value pairs, lengths of one byte or four with the high bit set
+        auto readLength = [&content, &offset]() -> size_t {
+            if (offset < content.size() && !(content[offset] & 0x80))
+                return static_cast<unsigned char>(content[offset++]);
+            if (offset + 4 > content.size())
+                return content.size();
+            const size_t length = ((static_cast<unsigned char>(content[offset]) & 0x7f) << 24)
+                | (static_cast<unsigned char>(content[offset + 1]) << 16)
+                | (static_cast<unsigned char>(content[offset + 2]) << 8) | static_cast<unsigned char>(content[offset + 3]);
+            offset += 4;
+            return length;
+        };
+        while (offset < content.size())
+        {
+            const size_t nameLength = readLength();
+            const size_t valueLength = readLength();
+
+            if (offset + nameLength + valueLength > content.size())
+                break ;
+
+            const std::string name = content.substr(offset, nameLength);
+            const std::string value = content.substr(offset + nameLength, valueLength);
+
+            offset += nameLength + valueLength;
+            if (name == "FCGI_MPXS_CONNS")
+                connection.multiplexed = value == "1";
+            else if (name == "FCGI_MAX_REQS" && !value.empty() && value.find_first_not_of("0123456789") == std::string::npos)
+                maxRequests = std::clamp<size_t>(std::stoul(value.substr(0, 9)), 1, FASTCGI_MAX_STREAMS);
+        }
+        connection.maxStreams = connection.multiplexed ? maxRequests : 1;
+        dispatch(connection.key);
+    }
+}
+
+//output the backend's headers don't make sense of ends the request with a 502, FCGI_END_REQUEST still frees the id
+void FastCGIClient::handleStdout(Connection &connection, uint16_t requestId, const std::string &content)
+{
+    auto it = connection.streams.find(requestId);
+
+    if (it == connection.streams.end())
+        return ;
+
+    Stream &stream = it->second;
+
+    stream.answered = true;
+    if (stream.aborted || content.empty())
+        return ;
+
+    const std::string out = stream.output.feed(content.data(), content.size(), false);
+
+    if (stream.output.isMalformed())
+    {
+        stream.aborted = true;
+        return fail(stream.job.clientSocket, 502);
+    }
+    if (!out.empty())
+        _output(stream.job.clientSocket, out, false);
+}
+
+/*
+The backend is done with the request and its id is free again. A backend that can't take more than
+one request per connection after all gets it back in the queue, for a connection of its own.
+*/
+void FastCGIClient::endStream(Connection &connection, uint16_t requestId, uint8_t protocolStatus)
+{
+    auto it = connection.streams.find(requestId);
+
+    if (it == connection.streams.end())
+        return ;
+
+    Stream      stream = std::move(it->second);
+    const int   clientSocket = stream.job.clientSocket;
+
+    connection.streams.erase(it);
+    connection.reused = true;
+    if (stream.aborted)
+        return dispatch(connection.key);
+    if (protocolStatus == FCGI_CANT_MPX_CONN && !stream.answered)
+    {
+        connection.multiplexed = false;
+        connection.maxStreams = 1;
+        _clientStreams[clientSocket] = {-1, 0};
+        _queued[connection.key].push_front(std::move(stream.job));
+    }
+    else if (protocolStatus == FCGI_OVERLOADED)
+        fail(clientSocket, 503);
+    else
+    {
+        const std::string out = stream.output.feed("", 0, true);
+
+        if (protocolStatus != FCGI_REQUEST_COMPLETE || !stream.output.headersSent())
+            fail(clientSocket, 502);
+        else
+        {
+            _clientStreams.erase(clientSocket);
+            _output(clientSocket, out, true);
+        }
+    }
+    dispatch(connection.key);
+}
+
+void FastCGIClient::fail(int clientSocket, int errorCode)
+{
+    _clientStreams.erase(clientSocket);
+    _error(clientSocket, errorCode);
+}
+
+/*
+The connection is gone with the requests on it. Those the backend hadn't started answering on a
+connection it had already served go back in the queue, as it may have just let an idle connection go.
+*/
+void FastCGIClient::closeConnection(int fd, int errorCode, bool retryUnanswered)
+{
+    auto it = _connections.find(fd);
+
+    if (it == _connections.end())
+        return ;
+
+    Connection connection = std::move(it->second);
+
+    _connections.erase(it);
+    _control(fd, EPOLL_CTL_DEL, 0);
+    for (auto &entry : connection.streams)
+    {
+        Stream &stream = entry.second;
+
+        if (stream.aborted)
+            continue ;
+        if (retryUnanswered && connection.reused && !stream.answered)
+        {
+            _clientStreams[stream.job.clientSocket] = {-1, 0};
+            _queued[connection.key].push_front(std::move(stream.job));
+        }
+        else
+            fail(stream.job.clientSocket, errorCode);
+    }
+    dispatch(connection.key);
+}
+
+//the client went away: the backend is told to stop, the id stays taken until it confirms
+void FastCGIClient::abort(int clientSocket)
+{
+    auto it = _clientStreams.find(clientSocket);
+
+    if (it == _clientStreams.end())
+        return ;
+
+    const int       fd = it->second.first;
+    const uint16_t  requestId = it->second.second;
+
+    _clientStreams.erase(it);
+    if (fd == -1)
+    {
+        for (auto &queue : _queued)
+        {
+            auto job = std::find_if(queue.second.begin(), queue.second.end(),
+                                    [clientSocket](const Job &queued) { return queued.clientSocket == clientSocket; });
+            if (job != queue.second.end())
+                return queue.second.erase(job), void();
+        }
+        return ;
+    }
+
+    auto connection = _connections.find(fd);
+
+    if (connection == _connections.end())
+        return ;
+
+    auto stream = connection->second.streams.find(requestId);
+
+    if (stream == connection->second.streams.end())
+        return ;
+    stream->second.aborted = true;
+    connection->second.out += record(FCGI_ABORT_REQUEST, requestId, nullptr, 0);
+    flush(connection->second);
+    watch(connection->second);
+}
+
+void FastCGIClient::checkTimeouts(void)
+{
+    const auto          now = std::chrono::steady_clock::now();
+    std::vector<int>    timedOut;
+    std::vector<int>    waitedTooLong;
+
+    for (const auto &entry : _connections)
+    {
+        const Connection &connection = entry.second;
+
+        if ((connection.connecting && now - connection.lastActivity > std::chrono::seconds(FASTCGI_CONNECT_TIMEOUT))
+            || (!connection.streams.empty() && now - connection.lastActivity > std::chrono::seconds(FASTCGI_READ_TIMEOUT)))
+            timedOut.push_back(entry.first);
+    }
+    for (int fd : timedOut)
+    {
+        std::cout << COLOR_RED_ERROR << "  FastCGI backend " << _connections[fd].key << " timed out ⏰\n\n" << COLOR_RESET;
+        closeConnection(fd, 504, false);
+    }
+    for (auto &queue : _queued)
+    {
+        while (!queue.second.empty() && now - queue.second.front().queued > std::chrono::seconds(FASTCGI_READ_TIMEOUT))
+        {
+            waitedTooLong.push_back(queue.second.front().clientSocket);
+            queue.second.pop_front();
+        }
+    }
+    for (int clientSocket : waitedTooLong)
+        fail(clientSocket, 504);
+}
+
+bool FastCGIClient::contains(int fd) const
+{
+    return _connections.find(fd) != _connections.end();
+}
+
+//sends what the socket takes, the rest waits for EPOLLOUT; a broken connection shows up as EPOLLHUP/EPOLLERR
+void FastCGIClient::flush(Connection &connection)
+{
+    if (connection.connecting)
+        return ;
+    while (connection.outOffset < connection.out.size())
+    {
+        const ssize_t bytesSent = send(connection.fd, connection.out.data() + connection.outOffset,
+                                       connection.out.size() - connection.outOffset, MSG_NOSIGNAL);
+
+        if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break ;
+        if (bytesSent <= 0)
+        {
+            connection.out.clear();
+            connection.outOffset = 0;
+            return ;
+        }
+        connection.outOffset += bytesSent;
+    }
+    if (connection.outOffset == connection.out.size())
+    {
+        connection.out.clear();
+        connection.outOffset = 0;
+    }
+    else if (connection.outOffset > connection.out.size() / 2)
+    {
+        connection.out.erase(0, connection.outOffset);
+        connection.outOffset = 0;
+    }
+}
+
+//always readable, so a backend closing an idle connection is noticed; writable while something is pending
+void FastCGIClient::watch(Connection &connection)
+{
+    uint32_t events = EPOLLIN;
+
+    if (connection.connecting || connection.outOffset < connection.out.size())
+        events |= EPOLLOUT;
+    if (events == connection.events)
+        return ;
+    _control(connection.fd, connection.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, events);
+    connection.events = events;
+}
+
+std::string FastCGIClient::record(uint8_t type, uint16_t requestId, const char *content, size_t length)
+{
+    std::string record(FCGI_HEADER_LEN, '\0');
+
+    record[0] = FCGI_VERSION_1;
+    record[1] = type;
+    record[2] = static_cast<char>(requestId >> 8);
+    record[3] = static_cast<char>(requestId & 0xff);
+    record[4] = static_cast<char>(length >> 8);
+    record[5] = static_cast<char>(length & 0xff);
+    if (length > 0)
+        record.append(content, length);
+    return record;
+}
+
+void FastCGIClient::appendPair(std::string &pairs, const std::string &name, const std::string &value)
+{
+    for (size_t length : {name.size(), value.size()})
+    {
+        if (length < 128)
+            pairs += static_cast<char>(length);
+        else
+        {
+            pairs += static_cast<char>((length >> 24) | 0x80);
+            pairs += static_cast<char>((length >> 16) & 0xff);
+            pairs += static_cast<char>((length >> 8) & 0xff);
+            pairs += static_cast<char>(length & 0xff);
+        }
+    }
+    pairs += name;
+    pairs += value;
+}
+
+//the CGI/1.1 meta-variables; SCRIPT_NAME is the location, PATH_INFO what follows it
+std::string FastCGIClient::encodeParams(const Request &request, const std::string &remoteAddress, size_t bodyLength)
+{
+    const RequestData   &data = request.getRequestData();
+    const Server        *server = request.getServer();
+    std::string         scriptName = request.getLocation()->uri;
+    std::string         pairs;
+
+    if (scriptName.size() > 1 && scriptName.back() == '/')
+        scriptName.pop_back();
+
+    const std::string   pathInfo = data.uri.compare(0, scriptName.size(), scriptName) == 0 && scriptName != "/"
+                                   ? data.uri.substr(scriptName.size()) : data.uri;
+
+    appendPair(pairs, "GATEWAY_INTERFACE", "CGI/1.1");
+    appendPair(pairs, "SERVER_SOFTWARE", "webserv");
+    appendPair(pairs, "SERVER_PROTOCOL", data.httpVersion);
+    appendPair(pairs, "SERVER_NAME", server->server_name.empty() ? server->host : server->server_name[0]);
+    appendPair(pairs, "SERVER_PORT", std::to_string(server->port));
+    appendPair(pairs, "REMOTE_ADDR", remoteAddress);
+    appendPair(pairs, "REQUEST_METHOD", data.method);
+    appendPair(pairs, "REQUEST_URI", data.query_string.empty() ? data.uri : data.uri + "?" + data.query_string);
+    appendPair(pairs, "SCRIPT_NAME", scriptName == "/" ? "" : scriptName);
+    appendPair(pairs, "PATH_INFO", pathInfo);
+    appendPair(pairs, "QUERY_STRING", data.query_string);
+    appendPair(pairs, "CONTENT_TYPE", data.content_type);
+    appendPair(pairs, "CONTENT_LENGTH", bodyLength > 0 ? std::to_string(bodyLength) : "");
+    appendPair(pairs, "REDIRECT_STATUS", "200");
+    appendPair(pairs, "UPLOAD_FOLDER", request.getLocation()->upload_folder);
+    for (const auto &header : data.headers)
+    {
+        std::string name = "HTTP_" + header.first;
+
+        if (strcasecmp(header.first.c_str(), "Content-Type") == 0 || strcasecmp(header.first.c_str(), "Content-Length") == 0)
+            continue ;
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return c == '-' ? '_' : ::toupper(c); });
+        appendPair(pairs, name, header.second);
+    }
+    return pairs;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "CGIOutput.hpp"
+#include "Request.hpp"
+#include "UpstreamResolver.hpp"
+
+#define FASTCGI_CONNECT_TIMEOUT 5
+#define FASTCGI_READ_TIMEOUT 30
+#define FASTCGI_MAX_STREAMS 64      // requests multiplexed on one connection, unless FCGI_MAX_REQS says less
+#define FASTCGI_RECORD_MAX 65535    // content bytes per record
+
+/*
+FastCGI (responder role) to the fastcgi_pass backends, which run on their own and keep their
+interpreter warm between requests. Connections are opened on demand, up to fastcgi_connections per
+backend, and stay open (FCGI_KEEP_CONN) and registered in the event loop (FdType::FASTCGI_SOCKET)
+once idle. Each one starts with FCGI_GET_VALUES and carries a single request until the backend
+answers FCGI_MPXS_CONNS=1, then up to FCGI_MAX_REQS at once. A request that finds every connection
+busy waits in the backend's queue.
+The backend's output is turned into the response by CGIOutput and streamed as it arrives; the
+callbacks hand it to the client's output, or report an error status to answer with.
+*/
+class FastCGIClient
+{
+public:
+    using ControlCallback = std::function<void(int fd, int operation, uint32_t events)>;
+    using OutputCallback = std::function<void(int clientSocket, const std::string &data, bool complete)>;
+    using ErrorCallback = std::function<void(int clientSocket, int errorCode)>;
+
+    FastCGIClient(size_t maxConnections, ControlCallback control, OutputCallback output, ErrorCallback error);
+    ~FastCGIClient();
+    FastCGIClient(const FastCGIClient &) = delete;
+    FastCGIClient &operator=(const FastCGIClient &) = delete;
+
+    void    start(const Request &request, int clientSocket, const std::string &remoteAddress);
+    void    handleEvent(int fd, uint32_t events);
+    bool    contains(int fd) const;
+    void    abort(int clientSocket);
+    void    checkTimeouts(void);
+
+private:
+    // a request as it will be sent, kept until the backend starts answering so it can be moved elsewhere
+    struct Job
+    {
+        int                                 clientSocket;
+        std::string                         key;
+        AddressList                         addresses;
+        std::string                         params;         // encoded name-value pairs
+        std::shared_ptr<const std::string>  body;           // the client's raw request, from bodyOffset on
+        size_t                              bodyOffset;
+        bool                                headOnly;       // HEAD: the backend's body is dropped
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    struct Stream
+    {
+        Job             job;
+        CGIOutput       output;
+        bool            answered = false;   // the backend sent something, the request can't be moved anymore
+        bool            aborted = false;    // client gone, waiting for FCGI_END_REQUEST to free the id
+    };
+
+    struct Connection
+    {
+        int             fd;
+        std::string     key;
+        bool            connecting = true;
+        bool            multiplexed = false;
+        size_t          maxStreams = 1;
+        bool            reused = false;     // finished a request before, the backend may have let it go
+        uint32_t        events = 0;
+        std::string     out;
+        size_t          outOffset = 0;
+        std::string     in;
+        std::unordered_map<uint16_t, Stream> streams;
+        std::chrono::steady_clock::time_point lastActivity;
+    };
+
+    size_t                                          _maxConnections;
+    ControlCallback                                 _control;
+    OutputCallback                                  _output;
+    ErrorCallback                                   _error;
+    std::unordered_map<int, Connection>             _connections;
+    std::unordered_map<std::string, std::deque<Job>> _queued;       // per backend key
+    std::unordered_map<int, std::pair<int, uint16_t>> _clientStreams; // client -> connection fd (-1: queued), request id
+
+    void    dispatch(const std::string &key);
+    void    assign(Connection &connection, Job job);
+    int     connect(const Job &job);
+    bool    readRecords(Connection &connection);
+    void    handleRecord(Connection &connection, uint8_t type, uint16_t requestId, const std::string &content);
+    void    handleStdout(Connection &connection, uint16_t requestId, const std::string &content);
+    void    endStream(Connection &connection, uint16_t requestId, uint8_t protocolStatus);
+    void    fail(int clientSocket, int errorCode);
+    void    closeConnection(int fd, int errorCode, bool retryUnanswered);
+    void    flush(Connection &connection);
+    void    watch(Connection &connection);
+
+    static std::string  record(uint8_t type, uint16_t requestId, const char *content, size_t length);
+    static void         appendPair(std::string &pairs, const std::string &name, const std::string &value);
+    static std::string  encodeParams(const Request &request, const std::string &remoteAddress, size_t bodyLength);
+};
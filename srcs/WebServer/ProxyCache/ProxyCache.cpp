@@ -0,0 +1,442 @@
+#include "ProxyCache.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <strings.h>
+
+#define PROXY_CACHE_FILE_MAGIC "webserv-proxy-cache 1"
+#define PROXY_CACHE_PASS_TTL 10
+#define PROXY_CACHE_PASS_SWEEP 1024
+
+ProxyCache::ProxyCache(size_t maxMemory, const std::string &diskPath, int defaultValidity)
+    : _maxMemory(maxMemory), _memoryUsed(0), _diskPath(diskPath), _defaultValidity(defaultValidity)
+{
+}
+
+static std::string trim(const std::string &value)
+{
+    const size_t start = value.find_first_not_of(" \t\r\n");
+    const size_t end = value.find_last_not_of(" \t\r\n");
+
+    return (start == std::string::npos) ? "" : value.substr(start, end - start + 1);
+}
+
+static std::string toLower(std::string value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+//request headers are stored as the client sent them, so names are matched case-insensitively
+std::string ProxyCache::findHeader(const Headers &headers, const std::string &name)
+{
+    for (const auto &header : headers)
+    {
+        if (strcasecmp(header.first.c_str(), name.c_str()) == 0)
+            return trim(header.second);
+    }
+    return "";
+}
+
+std::string ProxyCache::makeKey(const std::string &method, const Headers &requestHeaders, const std::string &uri)
+{
+    return method + " " + toLower(findHeader(requestHeaders, "Host")) + uri;
+}
+
+//GET and HEAD only, never with credentials or when the client asked not to store anything
+bool ProxyCache::isCacheableRequest(const std::string &method, const Headers &requestHeaders)
+{
+    if (method != "GET" && method != "HEAD")
+        return false;
+    if (!findHeader(requestHeaders, "Authorization").empty())
+        return false;
+    return parseCacheControl(findHeader(requestHeaders, "Cache-Control")).count("no-store") == 0;
+}
+
+bool ProxyCache::requiresRevalidation(const Headers &requestHeaders)
+{
+    const auto  directives = parseCacheControl(findHeader(requestHeaders, "Cache-Control"));
+    const auto  maxAge = directives.find("max-age");
+
+    return directives.count("no-cache") != 0 || (maxAge != directives.end() && std::atol(maxAge->second.c_str()) == 0)
+        || toLower(findHeader(requestHeaders, "Pragma")).find("no-cache") != std::string::npos;
+}
+
+ProxyCache::EntryPtr ProxyCache::lookup(const std::string &key, const Headers &requestHeaders)
+{
+    auto variants = _index.find(key);
+
+    if (variants != _index.end())
+    {
+        for (EntryList::iterator it : variants->second)
+        {
+            if (matchesVary(**it, requestHeaders))
+            {
+                _lru.splice(_lru.begin(), _lru, it);
+                return *it;
+            }
+        }
+    }
+    if (_diskPath.empty())
+        return nullptr;
+
+    EntryPtr entry = readFromDisk(key);
+
+    if (!entry || !matchesVary(*entry, requestHeaders))
+        return nullptr;
+    insert(entry);
+    return entry;
+}
+
+//called with the header block of an upstream response, before its body is kept
+bool ProxyCache::isStorable(const ResponseFraming &framing) const
+{
+    static const int    cacheableStatus[] = { 200, 203, 204, 300, 301, 308, 404, 405, 410, 414, 501 };
+    const auto          directives = parseCacheControl(framing.getHeaderValue("Cache-Control"));
+    Entry               entry;
+
+    if (std::find(std::begin(cacheableStatus), std::end(cacheableStatus), framing.getStatusCode()) == std::end(cacheableStatus))
+        return false;
+    if (directives.count("no-store") || directives.count("private") || !framing.getHeaderValue("Set-Cookie").empty()
+        || trim(framing.getHeaderValue("Vary")) == "*")
+        return false;
+    if (framing.getFraming() == ResponseFraming::FRAMING_LENGTH && framing.getPlainBodyRemaining() > getMaxEntrySize())
+        return false;
+    return setFreshness(entry, framing, time(nullptr)) || hasValidators(entry);
+}
+
+void ProxyCache::store(const std::string &key, const Headers &requestHeaders, const std::string &response,
+                       const ResponseFraming &framing)
+{
+    EntryPtr            entry = std::make_shared<Entry>();
+    const size_t        headersEnd = response.find("\r\n\r\n");
+    std::stringstream   vary(framing.getHeaderValue("Vary"));
+    std::string         name;
+
+    if (headersEnd == std::string::npos || response.length() > getMaxEntrySize())
+        return ;
+    if (!setFreshness(*entry, framing, time(nullptr)) && !hasValidators(*entry))
+        return ;
+    entry->key = key;
+    entry->response = response;
+    //Age is recomputed from storedAt whenever the entry is served
+    for (size_t pos = entry->response.find("\r\n"); pos < entry->response.find("\r\n\r\n"); )
+    {
+        const size_t next = entry->response.find("\r\n", pos + 2);
+
+        if (strncasecmp(entry->response.c_str() + pos + 2, "Age:", 4) == 0)
+            entry->response.erase(pos, next - pos);
+        else
+            pos = next;
+    }
+    while (std::getline(vary, name, ','))
+    {
+        name = toLower(trim(name));
+        if (!name.empty())
+            entry->vary.emplace_back(name, findHeader(requestHeaders, name));
+    }
+    insert(entry);
+    writeToDisk(*entry);
+}
+
+//a 304 to a conditional request: the stored response is good for another lifetime
+void ProxyCache::refresh(const EntryPtr &entry, const ResponseFraming &notModified)
+{
+    const time_t    now = time(nullptr);
+    const time_t    lifetime = entry->freshUntil - entry->storedAt;
+    const time_t    staleWindow = entry->staleUntil - entry->freshUntil;
+
+    if (!setFreshness(*entry, notModified, now))
+    {
+        entry->storedAt = now;
+        entry->freshUntil = now + lifetime;
+        entry->staleUntil = entry->freshUntil + staleWindow;
+    }
+    insert(entry);
+    writeToDisk(*entry);
+}
+
+//after a POST, PUT or DELETE through the location, what was stored for the URI is outdated
+void ProxyCache::invalidate(const std::string &key)
+{
+    auto variants = _index.find(key);
+
+    while (variants != _index.end())
+    {
+        erase(variants->second.back());
+        variants = _index.find(key);
+    }
+    if (!_diskPath.empty())
+        std::remove(diskFile(key).c_str());
+}
+
+//a quarter of the memory tier, so one response can't flush everything else out
+size_t ProxyCache::getMaxEntrySize() const { return _maxMemory / 4; }
+
+//true when the client was queued behind the request in flight for key, otherwise that request is the caller's
+bool ProxyCache::collapse(const std::string &key, int clientSocket)
+{
+    auto    pass = _passUntil.find(key);
+
+    if (pass != _passUntil.end())
+    {
+        if (time(nullptr) < pass->second)
+            return false;
+        _passUntil.erase(pass);
+    }
+
+    auto    inFlight = _inFlight.find(key);
+
+    if (inFlight == _inFlight.end())
+    {
+        _inFlight.emplace(key, std::vector<int>());
+        return false;
+    }
+    inFlight->second.push_back(clientSocket);
+    return true;
+}
+
+//the request for key is done, whatever its outcome; returns the clients that waited for it
+std::vector<int> ProxyCache::release(const std::string &key)
+{
+    auto                inFlight = _inFlight.find(key);
+    std::vector<int>    waiters;
+    const time_t        now = time(nullptr);
+
+    if (inFlight == _inFlight.end())
+        return waiters;
+    waiters = std::move(inFlight->second);
+    _inFlight.erase(inFlight);
+    if (hasFreshEntry(key, now))
+        return waiters;
+    if (_passUntil.size() >= PROXY_CACHE_PASS_SWEEP)
+    {
+        for (auto it = _passUntil.begin(); it != _passUntil.end(); )
+            it = it->second <= now ? _passUntil.erase(it) : std::next(it);
+    }
+    _passUntil[key] = now + PROXY_CACHE_PASS_TTL;
+    return waiters;
+}
+
+bool ProxyCache::isFresh(const Entry &entry, time_t now) { return now < entry.freshUntil; }
+
+bool ProxyCache::isServableStale(const Entry &entry, time_t now) { return now < entry.staleUntil; }
+
+bool ProxyCache::hasValidators(const Entry &entry) { return !entry.etag.empty() || !entry.lastModified.empty(); }
+
+std::string ProxyCache::render(const Entry &entry, time_t now)
+{
+    std::string     response = entry.response;
+    const size_t    statusEnd = response.find("\r\n");
+
+    response.insert(statusEnd, "\r\nAge: " + std::to_string(std::max<time_t>(0, now - entry.storedAt)));
+    return response;
+}
+
+//replaces a variant stored for the same Vary values, then evicts from the cold end
+void ProxyCache::insert(const EntryPtr &entry)
+{
+    auto variants = _index.find(entry->key);
+
+    if (variants != _index.end())
+    {
+        for (EntryList::iterator it : variants->second)
+        {
+            if ((*it)->vary == entry->vary)
+            {
+                erase(it);
+                break ;
+            }
+        }
+    }
+    _lru.push_front(entry);
+    _index[entry->key].push_back(_lru.begin());
+    _memoryUsed += entrySize(*entry);
+    while (_memoryUsed > _maxMemory && !_lru.empty())
+        erase(std::prev(_lru.end()));
+}
+
+//any variant, the waiters of a collapsed request may differ in their Vary headers
+bool ProxyCache::hasFreshEntry(const std::string &key, time_t now) const
+{
+    auto    variants = _index.find(key);
+
+    if (variants == _index.end())
+        return false;
+    for (const EntryList::iterator &it : variants->second)
+    {
+        if (isFresh(**it, now))
+            return true;
+    }
+    return false;
+}
+
+void ProxyCache::erase(EntryList::iterator it)
+{
+    auto                                variants = _index.find((*it)->key);
+    std::vector<EntryList::iterator>    &list = variants->second;
+
+    list.erase(std::find(list.begin(), list.end(), it));
+    if (list.empty())
+        _index.erase(variants);
+    _memoryUsed -= entrySize(**it);
+    _lru.erase(it);
+}
+
+/*
+Sets the entry's lifetime and validators from the response headers.
+False when nothing says how long it may be used (no Cache-Control age, no Expires, no proxy_cache_valid).
+no-cache is an explicit lifetime of 0; must-revalidate, proxy-revalidate and no-cache rule out serving it stale.
+*/
+bool ProxyCache::setFreshness(Entry &entry, const ResponseFraming &framing, time_t now) const
+{
+    const auto          directives = parseCacheControl(framing.getHeaderValue("Cache-Control"));
+    const std::string   expires = framing.getHeaderValue("Expires");
+    const std::string   etag = framing.getHeaderValue("ETag");
+    const std::string   lastModified = framing.getHeaderValue("Last-Modified");
+    time_t              lifetime = -1;
+
+    if (directives.count("s-maxage"))
+        lifetime = std::atol(directives.at("s-maxage").c_str());
+    else if (directives.count("max-age"))
+        lifetime = std::atol(directives.at("max-age").c_str());
+    else if (!expires.empty())
+    {
+        const time_t expiresAt = parseHttpDate(expires);
+        const time_t date = parseHttpDate(framing.getHeaderValue("Date"));
+
+        lifetime = (expiresAt == -1) ? 0 : std::max<time_t>(0, expiresAt - (date == -1 ? now : date));
+    }
+    else if (_defaultValidity > 0)
+        lifetime = _defaultValidity;
+    if (directives.count("no-cache"))
+        lifetime = 0;
+
+    const bool noStale = directives.count("no-cache") || directives.count("must-revalidate") || directives.count("proxy-revalidate");
+    const auto staleWindow = directives.find("stale-while-revalidate");
+
+    entry.storedAt = now - std::max(0L, std::atol(framing.getHeaderValue("Age").c_str()));
+    entry.freshUntil = entry.storedAt + std::max<time_t>(0, lifetime);
+    entry.staleUntil = entry.freshUntil;
+    if (staleWindow != directives.end() && !noStale)
+        entry.staleUntil += std::max(0L, std::atol(staleWindow->second.c_str()));
+    if (!etag.empty())
+        entry.etag = etag;
+    if (!lastModified.empty())
+        entry.lastModified = lastModified;
+    return lifetime >= 0;
+}
+
+bool ProxyCache::matchesVary(const Entry &entry, const Headers &requestHeaders)
+{
+    for (const auto &header : entry.vary)
+    {
+        if (findHeader(requestHeaders, header.first) != header.second)
+            return false;
+    }
+    return true;
+}
+
+//directive names lowercased, quotes around values dropped
+std::unordered_map<std::string, std::string> ProxyCache::parseCacheControl(const std::string &value)
+{
+    std::unordered_map<std::string, std::string>    directives;
+    std::stringstream                               stream(value);
+    std::string                                     directive;
+
+    while (std::getline(stream, directive, ','))
+    {
+        const size_t    equals = directive.find('=');
+        std::string     argument = (equals == std::string::npos) ? "" : trim(directive.substr(equals + 1));
+
+        if (argument.length() >= 2 && argument.front() == '"' && argument.back() == '"')
+            argument = argument.substr(1, argument.length() - 2);
+        directive = toLower(trim(directive.substr(0, equals)));
+        if (!directive.empty())
+            directives.emplace(directive, argument);
+    }
+    return directives;
+}
+
+//IMF-fixdate (Sun, 06 Nov 1994 08:49:37 GMT); -1 when invalid, which Expires treats as already expired
+time_t ProxyCache::parseHttpDate(const std::string &date)
+{
+    struct tm   time = {};
+    const char  *end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &time);
+
+    if (!end || *end != '\0')
+        return -1;
+    return timegm(&time);
+}
+
+size_t ProxyCache::entrySize(const Entry &entry) { return entry.key.length() + entry.response.length(); }
+
+//one file per key, named by its FNV-1a hash
+std::string ProxyCache::diskFile(const std::string &key) const
+{
+    uint64_t    hash = 14695981039346656037ULL;
+    char        name[17];
+
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return _diskPath + "/" + name;
+}
+
+/*
+A text header (magic, key, times, validators, Vary values), then the response as is.
+Written to a temporary file and renamed over the old one, so a reader never sees half an entry.
+*/
+void ProxyCache::writeToDisk(const Entry &entry) const
+{
+    if (_diskPath.empty())
+        return ;
+
+    const std::string   path = diskFile(entry.key);
+    const std::string   temporary = path + ".tmp";
+    std::ofstream       file(temporary, std::ios::binary | std::ios::trunc);
+
+    file << PROXY_CACHE_FILE_MAGIC << "\n" << entry.key << "\n"
+         << entry.storedAt << " " << entry.freshUntil << " " << entry.staleUntil << "\n"
+         << entry.etag << "\n" << entry.lastModified << "\n" << entry.vary.size() << "\n";
+    for (const auto &header : entry.vary)
+        file << header.first << "\t" << header.second << "\n";
+    file << entry.response;
+    file.close();
+    if (!file || std::rename(temporary.c_str(), path.c_str()) != 0)
+        std::remove(temporary.c_str());
+}
+
+ProxyCache::EntryPtr ProxyCache::readFromDisk(const std::string &key) const
+{
+    std::ifstream   file(diskFile(key), std::ios::binary);
+    EntryPtr        entry = std::make_shared<Entry>();
+    std::string     line;
+    size_t          varyCount = 0;
+
+    if (!std::getline(file, line) || line != PROXY_CACHE_FILE_MAGIC || !std::getline(file, entry->key) || entry->key != key)
+        return nullptr;
+    if (!(file >> entry->storedAt >> entry->freshUntil >> entry->staleUntil) || !std::getline(file, line))
+        return nullptr;
+    if (!std::getline(file, entry->etag) || !std::getline(file, entry->lastModified) || !(file >> varyCount)
+        || !std::getline(file, line))
+        return nullptr;
+    for (size_t i = 0; i < varyCount; i++)
+    {
+        if (!std::getline(file, line) || line.find('\t') == std::string::npos)
+            return nullptr;
+        entry->vary.emplace_back(line.substr(0, line.find('\t')), line.substr(line.find('\t') + 1));
+    }
+    entry->response.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (entry->response.find("\r\n\r\n") == std::string::npos || entry->response.length() > getMaxEntrySize())
+        return nullptr;
+    return entry;
+}
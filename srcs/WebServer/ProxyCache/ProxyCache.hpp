@@ -0,0 +1,92 @@
+#pragma once
+
+#include <ctime>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ResponseFraming.hpp"
+
+/*
+Proxied responses of one proxy_cache location, keyed by method, Host and URI, one entry per Vary variant.
+The memory tier is an LRU bounded by the proxy_cache size. With proxy_cache_path every stored response
+is also written to a file there (the newest variant of each key), which a memory miss falls back to,
+so entries survive eviction and restarts.
+Freshness follows RFC 9111: s-maxage, max-age, Expires, then proxy_cache_valid. A stale entry with an
+ETag or Last-Modified is revalidated with a conditional request, and within stale-while-revalidate it
+is served as is while that request runs in the background.
+Entries are shared_ptrs, so a revalidation can hold on to one that gets evicted meanwhile.
+Concurrent misses on a key are collapsed: the first one goes upstream, the others wait for its
+response. When it didn't leave a fresh entry behind, the key passes (misses go upstream on their
+own) for PROXY_CACHE_PASS_TTL seconds, so the waiters and the next burst don't queue up again.
+*/
+class ProxyCache
+{
+public:
+    using Headers = std::unordered_map<std::string, std::string>;
+
+    struct Entry
+    {
+        std::string                                         key;
+        std::vector<std::pair<std::string, std::string>>    vary;       //lowercase request header, value it was stored for
+        std::string                                         response;   //as received, without its Age header
+        time_t                                              storedAt;   //when the upstream generated it
+        time_t                                              freshUntil;
+        time_t                                              staleUntil; //end of stale-while-revalidate
+        std::string                                         etag;
+        std::string                                         lastModified;
+        bool                                                revalidating = false;
+    };
+    using EntryPtr = std::shared_ptr<Entry>;
+
+    ProxyCache(size_t maxMemory, const std::string &diskPath, int defaultValidity);
+    ~ProxyCache() = default;
+    ProxyCache(const ProxyCache &) = delete;
+    ProxyCache &operator=(const ProxyCache &) = delete;
+
+    static std::string  makeKey(const std::string &method, const Headers &requestHeaders, const std::string &uri);
+    static bool         isCacheableRequest(const std::string &method, const Headers &requestHeaders);
+    static bool         requiresRevalidation(const Headers &requestHeaders);
+    static std::string  findHeader(const Headers &headers, const std::string &name);
+
+    EntryPtr            lookup(const std::string &key, const Headers &requestHeaders);
+    bool                isStorable(const ResponseFraming &framing) const;
+    void                store(const std::string &key, const Headers &requestHeaders, const std::string &response,
+                              const ResponseFraming &framing);
+    void                refresh(const EntryPtr &entry, const ResponseFraming &notModified);
+    void                invalidate(const std::string &key);
+    size_t              getMaxEntrySize() const;
+    bool                collapse(const std::string &key, int clientSocket);
+    std::vector<int>    release(const std::string &key);
+
+    static bool         isFresh(const Entry &entry, time_t now);
+    static bool         isServableStale(const Entry &entry, time_t now);
+    static bool         hasValidators(const Entry &entry);
+    static std::string  render(const Entry &entry, time_t now);
+
+private:
+    using EntryList = std::list<EntryPtr>;
+
+    size_t                                                          _maxMemory;
+    size_t                                                          _memoryUsed;
+    std::string                                                     _diskPath;
+    int                                                             _defaultValidity;
+    EntryList                                                       _lru;   //most recently used first
+    std::unordered_map<std::string, std::vector<EntryList::iterator>> _index;
+    std::unordered_map<std::string, std::vector<int>>               _inFlight;  //key -> clients waiting for its response
+    std::unordered_map<std::string, time_t>                         _passUntil;
+
+    void                insert(const EntryPtr &entry);
+    void                erase(EntryList::iterator it);
+    bool                hasFreshEntry(const std::string &key, time_t now) const;
+    bool                setFreshness(Entry &entry, const ResponseFraming &framing, time_t now) const;
+    std::string         diskFile(const std::string &key) const;
+    void                writeToDisk(const Entry &entry) const;
+    EntryPtr            readFromDisk(const std::string &key) const;
+    static bool         matchesVary(const Entry &entry, const Headers &requestHeaders);
+    static std::unordered_map<std::string, std::string> parseCacheControl(const std::string &value);
+    static time_t       parseHttpDate(const std::string &date);
+    static size_t       entrySize(const Entry &entry);
+};
@@ -5,17 +5,17 @@
 #include <iomanip>
 
 Request::Request()
-    : _rawRequest(""), _server(nullptr), _location(nullptr), _proxyInfo(nullptr)
+    : _rawRequest(std::make_shared<const std::string>()), _server(nullptr), _location(nullptr)
 {
 }
 
-Request::Request(const std::string& rawRequest, const std::vector<Server>& servers, const std::unordered_map<std::string, addrinfo*>& proxyInfoMap)
-    : _rawRequest(rawRequest), _server(nullptr), _location(nullptr), _proxyInfo(nullptr)
+Request::Request(const std::string& rawRequest, const VirtualHostMap& virtualHosts, const std::unordered_map<std::string, AddressList>& proxyInfoMap)
+    : _rawRequest(std::make_shared<const std::string>(rawRequest)), _server(nullptr), _location(nullptr)
 {
     try
     {
         parseRequest();
-        RequestValidator(*this, servers, proxyInfoMap).validate();
+        RequestValidator(*this, virtualHosts, proxyInfoMap).validate();
         if (!_server || !_location)
             throw std::runtime_error( "Error validating request" );
     }
@@ -29,7 +29,7 @@ void Request::parseRequest(void)
 {
     try
     {
-        std::istringstream stream(_rawRequest);
+        std::istringstream stream(*_rawRequest);
         std::string requestLine;
         std::getline(stream, requestLine);
 
@@ -172,7 +172,9 @@ void Request::setContentTypeAndLength()
     }
 }
 
-const std::string&  Request::getRawRequest() const { return _rawRequest; }
+const std::string&  Request::getRawRequest() const { return *_rawRequest; }
+
+std::shared_ptr<const std::string> Request::getRawRequestBuffer() const { return _rawRequest; }
 
 const RequestData&  Request::getRequestData() const { return _requestData; }
 
@@ -180,6 +182,6 @@ const Server*       Request::getServer() const { return _server; }
 
 const Location*     Request::getLocation() const { return _location; }
 
-addrinfo*           Request::getProxyInfo() const { return _proxyInfo; }
+AddressList         Request::getProxyInfo() const { return _proxyInfo; }
 
 int                 Request::getErrorCode() const { return _errorCode; }
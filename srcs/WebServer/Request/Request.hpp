@@ -3,8 +3,11 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <memory>
 #include <netdb.h> 
 #include "WebParser.hpp"
+#include "VirtualHostMap.hpp"
+#include "UpstreamResolver.hpp"
 
 struct RequestData
 {
@@ -49,21 +52,22 @@ class Request
 {
 public:
     Request();
-    Request(const std::string& rawRequest, const std::vector<Server>& servers,\
-        const std::unordered_map<std::string, addrinfo*>& proxyInfoMap);
+    Request(const std::string& rawRequest, const VirtualHostMap& virtualHosts,\
+        const std::unordered_map<std::string, AddressList>& proxyInfoMap);
 
     const std::string&  getRawRequest() const;
+    std::shared_ptr<const std::string> getRawRequestBuffer() const;
     const Server*       getServer() const;
     const Location*     getLocation() const;
-    addrinfo*           getProxyInfo() const;
+    AddressList         getProxyInfo() const;
     const RequestData&  getRequestData() const;
     int                 getErrorCode() const;
 private:
     RequestData     _requestData = {};
-    std::string     _rawRequest;
+    std::shared_ptr<const std::string> _rawRequest;  //shared by copies, and by a proxied request sending its body
     const Server*   _server = nullptr;
     const Location* _location = nullptr;
-    addrinfo*       _proxyInfo;
+    AddressList     _proxyInfo;
     size_t          _totalHeaderSize;
 
     int             _errorCode = 0;
@@ -81,15 +85,15 @@ public:
     class RequestValidator
     {
     public:
-        RequestValidator(Request& request, const std::vector<Server>& servers,\
-            const std::unordered_map<std::string, addrinfo*>& proxyInfoMap);
+        RequestValidator(Request& request, const VirtualHostMap& virtualHosts,\
+            const std::unordered_map<std::string, AddressList>& proxyInfoMap);
         ~RequestValidator() = default;
         bool validate() const;
 
     private:
         Request&                                            _request;
-        const std::vector<Server>&                          _servers;
-        const std::unordered_map<std::string, addrinfo*>&   _proxyInfoMap;
+        const VirtualHostMap&                               _virtualHosts;
+        const std::unordered_map<std::string, AddressList>&   _proxyInfoMap;
 
         bool checkForIndexing(std::string& fullPath) const;
         bool isPathValid()      const;
@@ -98,7 +102,7 @@ public:
         bool isAllowedMethod()    const;
         bool isProtocolValid()  const;
         bool areHeadersValid()  const;
-        bool isServerMatch(const Server& server) const;
+        const Server* findServer() const;
         bool matchLocationSetData(const Server& server) const;
         bool isServerFull() const;
         bool isUploadDirAccessible() const;
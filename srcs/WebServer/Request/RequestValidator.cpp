@@ -5,8 +5,8 @@
 #include <sys/stat.h> 
 #include <filesystem>
 
-Request::RequestValidator::RequestValidator(Request& request, const std::vector<Server>& servers, const std::unordered_map<std::string, addrinfo*>& proxyInfoMap)
-    : _request(request), _servers(servers), _proxyInfoMap(proxyInfoMap) {}
+Request::RequestValidator::RequestValidator(Request& request, const VirtualHostMap& virtualHosts, const std::unordered_map<std::string, AddressList>& proxyInfoMap)
+    : _request(request), _virtualHosts(virtualHosts), _proxyInfoMap(proxyInfoMap) {}
 
 bool Request::RequestValidator::isReadOk() const
 {
@@ -39,9 +39,9 @@ bool   Request::RequestValidator::isServerFull() const
 
 bool   Request::RequestValidator::isExistingMethod() const
 {
-    std::string validMethods[] = {"GET", "POST", "DELETE", "HEAD"};
+    std::string validMethods[] = {"GET", "POST", "PUT", "DELETE", "HEAD"};
 
-    for (size_t i = 0; i < 4; i++)
+    for (size_t i = 0; i < 5; i++)
     {
         if (_request._requestData.method.compare(validMethods[i]) == 0)
             return true;
@@ -53,79 +53,81 @@ bool Request::RequestValidator::validate() const
 {
     try
     {
-        for (const auto& srv : _servers)
+        const Server* srv = findServer();
+
+        if (srv && matchLocationSetData(*srv))
         {
-            if (isServerMatch(srv))
+            _request._server = srv;
+            if (_request._requestData.uri.length() > 2048)
+            {
+                _request._errorCode = URI_TOO_LONG;
+                return true;
+            }
+            if (_request._totalHeaderSize > 5000)
+            {
+                _request._errorCode = REQUEST_HEADER_FIELDS_TOO_LARGE;
+                return true;
+            }
+            if (_request._location->type != PROXY && _request._location->type != HTTP_REDIR)
             {
-                if (matchLocationSetData(srv))
+                const std::string   &method = _request._requestData.method;
+                const bool          upload = _request._location->uploadOn && (method == "POST" || method == "PUT");
+                const bool          onDisk = _request._location->type != FASTCGI && !upload; // the backend finds its own scripts, uploads are new files
+
+                if (!onDisk)
+                    _request._requestData.originalUri = _request._requestData.uri;
+                if (!isExistingMethod())
                 {
-                    _request._server = &srv;
-                    if (_request._requestData.uri.length() > 2048)
-                    {
-                        _request._errorCode = URI_TOO_LONG;
-                        return true;
-                    }
-                    if (_request._totalHeaderSize > 5000)
+                    _request._errorCode = NOT_IMPLEMENTED;
+                    return true;
+                }
+                if (!isAllowedMethod())
+                {
+                    _request._errorCode = INVALID_METHOD;
+                    return true;
+                }
+                if (_request.getServer()->client_max_body_size < static_cast<long>(_request._requestData.body.size()))
+                {
+                    _request._errorCode = REQUEST_BODY_TOO_LARGE;
+                    return true;
+                }
+                if (onDisk && !isPathValid())
+                {
+                    _request._errorCode = NOT_FOUND;
+                    return true;
+                }
+                if (!isProtocolValid())
+                {
+                    _request._errorCode = HTTP_VERSION_NOT_SUPPORTED;
+                    return true;
+                }
+                if (onDisk && !isReadOk())
+                {
+                    _request._errorCode = FORBIDDEN;
+                    return true;
+                }
+                if (!areHeadersValid())
+                {
+                    _request._errorCode = BAD_REQUEST;
+                    return true;
+                }
+                if (onDisk && !isServerFull())
+                {
+                    _request._errorCode = INSUFFICIENT_STORAGE;
+                    return true;
+                }
+                if (_request._location->type == CGI)
+                {
+                    if (!isUploadDirAccessible())
                     {
-                        _request._errorCode = REQUEST_HEADER_FIELDS_TOO_LARGE;
+                        std::cerr << COLOR_RED_ERROR << \
+                            "  Error: no needed permissions for the cgi script to work on the upload folder\n\n" << COLOR_RESET;
+                        _request._errorCode = FORBIDDEN;
                         return true;
                     }
-                    if (_request._location->type != PROXY && _request._location->type != HTTP_REDIR)
-                    {
-                        if (!isExistingMethod())
-                        {
-                            _request._errorCode = NOT_IMPLEMENTED;
-                            return true;
-                        }
-                        if (!isAllowedMethod())
-                        {
-                            _request._errorCode = INVALID_METHOD;
-                            return true;
-                        }
-                        if (_request.getServer()->client_max_body_size < static_cast<long>(_request._requestData.body.size()))
-                        {
-                            _request._errorCode = REQUEST_BODY_TOO_LARGE;
-                            return true;
-                        }
-                        if (!isPathValid())
-                        {
-                            _request._errorCode = NOT_FOUND;
-                            return true;
-                        }
-                        if (!isProtocolValid())
-                        {
-                            _request._errorCode = HTTP_VERSION_NOT_SUPPORTED;
-                            return true;
-                        }
-                        if (!isReadOk())
-                        {
-                            _request._errorCode = FORBIDDEN;
-                            return true;
-                        }
-                        if (!areHeadersValid())
-                        {
-                            _request._errorCode = BAD_REQUEST;
-                            return true;
-                        }
-                        if (!isServerFull())
-                        {
-                            _request._errorCode = INSUFFICIENT_STORAGE;
-                            return true;
-                        }
-                        if (_request._location->type == CGI)
-                        {
-                            if (!isUploadDirAccessible())
-                            {
-                                std::cerr << COLOR_RED_ERROR << \
-                                    "  Error: no needed permissions for the cgi script to work on the upload folder\n\n" << COLOR_RESET;
-                                _request._errorCode = FORBIDDEN;
-                                return true;
-                            }
-                        }
-                    }
-                    return true;
                 }
             }
+            return true;
         }
         return false;
     }
@@ -180,6 +182,7 @@ bool Request::RequestValidator::isAllowedMethod() const
 
         return  ((method == "GET" && _request._location->allowedGET)
             || (method == "POST" && _request._location->allowedPOST)
+            || (method == "PUT" && _request._location->allowedPUT)
             || (method == "DELETE" && _request._location->allowedDELETE)
             || (method == "HEAD" && _request._location->allowedHEAD));
     }
@@ -312,29 +315,17 @@ bool Request::RequestValidator::areHeadersValid() const
     }
 }
 
-bool Request::RequestValidator::isServerMatch(const Server& server) const
+//Host header without the port, looked up in the listener's virtual hosts; unknown hosts get the default server
+const Server* Request::RequestValidator::findServer() const
 {
     try
     {
         const auto& headers = _request._requestData.headers;
         auto hostIt = headers.find("Host");
 
-        if (hostIt == headers.end()) return false;
-
-        std::string hostHeader = WebParser::trimSpaces(hostIt->second);
-
-        if (hostHeader.empty()) return false;
-
-        for (const auto& serverName : server.server_name)
-        {
-            std::string fullServerName = serverName + ":" + std::to_string(server.port);
-            if (hostHeader == fullServerName)
-            {
-                _request._server = &server;
-                return true;
-            }
-        }
-        return false;
+        if (hostIt == headers.end())
+            return _virtualHosts.getDefaultServer();
+        return _virtualHosts.findServer(hostIt->second);
     }
     catch (const std::exception& e)
     {
@@ -346,26 +337,16 @@ bool Request::RequestValidator::matchLocationSetData(const Server& server) const
 {
     try
     {
-        std::string uri = _request._requestData.uri;
-        const Location* bestMatchLocation = nullptr;
-
-        for (const auto& location : server.locations)
-        {
-            if (uri.find(location.uri) == 0)
-            {
-                if (!bestMatchLocation || location.uri.length() > bestMatchLocation->uri.length())
-                {
-                    bestMatchLocation = &location;
-                }
-            }
-        }
+        ssize_t locationIndex = server.locationTrie.findLongestPrefix(_request._requestData.uri);
 
-        if (!bestMatchLocation)
+        if (locationIndex == -1)
             return false;
 
+        const Location* bestMatchLocation = &server.locations[locationIndex];
+
         _request._location = bestMatchLocation;
 
-        if (bestMatchLocation->type == PROXY)
+        if (bestMatchLocation->type == PROXY || bestMatchLocation->type == FASTCGI)
         {
             auto it = _proxyInfoMap.find(bestMatchLocation->target);
             if (it != _proxyInfoMap.end())
@@ -5,8 +5,11 @@
 #include "WebParser.hpp"
 #include "WebServer.hpp"
 #include <fcntl.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 
-CGIHandler::CGIHandler(const Request& request, WebServer &webServer) : _webServer(webServer), _request(request), _response(""), _scriptPath(_request.getRequestData().uri)
+CGIHandler::CGIHandler(const Request& request, WebServer &webServer, int clientSocket) : _webServer(webServer), _request(request), _clientSocket(clientSocket), _response(""), _scriptPath(_request.getRequestData().uri)
 {
     std::cout << COLOR_YELLOW_CGI << "  CGIHandler: " << _request.getRequestData().method << " " <<  " 🐍\n\n" << COLOR_RESET;
     executeScript();
@@ -23,23 +26,36 @@ void CGIHandler::executeScript(void)
             ErrorHandler(_request.getServer()).handleError(_response, 500);
             return WebErrors::printerror("CGIHandler::executeScript", "Error accessing script file") , void();
         }
-        if (pipe(_fromCgi_pipe) == -1 || pipe(_toCgi_pipe) == -1)
+        // close-on-exec from the start: a script must not hold another script's stdin open, or that one
+        // never reads EOF; the ends a script gets are dup2()ed onto 0, 1 and 2, which clears it
+        if (pipe2(_fromCgi_pipe, O_CLOEXEC) == -1 || pipe2(_toCgi_pipe, O_CLOEXEC) == -1)
         {
             ErrorHandler(_request.getServer()).handleError(_response, 500);
             return WebErrors::printerror("CGIHandler::executeScript", "Error creating pipes") , void();
         }
-        WebServer::setFdNonBlocking(_fromCgi_pipe[READEND]);
-        WebServer::setFdNonBlocking(_fromCgi_pipe[WRITEND]);
-        pid = fork();
+        WebServer::setFdNonBlocking(_fromCgi_pipe[READEND]); // only our ends, the script's stay blocking
+        if (_webServer.getCgiZygote())
+        {
+            const uint64_t ticket = _webServer.getCgiZygote()->spawn(scriptDirectory(), _scriptPath, environment(),
+                                                                     _toCgi_pipe[READEND], _fromCgi_pipe[WRITEND]);
+            if (ticket != 0)
+            {
+                parent(0, ticket);
+                std::cout << COLOR_YELLOW_CGI << "  CGI Script Started from the zygote 🐍\n\n" << COLOR_RESET;
+                return ;
+            }
+        }
+        pid = spawn();
         if (pid < 0)
         {
+            const std::string reason = strerror(errno);
+
+            for (int fd : {_toCgi_pipe[READEND], _toCgi_pipe[WRITEND], _fromCgi_pipe[READEND], _fromCgi_pipe[WRITEND]})
+                close(fd);
             ErrorHandler(_request.getServer()).handleError(_response, 500);
-            return WebErrors::printerror("CGIHandler::executeScript", "Error forking process") , void();
+            return WebErrors::printerror("CGIHandler::executeScript", "Error starting the script: " + reason), void();
         }
-        else if (pid == 0)
-            child();
-        else
-            parent(pid);
+        parent(pid);
         std::cout << COLOR_YELLOW_CGI << "  CGI Script Started 🐍\n\n" << COLOR_RESET;
     }
     catch (const std::exception &e)
@@ -49,75 +65,146 @@ void CGIHandler::executeScript(void)
     }
 }
 
-void CGIHandler::child(void)
+/*
+posix_spawn() instead of fork(): glibc starts the child with clone(CLONE_VM | CLONE_VFORK), so nothing
+of the server's address space is copied however much of it the caches and connection tables use.
+What the child did after fork is done by the file actions: the pipes onto stdin, stdout and stderr,
+their other ends closed, and the script's directory as working directory.
+-1 with errno set if the script could not be started, including a failed chdir or execve.
+*/
+pid_t CGIHandler::spawn(void)
 {
-    try
-    {
-        size_t      lastSlashPos = _scriptPath.find_last_of('/');
-        std::string scriptDir;
+    const std::vector<std::string>  env = environment();
+    std::vector<char *>             envp;
+    char *const                     argv[] = {const_cast<char *>(PYTHON3), const_cast<char *>(_scriptPath.c_str()), nullptr};
+    posix_spawn_file_actions_t      actions;
+    posix_spawnattr_t               attributes;
+    sigset_t                        signals;
+    pid_t                           pid = -1;
 
-        if (lastSlashPos != std::string::npos)
-            scriptDir = _scriptPath.substr(0, lastSlashPos);
-        else
-            scriptDir = ".";
-        if (chdir(scriptDir.c_str()) != 0)
-        {
-            std::cout << WebParser::getErrorPage(500, _request.getServer());
-            exit(EXIT_FAILURE);
-        }
-        char const *argv[] = {PYTHON3, _scriptPath.c_str(), NULL};
-        char const *envp[9];
+    for (const std::string &variable : env)
+        envp.push_back(const_cast<char *>(variable.c_str()));
+    envp.push_back(nullptr);
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return -1;
+    if (posix_spawnattr_init(&attributes) != 0)
+        return posix_spawn_file_actions_destroy(&actions), -1;
 
-        close(_toCgi_pipe[WRITEND]);
-        dup2(_toCgi_pipe[READEND], STDIN_FILENO);
-        close(_toCgi_pipe[READEND]);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPIPE);   // ignored by the server, the script gets the default back
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
 
-        close(_fromCgi_pipe[READEND]);
-        dup2(_fromCgi_pipe[WRITEND], STDOUT_FILENO);
-        dup2(_fromCgi_pipe[WRITEND], STDERR_FILENO);
-        close(_fromCgi_pipe[WRITEND]);
+    posix_spawn_file_actions_addclose(&actions, _toCgi_pipe[WRITEND]);
+    posix_spawn_file_actions_adddup2(&actions, _toCgi_pipe[READEND], STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, _toCgi_pipe[READEND]);
+    posix_spawn_file_actions_addclose(&actions, _fromCgi_pipe[READEND]);
+    posix_spawn_file_actions_adddup2(&actions, _fromCgi_pipe[WRITEND], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, _fromCgi_pipe[WRITEND], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, _fromCgi_pipe[WRITEND]);
+    posix_spawn_file_actions_addchdir_np(&actions, scriptDirectory().c_str());
 
-        childSetEnvp(envp);
-        execve(PYTHON3, (char *const *)argv, (char *const *)envp);
+    const int error = posix_spawn(&pid, PYTHON3, &actions, &attributes, argv, envp.data());
 
-        WebErrors::printerror("CGIHandler::child", "Error executing script");
-        std::cout << WebParser::getErrorPage(500, _request.getServer());
-        std::terminate();
-    }
-    catch (const std::exception &e)
-    {
-        ErrorHandler(_request.getServer()).handleError(_response, 500);
-        std::cout << _response << std::endl;
-        exit(EXIT_FAILURE);
-    }
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0)
+        return errno = error, -1;
+    return pid;
 }
 
+//an error page when the script could not be started, its output is read in the event loop otherwise
+std::string CGIHandler::getCGIResponse(void) const { return _response; }
+
+//empty unless the location has cgi_collapse on and the response can't depend on who asks
+std::string CGIHandler::collapseKey(const Request &request)
+{
+    const RequestData   &data = request.getRequestData();
+
+    if (!request.getLocation()->cgi_collapse || (data.method != "GET" && data.method != "HEAD"))
+        return "";
+    if (!ProxyCache::findHeader(data.headers, "Cookie").empty()
+        || !ProxyCache::findHeader(data.headers, "Authorization").empty())
+        return "";
+    return ProxyCache::makeKey(data.method, data.headers,
+                               data.query_string.empty() ? data.uri : data.uri + "?" + data.query_string);
+}
 
-void CGIHandler::parent(pid_t pid)
+/*
+The script is watched from the event loop: its pidfd turns readable when it exits, whatever started it,
+and its timerfd when it has run for CGI_TIMEOUT_LIMIT. A zygote child has no pid yet (0), its pidfd
+comes with it in WebServer::watchZygoteChild.
+*/
+void CGIHandler::parent(pid_t pid, uint64_t zygoteTicket)
 {
     try
     {
-        CGIProcessInfo cgiInfo;
+        CGIProcessInfo      cgiInfo;
 
         cgiInfo.pid = pid;
-        cgiInfo.clientSocket = _webServer.getCurrentEventFd();
-        cgiInfo.response = "";
+        cgiInfo.zygoteTicket = zygoteTicket;
+        cgiInfo.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if ((pid > 0 && watchProcess(cgiInfo) == -1) || cgiInfo.timerFd == -1 || resetTimeout(cgiInfo) == -1)
+        {
+            const std::string reason = strerror(errno);
+
+            if (pid > 0) // a zygote child is killed once its pid comes in and finds no entry
+            {
+                kill(pid, SIGKILL);
+                waitpid(pid, nullptr, 0);
+            }
+            for (int fd : {cgiInfo.pidFd, cgiInfo.timerFd, _toCgi_pipe[READEND], _toCgi_pipe[WRITEND],
+                           _fromCgi_pipe[READEND], _fromCgi_pipe[WRITEND]})
+            {
+                if (fd != -1)
+                    close(fd);
+            }
+            ErrorHandler(_request.getServer()).handleError(_response, 500);
+            return WebErrors::printerror("CGIHandler::parent", "Error watching the script: " + reason), void();
+        }
+        cgiInfo.clientSocket = _clientSocket;
+        cgiInfo.limiter = _webServer.findCGILimiter(_request.getLocation());
         cgiInfo.startTime = std::chrono::steady_clock::now();
+        cgiInfo.output = CGIOutput(_request.getRequestData().method == "HEAD");
         cgiInfo.readFromCgiFd = _fromCgi_pipe[READEND];
         cgiInfo.writeToCgiFd = _toCgi_pipe[WRITEND];
-        if (_request.getRequestData().method == "POST" && !_request.getRequestData().body.empty())
+        cgiInfo.collapseKey = collapseKey(_request);
+        cgiInfo.cache = _webServer.findCGICache(_request.getLocation());
+        cgiInfo.cacheKey = cgiInfo.cache ? cgiInfo.cache->makeKey(_request.getRequestData()) : "";
+        cgiInfo.body = _request.getRawRequestBuffer();
+
+        const size_t        headerEnd = cgiInfo.body->find("\r\n\r\n");
+
+        cgiInfo.bodyOffset = headerEnd == std::string::npos ? cgiInfo.body->size() : headerEnd + 4;
+
+        const size_t        inHand = cgiInfo.body->size() - cgiInfo.bodyOffset;
+        const std::string   contentLength = WebParser::trimSpaces(_request.getRequestData().content_length);
+
+        if (!contentLength.empty() && contentLength.find_first_not_of("0123456789") == std::string::npos
+            && contentLength.size() <= 18 && std::stoull(contentLength) > inHand)
         {
-            const size_t bodySize = _request.getRequestData().body.size();
-            const ssize_t written = write(_toCgi_pipe[WRITEND], _request.getRequestData().body.c_str(), bodySize);
-            if (written == -1)
-                throw std::runtime_error("Failed to write to CGI script");
-            else if (written == 0)
-                throw std::runtime_error("Zero bytes written to CGI");
+            cgiInfo.bodySocket = _clientSocket; // the headers came first, see WebServer::streamCGIRequest
+            cgiInfo.bodyRemaining = std::stoull(contentLength) - inHand;
         }
+        if (inHand > 0 || cgiInfo.bodySocket != -1)
+            WebServer::setFdNonBlocking(_toCgi_pipe[WRITEND]);
         else
+        {
             close(_toCgi_pipe[WRITEND]);
+            cgiInfo.writeToCgiFd = -1;
+            cgiInfo.body.reset();
+        }
         _webServer.getCgiInfoList().push_back(cgiInfo);
-        _webServer.epollController(_fromCgi_pipe[READEND], EPOLL_CTL_ADD, EPOLLIN, FdType::CGI_PIPE);
+        _webServer.eventController(_fromCgi_pipe[READEND], EPOLL_CTL_ADD, EPOLLIN, FdType::CGI_PIPE);
+        if (cgiInfo.writeToCgiFd != -1) // the body goes in as the script takes it
+            _webServer.eventController(cgiInfo.writeToCgiFd, EPOLL_CTL_ADD, inHand > 0 ? uint32_t(EPOLLOUT) : 0u, FdType::CGI_PIPE);
+        if (cgiInfo.bodySocket != -1)
+            _webServer.eventController(cgiInfo.bodySocket, EPOLL_CTL_ADD, inHand > 0 ? 0u : uint32_t(EPOLLIN), FdType::CLIENT);
+        if (cgiInfo.pidFd != -1)
+            _webServer.eventController(cgiInfo.pidFd, EPOLL_CTL_ADD, EPOLLIN, FdType::CGI_PROCESS);
+        _webServer.eventController(cgiInfo.timerFd, EPOLL_CTL_ADD, EPOLLIN, FdType::CGI_PROCESS);
         close(_toCgi_pipe[READEND]);
         close(_fromCgi_pipe[WRITEND]);
     }
@@ -127,39 +214,58 @@ void CGIHandler::parent(pid_t pid)
     }
 }
 
+//CGI_TIMEOUT_LIMIT from now on; while the body is still coming in, from its last bytes
+int CGIHandler::resetTimeout(const CGIProcessInfo &cgiInfo)
+{
+    const itimerspec timeout = {{0, 0}, {CGI_TIMEOUT_LIMIT, 0}};
+
+    return timerfd_settime(cgiInfo.timerFd, 0, &timeout, nullptr);
+}
 
-void CGIHandler::childSetEnvp(char const *envp[])
+//a pidfd_open() failing with ESRCH means a zygote child that already exited and was reaped by the zygote
+int CGIHandler::watchProcess(CGIProcessInfo &cgiInfo)
 {
-    try
-    {
-        static std::vector<std::string> env(9);
-        const RequestData *reqData =    &_request.getRequestData();
-
-        env[0] = "REQUEST_METHOD=" + reqData->method;
-        env[1] = "QUERY_STRING=" + reqData->query_string;
-        env[2] = "CONTENT_TYPE=" + reqData->content_type;
-        env[3] = "CONTENT_LENGTH=" + reqData->content_length;
-        env[4] = "DOCUMENT_ROOT=" + reqData->absoluteRootPath;
-        env[5] = "SCRIPT_FILENAME=" + _scriptPath;
-        env[6] = "SCRIPT_NAME=" + _scriptPath;
-        env[7] = "REDIRECT_STATUS=200";
-        env[8] = "UPLOAD_FOLDER="  + _request.getLocation()->upload_folder;
-
-        envp[0] = env[0].c_str();
-        envp[1] = env[1].c_str();
-        envp[2] = env[2].c_str();
-        envp[3] = env[3].c_str();
-        envp[4] = env[4].c_str();
-        envp[5] = env[5].c_str();
-        envp[6] = env[6].c_str();
-        envp[7] = env[7].c_str();
-        envp[8] = env[8].c_str();
-        envp[9] = NULL;
-    }
-    catch (const std::exception &e)
-    {
-        ErrorHandler(_request.getServer()).handleError(_response, 500);
-        std::cout <<  _response << std::endl;
-        exit(EXIT_FAILURE);
-    }
+    cgiInfo.pidFd = syscall(SYS_pidfd_open, cgiInfo.pid, 0);
+    cgiInfo.exited = cgiInfo.pidFd == -1 && errno == ESRCH;
+    return (cgiInfo.pidFd == -1 && !cgiInfo.exited) ? -1 : 0;
+}
+
+//through the pidfd while there is one: a zygote child's pid may already belong to another process
+int CGIHandler::killScript(CGIProcessInfo &cgiInfo)
+{
+    if (cgiInfo.exited)
+        return 0;
+    if (cgiInfo.zygoteTicket != 0)
+        return cgiInfo.killPending = true, 0;
+    if (cgiInfo.pidFd != -1)
+        return syscall(SYS_pidfd_send_signal, cgiInfo.pidFd, SIGKILL, nullptr, 0);
+    return kill(cgiInfo.pid, SIGKILL);
+}
+
+//what the script gets, whether it is exec'd or forked from the zygote
+std::vector<std::string> CGIHandler::environment(void) const
+{
+    const RequestData *reqData = &_request.getRequestData();
+
+    return {
+        "REQUEST_METHOD=" + reqData->method,
+        "QUERY_STRING=" + reqData->query_string,
+        "CONTENT_TYPE=" + reqData->content_type,
+        "CONTENT_LENGTH=" + reqData->content_length,
+        "DOCUMENT_ROOT=" + reqData->absoluteRootPath,
+        "SCRIPT_FILENAME=" + _scriptPath,
+        "SCRIPT_NAME=" + _scriptPath,
+        "REDIRECT_STATUS=200",
+        "UPLOAD_FOLDER=" + _request.getLocation()->upload_folder,
+    };
+}
+
+//the script runs from its own directory
+std::string CGIHandler::scriptDirectory(void) const
+{
+    size_t lastSlashPos = _scriptPath.find_last_of('/');
+
+    if (lastSlashPos != std::string::npos)
+        return _scriptPath.substr(0, lastSlashPos);
+    return ".";
 }
@@ -30,17 +30,27 @@
 #define PYTHON3 "/bin/python3"
 #define ERROR "\033[31ERROR: \033[0"
 #define CGI_TIMEOUT_LIMIT 5
+#define CGI_READ_MAX 65536     // bytes of script output taken per event
+#define CGI_SPLICE_MAX 1048576  // bytes of request body spliced into the script per call
+#ifndef P_PIDFD
+# define P_PIDFD 3              // waitid() on a pidfd, <linux/wait.h>
+#endif
 
 class   CGIHandler
 {
     public:
-        CGIHandler(const Request& request, WebServer &webServer);
+        CGIHandler(const Request& request, WebServer &webServer, int clientSocket);
         ~CGIHandler() = default;
 
         std::string      getCGIResponse( void ) const;
+        static std::string  collapseKey(const Request &request);
+        static int       killScript(CGIProcessInfo &cgiInfo);
+        static int       watchProcess(CGIProcessInfo &cgiInfo);
+        static int       resetTimeout(const CGIProcessInfo &cgiInfo);
     private:
         WebServer       &_webServer;
         const Request&   _request;
+        int              _clientSocket;
         std::string      _response;
         std::string      _scriptPath;
         int              _fromCgi_pipe[PIPES];
@@ -49,7 +59,8 @@ class   CGIHandler
         bool            validateExecutable( void );
         bool            parentWaitForChild(pid_t pid);
         void            executeScript( void );
-        void            child( void );
-        void            parent( pid_t pid );
-        void            childSetEnvp( char const *envp[] );
+        pid_t           spawn( void );
+        void            parent( pid_t pid, uint64_t zygoteTicket = 0 );
+        std::string     scriptDirectory( void ) const;
+        std::vector<std::string> environment( void ) const;
 };
@@ -0,0 +1,154 @@
+#include "CGIOutput.hpp"
+#include "WebParser.hpp"
+#include <algorithm>
+#include <sstream>
+#include <strings.h>
+
+CGIOutput::CGIOutput(bool headOnly) : _headOnly(headOnly) {}
+
+//what goes to the client for these bytes of output; eof: the script is done, this was the last of it
+std::string CGIOutput::feed(const char *data, size_t length, bool eof)
+{
+    std::string out;
+
+    if (_state == MALFORMED)
+        return out;
+    if (_state != HEADERS)
+        return frame(out, data, length, eof), out;
+
+    const size_t searchFrom = _head.size() > 3 ? _head.size() - 3 : 0;
+
+    _head.append(data, length);
+
+    const size_t crlf = _head.find("\r\n\r\n", searchFrom);
+    const size_t lf = _head.find("\n\n", searchFrom);
+    const size_t headEnd = std::min(crlf, lf);
+
+    if (headEnd == std::string::npos)
+    {
+        if (eof || _head.size() > CGI_HEADERS_MAX)
+            _state = MALFORMED;
+        return out;
+    }
+    return respond(headEnd, headEnd + (headEnd == crlf ? 4 : 2), eof);
+}
+
+std::string CGIOutput::respond(size_t headEnd, size_t bodyStart, bool eof)
+{
+    std::istringstream  stream(_head.substr(0, headEnd));
+    std::string         line;
+    std::string         status;
+    std::string         headers;
+    std::string         contentLength;
+    bool                location = false;
+
+    while (std::getline(stream, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (status.empty() && headers.empty() && line.compare(0, 5, "HTTP/") == 0)
+        {
+            status = WebParser::trimSpaces(line.substr(std::min(line.find(' '), line.size())));
+            continue ;
+        }
+
+        const size_t colon = line.find(':');
+
+        if (colon == std::string::npos || colon == 0)
+            return _state = MALFORMED, "";
+
+        const std::string name = line.substr(0, colon);
+        const std::string value = WebParser::trimSpaces(line.substr(colon + 1));
+
+        if (strcasecmp(name.c_str(), "Status") == 0)
+            status = value;
+        else if (strcasecmp(name.c_str(), "Content-Length") == 0)
+            contentLength = value;
+        else if (strcasecmp(name.c_str(), "Connection") != 0 && strcasecmp(name.c_str(), "Keep-Alive") != 0
+                 && strcasecmp(name.c_str(), "Transfer-Encoding") != 0)
+        {
+            location = location || strcasecmp(name.c_str(), "Location") == 0;
+            headers += name + ": " + value + "\r\n";
+        }
+    }
+    if (status.empty())
+        status = location ? "302 Found" : "200 OK";
+    if (status.size() < 3 || !std::all_of(status.begin(), status.begin() + 3, ::isdigit)
+        || (status.size() > 3 && status[3] != ' '))
+        return _state = MALFORMED, "";
+    _statusCode = std::stoi(status.substr(0, 3));
+    if (status.size() == 3)
+        status += ' ';
+
+    const bool      bodyless = _headOnly || _statusCode < 200 || _statusCode == 204 || _statusCode == 304;
+    const size_t    bodyInHand = _head.size() - bodyStart;
+
+    if (!contentLength.empty() && contentLength.find_first_not_of("0123456789") == std::string::npos
+        && contentLength.size() <= 18)
+    {
+        _remaining = std::stoull(contentLength);
+        _state = BODY_LENGTH;
+        headers += "Content-Length: " + contentLength + "\r\n";
+    }
+    else if (eof && (_headOnly || !bodyless))
+    {
+        _remaining = bodyInHand;
+        _state = BODY_LENGTH;
+        headers += "Content-Length: " + std::to_string(bodyInHand) + "\r\n";
+    }
+    else if (!bodyless)
+    {
+        _state = BODY_CHUNKED;
+        headers += "Transfer-Encoding: chunked\r\n";
+    }
+    if (bodyless)
+        _state = DONE;
+
+    std::string out = "HTTP/1.1 " + status + "\r\n" + headers + "Connection: close\r\n\r\n";
+
+    frame(out, _head.data() + bodyStart, bodyInHand, eof);
+    _head.clear();
+    _head.shrink_to_fit();
+    return out;
+}
+
+void CGIOutput::frame(std::string &out, const char *data, size_t length, bool eof)
+{
+    switch (_state)
+    {
+    case BODY_LENGTH:
+        length = std::min<size_t>(length, _remaining);
+        out.append(data, length);
+        _remaining -= length;
+        if (_remaining == 0)
+            _state = DONE;
+        break ;
+    case BODY_CHUNKED:
+        if (length > 0)
+        {
+            std::ostringstream size;
+
+            size << std::hex << length << "\r\n";
+            out += size.str();
+            out.append(data, length);
+            out += "\r\n";
+        }
+        if (eof)
+        {
+            out += "0\r\n\r\n";
+            _state = DONE;
+        }
+        break ;
+    default:
+        break ;
+    }
+}
+
+bool CGIOutput::headersSent() const { return _state != HEADERS && _state != MALFORMED; }
+
+//the body is all there; a script that stopped short of its Content-Length never gets here
+bool CGIOutput::isComplete() const { return _state == DONE; }
+
+bool CGIOutput::isMalformed() const { return _state == MALFORMED; }
+
+int CGIOutput::getStatusCode() const { return _statusCode; }
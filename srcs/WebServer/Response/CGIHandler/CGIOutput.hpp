@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+
+#define CGI_HEADERS_MAX 16384   // bytes of CGI headers before the output is taken as malformed
+
+/*
+CGI/1.1 output (RFC 3875 6) turned into an HTTP/1.1 response as it is produced, for cgi_pass scripts
+and fastcgi_pass backends alike. The headers are held back until the blank line (CRLF or bare LF):
+Status, or a Location without it (302), gives the status line, 200 otherwise; a first line that
+already is an HTTP status line is taken as Status. Connection, Keep-Alive and Transfer-Encoding are
+ours to set. The body then goes out as it comes:
+- with the script's Content-Length, anything past it dropped;
+- with a Content-Length of our own when the whole output is already in hand;
+- chunked otherwise (requests are HTTP/1.1 only).
+No body for HEAD, 1xx, 204 and 304.
+*/
+class CGIOutput
+{
+public:
+    CGIOutput(bool headOnly = false);
+
+    std::string feed(const char *data, size_t length, bool eof);
+
+    bool        headersSent() const;
+    bool        isComplete() const;
+    bool        isMalformed() const;
+    int         getStatusCode() const;
+
+private:
+    enum State { HEADERS, BODY_LENGTH, BODY_CHUNKED, DONE, MALFORMED };
+
+    bool        _headOnly;
+    State       _state = HEADERS;
+    int         _statusCode = 0;
+    std::string _head;
+    size_t      _remaining = 0;
+
+    std::string respond(size_t headEnd, size_t bodyStart, bool eof);
+    void        frame(std::string &out, const char *data, size_t length, bool eof);
+};
@@ -0,0 +1,261 @@
+#include "CGIZygote.hpp"
+#include "WebErrors.hpp"
+#include <cerrno>
+#include <csignal>
+#include <spawn.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+The helper, run with python3 -c. Messages are NUL separated fields: directory, script, then the
+environment; the fds come in the same message. The child runs the script in a fresh __main__ module, so it
+sees the same thing as under python3 <script>, only with its imports already in sys.modules.
+*/
+static const char *const ZYGOTE_SOURCE = R"PY(
+import gc, os, sys, signal, socket, types, traceback
+import re, json, time, io, html, random, hashlib, base64, datetime, mimetypes, shutil, tempfile
+import urllib.parse, http.cookies, email.parser, email.message
+
+control = socket.socket(fileno=3)
+signal.signal(signal.SIGCHLD, signal.SIG_IGN)
+for number in (signal.SIGINT, signal.SIGQUIT, signal.SIGTSTP):  # sent to the whole group, for webserv
+    signal.signal(number, signal.SIG_IGN)
+gc.freeze()  # the children's collections then leave the preloaded objects, and their shared pages, alone
+control.send(b"ready")
+while True:
+    try:
+        message, fds, _, _ = socket.recv_fds(control, 1 << 20, 2)
+    except OSError:
+        os._exit(1)
+    if not message:
+        os._exit(0)
+    if len(fds) != 2:
+        for fd in fds:
+            os.close(fd)
+        control.send((-1).to_bytes(4, sys.byteorder, signed=True))
+        continue
+    fields = message.decode("latin-1").split("\0")
+    sys.stdout.flush()
+    sys.stderr.flush()
+    pid = os.fork()
+    if pid == 0:
+        status = 0
+        try:
+            control.close()
+            for number in (signal.SIGCHLD, signal.SIGINT, signal.SIGQUIT, signal.SIGTSTP):
+                signal.signal(number, signal.SIG_DFL)
+            os.dup2(fds[0], 0)
+            os.dup2(fds[1], 1)
+            os.dup2(fds[1], 2)
+            os.close(fds[0])
+            os.close(fds[1])
+            os.chdir(fields[0])
+            os.environ.clear()
+            os.environ.update(field.split("=", 1) for field in fields[2:] if "=" in field)
+            sys.argv = [fields[1]]
+            sys.path[0] = os.path.dirname(fields[1])
+            main = types.ModuleType("__main__")
+            main.__file__ = fields[1]
+            main.__builtins__ = __builtins__
+            sys.modules["__main__"] = main
+            with open(fields[1], "rb") as script:
+                code = compile(script.read(), fields[1], "exec")
+            exec(code, main.__dict__)
+        except SystemExit as exit:
+            status = exit.code if isinstance(exit.code, int) else (exit.code is not None)
+        except BaseException:
+            traceback.print_exc()
+            status = 1
+        try:
+            sys.stdout.flush()
+            sys.stderr.flush()
+        finally:
+            os._exit(status)
+    os.close(fds[0])
+    os.close(fds[1])
+    control.send(pid.to_bytes(4, sys.byteorder, signed=True))
+)PY";
+
+CGIZygote::CGIZygote(const std::string &interpreter, ControlCallback control, StartedCallback started)
+    : _interpreter(interpreter), _control(std::move(control)), _started(std::move(started))
+{
+    if (!launch(true))
+    {
+        _failed = true;
+        WebErrors::printerror("CGIZygote::CGIZygote", "cgi_zygote helper did not start, CGI scripts are started with posix_spawn");
+    }
+}
+
+//the event loop goes away along with us, the socket is just closed
+CGIZygote::~CGIZygote()
+{
+    if (_socket != -1)
+        close(_socket);
+    if (_pid > 0)
+    {
+        kill(_pid, SIGKILL);
+        waitpid(_pid, nullptr, 0);
+    }
+}
+
+/*
+posix_spawn as for the scripts. The helper is also started again while the server runs, with clients,
+listeners and CGI pipes open: everything past its control socket is closed in it, whatever the flags
+those were created with, or it and every script it forks would hold them for their whole life.
+Only at startup is it waited for; started again, its "ready" comes through the event loop.
+*/
+bool CGIZygote::launch(bool waitReady)
+{
+    int                         sockets[2];
+    char                        ready[8];
+    posix_spawn_file_actions_t  actions;
+    char *const                 argv[] = {const_cast<char *>(_interpreter.c_str()), const_cast<char *>("-c"),
+                                          const_cast<char *>(ZYGOTE_SOURCE), nullptr};
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1)
+        return false;
+    if (posix_spawn_file_actions_init(&actions) != 0)
+        return close(sockets[0]), close(sockets[1]), false;
+    posix_spawn_file_actions_adddup2(&actions, sockets[1], ZYGOTE_FD); // without close-on-exec, unlike the original
+    posix_spawn_file_actions_addclosefrom_np(&actions, ZYGOTE_FD + 1);
+
+    const int error = posix_spawn(&_pid, _interpreter.c_str(), &actions, nullptr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(sockets[1]);
+    if (error != 0)
+    {
+        _pid = -1;
+        close(sockets[0]);
+        return false;
+    }
+    _socket = sockets[0];
+    _ready = false;
+    if (waitReady)
+    {
+        const timeval timeout = {ZYGOTE_READY_TIMEOUT, 0};
+
+        setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (recv(_socket, ready, sizeof(ready), 0) != 5 || memcmp(ready, "ready", 5) != 0)
+        {
+            close(_socket);
+            _socket = -1;
+            kill(_pid, SIGKILL);
+            waitpid(_pid, nullptr, 0);
+            _pid = -1;
+            return false;
+        }
+        _ready = true;
+    }
+    fcntl(_socket, F_SETFL, O_NONBLOCK);
+    _control(_socket, EPOLL_CTL_ADD, EPOLLIN);
+    return true;
+}
+
+//closing the socket makes the helper exit; its children run on until they are done
+void CGIZygote::stop(void)
+{
+    const std::deque<uint64_t> pending = std::move(_pending);
+
+    _pending.clear();
+    if (_socket != -1)
+        _control(_socket, EPOLL_CTL_DEL, 0);
+    _socket = -1;
+    if (_pid > 0)
+    {
+        kill(_pid, SIGKILL);
+        waitpid(_pid, nullptr, 0);
+    }
+    _pid = -1;
+    for (uint64_t ticket : pending)
+        _started(ticket, -1);
+}
+
+/*
+Sends the script without waiting for the fork: the ticket it returns comes back with the pid, or -1, in
+the started callback. 0 if it wasn't sent, even after starting the helper again; the caller then
+starts the script itself.
+*/
+uint64_t CGIZygote::spawn(const std::string &directory, const std::string &script,
+                          const std::vector<std::string> &environment, int stdinFd, int stdoutFd)
+{
+    std::string message = directory + '\0' + script;
+
+    for (const std::string &variable : environment)
+        message += '\0' + variable;
+    for (int attempt = 0; attempt < 2 && !_failed; attempt++)
+    {
+        if (_socket == -1 && !launch(false))
+        {
+            _failed = true;
+            break ;
+        }
+
+        const int   fds[2] = {stdinFd, stdoutFd};
+        char        control[CMSG_SPACE(sizeof(fds))] = {};
+        iovec       data = {const_cast<char *>(message.data()), message.size()};
+        msghdr      header = {};
+
+        header.msg_iov = &data;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+        cmsghdr *rights = CMSG_FIRSTHDR(&header);
+        rights->cmsg_level = SOL_SOCKET;
+        rights->cmsg_type = SCM_RIGHTS;
+        rights->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(rights), fds, sizeof(fds));
+        if (sendmsg(_socket, &header, MSG_NOSIGNAL) == static_cast<ssize_t>(message.size()))
+        {
+            _pending.push_back(_nextTicket);
+            return _nextTicket++;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0; // the helper is that far behind, this one is better off without it
+        WebErrors::printerror("CGIZygote::spawn", std::string("cgi_zygote helper is gone: ") + strerror(errno));
+        stop();
+    }
+    return 0;
+}
+
+//the helper's replies: "ready" once it is, then one pid per script in the order they were sent
+void CGIZygote::handleEvent(void)
+{
+    char reply[8];
+
+    while (_socket != -1)
+    {
+        const ssize_t   length = recv(_socket, reply, sizeof(reply), 0);
+        int32_t         pid;
+
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return ;
+        if (length == 5 && memcmp(reply, "ready", 5) == 0)
+        {
+            _ready = true;
+            continue ;
+        }
+        if (length == sizeof(pid) && !_pending.empty())
+        {
+            const uint64_t ticket = _pending.front();
+
+            memcpy(&pid, reply, sizeof(pid));
+            _pending.pop_front();
+            _started(ticket, pid);
+            continue ;
+        }
+        if (length >= 0)
+            errno = 0; // printerror() appends it, the helper closing its end leaves a stale one
+        WebErrors::printerror("CGIZygote::handleEvent", _ready ? "cgi_zygote helper is gone"
+                              : "cgi_zygote helper died while starting, CGI scripts are started with posix_spawn");
+        _failed = !_ready;
+        return stop();
+    }
+}
+
+int CGIZygote::getFd(void) const { return _socket; }
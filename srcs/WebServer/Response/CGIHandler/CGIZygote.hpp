@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#define ZYGOTE_FD 3                 // the helper's end of the control socket
+#define ZYGOTE_READY_TIMEOUT 5      // seconds for the helper to preload and check in, at startup
+
+/*
+cgi_zygote on: a python3 started once at startup that has imported the modules CGI scripts commonly
+use, then waits on a SOCK_SEQPACKET socket. For every script it is sent the working directory, the
+script and the environment, with the script's stdin and stdout (its stderr too) attached as
+SCM_RIGHTS; it forks, the child takes those over and runs the script as __main__, and the helper
+answers with the child's pid. A script thus starts at the cost of a fork instead of an interpreter startup.
+The socket is in the event loop (FdType::CGI_PROCESS): spawn() only sends, and the pids are handed to
+the started callback in the order the scripts were sent, -1 for those the helper went away with.
+The helper reaps its own children (SIGCHLD ignored), so kill() on the pid is all that's left to us.
+When it is gone it is started again on the next script, without waiting for it to check in; one that
+dies before it does is not started again, and the caller falls back to posix_spawn from then on.
+*/
+class CGIZygote
+{
+public:
+    using ControlCallback = std::function<void(int fd, int operation, uint32_t events)>;
+    using StartedCallback = std::function<void(uint64_t ticket, pid_t pid)>;
+
+    CGIZygote(const std::string &interpreter, ControlCallback control, StartedCallback started);
+    ~CGIZygote();
+    CGIZygote(const CGIZygote &) = delete;
+    CGIZygote &operator=(const CGIZygote &) = delete;
+
+    uint64_t    spawn(const std::string &directory, const std::string &script,
+                      const std::vector<std::string> &environment, int stdinFd, int stdoutFd);
+    void        handleEvent(void);
+    int         getFd(void) const;
+
+private:
+    std::string             _interpreter;
+    ControlCallback         _control;
+    StartedCallback         _started;
+    int                     _socket = -1;
+    pid_t                   _pid = -1;
+    bool                    _ready = false;     // checked in since it was last started
+    bool                    _failed = false;    // died before checking in, not started again
+    uint64_t                _nextTicket = 1;
+    std::deque<uint64_t>    _pending;           // sent, pid not reported yet
+
+    bool        launch(bool waitReady);
+    void        stop(void);
+};
@@ -1,113 +1,561 @@
 #include "ProxyHandler.hpp"
 #include "ProxySocket/ProxySocket.hpp"
 #include "WebErrors.hpp"
+#include <algorithm>
 #include <cstring>
+#include <strings.h>
 #include <netinet/tcp.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <iostream>
+#include <cerrno>
+#include <sstream>
+#include <arpa/inet.h>
+#include <sys/uio.h>
 
-ProxyHandler::ProxyHandler(const Request& req) : _request(req), _proxyInfo(req.getProxyInfo()), _proxyHost(req.getLocation()->target)
+static std::string toLower(std::string value)
 {
-    if (!_proxyInfo) throw WebErrors::ProxyException("No proxy information available");
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
 }
 
-bool ProxyHandler::isDataAvailable(int fd, int timeout_usec)
+ProxyHandler::ProxyHandler(const Request& req, WebServer &webServer, int clientSocket)
+    : _webServer(webServer), _request(req), _proxyInfo(req.getProxyInfo()), _proxyHost(req.getLocation()->target)
 {
-    if (fd < 0)
-        throw WebErrors::ProxyException("Invalid file descriptor.");
+    ProxyConnectionInfo proxy;
+    ProxyCache          *cache = _webServer.findProxyCache(_request.getLocation());
+
+    proxy.clientSocket = clientSocket;
+    proxy.uri = _request.getRequestData().uri;
+    if (!_request.getRequestData().query_string.empty())
+        proxy.uri += "?" + _request.getRequestData().query_string;
+    buildUpstreamRequest(proxy, clientSocket);
+    proxy.framing.reset(_request.getRequestData().method == "HEAD");
+    if (cache && serveFromCache(*cache, proxy))
+        return ;
+
+    ProxyCache          *collapseCache = proxy.collapseCache;
+    const std::string   cacheKey = proxy.cacheKey;
+
     try
     {
-        struct timeval timeout;
-        timeout.tv_sec = timeout_usec / 1000000;
-        timeout.tv_usec = timeout_usec % 1000000;
+        startRequest(std::move(proxy));
+    }
+    catch (const WebErrors::ProxyException &e)
+    {
+        _webServer.resumeCollapsedRequests(collapseCache, cacheKey);
+        throw;
+    }
+}
 
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(fd, &readfds);
+//picks the upstream (a server of the group, or the proxy_pass address) and connects to it
+void ProxyHandler::startRequest(ProxyConnectionInfo proxy)
+{
+    UpstreamGroup   *group = _webServer.findUpstreamGroup(_proxyHost);
 
-        int ret = select(fd + 1, &readfds, nullptr, nullptr, &timeout);
+    if (group)
+    {
+        proxy.group = group;
+        proxy.peer = group->select(proxy.uri);
+        if (!proxy.peer)
+            throw WebErrors::ProxyException("No live server in upstream " + _proxyHost);
+        proxy.upstreamKey = proxy.peer->key;
+        proxy.upstreamAddress = proxy.peer->address;
+    }
+    else
+    {
+        if (!_proxyInfo) throw WebErrors::ProxyException("No proxy information available");
+        proxy.upstreamKey = _proxyHost;
+        proxy.upstreamAddress = _proxyInfo;
+    }
 
-        if (ret < 0) {
-            throw WebErrors::ProxyException("Error with select on proxy server socket");
-        }
-        return ret > 0 && FD_ISSET(fd, &readfds);
+    UpstreamGroup::Peer *peer = proxy.peer;
+    try
+    {
+        connectUpstream(std::move(proxy), _webServer, true);
     }
-    catch (const std::exception &e)
+    catch (const WebErrors::ProxyException &e)
     {
-        WebErrors::printerror("ProxyHandler::isDataAvailable", e.what());
+        if (peer)
+            group->release(*peer, true);
         throw;
     }
 }
 
-std::string ProxyHandler::modifyRequestForProxy()
+/*
+Answers the client from the cache when the entry is fresh, or stale within stale-while-revalidate
+(then a request without a client refreshes it in the background). Otherwise the proxied request is
+set up to store its response, and made conditional when the stale entry has validators.
+A miss while the same key is already being fetched waits for that response instead.
+Unsafe methods invalidate what is stored for the URI.
+*/
+bool ProxyHandler::serveFromCache(ProxyCache &cache, ProxyConnectionInfo &proxy)
 {
+    const RequestData   &data = _request.getRequestData();
+    const time_t        now = time(nullptr);
+
+    if (!ProxyCache::isCacheableRequest(data.method, data.headers))
+    {
+        if (data.method != "GET" && data.method != "HEAD")
+        {
+            cache.invalidate(ProxyCache::makeKey("GET", data.headers, proxy.uri));
+            cache.invalidate(ProxyCache::makeKey("HEAD", data.headers, proxy.uri));
+        }
+        return false;
+    }
+    proxy.cache = &cache;
+    proxy.cacheKey = ProxyCache::makeKey(data.method, data.headers, proxy.uri);
+    proxy.cacheRequestHeaders = data.headers;
+
+    const ProxyCache::EntryPtr  entry = cache.lookup(proxy.cacheKey, data.headers);
+    const bool                  revalidate = ProxyCache::requiresRevalidation(data.headers);
+
+    if (entry && !revalidate && ProxyCache::isServableStale(*entry, now) && !ProxyCache::isFresh(*entry, now)
+        && !entry->revalidating)
+    {
+        ProxyConnectionInfo background = proxy;
+
+        background.clientSocket = -1;
+        makeConditional(background, entry);
+        entry->revalidating = true;
+        try
+        {
+            startRequest(std::move(background));
+        }
+        catch (const WebErrors::ProxyException &e)
+        {
+            WebErrors::printerror("ProxyHandler::serveFromCache", e.what());
+            entry->revalidating = false;
+        }
+    }
+    if (entry && !revalidate && ProxyCache::isServableStale(*entry, now))
+    {
+        std::cout << COLOR_GREEN_SERVER << "  Served from proxy cache 📦\n\n" << COLOR_RESET;
+        _webServer.queueResponse(proxy.clientSocket, ProxyCache::render(*entry, now));
+        return true;
+    }
+    if (!revalidate)
+    {
+        if (cache.collapse(proxy.cacheKey, proxy.clientSocket))
+        {
+            std::cout << COLOR_GREEN_SERVER << "  Waiting for the same request to the proxy 📦\n\n" << COLOR_RESET;
+            return true;
+        }
+        proxy.collapseCache = &cache;
+    }
+    if (entry && ProxyCache::hasValidators(*entry))
+        makeConditional(proxy, entry);
+    return false;
+}
+
+//a 304 then means the stored response can be served (see WebServer::finishProxyConnection)
+void ProxyHandler::makeConditional(ProxyConnectionInfo &proxy, const ProxyCache::EntryPtr &entry)
+{
+    proxy.cacheEntry = entry;
+    if (!entry->etag.empty())
+        setRequestHeader(proxy.request, "If-None-Match", entry->etag);
+    if (!entry->lastModified.empty())
+        setRequestHeader(proxy.request, "If-Modified-Since", entry->lastModified);
+}
+
+//replaces any header of that name the client sent
+void ProxyHandler::setRequestHeader(std::string &request, const std::string &name, const std::string &value)
+{
+    size_t  headersEnd = request.find("\r\n\r\n");
+    size_t  pos = request.find("\r\n");
+
+    if (headersEnd == std::string::npos)
+        return ;
+    while (pos < headersEnd)
+    {
+        const size_t next = request.find("\r\n", pos + 2);
+
+        if (strncasecmp(request.c_str() + pos + 2, name.c_str(), name.length()) == 0
+            && request[pos + 2 + name.length()] == ':')
+        {
+            request.erase(pos, next - pos);
+            headersEnd -= next - pos;
+        }
+        else
+            pos = next;
+    }
+    request.insert(headersEnd, "\r\n" + name + ": " + value);
+}
+
+bool ProxyHandler::isNotModified(const ProxyConnectionInfo &proxy)
+{
+    return proxy.cacheEntry && proxy.framing.getStatusCode() == 304;
+}
+
+//keeps a copy of what may be stored, dropped as soon as the response turns out not to be cacheable
+void ProxyHandler::captureForCache(ProxyConnectionInfo &proxy, bool hadHeaders, const char *data, size_t length)
+{
+    proxy.cacheCapture.append(data, length);
+    if (!hadHeaders && proxy.framing.headersComplete() && !isNotModified(proxy) && !proxy.cache->isStorable(proxy.framing))
+        proxy.cache = nullptr;
+    else if (!hadHeaders && proxy.framing.headersComplete())
+        proxy.cacheCapture.erase(0, rewriteResponseHead(proxy.cacheCapture, proxy.framing)); // without interim responses
+    else if (proxy.cacheCapture.length() > proxy.cache->getMaxEntrySize())
+        proxy.cache = nullptr;
+    if (!proxy.cache)
+        std::string().swap(proxy.cacheCapture);
+}
+
+//a plain GET without a client; any 2xx/3xx keeps the server in rotation
+void ProxyHandler::startHealthProbe(UpstreamGroup &group, UpstreamGroup::Peer &peer, WebServer &webServer)
+{
+    ProxyConnectionInfo probe;
+
+    probe.clientSocket = -1;
+    probe.upstreamKey = peer.key;
+    probe.upstreamAddress = peer.address;
+    probe.group = &group;
+    probe.peer = &peer;
+    probe.healthProbe = true;
+    probe.request = "GET " + group.getHealthCheckUri() + " HTTP/1.1\r\nHost: " + hostHeader(peer.key) + "\r\nConnection: close\r\n\r\n";
+    probe.framing.reset(false);
+    peer.probing = true;
+    try
+    {
+        connectUpstream(std::move(probe), webServer, false);
+    }
+    catch (const WebErrors::ProxyException &e)
+    {
+        group.setHealth(peer, false);
+    }
+}
+
+//takes an idle pooled connection if allowed and available, otherwise starts a new connect
+void ProxyHandler::connectUpstream(ProxyConnectionInfo proxy, WebServer &webServer, bool allowReuse)
+{
+    int upstreamFd = allowReuse ? webServer.getUpstreamPool().acquire(proxy.upstreamKey, proxy.requestsServed) : -1;
+
+    proxy.requestSent = 0;
+    proxy.response.clear();
+    proxy.reusable = false;
+    proxy.lastActivity = std::chrono::steady_clock::now();
+    if (upstreamFd != -1)
+    {
+        proxy.upstreamFd = upstreamFd;
+        proxy.reused = true;
+        proxy.state = PROXY_SENDING;
+        webServer.getProxyConnections().emplace(upstreamFd, std::move(proxy));
+        webServer.eventController(upstreamFd, EPOLL_CTL_MOD, EPOLLOUT, FdType::PROXY_SOCKET);
+        return ;
+    }
+
+    ProxySocket proxySocket = openSocket(proxy);
+
+    proxy.upstreamFd = proxySocket.getFd();
+    proxy.reused = false;
+    proxy.requestsServed = 0;
+    proxy.state = proxySocket.isConnected() ? PROXY_SENDING : PROXY_CONNECTING;
+    upstreamFd = proxySocket.release();
+    webServer.getProxyConnections().emplace(upstreamFd, std::move(proxy));
     try
     {
-        std::string modifiedRequest = _request.getRawRequest();
-
-        auto replaceHostHeader = [&](const std::string& newHost) {
-            size_t hostPos = modifiedRequest.find("Host: ");
-            if (hostPos != std::string::npos)
-            {
-                size_t hostEnd = modifiedRequest.find("\r\n", hostPos);
-                if (hostEnd != std::string::npos)
-                    modifiedRequest.replace(hostPos + 6, hostEnd - (hostPos + 6), newHost);
-            }
-        };
-
-        auto modifyUri = [&]() {
-            std::string locationUri = _request.getLocation()->uri;
-            size_t uriPos = modifiedRequest.find(locationUri);
-            if (uriPos != std::string::npos && locationUri != "/")
-            {
-                std::string newUri = modifiedRequest.substr(uriPos + locationUri.length());
-                if (newUri.empty() || newUri[0] != '/')
-                    newUri = "/" + newUri;
-                modifiedRequest.replace(uriPos, modifiedRequest.find(" ", uriPos) - uriPos, newUri);
-            }
-        };
-
-        replaceHostHeader(_proxyHost);
-        modifyUri();
-
-        return modifiedRequest;
+        webServer.eventController(upstreamFd, EPOLL_CTL_ADD, EPOLLOUT, FdType::PROXY_SOCKET);
     }
     catch (const std::exception &e)
     {
+        webServer.getProxyConnections().erase(upstreamFd);
         throw;
     }
 }
 
-void ProxyHandler::passRequest(std::string &response)
+//the first address from addressIndex on that a connect can be started to
+ProxySocket ProxyHandler::openSocket(ProxyConnectionInfo &proxy)
+{
+    if (!proxy.upstreamAddress || proxy.addressIndex >= proxy.upstreamAddress->size())
+        throw WebErrors::ProxyException("No address for " + proxy.upstreamKey);
+    for (;; proxy.addressIndex++)
+    {
+        try
+        {
+            return ProxySocket((*proxy.upstreamAddress)[proxy.addressIndex], proxy.upstreamKey);
+        }
+        catch (const WebErrors::ProxyException &e)
+        {
+            if (proxy.addressIndex + 1 >= proxy.upstreamAddress->size())
+                throw;
+        }
+    }
+}
+
+/*
+The upstream request is rebuilt from the client's: request line with the location prefix taken off
+the path, the client's header lines in their order minus the hop-by-hop ones (Connection, the headers
+it names, Keep-Alive, Proxy-Connection, TE, Trailer, Upgrade), then our Host, X-Forwarded-For (the
+client's chain with its address appended), X-Real-IP and Connection. The body is not copied, it is
+sent from the client's raw request after these headers (see sendRequest); what is still to come of a
+large one is spliced from the client after that (see WebServer::streamProxyRequest).
+*/
+void ProxyHandler::buildUpstreamRequest(ProxyConnectionInfo &proxy, int clientSocket)
 {
-    try {
-        ProxySocket proxySocket(_proxyInfo, _proxyHost);
-        std::string modifiedRequest = modifyRequestForProxy();
-        char        buffer[8192];
-        ssize_t     bytesRead = 0;
-        ssize_t     bytesSent = 0;
+    const RequestData               &data = _request.getRequestData();
+    const std::string               &raw = _request.getRawRequest();
+    const std::string               &locationUri = _request.getLocation()->uri;
+    const size_t                    headEnd = raw.find("\r\n\r\n");
+    const std::string               clientAddress = peerAddress(clientSocket);
+    std::vector<std::string>        hopByHop = {"connection", "keep-alive", "proxy-connection", "te", "trailer",
+                                                "upgrade", "host", "x-forwarded-for", "x-real-ip"};
+    std::string                     path = data.uri;
+    std::string                     forwardedFor;
+    std::stringstream               named(ProxyCache::findHeader(data.headers, "Connection"));
+    std::string                     token;
+
+    if (headEnd == std::string::npos)
+        throw WebErrors::ProxyException("Incomplete request headers");
+    if (locationUri != "/" && path.compare(0, locationUri.length(), locationUri) == 0)
+        path.erase(0, locationUri.length());
+    if (path.empty() || path[0] != '/')
+        path.insert(0, "/");
+    if (!data.query_string.empty())
+        path += "?" + data.query_string;
+    while (std::getline(named, token, ','))
+        hopByHop.push_back(toLower(WebParser::trimSpaces(token)));
+
+    std::string &head = proxy.request;
+
+    head = data.method + " " + path + " HTTP/1.1\r\n";
+    for (size_t pos = raw.find("\r\n") + 2; pos < headEnd + 2; )
+    {
+        const size_t        lineEnd = raw.find("\r\n", pos);
+        const size_t        colon = raw.find(':', pos);
+        const std::string   name = colon < lineEnd ? toLower(WebParser::trimSpaces(raw.substr(pos, colon - pos))) : "";
+
+        if (name == "x-forwarded-for")
+        {
+            const std::string value = WebParser::trimSpaces(raw.substr(colon + 1, lineEnd - colon - 1));
+            forwardedFor += (forwardedFor.empty() || value.empty() ? "" : ", ") + value;
+        }
+        if (!name.empty() && std::find(hopByHop.begin(), hopByHop.end(), name) == hopByHop.end())
+            head.append(raw, pos, lineEnd + 2 - pos);
+        pos = lineEnd + 2;
+    }
+    head += "Host: " + hostHeader(_proxyHost) + "\r\n";
+    if (!clientAddress.empty())
+    {
+        head += "X-Forwarded-For: " + (forwardedFor.empty() ? clientAddress : forwardedFor + ", " + clientAddress) + "\r\n";
+        head += "X-Real-IP: " + clientAddress + "\r\n";
+    }
+    else if (!forwardedFor.empty())
+        head += "X-Forwarded-For: " + forwardedFor + "\r\n";
+    head += std::string("Connection: ") + (_webServer.getUpstreamPool().isEnabled() ? "keep-alive" : "close") + "\r\n\r\n";
+    proxy.requestBody = _request.getRawRequestBuffer();
+    proxy.bodyOffset = headEnd + 4;
+}
+
+/*
+The response head as the client gets it: interim responses as they came, then the final header block
+minus the hop-by-hop headers (Connection, the headers it names, Keep-Alive, Proxy-Connection, TE,
+Upgrade) and with our own Connection: close. The body keeps the upstream's framing, Transfer-Encoding
+included. bytes holds the head and whatever of the body came along with it; returns where the final
+header block starts in it.
+*/
+size_t ProxyHandler::rewriteResponseHead(std::string &bytes, const ResponseFraming &framing)
+{
+    const std::string           &headers = framing.getHeaders();
+    const size_t                start = bytes.find(headers);
+    std::vector<std::string>    hopByHop = {"connection", "keep-alive", "proxy-connection", "te", "upgrade"};
+    std::stringstream           named(framing.getHeaderValue("Connection"));
+    std::string                 token;
+    std::string                 head;
+
+    if (start == std::string::npos)
+        return 0;
+    while (std::getline(named, token, ','))
+        hopByHop.push_back(toLower(WebParser::trimSpaces(token)));
+    for (size_t pos = 0; pos < headers.length() - 2; )
+    {
+        const size_t        lineEnd = headers.find("\r\n", pos);
+        const size_t        colon = headers.find(':', pos);
+        const std::string   name = colon < lineEnd ? toLower(WebParser::trimSpaces(headers.substr(pos, colon - pos))) : "";
+
+        if (pos == 0 || (!name.empty() && std::find(hopByHop.begin(), hopByHop.end(), name) == hopByHop.end()))
+            head.append(headers, pos, lineEnd + 2 - pos);
+        pos = lineEnd + 2;
+    }
+    head += "Connection: close\r\n\r\n";
+    bytes.replace(start, headers.length(), head);
+    return start;
+}
+
+//a Unix socket path means nothing to the upstream as a Host, it gets "localhost" like with nginx
+std::string ProxyHandler::hostHeader(const std::string &target)
+{
+    return target.compare(0, 5, "unix:") == 0 ? "localhost" : target;
+}
+
+//numeric address of the client, empty when it can't be told
+std::string ProxyHandler::peerAddress(int clientSocket)
+{
+    sockaddr_storage    address{};
+    socklen_t           length = sizeof(address);
+    char                text[INET6_ADDRSTRLEN] = "";
+
+    if (clientSocket < 0 || getpeername(clientSocket, reinterpret_cast<sockaddr *>(&address), &length) == -1)
+        return "";
+    if (address.ss_family == AF_INET)
+        inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in *>(&address)->sin_addr, text, sizeof(text));
+    else if (address.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 *>(&address)->sin6_addr, text, sizeof(text));
+    return text;
+}
+
+//an HTTP/1.1 response that ended on its own framing and didn't ask to close
+bool ProxyHandler::isReusable(const ResponseFraming &framing)
+{
+    std::string connection = framing.getHeaderValue("Connection");
+
+    std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+    return framing.getFraming() != ResponseFraming::FRAMING_CLOSE
+        && framing.getHeaders().compare(0, 9, "HTTP/1.1 ") == 0
+        && connection.find("close") == std::string::npos;
+}
 
-        bytesSent = send(proxySocket.getFd(), modifiedRequest.c_str(), modifiedRequest.length(), 0);
-        if (bytesSent == 0)
-            throw WebErrors::ProxyException("Error sending to proxy server, connection was closed by proxy server");
-        else if (bytesSent < 0)
+//true once the whole request is on the wire
+bool ProxyHandler::sendRequest(ProxyConnectionInfo &proxy)
+{
+    const size_t    headLength = proxy.request.length();
+    const char      *body = proxy.requestBody ? proxy.requestBody->data() + proxy.bodyOffset : nullptr;
+    const size_t    bodyLength = proxy.requestBody ? proxy.requestBody->length() - proxy.bodyOffset : 0;
+
+    while (proxy.requestSent < headLength + bodyLength)
+    {
+        iovec   segments[2];
+        int     count = 0;
+
+        if (proxy.requestSent < headLength)
+            segments[count++] = {const_cast<char *>(proxy.request.data()) + proxy.requestSent, headLength - proxy.requestSent};
+        if (bodyLength > 0)
+        {
+            const size_t bodySent = proxy.requestSent > headLength ? proxy.requestSent - headLength : 0;
+            segments[count++] = {const_cast<char *>(body) + bodySent, bodyLength - bodySent};
+        }
+
+        const ssize_t bytesSent = writev(proxy.upstreamFd, segments, count);
+
+        if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        if (bytesSent <= 0)
             throw WebErrors::ProxyException("Error sending to proxy server");
+        proxy.requestSent += bytesSent;
+    }
+    return true;
+}
+
+/*
+true once the response is complete, either by its framing or because the upstream closed.
+Bytes go to the client's output as they arrive (only the header block is held back, so a bad one
+still turns into a 502), and reading stops at the high watermark for the caller to pause.
+Health probes have no output, only the framing is kept.
+Past the headers, a large Content-Length or close-delimited body is spliced instead of copied.
+*/
+bool ProxyHandler::readResponse(ProxyConnectionInfo &proxy, ClientOutput *output)
+{
+    char    buffer[16384];
+
+    while (!output || output->pending() < PROXY_BUFFER_HIGH)
+    {
+        if (output && output->isSplicing())
+            return spliceResponse(proxy, *output);
+
+        const ssize_t bytesRead = recv(proxy.upstreamFd, buffer, sizeof(buffer), 0);
+        const bool    hadHeaders = proxy.framing.headersComplete();
+
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        if (bytesRead < 0)
+            throw WebErrors::ProxyException("Error reading from proxy server");
+        if (bytesRead == 0)
+        {
+            proxy.framing.onEof();
+            if (!proxy.framing.headersComplete())
+                throw WebErrors::ProxyException("Proxy server closed the connection before responding");
+            return true;
+        }
+        const size_t used = proxy.framing.feed(buffer, bytesRead);
+        proxy.bytesReceived += used;
+        if (proxy.framing.isMalformed())
+            throw WebErrors::ProxyException("Malformed response from proxy server");
+        if (proxy.cache)
+            captureForCache(proxy, hadHeaders, buffer, used);
+        if (!proxy.framing.headersComplete())
+            proxy.response.append(buffer, used);
+        else if (!output || isNotModified(proxy))
+            proxy.response.clear();
+        else if (!hadHeaders)
+        {
+            proxy.response.append(buffer, used);
+            rewriteResponseHead(proxy.response, proxy.framing);
+            output->data += proxy.response;
+            output->started = true;
+            proxy.response.clear();
+        }
+        else
+            output->data.append(buffer, used);
+        if (proxy.framing.isComplete())
+        {
+            proxy.reusable = used == static_cast<size_t>(bytesRead) && isReusable(proxy.framing);
+            return true;
+        }
+        if (output && !proxy.cache && !hadHeaders && proxy.framing.headersComplete()
+            && proxy.framing.getPlainBodyRemaining() >= PROXY_SPLICE_MIN)
+            openSplicePipe(*output);
+    }
+    return false;
+}
+
+//upstream -> pipe without a copy to user space, the client side splices it out in flushClientOutput
+bool ProxyHandler::spliceResponse(ProxyConnectionInfo &proxy, ClientOutput &output)
+{
+    while (output.pending() < PROXY_BUFFER_HIGH)
+    {
+        const size_t  length = std::min(PROXY_BUFFER_HIGH - output.pending(), proxy.framing.getPlainBodyRemaining());
+        const ssize_t bytesMoved = splice(proxy.upstreamFd, nullptr, output.pipeFds[1], nullptr, length,
+                                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
 
-        while (isDataAvailable(proxySocket.getFd(), 20000)) // 2ms timeout
+        if (bytesMoved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        //splice not supported for this pair of fds: copy the rest like any other body
+        if (bytesMoved < 0 && errno == EINVAL && output.piped == 0)
         {
-            bytesRead = recv(proxySocket.getFd(), buffer, sizeof(buffer), 0);
-            if (bytesRead > 0)
-            {
-                response.append(buffer, bytesRead);
-            }
-            else if (bytesRead == 0)
-                break;
-            else if (bytesRead < 0)
-                throw WebErrors::ProxyException("Error reading from proxy server");
+            output.closePipe();
+            return readResponse(proxy, &output);
+        }
+        if (bytesMoved < 0)
+            throw WebErrors::ProxyException("Error reading from proxy server");
+        if (bytesMoved == 0)
+        {
+            proxy.framing.onEof();
+            return true;
+        }
+        output.piped += bytesMoved;
+        proxy.bytesReceived += bytesMoved;
+        proxy.framing.skipPlainBody(bytesMoved);
+        if (proxy.framing.isComplete())
+        {
+            proxy.reusable = isReusable(proxy.framing);
+            return true;
         }
     }
-    catch (const std::exception &e)
+    return false;
+}
+
+//sized to the high watermark; without one (fd limit, pipe size limit) the body is copied as before
+void ProxyHandler::openSplicePipe(ClientOutput &output)
+{
+    int fds[2];
+
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1)
+        return ;
+    if (fcntl(fds[1], F_SETPIPE_SZ, PROXY_BUFFER_HIGH) < PROXY_BUFFER_HIGH)
     {
-        throw ;
+        close(fds[0]);
+        close(fds[1]);
+        return ;
     }
+    output.pipeFds[0] = fds[0];
+    output.pipeFds[1] = fds[1];
 }
@@ -1,21 +1,53 @@
 #pragma once
 
 #include "ScopedSocket.hpp"
+#include "ProxySocket.hpp"
 #include "Request.hpp"
+#include "WebServer.hpp"
 #include <string>
 
+#define PROXY_CONNECT_TIMEOUT 5
+#define PROXY_READ_TIMEOUT 30
+#define PROXY_CONNECT_ATTEMPT_DELAY 1   // seconds before a connect still pending gives way to the next address
+#define PROXY_BUFFER_HIGH (256 * 1024)  // upstream reads pause once this much waits for the client
+#define PROXY_BUFFER_LOW (64 * 1024)    // and resume when the client drained it below this
+#define PROXY_SPLICE_MIN (64 * 1024)    // smaller bodies aren't worth a pipe, they are copied
+
+/*
+Starts a proxied request without blocking: an idle keep-alive connection is taken from the
+UpstreamPool, or a new connect is begun, and the socket is registered in the event loop
+(FdType::PROXY_SOCKET). The static steps below are driven from
+WebServer::handleProxyInteraction as the upstream becomes writable/readable.
+*/
 class ProxyHandler
 {
 public:
-    ProxyHandler(const Request& request);
+    ProxyHandler(const Request& request, WebServer &webServer, int clientSocket);
     ~ProxyHandler() = default;
-    void passRequest(std::string &response);
+
+    static void     connectUpstream(ProxyConnectionInfo proxy, WebServer &webServer, bool allowReuse);
+    static void     startHealthProbe(UpstreamGroup &group, UpstreamGroup::Peer &peer, WebServer &webServer);
+    static bool     sendRequest(ProxyConnectionInfo &proxy);
+    static bool     readResponse(ProxyConnectionInfo &proxy, ClientOutput *output);
+    static bool     spliceResponse(ProxyConnectionInfo &proxy, ClientOutput &output);
+    static void     openSplicePipe(ClientOutput &output);
+    static bool     isReusable(const ResponseFraming &framing);
+    static std::string peerAddress(int clientSocket);
 
 private:
+    WebServer       &_webServer;
     const Request&  _request;
-    addrinfo*       _proxyInfo;
+    AddressList     _proxyInfo;
     std::string     _proxyHost;
-    void            sendRequestToProxy(ScopedSocket& proxySocket, const std::string& modifiedRequest);
-    bool            isDataAvailable(int fd, int timeout_usec);
-    std::string     modifyRequestForProxy();
+    void            buildUpstreamRequest(ProxyConnectionInfo &proxy, int clientSocket);
+    void            startRequest(ProxyConnectionInfo proxy);
+    bool            serveFromCache(ProxyCache &cache, ProxyConnectionInfo &proxy);
+
+    static void     makeConditional(ProxyConnectionInfo &proxy, const ProxyCache::EntryPtr &entry);
+    static void     setRequestHeader(std::string &request, const std::string &name, const std::string &value);
+    static bool     isNotModified(const ProxyConnectionInfo &proxy);
+    static ProxySocket openSocket(ProxyConnectionInfo &proxy);
+    static std::string hostHeader(const std::string &target);
+    static void     captureForCache(ProxyConnectionInfo &proxy, bool hadHeaders, const char *data, size_t length);
+    static size_t   rewriteResponseHead(std::string &bytes, const ResponseFraming &framing);
 };
@@ -1,7 +1,6 @@
 #include "Response.hpp"
 #include "CGIHandler/CGIHandler.hpp"
 #include "ErrorHandler/ErrorHandler.hpp"
-#include "ProxyHandler/ProxyHandler.hpp"
 #include "Request.hpp"
 #include "ScopedSocket.hpp"
 #include "WebErrors.hpp"
@@ -13,7 +12,8 @@
 #include "StaticFileHandler.hpp"
 #include "WebServer.hpp"
 
-Response::Response(const Request &request)
+Response::Response(const Request &request, std::string *fileContent, int fileError)
+    : _fileContent(fileContent), _fileError(fileError)
 {
     try {
         _response = generate(request);
@@ -43,14 +43,10 @@ std::string Response::generate(const Request &request)
             response += "\r\n";
             return response;
         }
-        else if (request.getLocation()->type == LocationType::PROXY)
-        {
-            ProxyHandler(request).passRequest(response);
-        }
         else if (request.getLocation()->type == LocationType::STANDARD
             || request.getLocation()->type == LocationType::ALIAS)
         {
-            StaticFileHandler(request).serveFile(response);
+            StaticFileHandler(request, _fileContent, _fileError).serveFile(response);
         }
         if (request.getRequestData().method == "HEAD" && request.getErrorCode() == 0)
         {
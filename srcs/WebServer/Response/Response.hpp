@@ -9,18 +9,15 @@ class Request;
 class Response
 {
 public:
-    Response(const Request &request);
+    Response(const Request &request, std::string *fileContent = nullptr, int fileError = 0);
     ~Response() = default;
 
     const std::string   &getResponse() const;
 
 private:
     std::string    _response;
+    std::string    *_fileContent;   // the file already read by the event backend, or its errno in _fileError
+    int            _fileError;
 
-    ScopedSocket    createProxySocket(addrinfo* proxyInfo);
-    void            sendRequestToProxy(ScopedSocket& proxySocket, const std::string& modifiedRequest);
-    void            receiveResponseFromProxy(ScopedSocket& proxySocket, std::string &response, const std::string& proxyHost);
-    void            handleProxyPass(const Request& request, std::string &response);
-    bool            isDataAvailable(int fd, int timeout_usec);
     std::string     generate(const Request &request);
 };
@@ -0,0 +1,203 @@
+#include "ResponseFraming.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <strings.h>
+
+#define MAX_RESPONSE_HEADER_SIZE 65536
+
+ResponseFraming::ResponseFraming(bool isHeadRequest)
+{
+    reset(isHeadRequest);
+}
+
+void ResponseFraming::reset(bool isHeadRequest)
+{
+    _isHeadRequest = isHeadRequest;
+    _state = HEADERS;
+    _framing = FRAMING_UNKNOWN;
+    _statusCode = 0;
+    _headers.clear();
+    _line.clear();
+    _remaining = 0;
+}
+
+size_t ResponseFraming::feed(const char *data, size_t length)
+{
+    size_t consumed = 0;
+
+    while (consumed < length && _state != DONE && _state != MALFORMED)
+    {
+        switch (_state)
+        {
+            case HEADERS:
+                _headers += data[consumed++];
+                if (_headers.length() >= 4 && _headers.compare(_headers.length() - 4, 4, "\r\n\r\n") == 0)
+                    onHeadersComplete();
+                else if (_headers.length() > MAX_RESPONSE_HEADER_SIZE)
+                    _state = MALFORMED;
+                break;
+            case BODY_LENGTH:
+            case CHUNK_DATA:
+            {
+                const size_t take = std::min(_remaining, length - consumed);
+                consumed += take;
+                _remaining -= take;
+                if (_remaining == 0)
+                    _state = (_state == BODY_LENGTH) ? DONE : CHUNK_DATA_END;
+                break;
+            }
+            case CHUNK_DATA_END:
+            case CHUNK_SIZE:
+            case TRAILERS:
+                _line += data[consumed++];
+                if (_line.back() != '\n')
+                {
+                    if (_line.length() > 4096)
+                        _state = MALFORMED;
+                    break;
+                }
+                if (_state == CHUNK_DATA_END)
+                    _state = (_line == "\r\n") ? CHUNK_SIZE : MALFORMED;
+                else if (_state == CHUNK_SIZE)
+                    onChunkSizeLine();
+                else if (_line == "\r\n")
+                    _state = DONE;
+                _line.clear();
+                break;
+            case BODY_UNTIL_CLOSE:
+                consumed = length;
+                break;
+            default:
+                break;
+        }
+    }
+    return consumed;
+}
+
+void ResponseFraming::onHeadersComplete()
+{
+    const size_t space = _headers.find(' ');
+
+    if (_headers.compare(0, 5, "HTTP/") != 0 || space == std::string::npos)
+    {
+        _state = MALFORMED;
+        return ;
+    }
+    _statusCode = std::atoi(_headers.c_str() + space + 1);
+    // an interim response is followed by the real one on the same connection
+    if (_statusCode >= 100 && _statusCode < 200 && _statusCode != 101)
+    {
+        _headers.clear();
+        return ;
+    }
+
+    std::string       transferEncoding = getHeaderValue("Transfer-Encoding");
+    const std::string contentLength = getHeaderValue("Content-Length");
+
+    std::transform(transferEncoding.begin(), transferEncoding.end(), transferEncoding.begin(), ::tolower);
+    if (_isHeadRequest || _statusCode == 204 || _statusCode == 304)
+    {
+        _framing = FRAMING_NONE;
+        _state = DONE;
+    }
+    else if (transferEncoding.find("chunked") != std::string::npos)
+    {
+        _framing = FRAMING_CHUNKED;
+        _state = CHUNK_SIZE;
+    }
+    else if (!contentLength.empty())
+    {
+        char *end = nullptr;
+        _remaining = std::strtoul(contentLength.c_str(), &end, 10);
+        _framing = FRAMING_LENGTH;
+        _state = (_remaining == 0) ? DONE : BODY_LENGTH;
+    }
+    else
+    {
+        _framing = FRAMING_CLOSE;
+        _state = BODY_UNTIL_CLOSE;
+    }
+}
+
+void ResponseFraming::onChunkSizeLine()
+{
+    char            *end = nullptr;
+    unsigned long   size = std::strtoul(_line.c_str(), &end, 16);
+
+    if (end == _line.c_str())
+    {
+        _state = MALFORMED;
+        return ;
+    }
+    _remaining = size;
+    _state = (size == 0) ? TRAILERS : CHUNK_DATA;
+}
+
+void ResponseFraming::onEof()
+{
+    if (_state == BODY_UNTIL_CLOSE)
+        _state = DONE;
+}
+
+/*
+Body bytes that can be passed on without being looked at (Content-Length or close-delimited body),
+so a caller can move them without feed(); chunked bodies always go through feed().
+*/
+size_t ResponseFraming::getPlainBodyRemaining() const
+{
+    if (_state == BODY_LENGTH)
+        return _remaining;
+    if (_state == BODY_UNTIL_CLOSE)
+        return static_cast<size_t>(-1);
+    return 0;
+}
+
+//accounts for plain body bytes that were forwarded without feed()
+void ResponseFraming::skipPlainBody(size_t length)
+{
+    if (_state != BODY_LENGTH)
+        return ;
+    _remaining -= std::min(_remaining, length);
+    if (_remaining == 0)
+        _state = DONE;
+}
+
+bool ResponseFraming::headersComplete() const { return _framing != FRAMING_UNKNOWN; }
+
+bool ResponseFraming::isComplete() const { return _state == DONE; }
+
+bool ResponseFraming::isMalformed() const { return _state == MALFORMED; }
+
+int ResponseFraming::getStatusCode() const { return _statusCode; }
+
+ResponseFraming::Framing ResponseFraming::getFraming() const { return _framing; }
+
+const std::string &ResponseFraming::getHeaders() const { return _headers; }
+
+//case-insensitive, first occurrence, surrounding whitespace trimmed; empty if absent
+std::string ResponseFraming::getHeaderValue(const std::string &name) const
+{
+    size_t lineStart = _headers.find("\r\n");
+
+    while (lineStart != std::string::npos && lineStart + 2 < _headers.length())
+    {
+        lineStart += 2;
+        const size_t lineEnd = _headers.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos || lineEnd == lineStart)
+            break;
+        if (lineEnd - lineStart > name.length() && _headers[lineStart + name.length()] == ':'
+            && strncasecmp(_headers.c_str() + lineStart, name.c_str(), name.length()) == 0)
+        {
+            size_t valueStart = lineStart + name.length() + 1;
+            size_t valueEnd = lineEnd;
+            while (valueStart < valueEnd && std::isspace(static_cast<unsigned char>(_headers[valueStart])))
+                valueStart++;
+            while (valueEnd > valueStart && std::isspace(static_cast<unsigned char>(_headers[valueEnd - 1])))
+                valueEnd--;
+            return _headers.substr(valueStart, valueEnd - valueStart);
+        }
+        lineStart = lineEnd;
+    }
+    return "";
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+/*
+Incremental HTTP/1.x response framing: tells where an upstream response ends without buffering it.
+feed() returns how many of the given bytes belong to the current response, so whatever follows
+(a pipelined or stray response) is never mistaken for body. The header block is kept for callers
+that need the status code or header values.
+Body length follows RFC 9112 6.3: no body for HEAD, 1xx, 204 and 304, then chunked,
+then Content-Length, otherwise the body runs until the upstream closes the connection.
+*/
+class ResponseFraming
+{
+public:
+    enum Framing { FRAMING_UNKNOWN, FRAMING_NONE, FRAMING_LENGTH, FRAMING_CHUNKED, FRAMING_CLOSE };
+
+    ResponseFraming(bool isHeadRequest = false);
+
+    size_t              feed(const char *data, size_t length);
+    void                onEof();
+    void                reset(bool isHeadRequest);
+    size_t              getPlainBodyRemaining() const;
+    void                skipPlainBody(size_t length);
+
+    bool                headersComplete() const;
+    bool                isComplete() const;
+    bool                isMalformed() const;
+    int                 getStatusCode() const;
+    Framing             getFraming() const;
+    const std::string   &getHeaders() const;
+    std::string         getHeaderValue(const std::string &name) const;
+
+private:
+    enum State { HEADERS, BODY_LENGTH, CHUNK_SIZE, CHUNK_DATA, CHUNK_DATA_END, TRAILERS, BODY_UNTIL_CLOSE, DONE, MALFORMED };
+
+    bool                _isHeadRequest;
+    State               _state;
+    Framing             _framing;
+    int                 _statusCode;
+    std::string         _headers;
+    std::string         _line;
+    size_t              _remaining;
+
+    void                onHeadersComplete();
+    void                onChunkSizeLine();
+};
@@ -1,19 +1,20 @@
 #include "StaticFileHandler.hpp"
+#include <cerrno>
 #include <filesystem>
 #include <numeric>
 #include "ErrorHandler.hpp"
 #include "WebErrors.hpp"
 #include "WebServer.hpp"
 
-StaticFileHandler::StaticFileHandler(const Request& request) 
-    : _request(request) {}
+StaticFileHandler::StaticFileHandler(const Request& request, std::string *fileContent, int fileError)
+    : _request(request), _fileContent(fileContent), _fileError(fileError) {}
 
 void StaticFileHandler::serveFile(std::string& response)
 {
     try
     {
         const std::string& fullPath = _request.getRequestData().uri;
-        const bool isAutoIndex = std::filesystem::is_directory(fullPath) && _request.getLocation()->autoIndexOn;
+        const bool isAutoIndex = !_fileContent && std::filesystem::is_directory(fullPath) && _request.getLocation()->autoIndexOn;
 
         auto appendHeaders = [&](const std::string& status, const std::string& mimeType, size_t contentLength) {
             response += "HTTP/1.1 " + status + "\r\n";
@@ -32,7 +33,13 @@ void StaticFileHandler::serveFile(std::string& response)
             return;
         }
 
-        if (!std::filesystem::exists(fullPath))
+        if (_fileContent && _fileError != 0)
+        {
+            ErrorHandler    errorHandler(_request.getServer());
+            errorHandler.handleError(response, _fileError == ENOENT || _fileError == ENOTDIR ? NOT_FOUND : SERVER_ERROR);
+            return;
+        }
+        if (!_fileContent && !std::filesystem::exists(fullPath))
         {
             ErrorHandler    errorHandler(_request.getServer());
             errorHandler.handleError(response, NOT_FOUND);
@@ -41,7 +48,10 @@ void StaticFileHandler::serveFile(std::string& response)
 
         std::string fileContent;
         try {
-            readFileContent(fullPath, fileContent);
+            if (_fileContent)
+                fileContent = std::move(*_fileContent);
+            else
+                readFileContent(fullPath, fileContent);
         } catch (const std::exception& e) {
             ErrorHandler    errorHandlerServer(_request.getServer());
             errorHandlerServer.handleError(response, SERVER_ERROR);
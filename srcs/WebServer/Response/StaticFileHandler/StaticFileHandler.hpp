@@ -5,11 +5,13 @@
 class StaticFileHandler
 {
 public:
-    StaticFileHandler(const Request& request);
+    StaticFileHandler(const Request& request, std::string *fileContent = nullptr, int fileError = 0);
     void serveFile(std::string& response);
 
 private:
     const Request& _request;
+    std::string    *_fileContent;  // read beforehand, see WebServer::handleOutgoingData; nullptr to read it here
+    int            _fileError;
 
     void        handleCookies(const Request &request, std::string &response);
     bool        fileExists(const std::string& path) const;
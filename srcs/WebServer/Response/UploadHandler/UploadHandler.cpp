@@ -0,0 +1,367 @@
+#include "UploadHandler.hpp"
+#include "ErrorHandler.hpp"
+#include "ProxyCache.hpp"
+#include "WebServer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sstream>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+UploadHandler::UploadHandler(const Request &request)
+    : _server(request.getServer()), _folder(request.getLocation()->upload_folder), _state(RAW), _remaining(0)
+{
+    start(request);
+    if (_remaining == 0)
+        finish();
+}
+
+//the checks that can be made on the headers, the target file of a PUT or the boundary of a multipart POST
+void UploadHandler::start(const Request &request)
+{
+    const RequestData   &data = request.getRequestData();
+    const std::string   contentLength = ProxyCache::findHeader(data.headers, "Content-Length");
+    const std::string   contentType = ProxyCache::findHeader(data.headers, "Content-Type");
+    std::error_code     error;
+
+    if (!ProxyCache::findHeader(data.headers, "Transfer-Encoding").empty() || (contentLength.empty() && data.method == "PUT"))
+        return fail(411, "an upload needs a Content-Length");
+    if (contentLength.find_first_not_of("0123456789") != std::string::npos || contentLength.size() > 18)
+        return fail(400, "invalid Content-Length '" + contentLength + "'");
+    _remaining = contentLength.empty() ? 0 : std::stoull(contentLength);
+    std::filesystem::create_directories(_folder, error);
+    if (error)
+        return fail(500, "can't create the upload folder " + _folder + ": " + error.message());
+    if (data.method == "PUT")
+    {
+        std::string name = data.uri.substr(std::min(data.uri.size(), request.getLocation()->uri.size()));
+
+        if (!name.empty() && name.front() == '/')
+            name.erase(0, 1);
+        if (!isValidFilename(name))
+            return fail(400, "no file name in " + data.uri);
+        _status = access((_folder + "/" + name).c_str(), F_OK) == 0 ? 200 : 201;
+        openFile("", name);
+    }
+    else
+    {
+        const std::string boundary = findParameter(contentType, "boundary");
+
+        if (strncasecmp(contentType.c_str(), "multipart/form-data", 19) != 0)
+            return fail(415, "POST uploads are multipart/form-data, not '" + contentType + "'");
+        if (boundary.empty() || boundary.size() > 70)
+            return fail(400, "no multipart boundary in '" + contentType + "'");
+        _delimiter = "\r\n--" + boundary;
+        _pending = "\r\n"; // the body starts right at the first delimiter, without the line break before it
+        _state = PREAMBLE;
+    }
+}
+
+//files not complete yet are removed
+UploadHandler::~UploadHandler()
+{
+    for (const File &file : _files)
+    {
+        if (file.fd != -1)
+            close(file.fd);
+        if (!file.tempPath.empty())
+            unlink(file.tempPath.c_str());
+    }
+}
+
+//body bytes as they arrive, anything past the Content-Length is not taken; after a failure they are dropped
+void UploadHandler::feed(const char *data, size_t length)
+{
+    length = std::min(length, _remaining);
+    _remaining -= length;
+    if (_errorCode != 0)
+        return ;
+    if (_state == RAW)
+        writeFile(data, length);
+    else
+    {
+        _pending.append(data, length);
+        parseMultipart();
+    }
+    if (_remaining == 0)
+        finish();
+}
+
+//the whole body was taken, or it failed; what is left of it still has to be read
+bool UploadHandler::isDone() const { return _errorCode != 0 || _remaining == 0; }
+
+size_t UploadHandler::getRemaining() const { return _remaining; }
+
+int UploadHandler::getErrorCode() const { return _errorCode; }
+
+std::string UploadHandler::getResponse() const
+{
+    std::string response;
+    std::string body = "{\"files\":[";
+
+    if (_errorCode != 0)
+        return ErrorHandler(_server).handleError(response, _errorCode), response;
+    for (const File &file : _files)
+    {
+        body += &file == &_files.front() ? "{" : ",{";
+        if (!file.field.empty())
+            body += "\"field\":" + jsonString(file.field) + ",";
+        body += "\"filename\":" + jsonString(file.filename) + ",\"size\":" + std::to_string(file.size) + "}";
+    }
+    body += "]}\n";
+    response = _status == 201 ? "HTTP/1.1 201 Created\r\n" : "HTTP/1.1 200 OK\r\n";
+    response += "Content-Type: application/json\r\n";
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    return response + body;
+}
+
+void UploadHandler::finish(void)
+{
+    if (_errorCode != 0)
+        return ;
+    if (_state == RAW)
+        return closeFile();
+    if (_state != EPILOGUE)
+        fail(400, "the multipart body ends before its closing delimiter");
+}
+
+/*
+Parts are separated by CRLF "--" boundary, which the body is searched for as it comes; up to a delimiter's
+worth of bytes is held back from a file in case one starts there. Between the delimiter and the CRLF
+before the part's headers may come spaces (transport padding); "--" instead of the CRLF ends the body.
+*/
+void UploadHandler::parseMultipart(void)
+{
+    size_t position = 0;
+
+    while (_errorCode == 0 && position < _pending.size())
+    {
+        const char      *begin = _pending.data() + position;
+        const size_t    available = _pending.size() - position;
+
+        if (_state == PREAMBLE || _state == PART_BODY)
+        {
+            const char      *found = static_cast<const char *>(memmem(begin, available, _delimiter.data(), _delimiter.size()));
+            const size_t    take = found ? found - begin : available - std::min(available, _delimiter.size() - 1);
+
+            if (_state == PART_BODY && !_files.empty() && _files.back().fd != -1)
+                writeFile(begin, take);
+            position += take;
+            if (!found)
+                break ;
+            if (_state == PART_BODY)
+                closeFile();
+            position += _delimiter.size();
+            _state = DELIMITER;
+        }
+        else if (_state == DELIMITER)
+        {
+            if (*begin == ' ' || *begin == '\t')
+            {
+                position++;
+                continue ;
+            }
+            if (available < 2)
+                break ;
+            if (begin[0] == '-' && begin[1] == '-')
+                _state = EPILOGUE;
+            else if (begin[0] == '\r' && begin[1] == '\n')
+                _state = PART_HEADERS;
+            else
+                return fail(400, "malformed multipart delimiter");
+            position += 2;
+        }
+        else if (_state == PART_HEADERS)
+        {
+            const size_t end = _pending.compare(position, 2, "\r\n") == 0 ? position : _pending.find("\r\n\r\n", position);
+
+            if (end == std::string::npos)
+            {
+                if (available > UPLOAD_HEADERS_MAX)
+                    fail(400, "multipart part headers too large");
+                break ;
+            }
+
+            const std::string headers = _pending.substr(position, end - position);
+
+            position = end + (end == position ? 2 : 4);
+            if (!startPart(headers))
+                return ;
+            _state = PART_BODY;
+        }
+        else
+            position = _pending.size(); // the epilogue, ignored
+    }
+    _pending.erase(0, position);
+}
+
+//a file for a part with a filename; false on failure
+bool UploadHandler::startPart(const std::string &headers)
+{
+    std::istringstream  stream(headers);
+    std::string         line;
+
+    while (std::getline(stream, line))
+    {
+        const size_t colon = line.find(':');
+
+        if (colon == std::string::npos || strcasecmp(line.substr(0, colon).c_str(), "Content-Disposition") != 0)
+            continue ;
+
+        const std::string   disposition = line.substr(colon + 1);
+        std::string         filename = findParameter(disposition, "filename");
+
+        if (filename.empty())
+            return true; // a form field
+        filename = filename.substr(filename.find_last_of("/\\") + 1); // some browsers send the whole path
+        if (!isValidFilename(filename))
+            return fail(400, "invalid file name '" + filename + "'"), false;
+        return openFile(findParameter(disposition, "name"), filename);
+    }
+    return true;
+}
+
+/*
+The space the rest of the body could take is reserved for the file right away; ENOSPC there is the 507
+the upload would run into anyway. EOPNOTSUPP and the like just mean the file system can't tell in advance.
+*/
+bool UploadHandler::openFile(const std::string &field, const std::string &filename)
+{
+    std::string     path = _folder + "/.upload-XXXXXX";
+    const size_t    reserve = _remaining + _pending.size();
+    File            file;
+
+    file.field = field;
+    file.filename = filename;
+    file.fd = mkostemp(&path[0], O_CLOEXEC);
+    if (file.fd == -1)
+        return fail(errno == ENOSPC || errno == EDQUOT ? 507 : 500, "can't create a file in " + _folder + ": " + strerror(errno)), false;
+    file.tempPath = path;
+    _files.push_back(file);
+    fchmod(file.fd, 0644);
+    if (reserve > 0 && fallocate(file.fd, 0, 0, reserve) == -1 && (errno == ENOSPC || errno == EDQUOT))
+        return fail(507, "no room for " + std::to_string(reserve) + " bytes in " + _folder), false;
+    return true;
+}
+
+void UploadHandler::writeFile(const char *data, size_t length)
+{
+    File &file = _files.back();
+
+    while (length > 0)
+    {
+        const ssize_t written = write(file.fd, data, length);
+
+        if (written < 0 && errno == EINTR)
+            continue ;
+        if (written < 0)
+            return fail(errno == ENOSPC || errno == EDQUOT ? 507 : 500, "writing " + file.filename + ": " + strerror(errno));
+        data += written;
+        length -= written;
+        file.size += written;
+    }
+}
+
+//cut down to what was written, past the reservation, and moved into place
+void UploadHandler::closeFile(void)
+{
+    if (_files.empty() || _files.back().fd == -1)
+        return ;
+
+    File                &file = _files.back();
+    const std::string   path = _folder + "/" + file.filename;
+    const bool          written = ftruncate(file.fd, file.size) == 0;
+
+    if (close(file.fd) == -1 || !written || rename(file.tempPath.c_str(), path.c_str()) == -1)
+    {
+        file.fd = -1;
+        return fail(500, "storing " + path + ": " + strerror(errno));
+    }
+    file.fd = -1;
+    file.tempPath.clear();
+    std::cout << COLOR_GREEN_SERVER << "  Stored " << path << " (" << file.size << " bytes) 📦\n\n" << COLOR_RESET;
+}
+
+//the file being written is removed, those already stored stay
+void UploadHandler::fail(int errorCode, const std::string &reason)
+{
+    if (_errorCode != 0)
+        return ;
+    _errorCode = errorCode;
+    std::cerr << COLOR_RED_ERROR << "Upload failed: " << reason << "\n\n" << COLOR_RESET;
+    if (_files.empty() || _files.back().tempPath.empty())
+        return ;
+    if (_files.back().fd != -1)
+        close(_files.back().fd);
+    unlink(_files.back().tempPath.c_str());
+    _files.pop_back();
+}
+
+//a parameter of a header value such as name="file"; quoted or not, empty if absent
+std::string UploadHandler::findParameter(const std::string &value, const std::string &name)
+{
+    size_t position = value.find(';');
+
+    while (position != std::string::npos)
+    {
+        const size_t equals = value.find('=', position);
+
+        if (equals == std::string::npos)
+            break ;
+
+        const std::string   key = WebParser::trimSpaces(value.substr(position + 1, equals - position - 1));
+        std::string         result;
+
+        position = value.find_first_not_of(" \t", equals + 1);
+        if (position != std::string::npos && value[position] == '"')
+        {
+            const size_t quote = value.find('"', position + 1);
+
+            result = value.substr(position + 1, quote - position - 1);
+            position = quote == std::string::npos ? quote : value.find(';', quote);
+        }
+        else if (position != std::string::npos)
+        {
+            const size_t end = value.find(';', position);
+
+            result = WebParser::trimSpaces(value.substr(position, end - position));
+            position = end;
+        }
+        if (strcasecmp(key.c_str(), name.c_str()) == 0)
+            return result;
+    }
+    return "";
+}
+
+//a plain name within the upload folder
+bool UploadHandler::isValidFilename(const std::string &filename)
+{
+    return !filename.empty() && filename != "." && filename != ".." && filename.find('/') == std::string::npos
+        && std::none_of(filename.begin(), filename.end(), [](unsigned char c) { return c < 0x20 || c == 0x7f; });
+}
+
+std::string UploadHandler::jsonString(const std::string &value)
+{
+    std::string result = "\"";
+
+    for (unsigned char c : value)
+    {
+        if (c == '"' || c == '\\')
+            result += std::string("\\") + static_cast<char>(c);
+        else if (c < 0x20)
+        {
+            char escaped[7];
+
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            result += escaped;
+        }
+        else
+            result += static_cast<char>(c);
+    }
+    return result + "\"";
+}
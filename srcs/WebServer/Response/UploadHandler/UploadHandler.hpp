@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Request.hpp"
+
+#define UPLOAD_HEADERS_MAX 8192     // bytes of the headers of one multipart part
+#define UPLOAD_READ_MAX 1048576     // bytes of request body taken per event
+
+/*
+POST and PUT to a location with upload_folder (root or alias, see Location::uploadOn) are stored by the
+server itself, the body going to disk as it arrives:
+- multipart/form-data is parsed as it comes, every part with a filename is written to that name (its
+  last path segment) in the upload folder; parts without one are form fields, skipped;
+- a PUT body is written raw to the last segment of the URI.
+Each file is written under a temporary name in the folder and renamed into place once complete, so an
+upload cut short leaves nothing behind. The Content-Length bounds every file, and is fallocate()d up
+front so that a full disk shows as a 507 before any of it is written; a part is then truncated to its
+size. The result is a small JSON list of the stored files.
+*/
+class UploadHandler
+{
+public:
+    UploadHandler(const Request &request);
+    ~UploadHandler();
+    UploadHandler(const UploadHandler &) = delete;
+    UploadHandler &operator=(const UploadHandler &) = delete;
+
+    void        feed(const char *data, size_t length);
+    bool        isDone() const;
+    size_t      getRemaining() const;
+    int         getErrorCode() const;
+    std::string getResponse() const;
+
+private:
+    enum State { PREAMBLE, DELIMITER, PART_HEADERS, PART_BODY, EPILOGUE, RAW };
+
+    struct File
+    {
+        std::string field;      //multipart name, empty for PUT
+        std::string filename;
+        std::string tempPath;
+        size_t      size = 0;
+        int         fd = -1;    //open while it is written
+    };
+
+    const Server        *_server;
+    std::string         _folder;
+    State               _state;
+    std::string         _delimiter;     //CRLF "--" boundary
+    std::string         _pending;       //multipart bytes not taken yet, at most a delimiter's worth within a part
+    size_t              _remaining;     //of the Content-Length
+    int                 _errorCode = 0;
+    int                 _status = 200;
+    std::vector<File>   _files;         //the last one is being written when its fd is open
+
+    void                start(const Request &request);
+    void                finish(void);
+    void                parseMultipart(void);
+    bool                startPart(const std::string &headers);
+    bool                openFile(const std::string &field, const std::string &filename);
+    void                writeFile(const char *data, size_t length);
+    void                closeFile(void);
+    void                fail(int errorCode, const std::string &reason);
+    static std::string  findParameter(const std::string &value, const std::string &name);
+    static bool         isValidFilename(const std::string &filename);
+    static std::string  jsonString(const std::string &value);
+};
@@ -1,15 +1,19 @@
 #include "ProxySocket.hpp"
+#include <cerrno>
 
-ProxySocket::ProxySocket(addrinfo* proxyInfo, const std::string& proxyHost)
-    : ScopedSocket(socket(proxyInfo->ai_family, proxyInfo->ai_socktype, proxyInfo->ai_protocol)),
-      _proxyHost(proxyHost)
+ProxySocket::ProxySocket(const UpstreamResolver::Address &address, const std::string& proxyHost)
+    : ScopedSocket(), _proxyHost(proxyHost), _connected(false)
 {
     try
     {
-        if (proxyInfo == nullptr)
-            throw WebErrors::ProxyException("Invalid proxy info provided");
-        setupSocketOptions();
-        if (this->getFd() < 0 || connect(this->getFd() , proxyInfo->ai_addr, proxyInfo->ai_addrlen) < 0)
+        reset(socket(address.storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        if (this->getFd() < 0)
+            throw WebErrors::ProxyException("Error creating proxy socket");
+        if (address.storage.ss_family != AF_UNIX)
+            setupSocketOptions();
+        if (connect(this->getFd(), reinterpret_cast<const sockaddr *>(&address.storage), address.length) == 0)
+            _connected = true;
+        else if (errno != EINPROGRESS) // a Unix socket with a full backlog fails with EAGAIN
             throw WebErrors::ProxyException("Error connecting to proxy server");
     }
     catch (const WebErrors::ProxyException& e)
@@ -20,7 +24,8 @@ ProxySocket::ProxySocket(addrinfo* proxyInfo, const std::string& proxyHost)
 
 ProxySocket::ProxySocket(ProxySocket&& other) noexcept
     : ScopedSocket(std::move(other)),
-      _proxyHost(std::move(other._proxyHost))
+      _proxyHost(std::move(other._proxyHost)),
+      _connected(other._connected)
 {
 }
 
@@ -31,7 +36,27 @@ void ProxySocket::setupSocketOptions()
         throw WebErrors::ProxyException("Error setting TCP_NODELAY");
 }
 
+//called once the socket turns writable, the pending connect's result is in SO_ERROR
+void ProxySocket::finishConnect(int fd)
+{
+    int         error = 0;
+    socklen_t   length = sizeof(error);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+        error = errno;
+    if (error != 0)
+    {
+        errno = error;
+        throw WebErrors::ProxyException("Error connecting to proxy server");
+    }
+}
+
 const std::string& ProxySocket::getProxyHost() const
 {
     return _proxyHost;
 }
+
+bool ProxySocket::isConnected() const
+{
+    return _connected;
+}
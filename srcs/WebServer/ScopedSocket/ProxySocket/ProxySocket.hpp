@@ -3,17 +3,23 @@
 #include "ScopedSocket.hpp"
 #include <netinet/tcp.h>
 #include "WebErrors.hpp"
+#include "UpstreamResolver.hpp"
 
+// Non-blocking: the connect is only started here and finished from the event loop (finishConnect)
 class ProxySocket : public ScopedSocket
 {
 public:
-    ProxySocket(addrinfo* proxyInfo, const std::string& proxyHost);
+    ProxySocket(const UpstreamResolver::Address &address, const std::string& proxyHost);
     ProxySocket(ProxySocket&& other) noexcept;
     ProxySocket& operator=(ProxySocket&& other) noexcept = delete;
 
-    const std::string& getProxyHost() const;
+    const std::string&  getProxyHost() const;
+    bool                isConnected() const;
+
+    static void         finishConnect(int fd);
 
 private:
     std::string _proxyHost;
+    bool        _connected;
     void setupSocketOptions();
-};
\ No newline at end of file
+};
@@ -3,7 +3,6 @@
 #include <unistd.h>
 
 
-// DONT ADD THE NONBLOCK FLAG TO THE PROXY SOCKETS so false it
 class ScopedSocket
 {
 public:
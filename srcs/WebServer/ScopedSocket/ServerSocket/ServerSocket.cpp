@@ -1,17 +1,27 @@
 #include "ServerSocket.hpp"
 #include "WebErrors.hpp"
 #include "WebParser.hpp"
+#include "WebServer.hpp"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
-ServerSocket::ServerSocket(const Server& server, int socket_flags)
-    : ScopedSocket(socket(AF_INET, SOCK_STREAM, 0), socket_flags), _server(server)
+ServerSocket::ServerSocket(const Listen &listen, int socket_flags)
+    : ScopedSocket(), _listen(listen)
 {
     try
     {
+        resolveAddress();
+        _address = _listen.family == LISTEN_UNIX ? _listen.address : addressText(_serverAddr);
+        reset(socket(_serverAddr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0));
         if (this->getFd() < 0) 
-            throw WebErrors::ServerException("Error opening server socket for server on port " + std::to_string(server.port));
-        
+            throw WebErrors::ServerException("Error opening server socket on " + describe(_listen));
+
+        setSocketFlags(socket_flags);
         setupSocketOptions(1);
         bindAndListen();
+        reportSocketOptions();
     }
     catch (const std::exception &e)
     {
@@ -20,28 +30,213 @@ ServerSocket::ServerSocket(const Server& server, int socket_flags)
 }
 
 ServerSocket::ServerSocket(ServerSocket&& other) noexcept
-    : ScopedSocket(std::move(other)), _server(other._server)
+    : ScopedSocket(std::move(other)), _listen(std::move(other._listen)), _address(std::move(other._address)),
+      _virtualHosts(std::move(other._virtualHosts)), _addressHosts(std::move(other._addressHosts)), _serverAddr(other._serverAddr), _serverAddrLen(other._serverAddrLen)
+{
+}
+
+// a moved-from socket has no fd and must not remove the path the moved-to one listens on
+ServerSocket::~ServerSocket()
+{
+    if (getFd() != -1 && _listen.family == LISTEN_UNIX)
+        unlink(_listen.address.c_str());
+}
+
+// a listen on another address than the socket's is one a wildcard socket took in
+void ServerSocket::addServer(const Server &server, const Listen &listen)
+{
+    const std::string address = numericAddress(listen);
+
+    if (address == _address)
+        _virtualHosts.addServer(server, listen.default_server);
+    else
+        _addressHosts[address].addServer(server, listen.default_server);
+}
+
+const VirtualHostMap &ServerSocket::getVirtualHosts() const { return _virtualHosts; }
+
+// the servers of the address the client connected to, those of the socket's own address for any other
+const VirtualHostMap &ServerSocket::getVirtualHosts(int clientFd) const
+{
+    struct sockaddr_storage local = {};
+    socklen_t               length = sizeof(local);
+
+    if (_addressHosts.empty() || getsockname(clientFd, reinterpret_cast<struct sockaddr *>(&local), &length) < 0)
+        return _virtualHosts;
+
+    auto it = _addressHosts.find(addressText(local));
+
+    return it == _addressHosts.end() ? _virtualHosts : it->second;
+}
+
+const Listen &ServerSocket::getListen() const { return _listen; }
+
+std::string ServerSocket::describe(const Listen &listen)
+{
+    if (listen.family == LISTEN_UNIX)
+        return "unix:" + listen.address;
+    if (listen.family == LISTEN_INET6)
+        return "[" + listen.address + "]:" + std::to_string(listen.port);
+    return listen.address + ":" + std::to_string(listen.port);
+}
+
+// resolved the way the socket binds it, so that equal addresses compare equal however they were written
+std::string ServerSocket::numericAddress(const Listen &listen)
+{
+    if (listen.family == LISTEN_UNIX)
+        return listen.address;
+
+    addrinfo                hints{};
+    addrinfo                *result = nullptr;
+    struct sockaddr_storage address = {};
+
+    hints.ai_family = (listen.family == LISTEN_INET6) ? AF_INET6 : AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(listen.address.c_str(), nullptr, &hints, &result) != 0 || !result)
+        throw WebErrors::ServerException("Error resolving listen address " + describe(listen));
+    std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    return addressText(address);
+}
+
+bool ServerSocket::isWildcard(const Listen &listen)
+{
+    const std::string address = numericAddress(listen);
+
+    return address == "0.0.0.0" || address == "::";
+}
+
+std::string ServerSocket::addressText(const struct sockaddr_storage &address)
+{
+    char text[INET6_ADDRSTRLEN] = "";
+
+    if (address.ss_family == AF_INET)
+        inet_ntop(AF_INET, &reinterpret_cast<const struct sockaddr_in *>(&address)->sin_addr, text, sizeof(text));
+    else if (address.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &reinterpret_cast<const struct sockaddr_in6 *>(&address)->sin6_addr, text, sizeof(text));
+    return text;
+}
+
+void ServerSocket::resolveAddress()
+{
+    std::memset(&_serverAddr, 0, sizeof(_serverAddr));
+    if (_listen.family == LISTEN_UNIX)
+    {
+        struct sockaddr_un *unixAddr = reinterpret_cast<struct sockaddr_un *>(&_serverAddr);
+
+        unixAddr->sun_family = AF_UNIX;
+        std::strncpy(unixAddr->sun_path, _listen.address.c_str(), sizeof(unixAddr->sun_path) - 1);
+        _serverAddrLen = sizeof(struct sockaddr_un);
+        return ;
+    }
+
+    addrinfo hints{};
+    addrinfo *result = nullptr;
+
+    hints.ai_family = (_listen.family == LISTEN_INET6) ? AF_INET6 : AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    if (getaddrinfo(_listen.address.c_str(), std::to_string(_listen.port).c_str(), &hints, &result) != 0 || !result)
+        throw WebErrors::ServerException("Error resolving listen address " + describe(_listen));
+    std::memcpy(&_serverAddr, result->ai_addr, result->ai_addrlen);
+    _serverAddrLen = result->ai_addrlen;
+    freeaddrinfo(result);
+}
+
+bool ServerSocket::hasSocketOptions(const Listen &listen)
 {
+    return (listen.backlog != -1 || listen.deferred || listen.fastopen || listen.rcvbuf || listen.sndbuf || listen.nodelay);
 }
 
-const Server& ServerSocket::getServer() const { return _server; }
+void ServerSocket::setTcpOption(int level, int option, int value, const std::string &name)
+{
+    if (setsockopt(getFd(), level, option, &value, sizeof(value)) < 0)
+        throw WebErrors::ServerException("Error setting " + name + " for server on " + describe(_listen));
+}
 
+// buffer sizes are inherited by accepted sockets; deferred accept and fast open act on the listening socket
 void ServerSocket::setupSocketOptions(int opt)
 {
-    if (setsockopt(getFd(), SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-        throw WebErrors::ServerException("Error setting socket options for server on port " + std::to_string(_server.port));
+    if (_listen.rcvbuf)
+        setTcpOption(SOL_SOCKET, SO_RCVBUF, _listen.rcvbuf, "SO_RCVBUF");
+    if (_listen.sndbuf)
+        setTcpOption(SOL_SOCKET, SO_SNDBUF, _listen.sndbuf, "SO_SNDBUF");
+    if (_listen.family == LISTEN_UNIX)
+        return ;
+    setTcpOption(SOL_SOCKET, SO_REUSEADDR, opt, "SO_REUSEADDR");
+    // so [::]:port and 0.0.0.0:port can both be listened on, like nginx's default ipv6only=on
+    if (_listen.family == LISTEN_INET6)
+        setTcpOption(IPPROTO_IPV6, IPV6_V6ONLY, opt, "IPV6_V6ONLY");
+    // clients that connect without sending anything never wake the event loop
+    if (_listen.deferred)
+        setTcpOption(IPPROTO_TCP, TCP_DEFER_ACCEPT, _listen.deferred, "TCP_DEFER_ACCEPT");
+    if (_listen.fastopen)
+        setTcpOption(IPPROTO_TCP, TCP_FASTOPEN, _listen.fastopen, "TCP_FASTOPEN");
+}
+
+void ServerSocket::setupClientSocket(int clientFd) const
+{
+    int flag = 1;
+
+    if (_listen.nodelay && setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) < 0)
+        throw WebErrors::SocketException("Error setting TCP_NODELAY on client socket");
+}
+
+// values are read back from the kernel, which e.g. doubles buffer sizes and rounds the defer timeout
+void ServerSocket::reportSocketOptions() const
+{
+    auto readOption = [this](int level, int option) -> int {
+        int         value = 0;
+        socklen_t   length = sizeof(value);
+
+        if (getsockopt(getFd(), level, option, &value, &length) < 0)
+            return -1;
+        return value;
+    };
+
+    std::cout << COLOR_GREEN_SERVER << " { " << describe(_listen) << ": backlog "
+              << (_listen.backlog == -1 ? SOMAXCONN : _listen.backlog)
+              << ", rcvbuf " << readOption(SOL_SOCKET, SO_RCVBUF)
+              << ", sndbuf " << readOption(SOL_SOCKET, SO_SNDBUF);
+    if (_listen.family != LISTEN_UNIX)
+    {
+        std::cout << ", deferred " << readOption(IPPROTO_TCP, TCP_DEFER_ACCEPT)
+                  << ", fastopen " << readOption(IPPROTO_TCP, TCP_FASTOPEN)
+                  << ", nodelay " << (_listen.nodelay ? "on" : "off");
+    }
+    std::cout << " }\n\n" << COLOR_RESET;
 }
 
 void ServerSocket::bindAndListen()
 {
-    std::memset(&_serverAddr, 0, sizeof(_serverAddr));
-    _serverAddr.sin_family = AF_INET;
-    _serverAddr.sin_addr.s_addr = INADDR_ANY;
-    _serverAddr.sin_port = htons(_server.port);
+    if (_listen.family == LISTEN_UNIX)
+        removeStaleUnixSocket();
+
+    if (bind(getFd(), (struct sockaddr *)&_serverAddr, _serverAddrLen) < 0)
+        throw WebErrors::ServerException("Error binding server socket on " + describe(_listen));
+
+    if (listen(getFd(), _listen.backlog == -1 ? SOMAXCONN : _listen.backlog) < 0)
+        throw WebErrors::ServerException("Error listening on server socket on " + describe(_listen));
+}
+
+/*
+A socket file left behind by a previous run would make bind() fail with EADDRINUSE. It is only removed
+when nothing accepts on it anymore (ECONNREFUSED); one a running server still listens on is left to it.
+*/
+void ServerSocket::removeStaleUnixSocket() const
+{
+    struct stat sb;
+
+    if (stat(_listen.address.c_str(), &sb) != 0 || !S_ISSOCK(sb.st_mode))
+        return ;
 
-    if (bind(getFd(), (struct sockaddr *)&_serverAddr, sizeof(_serverAddr)) < 0)
-        throw WebErrors::ServerException("Error binding server socket on port " + std::to_string(_server.port));
+    ScopedSocket probe(socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), 0);
 
-    if (listen(getFd(), SOMAXCONN) < 0)
-        throw WebErrors::ServerException("Error listening on server socket on port " + std::to_string(_server.port));
+    if (probe.getFd() < 0)
+        throw WebErrors::ServerException("Error opening a socket to probe " + describe(_listen));
+    if (connect(probe.getFd(), (const struct sockaddr *)&_serverAddr, _serverAddrLen) == 0 || errno == EAGAIN)
+        throw WebErrors::ServerException("Another server is listening on " + describe(_listen));
+    if (errno == ECONNREFUSED)
+        unlink(_listen.address.c_str());
 }
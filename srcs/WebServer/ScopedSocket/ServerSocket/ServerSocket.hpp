@@ -2,22 +2,52 @@
 
 #include "ScopedSocket.hpp"
 #include "WebParser.hpp"
+#include "VirtualHostMap.hpp"
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <unordered_map>
 
+/*
+One listening socket per listen address (IPv4, IPv6 or Unix path); every server block listening there is a virtual host on it.
+Like with nginx, a wildcard (0.0.0.0 or ::) listen takes in the specific addresses of its family on its port: they can't be
+bound next to it. Their servers are kept apart and picked by the address a connection came in on.
+*/
 class ServerSocket : public ScopedSocket
 {
 public:
-    ServerSocket(const Server& server, int socket_flags = 0);
+    ServerSocket(const Listen &listen, int socket_flags = 0);
     ServerSocket(ServerSocket&& other) noexcept;
+    ~ServerSocket();
 
     ServerSocket& operator=(ServerSocket&& other) noexcept = delete;
 
-    const Server& getServer() const;
+    void                    addServer(const Server &server, const Listen &listen);
+    const VirtualHostMap    &getVirtualHosts() const;
+    const VirtualHostMap    &getVirtualHosts(int clientFd) const;
+    const Listen            &getListen() const;
+
+    void                    setupClientSocket(int clientFd) const;
+
+    static std::string      describe(const Listen &listen);
+    static bool             hasSocketOptions(const Listen &listen);
+    static std::string      numericAddress(const Listen &listen);
+    static bool             isWildcard(const Listen &listen);
 
 private:
+    void resolveAddress();
     void setupSocketOptions(int opt);
+    void setTcpOption(int level, int option, int value, const std::string &name);
     void bindAndListen();
+    void removeStaleUnixSocket() const;
+    void reportSocketOptions() const;
+
+    static std::string addressText(const struct sockaddr_storage &address);
 
-    const Server&       _server;
-    struct sockaddr_in  _serverAddr = {};
+    Listen                      _listen;
+    std::string                 _address;       // numeric, as getsockname() tells it
+    VirtualHostMap              _virtualHosts;
+    std::unordered_map<std::string, VirtualHostMap> _addressHosts; // specific addresses taken in by a wildcard
+    struct sockaddr_storage     _serverAddr = {};
+    socklen_t                   _serverAddrLen = 0;
 };
@@ -0,0 +1,188 @@
+#include "UpstreamGroup.hpp"
+#include "WebErrors.hpp"
+#include "WebServer.hpp"
+#include <algorithm>
+
+#define HASH_POINTS_PER_WEIGHT 160
+
+UpstreamGroup::UpstreamGroup(const Upstream &config, const std::unordered_map<std::string, AddressList> &proxyInfoMap)
+    : _name(config.name), _balance(config.balance), _healthCheckInterval(config.health_check_interval),
+      _healthCheckUri(config.health_check_uri), _nextProbe(std::chrono::steady_clock::now())
+{
+    for (const auto &server : config.servers)
+    {
+        auto resolved = proxyInfoMap.find(server.address);
+        if (resolved == proxyInfoMap.end())
+            throw WebErrors::ProxyException("Upstream server " + server.address + " was not resolved");
+
+        Peer peer;
+        peer.key = server.address;
+        peer.address = resolved->second;
+        peer.weight = server.weight;
+        peer.maxFails = server.max_fails;
+        peer.failTimeout = std::chrono::seconds(server.fail_timeout);
+        _peers.push_back(peer);
+    }
+    if (_balance == BALANCE_URI_HASH)
+    {
+        for (size_t i = 0; i < _peers.size(); i++)
+        {
+            for (int point = 0; point < _peers[i].weight * HASH_POINTS_PER_WEIGHT; point++)
+                _ring.emplace_back(hash(_peers[i].key + "-" + std::to_string(point)), i);
+        }
+        std::sort(_ring.begin(), _ring.end());
+    }
+}
+
+//nullptr when every server is down; the caller has to release() what it got
+UpstreamGroup::Peer *UpstreamGroup::select(const std::string &uri)
+{
+    const auto  now = std::chrono::steady_clock::now();
+    Peer        *peer = nullptr;
+
+    switch (_balance)
+    {
+        case BALANCE_ROUND_ROBIN:
+            peer = selectRoundRobin(now);
+            break;
+        case BALANCE_LEAST_CONN:
+            peer = selectLeastConn(now);
+            break;
+        case BALANCE_URI_HASH:
+            peer = selectUriHash(uri, now);
+            break;
+    }
+    if (peer)
+        peer->active++;
+    return (peer);
+}
+
+bool UpstreamGroup::isAvailable(const Peer &peer, std::chrono::steady_clock::time_point now) const
+{
+    return (peer.healthy && now >= peer.downUntil);
+}
+
+UpstreamGroup::Peer *UpstreamGroup::selectRoundRobin(std::chrono::steady_clock::time_point now)
+{
+    Peer    *best = nullptr;
+    int     totalWeight = 0;
+
+    for (auto &peer : _peers)
+    {
+        if (!isAvailable(peer, now))
+            continue ;
+        peer.currentWeight += peer.weight;
+        totalWeight += peer.weight;
+        if (!best || peer.currentWeight > best->currentWeight)
+            best = &peer;
+    }
+    if (best)
+        best->currentWeight -= totalWeight;
+    return (best);
+}
+
+//active / weight, compared without dividing; the scan starts one further each time so ties rotate
+UpstreamGroup::Peer *UpstreamGroup::selectLeastConn(std::chrono::steady_clock::time_point now)
+{
+    Peer    *best = nullptr;
+
+    for (size_t i = 0; i < _peers.size(); i++)
+    {
+        Peer &peer = _peers[(_leastConnStart + i) % _peers.size()];
+
+        if (!isAvailable(peer, now))
+            continue ;
+        if (!best || static_cast<long>(peer.active) * best->weight < static_cast<long>(best->active) * peer.weight)
+            best = &peer;
+    }
+    _leastConnStart = (_leastConnStart + 1) % _peers.size();
+    return (best);
+}
+
+//first available server clockwise from the URI's point on the ring
+UpstreamGroup::Peer *UpstreamGroup::selectUriHash(const std::string &uri, std::chrono::steady_clock::time_point now)
+{
+    const uint32_t  point = hash(uri);
+    auto            it = std::lower_bound(_ring.begin(), _ring.end(), std::make_pair(point, static_cast<size_t>(0)));
+
+    for (size_t i = 0; i < _ring.size(); i++, it++)
+    {
+        if (it == _ring.end())
+            it = _ring.begin();
+        if (isAvailable(_peers[it->second], now))
+            return (&_peers[it->second]);
+    }
+    return (nullptr);
+}
+
+//max_fails failures counted within fail_timeout mark the server down for fail_timeout
+void UpstreamGroup::release(Peer &peer, bool failed)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    if (peer.active > 0)
+        peer.active--;
+    if (!failed)
+    {
+        peer.fails = 0;
+        return ;
+    }
+    if (peer.maxFails == 0)
+        return ;
+    if (peer.fails == 0 || now - peer.firstFail > peer.failTimeout)
+    {
+        peer.fails = 0;
+        peer.firstFail = now;
+    }
+    if (++peer.fails >= peer.maxFails)
+    {
+        peer.downUntil = now + peer.failTimeout;
+        peer.fails = 0;
+        std::cerr << COLOR_RED_ERROR << "  Upstream " << _name << ": " << peer.key << " marked down for "
+                  << peer.failTimeout.count() << "s\n\n" << COLOR_RESET;
+    }
+}
+
+void UpstreamGroup::setHealth(Peer &peer, bool healthy)
+{
+    if (peer.healthy != healthy)
+        std::cerr << (healthy ? COLOR_GREEN_SERVER : COLOR_RED_ERROR) << "  Upstream " << _name << ": " << peer.key
+                  << (healthy ? " passed its health check\n\n" : " failed its health check\n\n") << COLOR_RESET;
+    peer.healthy = healthy;
+    peer.probing = false;
+}
+
+//true once per health_check interval, never without health_check
+bool UpstreamGroup::isProbeDue(void)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    if (_healthCheckInterval.count() == 0 || now < _nextProbe)
+        return (false);
+    _nextProbe = now + _healthCheckInterval;
+    return (true);
+}
+
+//FNV-1a with a murmur3 finalizer, so nearby keys ("a:80-1", "a:80-2") spread over the ring
+uint32_t UpstreamGroup::hash(const std::string &key)
+{
+    uint32_t h = 2166136261u;
+
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return (h);
+}
+
+std::vector<UpstreamGroup::Peer> &UpstreamGroup::getPeers(void) { return (_peers); }
+
+const std::string &UpstreamGroup::getName(void) const { return (_name); }
+
+const std::string &UpstreamGroup::getHealthCheckUri(void) const { return (_healthCheckUri); }
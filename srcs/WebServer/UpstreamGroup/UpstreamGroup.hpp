@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <netdb.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "WebParser.hpp"
+#include "UpstreamResolver.hpp"
+
+/*
+Runtime side of an upstream { } block: picks a server for each proxied request and keeps track of
+which ones are up. A server is skipped while it is marked down, either passively (max_fails errors
+or timeouts within fail_timeout take it out for fail_timeout) or by a failed active health probe.
+round_robin is nginx's smooth weighted round-robin, least_conn weighs active requests against the
+weight, uri_hash is a consistent hash ring (160 points per unit of weight), so a URI keeps landing
+on the same server and only the keys of a server that goes away move.
+*/
+class UpstreamGroup
+{
+public:
+    struct Peer
+    {
+        std::string                             key;        //host:port, _proxyInfoMap and UpstreamPool key
+        AddressList                             address;
+        int                                     weight;
+        int                                     maxFails;
+        std::chrono::seconds                    failTimeout;
+        int                                     currentWeight = 0;
+        int                                     active = 0;
+        int                                     fails = 0;
+        std::chrono::steady_clock::time_point   firstFail;
+        std::chrono::steady_clock::time_point   downUntil;
+        bool                                    healthy = true;
+        bool                                    probing = false;
+    };
+
+    UpstreamGroup(const Upstream &config, const std::unordered_map<std::string, AddressList> &proxyInfoMap);
+    ~UpstreamGroup() = default;
+
+    Peer                *select(const std::string &uri);
+    void                release(Peer &peer, bool failed);
+    void                setHealth(Peer &peer, bool healthy);
+    bool                isProbeDue(void);
+    std::vector<Peer>   &getPeers(void);
+    const std::string   &getName(void) const;
+    const std::string   &getHealthCheckUri(void) const;
+
+private:
+    std::string                                 _name;
+    BalanceMethod                               _balance;
+    std::chrono::seconds                        _healthCheckInterval;
+    std::string                                 _healthCheckUri;
+    std::chrono::steady_clock::time_point       _nextProbe;
+    std::vector<Peer>                           _peers;
+    std::vector<std::pair<uint32_t, size_t>>    _ring;      //hash point -> peer index, sorted
+    size_t                                      _leastConnStart = 0;
+
+    bool                isAvailable(const Peer &peer, std::chrono::steady_clock::time_point now) const;
+    Peer                *selectRoundRobin(std::chrono::steady_clock::time_point now);
+    Peer                *selectLeastConn(std::chrono::steady_clock::time_point now);
+    Peer                *selectUriHash(const std::string &uri, std::chrono::steady_clock::time_point now);
+    static uint32_t     hash(const std::string &key);
+};
@@ -0,0 +1,115 @@
+#include "UpstreamPool.hpp"
+#include <unistd.h>
+
+UpstreamPool::UpstreamPool(size_t maxIdle, int idleTimeout, size_t maxRequests, CloseCallback closeConnection)
+    : _maxIdle(maxIdle), _idleTimeout(idleTimeout), _maxRequests(maxRequests), _closeConnection(std::move(closeConnection))
+{
+}
+
+//the event loop is torn down with the server, so only the sockets are left to close
+UpstreamPool::~UpstreamPool()
+{
+    for (const auto &entry : _idleKeys)
+        close(entry.first);
+}
+
+//an idle socket for key, or -1 if a new connection is needed
+int UpstreamPool::acquire(const std::string &key, size_t &requestsServed)
+{
+    auto it = _idle.find(key);
+
+    if (it == _idle.end() || it->second.empty())
+        return (-1);
+
+    const IdleConnection connection = it->second.back();
+
+    it->second.pop_back();
+    _idleKeys.erase(connection.fd);
+    requestsServed = connection.requestsServed;
+    return (connection.fd);
+}
+
+//false if the socket is not worth keeping, the caller closes it then
+bool UpstreamPool::release(const std::string &key, int fd, size_t requestsServed)
+{
+    if (_maxIdle == 0 || requestsServed >= _maxRequests)
+        return (false);
+
+    std::deque<IdleConnection> &connections = _idle[key];
+
+    if (connections.size() >= _maxIdle)
+    {
+        const int oldest = connections.front().fd;
+
+        connections.pop_front();
+        _idleKeys.erase(oldest);
+        _closeConnection(oldest);
+    }
+    connections.push_back({fd, requestsServed, std::chrono::steady_clock::now()});
+    _idleKeys[fd] = key;
+    return (true);
+}
+
+bool UpstreamPool::contains(int fd) const
+{
+    return (_idleKeys.find(fd) != _idleKeys.end());
+}
+
+//an idle socket turned readable: the upstream closed it (or sent something it shouldn't have)
+void UpstreamPool::drop(int fd)
+{
+    auto key = _idleKeys.find(fd);
+
+    if (key == _idleKeys.end())
+        return ;
+
+    std::deque<IdleConnection> &connections = _idle[key->second];
+
+    for (auto it = connections.begin(); it != connections.end(); ++it)
+    {
+        if (it->fd == fd)
+        {
+            connections.erase(it);
+            break ;
+        }
+    }
+    _idleKeys.erase(key);
+    _closeConnection(fd);
+}
+
+void UpstreamPool::expireIdle(void)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    for (auto &entry : _idle)
+    {
+        //the oldest sit at the front
+        while (!entry.second.empty() && now - entry.second.front().idleSince > _idleTimeout)
+        {
+            const int fd = entry.second.front().fd;
+
+            entry.second.pop_front();
+            _idleKeys.erase(fd);
+            _closeConnection(fd);
+        }
+    }
+}
+
+//the key now resolves elsewhere, its idle connections lead to the old addresses
+void UpstreamPool::closeIdle(const std::string &key)
+{
+    auto it = _idle.find(key);
+
+    if (it == _idle.end())
+        return ;
+    for (const IdleConnection &connection : it->second)
+    {
+        _idleKeys.erase(connection.fd);
+        _closeConnection(connection.fd);
+    }
+    _idle.erase(it);
+}
+
+size_t UpstreamPool::getMaxRequests(void) const { return (_maxRequests); }
+
+bool UpstreamPool::isEnabled(void) const { return (_maxIdle > 0); }
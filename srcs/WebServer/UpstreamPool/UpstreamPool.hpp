@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+/*
+Idle keep-alive connections to proxy upstreams, keyed like WebServer::_proxyInfoMap ("host:port").
+Idle sockets stay registered in the event loop (EPOLLIN), so an upstream closing one is noticed
+right away through drop() instead of on the next request. Connections are reused newest first,
+the oldest is evicted when a key is full, and a socket that served maxRequests is not kept.
+Evicted and expired sockets are handed to the close callback, which removes them from the loop.
+*/
+class UpstreamPool
+{
+public:
+    using CloseCallback = std::function<void(int)>;
+
+    UpstreamPool(size_t maxIdle, int idleTimeout, size_t maxRequests, CloseCallback closeConnection);
+    ~UpstreamPool();
+    UpstreamPool(const UpstreamPool &) = delete;
+    UpstreamPool &operator=(const UpstreamPool &) = delete;
+
+    int     acquire(const std::string &key, size_t &requestsServed);
+    bool    release(const std::string &key, int fd, size_t requestsServed);
+    bool    contains(int fd) const;
+    void    drop(int fd);
+    void    expireIdle(void);
+    void    closeIdle(const std::string &key);
+    bool    isEnabled(void) const;
+    size_t  getMaxRequests(void) const;
+
+private:
+    struct IdleConnection
+    {
+        int                                     fd;
+        size_t                                  requestsServed;
+        std::chrono::steady_clock::time_point   idleSince;
+    };
+
+    size_t                                                      _maxIdle;
+    std::chrono::seconds                                        _idleTimeout;
+    size_t                                                      _maxRequests;
+    CloseCallback                                               _closeConnection;
+    std::unordered_map<std::string, std::deque<IdleConnection>> _idle;
+    std::unordered_map<int, std::string>                        _idleKeys;
+};
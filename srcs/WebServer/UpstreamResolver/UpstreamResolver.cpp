@@ -0,0 +1,161 @@
+#include "UpstreamResolver.hpp"
+#include "WebErrors.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <netdb.h>
+#include <sys/un.h>
+#include <utility>
+
+UpstreamResolver::UpstreamResolver(int validity) : _validity(validity)
+{
+}
+
+UpstreamResolver::~UpstreamResolver()
+{
+    if (!_thread.joinable())
+        return ;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wakeup.notify_one();
+    _thread.join();
+}
+
+//startup only, before the thread runs: blocks on DNS and throws when the name doesn't resolve
+AddressList UpstreamResolver::add(const std::string &key)
+{
+    auto known = _current.find(key);
+
+    if (known != _current.end())
+        return known->second;
+
+    AddressList addresses = resolve(key);
+
+    if (!addresses)
+        throw WebErrors::ProxyException("Error resolving upstream server " + key);
+    _current.emplace(key, addresses);
+    return addresses;
+}
+
+void UpstreamResolver::start(void)
+{
+    if (_validity > 0 && !_current.empty())
+        _thread = std::thread(&UpstreamResolver::run, this);
+}
+
+//lists that changed since the last call; never waits for the resolver thread
+UpstreamResolver::Updates UpstreamResolver::collect(void)
+{
+    std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+
+    if (!lock.owns_lock() || _updates.empty())
+        return Updates();
+    return std::exchange(_updates, Updates());
+}
+
+//"host:port", "[v6 address]:port" or "unix:path"; nullptr when it doesn't resolve
+AddressList UpstreamResolver::resolve(const std::string &key)
+{
+    if (key.compare(0, 5, "unix:") == 0)
+        return resolveUnix(key.substr(5));
+
+    const size_t    colonPos = key.rfind(':');
+    std::string     host = key.substr(0, colonPos);
+    std::string     port = colonPos == std::string::npos ? "80" : key.substr(colonPos + 1);
+    addrinfo        hints{};
+    addrinfo        *result = nullptr;
+
+    if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+        return nullptr;
+
+    std::vector<Address>    preferred;
+    std::vector<Address>    others;
+
+    for (addrinfo *info = result; info; info = info->ai_next)
+    {
+        Address address{};
+
+        if (info->ai_addrlen > sizeof(address.storage))
+            continue ;
+        memcpy(&address.storage, info->ai_addr, info->ai_addrlen);
+        address.length = info->ai_addrlen;
+        (info->ai_family == result->ai_family ? preferred : others).push_back(address);
+    }
+    freeaddrinfo(result);
+
+    auto addresses = std::make_shared<std::vector<Address>>();
+
+    for (size_t i = 0; i < preferred.size() || i < others.size(); i++)
+    {
+        if (i < preferred.size())
+            addresses->push_back(preferred[i]);
+        if (i < others.size())
+            addresses->push_back(others[i]);
+    }
+    if (addresses->empty())
+        return nullptr;
+    return addresses;
+}
+
+//a leading '@' names a socket in the abstract namespace, where the address length delimits the name
+AddressList UpstreamResolver::resolveUnix(const std::string &path)
+{
+    Address     address{};
+    sockaddr_un *unixAddress = reinterpret_cast<sockaddr_un *>(&address.storage);
+
+    if (path.empty() || path.length() >= sizeof(unixAddress->sun_path))
+        return nullptr;
+    unixAddress->sun_family = AF_UNIX;
+    memcpy(unixAddress->sun_path, path.data(), path.length());
+    if (path[0] == '@')
+    {
+        unixAddress->sun_path[0] = '\0';
+        address.length = offsetof(sockaddr_un, sun_path) + path.length();
+    }
+    else
+        address.length = sizeof(sockaddr_un);
+    return std::make_shared<std::vector<Address>>(1, address);
+}
+
+void UpstreamResolver::run(void)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_wakeup.wait_for(lock, std::chrono::seconds(_validity), [this] { return _stopping; }))
+    {
+        lock.unlock();
+        for (auto &entry : _current)
+        {
+            AddressList addresses = resolve(entry.first);
+
+            if (!addresses || isSame(addresses, entry.second))
+                continue ;
+            entry.second = addresses;
+            std::lock_guard<std::mutex> publish(_mutex);
+            _updates[entry.first] = std::move(addresses);
+        }
+        lock.lock();
+    }
+}
+
+//the same addresses in any order: round-robin DNS rotates its answers between lookups
+bool UpstreamResolver::isSame(const AddressList &lhs, const AddressList &rhs)
+{
+    auto sorted = [](const AddressList &addresses)
+    {
+        std::vector<std::string> bytes;
+
+        for (const Address &address : *addresses)
+            bytes.emplace_back(reinterpret_cast<const char *>(&address.storage), address.length);
+        std::sort(bytes.begin(), bytes.end());
+        return bytes;
+    };
+
+    return lhs->size() == rhs->size() && sorted(lhs) == sorted(rhs);
+}
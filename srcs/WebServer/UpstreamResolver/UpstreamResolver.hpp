@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+Addresses of the proxy_pass and upstream server names ("host:port", or "unix:path" for a Unix socket). Every name is resolved once
+at startup, where a name that doesn't resolve is a config error. Afterwards a background thread
+resolves them again every resolver_valid seconds (getaddrinfo reports no TTL, so this stands in for
+it) and leaves the lists that changed for the event loop, which takes them with collect() without
+ever waiting for DNS. A failed re-resolution keeps the previous addresses.
+Lists are immutable and shared, so a connection keeps the one it started with after an update.
+They are ordered for happy eyeballs (RFC 8305): address families alternate, preferred one first.
+*/
+class UpstreamResolver
+{
+public:
+    struct Address
+    {
+        sockaddr_storage    storage;
+        socklen_t           length;
+    };
+    using AddressList = std::shared_ptr<const std::vector<Address>>;
+    using Updates = std::unordered_map<std::string, AddressList>;
+
+    explicit UpstreamResolver(int validity);
+    ~UpstreamResolver();
+    UpstreamResolver(const UpstreamResolver &) = delete;
+    UpstreamResolver &operator=(const UpstreamResolver &) = delete;
+
+    AddressList         add(const std::string &key);
+    void                start(void);
+    Updates             collect(void);
+
+    static AddressList  resolve(const std::string &key);
+    static AddressList  resolveUnix(const std::string &path);
+
+private:
+    int                                         _validity;  //seconds, 0: resolved at startup only
+    std::unordered_map<std::string, AddressList> _current;   //owned by the thread once it runs
+    Updates                                     _updates;
+    std::thread                                 _thread;
+    std::mutex                                  _mutex;     //_updates and _stopping
+    std::condition_variable                     _wakeup;
+    bool                                        _stopping = false;
+
+    void                run(void);
+    static bool         isSame(const AddressList &lhs, const AddressList &rhs);
+};
+
+using AddressList = UpstreamResolver::AddressList;
@@ -0,0 +1,117 @@
+#include "VirtualHostMap.hpp"
+#include "WebErrors.hpp"
+#include "WebServer.hpp"
+#include <cctype>
+
+size_t VirtualHostMap::CaseInsensitiveHash::operator()(std::string_view key) const noexcept
+{
+    size_t hash = 14695981039346656037ULL;
+
+    for (unsigned char c : key)
+    {
+        hash ^= static_cast<size_t>(std::tolower(c));
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool VirtualHostMap::CaseInsensitiveEqual::operator()(std::string_view lhs, std::string_view rhs) const noexcept
+{
+    if (lhs.size() != rhs.size())
+        return false;
+    for (size_t i = 0; i < lhs.size(); i++)
+    {
+        if (std::tolower(static_cast<unsigned char>(lhs[i])) != std::tolower(static_cast<unsigned char>(rhs[i])))
+            return false;
+    }
+    return true;
+}
+
+void VirtualHostMap::addServer(const Server &server, bool isDefault)
+{
+    if (isDefault)
+    {
+        if (_hasExplicitDefault)
+            throw WebErrors::ConfigFormatException("Error: duplicate default_server on one listen address");
+        _defaultServer = &server;
+        _hasExplicitDefault = true;
+    }
+    else if (!_defaultServer)
+        _defaultServer = &server;
+
+    for (const auto &name : server.server_name)
+    {
+        std::string_view view(name);
+
+        if (view.empty())
+            continue;
+        if (view.size() > 2 && view.compare(0, 2, "*.") == 0)
+            insertWildcard(_leadingWildcards, view.substr(1), &server);
+        else if (view.size() > 2 && view.compare(view.size() - 2, 2, ".*") == 0)
+            insertWildcard(_trailingWildcards, view.substr(0, view.size() - 1), &server);
+        else if (!_exactNames.emplace(view, &server).second)
+            std::cerr << COLOR_RED_ERROR << "  Conflicting server name \"" << name
+                      << "\" on one listen address, ignored\n\n" << COLOR_RESET;
+    }
+}
+
+//keeps the list sorted longest pattern first, so the first hit is the most specific one
+void VirtualHostMap::insertWildcard(WildcardList &list, std::string_view pattern, const Server *server)
+{
+    auto it = list.begin();
+
+    while (it != list.end() && it->first.size() >= pattern.size())
+        ++it;
+    list.insert(it, std::make_pair(pattern, server));
+}
+
+std::string_view VirtualHostMap::stripPort(std::string_view host)
+{
+    size_t colon = host.rfind(':');
+
+    if (colon == std::string_view::npos)
+        return host;
+    //an IPv6 literal without a port, e.g. [::1]
+    if (host.front() == '[' && host.find(']') > colon)
+        return host;
+    for (size_t i = colon + 1; i < host.size(); i++)
+    {
+        if (!std::isdigit(static_cast<unsigned char>(host[i])))
+            return host;
+    }
+    return host.substr(0, colon);
+}
+
+const Server *VirtualHostMap::findServer(std::string_view hostHeader) const
+{
+    while (!hostHeader.empty() && std::isspace(static_cast<unsigned char>(hostHeader.front())))
+        hostHeader.remove_prefix(1);
+    while (!hostHeader.empty() && std::isspace(static_cast<unsigned char>(hostHeader.back())))
+        hostHeader.remove_suffix(1);
+
+    const std::string_view  host = stripPort(hostHeader);
+
+    if (host.empty())
+        return _defaultServer;
+
+    auto exact = _exactNames.find(host);
+    if (exact != _exactNames.end())
+        return exact->second;
+
+    CaseInsensitiveEqual equal;
+    for (const auto &wildcard : _leadingWildcards)
+    {
+        if (host.size() > wildcard.first.size()
+            && equal(host.substr(host.size() - wildcard.first.size()), wildcard.first))
+            return wildcard.second;
+    }
+    for (const auto &wildcard : _trailingWildcards)
+    {
+        if (host.size() > wildcard.first.size()
+            && equal(host.substr(0, wildcard.first.size()), wildcard.first))
+            return wildcard.second;
+    }
+    return _defaultServer;
+}
+
+const Server *VirtualHostMap::getDefaultServer() const { return _defaultServer; }
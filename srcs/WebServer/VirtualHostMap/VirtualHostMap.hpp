@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "WebParser.hpp"
+
+/*
+Host header -> Server lookup for the servers sharing one listener.
+Keys are views into Server::server_name (the parser outlives the server), hashed and compared
+case-insensitively, so a lookup never lowercases or copies the Host header.
+Order: exact name, longest '*.suffix' wildcard, longest 'prefix.*' wildcard, default server.
+*/
+class VirtualHostMap
+{
+public:
+    VirtualHostMap() = default;
+    ~VirtualHostMap() = default;
+
+    void            addServer(const Server &server, bool isDefault);
+    const Server    *findServer(std::string_view hostHeader) const;
+    const Server    *getDefaultServer() const;
+
+    static std::string_view stripPort(std::string_view host);
+
+private:
+    struct CaseInsensitiveHash
+    {
+        size_t operator()(std::string_view key) const noexcept;
+    };
+    struct CaseInsensitiveEqual
+    {
+        bool operator()(std::string_view lhs, std::string_view rhs) const noexcept;
+    };
+    using WildcardList = std::vector<std::pair<std::string_view, const Server *>>;
+
+    std::unordered_map<std::string_view, const Server *, CaseInsensitiveHash, CaseInsensitiveEqual> _exactNames;
+    WildcardList    _leadingWildcards;
+    WildcardList    _trailingWildcards;
+    const Server    *_defaultServer = nullptr;
+    bool            _hasExplicitDefault = false;
+
+    static void     insertWildcard(WildcardList &list, std::string_view pattern, const Server *server);
+};
@@ -1,14 +1,18 @@
 #include "WebServer.hpp"
 #include "CGIHandler.hpp"
 #include "ErrorHandler.hpp"
+#include "ProxyHandler.hpp"
+#include "ProxySocket.hpp"
 #include "ScopedSocket.hpp"
 #include "WebErrors.hpp"
 #include <algorithm>
 #include <csignal>
 #include <exception>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <iostream>
 #include <cstring>
+#include <strings.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -20,18 +24,44 @@
 volatile sig_atomic_t WebServer::s_serverRunning = 1;
 
 WebServer::WebServer(WebParser &parser)
-    : _epollFd(-1), _parser(parser), _events(MAX_EVENTS)
+    : _parser(parser), _events(MAX_EVENTS),
+      _upstreamPool(parser.getGlobalConfig().proxy_keepalive, parser.getGlobalConfig().proxy_keepalive_timeout,
+                    parser.getGlobalConfig().proxy_keepalive_requests,
+                    [this](int fd) { eventController(fd, EPOLL_CTL_DEL, 0, FdType::PROXY_SOCKET); }),
+      _resolver(parser.getGlobalConfig().resolver_valid),
+      _fastCGIClient(parser.getGlobalConfig().fastcgi_connections,
+                     [this](int fd, int operation, uint32_t events) { eventController(fd, operation, events, FdType::FASTCGI_SOCKET); },
+                     [this](int clientSocket, const std::string &data, bool complete) { queueCGIOutput(clientSocket, data, complete); },
+                     [this](int clientSocket, int errorCode) { sendCGIError(clientSocket, errorCode); })
 {
     try
     {
         std::cout << COLOR_GREEN_SERVER << "[ SERVER STARTED ] press Ctrl+C to stop 🏭 \n\n" << COLOR_RESET;
         _serverSockets = createServerSockets(parser.getServers());
         resolveProxyAddresses(parser.getServers());
-        _epollFd = epoll_create(1);
-        if (_epollFd == -1)
-            throw WebErrors::ServerException("Error creating epoll");
+        _resolver.start();
+        for (const auto &server : parser.getServers())
+        {
+            for (const auto &location : server.locations)
+            {
+                if (location.proxy_cache_size > 0)
+                    _proxyCaches.emplace(std::piecewise_construct, std::forward_as_tuple(&location),
+                                         std::forward_as_tuple(location.proxy_cache_size, location.proxy_cache_path,
+                                                               location.proxy_cache_valid));
+                if (location.cgi_max_concurrency > 0)
+                    _cgiLimiters.emplace(&location, location);
+                if (location.cgi_cache_valid > 0)
+                    _cgiCaches.emplace(&location, location);
+            }
+        }
+        _eventBackend = EventBackend::create(parser.getGlobalConfig().event_backend);
+        std::cout << COLOR_GREEN_SERVER << " { Event backend: " << _eventBackend->getName() << " }\n\n" << COLOR_RESET;
+        if (parser.getGlobalConfig().cgi_zygote)
+            _cgiZygote = std::make_unique<CGIZygote>(PYTHON3,
+                [this](int fd, int operation, uint32_t events) { eventController(fd, operation, events, FdType::CGI_PROCESS); },
+                [this](uint64_t ticket, pid_t pid) { watchZygoteChild(ticket, pid); });
         for (const auto& serverSocket : _serverSockets)
-            epollController(serverSocket.getFd(), EPOLL_CTL_ADD, EPOLLIN, FdType::SERVER);
+            eventController(serverSocket.getFd(), EPOLL_CTL_ADD, EPOLLIN | EVENT_ACCEPT, FdType::SERVER);
     }
     catch (const std::exception& e)
     {
@@ -41,36 +71,48 @@ WebServer::WebServer(WebParser &parser)
 
 WebServer::~WebServer()
 {
-    for (auto& entry : _proxyInfoMap)
-    {
-        if (entry.second)
-        {
-            freeaddrinfo(entry.second);
-            entry.second = nullptr;
-        }
-    }
-    if (_epollFd != -1)
-    {
-        close(_epollFd);
-        _epollFd = -1;
-    }
+    for (const auto& proxy : _proxyConnections)
+        close(proxy.first);
 }
 
 void WebServer::resolveProxyAddresses(const std::vector<Server>& server_confs)
 {
     try
     {
+        auto isUpstreamName = [this](const std::string &target) -> bool {
+            for (const auto &upstream : _parser.getUpstreams())
+            {
+                if (upstream.name == target)
+                    return true;
+            }
+            return false;
+        };
+
+        for (const auto& upstream : _parser.getUpstreams())
+        {
+            for (const auto& upstreamServer : upstream.servers)
+            {
+                if (_proxyInfoMap.find(upstreamServer.address) == _proxyInfoMap.end())
+                    _proxyInfoMap[upstreamServer.address] = _resolver.add(upstreamServer.address);
+            }
+            _upstreamGroups.emplace(upstream.name, UpstreamGroup(upstream, _proxyInfoMap));
+        }
         for (const auto& server : server_confs)
         {
             for (const auto& location : server.locations)
             {
-                if (location.type == PROXY)
+                if ((location.type == PROXY && !isUpstreamName(location.target)) || location.type == FASTCGI)
                 {
                     std::string proxyHost;
                     std::string proxyPort;
 
                     size_t colonPos = location.target.rfind(':');
-                    if (colonPos != std::string::npos)
+                    if (location.target.compare(0, 5, "unix:") == 0)
+                    {
+                        proxyHost = "unix";
+                        proxyPort = location.target.substr(5);
+                    }
+                    else if (colonPos != std::string::npos)
                     {
                         proxyHost = location.target.substr(0, colonPos);
                         proxyPort = location.target.substr(colonPos + 1);
@@ -83,19 +125,7 @@ void WebServer::resolveProxyAddresses(const std::vector<Server>& server_confs)
 
                     std::string key = proxyHost + ":" + proxyPort;
                     if (_proxyInfoMap.find(key) == _proxyInfoMap.end())
-                    {
-                        addrinfo hints{};
-                        hints.ai_family = AF_UNSPEC;
-                        hints.ai_socktype = SOCK_STREAM;
-
-                        addrinfo* proxyInfo = nullptr;
-                        int status = getaddrinfo(proxyHost.c_str(), proxyPort.c_str(), &hints, &proxyInfo);
-                        if (status != 0)
-                        {
-                            throw WebErrors::ProxyException( "Error resolving proxy address" );
-                        }
-                        _proxyInfoMap[key] = proxyInfo;
-                    }
+                        _proxyInfoMap[key] = _resolver.add(key);
                 }
             }
         }
@@ -106,16 +136,56 @@ void WebServer::resolveProxyAddresses(const std::vector<Server>& server_confs)
     }
 }
 
+/*
+A specific address on a port a wildcard of its family listens on as well goes to the wildcard's socket, nginx
+style: both can't be bound. getVirtualHosts(clientFd) then tells their servers apart by the connection's local address.
+*/
 std::vector<ServerSocket> WebServer::createServerSockets(const std::vector<Server> &server_confs)
 {
     try
     {
-        std::vector<ServerSocket> serverSockets;
+        std::vector<ServerSocket>                   serverSockets;
+        std::unordered_map<std::string, size_t>     listenerIndex;  // keyed by what is bound
+        std::unordered_map<std::string, Listen>     wildcards;      // family and port -> the first wildcard listen there
 
+        auto familyAndPort = [](const Listen &listen) { return std::to_string(listen.family) + "/" + std::to_string(listen.port); };
+
+        for (const auto& server_conf : server_confs)
+        {
+            for (const auto& listen : server_conf.listens)
+            {
+                if (listen.family != LISTEN_UNIX && ServerSocket::isWildcard(listen))
+                    wildcards.emplace(familyAndPort(listen), listen);
+            }
+        }
         for (const auto& server_conf : server_confs) 
         {
-            ServerSocket serverSocket(server_conf, O_NONBLOCK | FD_CLOEXEC);
-            serverSockets.push_back(std::move(serverSocket));
+            for (const auto& listen : server_conf.listens)
+            {
+                const auto      wildcard = listen.family == LISTEN_UNIX ? wildcards.end() : wildcards.find(familyAndPort(listen));
+                const bool      takenIn = wildcard != wildcards.end() && !ServerSocket::isWildcard(listen);
+                const Listen    &bound = takenIn ? wildcard->second : listen;
+                const std::string key = ServerSocket::describe(bound);
+                auto it = listenerIndex.find(key);
+                const bool      repeated = it != listenerIndex.end();
+
+                if (!repeated)
+                {
+                    ServerSocket serverSocket(bound, O_NONBLOCK);
+                    serverSockets.push_back(std::move(serverSocket));
+                    it = listenerIndex.emplace(key, serverSockets.size() - 1).first;
+                    std::cout << COLOR_GREEN_SERVER << " { Listening on " << key << " 👂 }\n\n" << COLOR_RESET;
+                }
+                if (takenIn && ServerSocket::hasSocketOptions(listen))
+                    std::cerr << COLOR_RED_ERROR << "  Socket options on " << ServerSocket::describe(listen)
+                              << " are ignored, it is served by " << key << "\n\n" << COLOR_RESET;
+                else if (takenIn)
+                    std::cout << COLOR_GREEN_SERVER << " { " << ServerSocket::describe(listen) << " served by " << key << " }\n\n" << COLOR_RESET;
+                else if (repeated && ServerSocket::hasSocketOptions(listen))
+                    std::cerr << COLOR_RED_ERROR << "  Socket options on a repeated listen " << key
+                              << " are ignored, set them on the first one\n\n" << COLOR_RESET;
+                serverSockets[it->second].addServer(server_conf, listen);
+            }
         }
         return serverSockets;
     }
@@ -125,35 +195,41 @@ std::vector<ServerSocket> WebServer::createServerSockets(const std::vector<Serve
     }
 }
 
-void WebServer::epollController(int clientSocket, int operation, uint32_t events, FdType fdType)
+void WebServer::eventController(int clientSocket, int operation, uint32_t events, FdType fdType)
 {
     try
     {
-        struct epoll_event event;
-
-        std::memset(&event, 0, sizeof(event));
-        event.data.fd = clientSocket;
-        event.events = events;
-
-        if (EPOLL_CTL_ADD)
+        if (operation == EPOLL_CTL_ADD)
         {
             switch (fdType)
             {
                 case FdType::SERVER:
-                    std::cout << COLOR_GREEN_SERVER << " { Server socket added to epoll 🏊 }\n\n" << COLOR_RESET;
+                    std::cout << COLOR_GREEN_SERVER << " { Server socket added to event loop 🏊 }\n\n" << COLOR_RESET;
                     break;
                 case FdType::CLIENT:
-                    std::cout << COLOR_GREEN_SERVER << " { Client socket added to epoll 🏊 }\n\n" << COLOR_RESET;
+                    std::cout << COLOR_GREEN_SERVER << " { Client socket added to event loop 🏊 }\n\n" << COLOR_RESET;
                     break;
                 case FdType::CGI_PIPE:
-                    std::cout << COLOR_GREEN_SERVER << " { CGI pipe added to epoll 🏊 }\n\n" << COLOR_RESET;
+                    std::cout << COLOR_GREEN_SERVER << " { CGI pipe added to event loop 🏊 }\n\n" << COLOR_RESET;
+                    break;
+                case FdType::CGI_PROCESS:
+                    break;
+                case FdType::PROXY_SOCKET:
+                    std::cout << COLOR_GREEN_SERVER << " { Proxy socket added to event loop 🏊 }\n\n" << COLOR_RESET;
+                    break;
+                case FdType::FASTCGI_SOCKET:
+                    std::cout << COLOR_GREEN_SERVER << " { FastCGI socket added to event loop 🏊 }\n\n" << COLOR_RESET;
                     break;
             }
         }
-        if (epoll_ctl(_epollFd, operation, clientSocket, &event) == -1)
+        try
+        {
+            _eventBackend->control(clientSocket, operation, events);
+        }
+        catch (const std::exception &e)
         {
             close(clientSocket);
-            throw std::runtime_error("Error changing epoll state: " + std::string(strerror(errno)));
+            throw;
         }
         if (operation == EPOLL_CTL_DEL)
         {
@@ -171,14 +247,22 @@ void WebServer::acceptAddClientToEpoll(int clientSocketFd)
 {
     try
     {
-        struct sockaddr_in  clientAddr;
-        socklen_t           clientLen = sizeof(clientAddr);
-        ScopedSocket        clientSocket(accept(clientSocketFd, (struct sockaddr *)&clientAddr, &clientLen), 0);
+        // close-on-exec right away, or CGI scripts started meanwhile keep the connection open after we close it
+        ScopedSocket            clientSocket(_eventBackend->accept(clientSocketFd), 0);
 
+        if (clientSocket.getFd() < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return ; // gone again before it was taken
         if (clientSocket.getFd() < 0)
             throw std::runtime_error( "Error accepting client" );
-        setFdNonBlocking(clientSocketFd);
-        epollController(clientSocket.getFd(), EPOLL_CTL_ADD, EPOLLIN, FdType::CLIENT);
+        eventController(clientSocket.getFd(), EPOLL_CTL_ADD, EPOLLIN | EVENT_RECV, FdType::CLIENT);
+        for (const auto &serverSocket : _serverSockets)
+        {
+            if (serverSocket.getFd() == clientSocketFd)
+            {
+                serverSocket.setupClientSocket(clientSocket.getFd());
+                _clientListeners[clientSocket.getFd()] = &serverSocket.getVirtualHosts(clientSocket.getFd());
+            }
+        }
         clientSocket.release();
     }
     catch (const std::exception &e)
@@ -189,42 +273,53 @@ void WebServer::acceptAddClientToEpoll(int clientSocketFd)
 
 void WebServer::handleIncomingData(int clientSocket)
 {
-    bool stopProcessing = false;
+    bool            stopProcessing = false;
+    const Server    *tooLarge = nullptr; // server whose client_max_body_size the request exceeds
+
+    if (_clientOutputs.find(clientSocket) != _clientOutputs.end() && _clientOutputs[clientSocket].discard > 0)
+        return discardRequestBody(clientSocket);
+    if (_uploads.find(clientSocket) != _uploads.end())
+        return receiveUpload(clientSocket);
 
     auto cleanupClient = [this](int clientSocket)
     {
-        epollController(clientSocket, EPOLL_CTL_DEL, 0, FdType::CLIENT);
+        eventController(clientSocket, EPOLL_CTL_DEL, 0, FdType::CLIENT);
         _partialRequests.erase(clientSocket);
         _requestMap.erase(clientSocket);
+        _clientListeners.erase(clientSocket);
+        _clientOutputs.erase(clientSocket);
+    };
+
+    //the error page goes out through the client's output like any response; an earlier request still being
+    //answered on the connection can't be followed by it, the connection is closed instead
+    auto sendRequestError = [this](int clientSocket, const Server *server, int errorCode)
+    {
+        std::string response;
+
+        if (_requestMap.count(clientSocket) > 0 || _clientOutputs.count(clientSocket) > 0 || _uploads.count(clientSocket) > 0)
+            return closeClientConnection(clientSocket);
+        ErrorHandler(server).handleError(response, errorCode);
+        _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // back in for EPOLLOUT while the page is sent
+        _partialRequests.erase(clientSocket);
+        queueResponse(clientSocket, std::move(response));
     };
 
-    auto isRequestComplete = [this, clientSocket, &stopProcessing](const std::string &request) -> bool
+    auto isRequestComplete = [this, clientSocket, &stopProcessing, &tooLarge](const std::string &request) -> bool
     {
         auto checkMaxBodySize = [&, this](const size_t &content_length, const std::string &request, int clientSocket) -> bool
         {
             auto hostIt = request.find("Host: ");
             if (hostIt == std::string::npos) return false;
 
-            std::string host = request.substr(hostIt + 6, request.find("\r\n", hostIt) - hostIt - 6);
+            const std::string_view host(request.data() + hostIt + 6, request.find("\r\n", hostIt) - hostIt - 6);
+            const Server *server = getClientVirtualHosts(clientSocket).findServer(host);
 
-            for (const auto &server : _parser.getServers())
+            if (server && static_cast<long>(content_length) > server->client_max_body_size)
             {
-                for (const auto &server_name : server.server_name)
-                {
-                    const std::string server_name_ports = server_name + ":" + std::to_string(server.port);
-                    if (server_name_ports == host && static_cast<long>(content_length) > server.client_max_body_size)
-                    {
-                        std::cout << COLOR_RED_ERROR << "  Request body size exceeds client_max_body_size limit\n\n" << COLOR_RESET;
-                        ErrorHandler(&server).handleError(_partialRequests[clientSocket], 413);
-                        const int ret = send (clientSocket, _partialRequests[clientSocket].c_str(), _partialRequests[clientSocket].length(), 0);
-                        if (ret == -1)
-                            std::cerr << COLOR_RED_ERROR << "Error sending 413 response to client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-                        else if (ret == 0)
-                            std::cerr << COLOR_RED_ERROR << "Error sending 413 response to client, Connection closed by the client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-                        stopProcessing = true;
-                        return true;
-                    }
-                }
+                std::cout << COLOR_RED_ERROR << "  Request body size exceeds client_max_body_size limit\n\n" << COLOR_RESET;
+                tooLarge = server;
+                stopProcessing = true;
+                return true;
             }
             return false;
         };
@@ -277,66 +372,95 @@ void WebServer::handleIncomingData(int clientSocket)
 
     auto processRequest = [this](int clientSocket, const std::string &requestStr)
     {
-        Request request(requestStr, _parser.getServers(), _proxyInfoMap);
+        Request request(requestStr, getClientVirtualHosts(clientSocket), _proxyInfoMap);
         _requestMap[clientSocket] = request;
 
-        std::cout << COLOR_MAGENTA_SERVER << "  Request to: " << request.getServer()->server_name[0]
+        const auto &serverNames = request.getServer()->server_name;
+        std::cout << COLOR_MAGENTA_SERVER << "  Request to: " << (serverNames.empty() ? "_" : serverNames[0])
                   << ":" << request.getServer()->port << request.getRequestData().originalUri << " ✉️\n\n"
                   << COLOR_RESET;
 
         if (request.getLocation()->type == LocationType::CGI && request.getErrorCode() == 0)
         {
-            CGIHandler cgiHandler(request, *this);
-            epoll_ctl(_epollFd, EPOLL_CTL_DEL, clientSocket, nullptr); // Only delete from epoll, don't close()
+            _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // Only delete from the event loop, don't close()
+            CGILimiter *limiter = findCGILimiter(request.getLocation());
+
+            if (!serveCachedCgiResponse(clientSocket, request) && !collapseCgiRequest(clientSocket, request))
+            {
+                if (!limiter || limiter->acquire())
+                    startCGIScript(clientSocket);
+                else if (limiter->enqueue(clientSocket))
+                    std::cout << COLOR_YELLOW_CGI << "  Waiting for a free CGI slot 🐍\n\n" << COLOR_RESET;
+                else
+                    sendCGIBusy(clientSocket, limiter->retryAfter());
+            }
+        }
+        else if (request.getLocation()->type == LocationType::PROXY && request.getErrorCode() == 0)
+        {
+            _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // back in the loop once the upstream answered
+            startProxyRequest(clientSocket, request);
+        }
+        else if (request.getLocation()->type == LocationType::FASTCGI && request.getErrorCode() == 0)
+        {
+            _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // back in the loop once the backend answers
+            _fastCGIClient.start(request, clientSocket, ProxyHandler::peerAddress(clientSocket));
         }
         else
         {
-            epollController(clientSocket, EPOLL_CTL_MOD, EPOLLOUT, FdType::CLIENT);
+            eventController(clientSocket, EPOLL_CTL_MOD, EPOLLOUT, FdType::CLIENT);
         }
         _partialRequests.erase(clientSocket);
     };
 
     try
     {
-        char    buffer[1024];
-        ssize_t bytesRead = recv(clientSocket, buffer, sizeof(buffer), 0);
+        char    buffer[EVENT_RECV_SIZE]; // all the backend holds, nothing is left there when the socket is handed on
+        ssize_t bytesRead = _eventBackend->recv(clientSocket, buffer, sizeof(buffer));
 
         if (bytesRead > 0)
         {
+            const size_t    received = _partialRequests[clientSocket].size();
+
             _partialRequests[clientSocket].append(buffer, bytesRead);
 
-            while (isRequestComplete(_partialRequests[clientSocket]))
+            const size_t    headerEnd = _partialRequests[clientSocket].find("\r\n\r\n");
+            bool            complete = isRequestComplete(_partialRequests[clientSocket]);
+
+            const bool      headersArrived = !stopProcessing && headerEnd != std::string::npos && headerEnd + 4 > received;
+
+            if (headersArrived && startUpload(clientSocket))
+                return ;
+            if (!complete && headersArrived && (streamCGIRequest(clientSocket) || streamProxyRequest(clientSocket)))
+                return ;
+            while (complete)
             {
                 if (stopProcessing)
                 {
-                    cleanupClient(clientSocket);
+                    sendRequestError(clientSocket, tooLarge, 413);
                     break;
                 }
                 std::string completeRequest = extractCompleteRequest(_partialRequests[clientSocket]);
                 _partialRequests[clientSocket].erase(0, completeRequest.length());
                 processRequest(clientSocket, completeRequest);
+                complete = isRequestComplete(_partialRequests[clientSocket]);
             }
         }
         else if (bytesRead == 0)
         {
             cleanupClient(clientSocket);
         }
+        else if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return ;
         else if (bytesRead == -1)
         {
+            std::cerr << COLOR_RED_ERROR << "Error receiving data from client: " << strerror(errno) << "\n\n" << COLOR_RESET;
             cleanupClient(clientSocket);
-            throw std::runtime_error("Error receiving data from client");
         }
     }
     catch (const std::exception &e)
     {
         try {
-            ErrorHandler(&_parser.getServers().front()).handleError(_partialRequests[clientSocket], 400);
-            const int ret = send(clientSocket, _partialRequests[clientSocket].c_str(), _partialRequests[clientSocket].length(), 0);
-            if (ret == -1)
-                std::cerr << COLOR_RED_ERROR << "Error sending 400 response to client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-            else if (ret == 0)
-                std::cerr << COLOR_RED_ERROR << "Error sending 400 response to client, Connection closed by the client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-            cleanupClient(clientSocket);
+            sendRequestError(clientSocket, getClientVirtualHosts(clientSocket).getDefaultServer(), 400);
         } catch (const std::exception &inner_e) {
             WebErrors::combineExceptions(e, inner_e);
             throw e;
@@ -347,35 +471,41 @@ void WebServer::handleIncomingData(int clientSocket)
 
 void WebServer::handleOutgoingData(int clientSocket)
 {
+    if (_uploads.find(clientSocket) != _uploads.end()) // the rest of its 100 Continue can go out
+        return receiveUpload(clientSocket);
     try
     {
-        auto          it = _requestMap.find(clientSocket);
-        if (it != _requestMap.end())
+        if (_clientOutputs.find(clientSocket) == _clientOutputs.end())
         {
-            const Request &request = it->second;
-            Response res(request);
+            auto it = _requestMap.find(clientSocket);
+            if (it == _requestMap.end())
+                return closeClientConnection(clientSocket);
 
-            const int bytesSent = send(clientSocket, res.getResponse().c_str(), res.getResponse().length(), 0);
+            const Request   &request = it->second;
+            const bool      staticFile = request.getErrorCode() == 0 && (request.getLocation()->type == LocationType::STANDARD
+                                                                          || request.getLocation()->type == LocationType::ALIAS);
+            std::string     content;
+            int             error = 0;
+            const bool      fileRead = staticFile && _eventBackend->takeFile(clientSocket, content, error);
 
-            if (bytesSent == -1)
-            {
-                epollController(clientSocket, EPOLL_CTL_DEL, 0, FdType::CLIENT);
-                throw std::runtime_error("Error sending response to client");
-            }
-            else if (bytesSent == 0)
-            {
-                epollController(clientSocket, EPOLL_CTL_DEL, 0, FdType::CLIENT);
-                throw std::runtime_error("Connection closed by the client");
-            }
-            else
-                epollController(clientSocket, EPOLL_CTL_DEL, 0, FdType::CLIENT);
+            // the backend reads the file when it can, the client is back here once it is in; directories and
+            // large files are left to Response
+            if (staticFile && !fileRead && _eventBackend->readFile(clientSocket, request.getRequestData().uri))
+                return ;
+
+            ClientOutput &output = _clientOutputs[clientSocket];
+            output.data = fileRead && error != EISDIR && error != EFBIG ? Response(request, &content, error).getResponse()
+                                                                        : Response(request).getResponse();
+            output.complete = true;
+            output.registered = true;
+            _requestMap.erase(it);
         }
-        _requestMap.erase(it);
+        flushClientOutput(clientSocket);
     }
     catch (const std::exception &e)
     {
         try {
-            epollController(clientSocket, EPOLL_CTL_DEL, 0, FdType::CLIENT);
+            closeClientConnection(clientSocket);
         } catch (const std::exception &inner_e) {
             WebErrors::combineExceptions(e, inner_e);
         }
@@ -383,83 +513,1217 @@ void WebServer::handleOutgoingData(int clientSocket)
     }
 }
 
+/*
+Sends what the client socket takes without blocking and keeps the rest for its next EPOLLOUT.
+The client is only in the event loop while something is left to send, it is closed once a complete
+output is drained, and a proxy or CGI script paused on this buffer resumes below the low watermark.
+False when the client is gone (closed here, along with the upstream feeding it).
+*/
+bool WebServer::flushClientOutput(int clientSocket)
+{
+    ClientOutput    &output = _clientOutputs[clientSocket];
+    const size_t    pendingBefore = output.pending();
+
+    if (output.discard > 0) // discardRequestBody comes back here once the body is out of the way
+        return true;
+    while (output.pending() > 0)
+    {
+        const size_t  length = output.data.size() - output.offset;
+        const ssize_t bytesSent = _eventBackend->send(clientSocket, output.data.data() + output.offset, length,
+                                                      output.pipeFds[0], output.piped);
+
+        if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break ;
+        if (bytesSent <= 0)
+        {
+            std::cerr << COLOR_RED_ERROR << "Error sending response to client: " << strerror(errno) << "\n\n" << COLOR_RESET;
+            closeClientConnection(clientSocket);
+            return false;
+        }
+        output.offset += std::min<size_t>(bytesSent, length); // the data goes first, then the pipe
+        output.piped -= bytesSent - std::min<size_t>(bytesSent, length);
+    }
+    if (output.pending() == 0)
+    {
+        output.data.clear();
+        output.offset = 0;
+    }
+    else if (output.offset > output.data.size() / 2)
+    {
+        output.data.erase(0, output.offset);
+        output.offset = 0;
+    }
+
+    if (output.pending() == 0 && output.complete)
+    {
+        closeClientConnection(clientSocket);
+        return false;
+    }
+    if (output.pending() == 0 && output.registered)
+    {
+        _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0);
+        output.registered = false;
+    }
+    else if (output.pending() > 0 && !output.registered)
+    {
+        _eventBackend->control(clientSocket, EPOLL_CTL_ADD, EPOLLOUT);
+        output.registered = true;
+    }
+    if (pendingBefore > PROXY_BUFFER_LOW && output.pending() <= PROXY_BUFFER_LOW)
+    {
+        for (CGIProcessInfo &cgiInfo : _cgiInfoList)
+            if (cgiInfo.clientSocket == clientSocket && cgiInfo.paused)
+                pauseCGIOutput(cgiInfo, false);
+    }
+
+    auto proxy = _proxyConnections.find(output.upstreamFd);
+    if (proxy == _proxyConnections.end() || !proxy->second.paused)
+        return true;
+    if (output.pending() < pendingBefore) // a paused upstream only times out once the client stops reading
+        proxy->second.lastActivity = std::chrono::steady_clock::now();
+    if (output.pending() <= PROXY_BUFFER_LOW)
+    {
+        _eventBackend->control(output.upstreamFd, EPOLL_CTL_ADD, EPOLLIN);
+        proxy->second.paused = false;
+    }
+    return true;
+}
+
+ClientOutput::~ClientOutput() { closePipe(); }
+
+void ClientOutput::closePipe()
+{
+    if (pipeFds[0] == -1)
+        return ;
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    pipeFds[0] = -1;
+    pipeFds[1] = -1;
+    piped = 0;
+}
+
+//drops everything kept for the client, including a proxy still feeding it
+void WebServer::closeClientConnection(int clientSocket)
+{
+    auto output = _clientOutputs.find(clientSocket);
+    bool registered = true;
+
+    if (output != _clientOutputs.end())
+    {
+        registered = output->second.registered;
+        if (output->second.upstreamFd != -1)
+            abortProxyConnection(output->second.upstreamFd);
+        _clientOutputs.erase(output);
+    }
+    _fastCGIClient.abort(clientSocket);
+    if (detachCGIClient(clientSocket))
+        registered = true;
+    if (_uploads.erase(clientSocket) > 0)
+        registered = true;
+    _proxyBodies.erase(clientSocket);
+    for (auto &limiter : _cgiLimiters)
+        limiter.second.cancel(clientSocket);
+    if (registered)
+        eventController(clientSocket, EPOLL_CTL_DEL, 0, FdType::CLIENT);
+    else
+        close(clientSocket);
+    _requestMap.erase(clientSocket);
+    _partialRequests.erase(clientSocket);
+    _clientListeners.erase(clientSocket);
+}
+
+/*
+The pipe is drained up to CGI_READ_MAX per event, so a script that is already done is seen to be at
+its end along with its output and gets a Content-Length rather than chunked encoding. Once the client
+has PROXY_BUFFER_HIGH waiting, held back or not, the pipe is paused and the script blocks on it.
+*/
 void WebServer::handleCGIinteraction(int pipeFd)
 {
+    auto it = std::find_if(_cgiInfoList.begin(), _cgiInfoList.end(), [pipeFd](const CGIProcessInfo &cgiInfo)
+                           { return cgiInfo.readFromCgiFd == pipeFd || cgiInfo.writeToCgiFd == pipeFd
+                                    || cgiInfo.bodySocket == pipeFd || cgiInfo.pidFd == pipeFd
+                                    || cgiInfo.timerFd == pipeFd; });
+
+    if (it == _cgiInfoList.end())
+        return ;
+    if (pipeFd == it->pidFd)
+        return reapCGIProcess(it);
+    if (pipeFd == it->timerFd)
+        return expireCGIProcess(it);
+    if (pipeFd == it->writeToCgiFd || pipeFd == it->bodySocket)
+        return feedCGIInput(*it);
+
+    char        buffer[16384];
+    std::string data;
+    bool        eof = false;
+
+    while (data.size() < CGI_READ_MAX)
+    {
+        const ssize_t bytes = read(pipeFd, buffer, sizeof(buffer));
+
+        if (bytes > 0)
+            data.append(buffer, bytes);
+        else if (bytes == 0)
+            eof = true;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            throw std::runtime_error("Error reading from CGI output pipe");
+        if (bytes <= 0)
+            break ;
+    }
+
+    const std::string out = it->output.feed(data.data(), data.size(), eof);
+
+    if (!it->collapseKey.empty() || !it->cacheKey.empty())
+        it->response += out;
+    if (!it->cacheKey.empty() && it->response.size() > it->cache->getMaxEntrySize())
+    {
+        it->cacheKey.clear(); // too large to be stored
+        if (it->collapseKey.empty())
+            it->response.clear();
+    }
+    if (!out.empty() && it->clientSocket != -1 && it->bodySocket != -1) // held back until the body is in
+    {
+        _clientOutputs[it->clientSocket].data += out;
+        _clientOutputs[it->clientSocket].started = true;
+    }
+    else if (!out.empty() && it->clientSocket != -1)
+        queueCGIOutput(it->clientSocket, out, false);
+    if (!eof && !it->output.isMalformed())
+    {
+        auto output = _clientOutputs.find(it->clientSocket); // flushing may have closed the client
+
+        if (output != _clientOutputs.end() && output->second.pending() >= PROXY_BUFFER_HIGH)
+            pauseCGIOutput(*it, true);
+        return ;
+    }
+
+    const int               clientSocket = it->clientSocket;
+    const bool              malformed = it->output.isMalformed();
+    const std::string       response = std::move(it->response);
+    const std::vector<int>  waiters = std::move(it->waiters);
+
+    if (malformed)
+    {
+        std::cerr << COLOR_RED_ERROR << "CGI script sent no valid headers\n\n" << COLOR_RESET;
+        CGIHandler::killScript(*it);
+    }
+    else if (!it->cacheKey.empty() && it->output.isComplete())
+        it->cache->store(it->cacheKey, response);
+    closeCGIPipes(it);
+    for (int waiter : waiters)
+    {
+        if (malformed)
+            sendProxyError(waiter, 502);
+        else
+        {
+            _requestMap.erase(waiter);
+            queueResponse(waiter, response);
+        }
+    }
+    if (clientSocket == -1)
+        return ;
+    if (malformed)
+        sendCGIError(clientSocket, 502);
+    else
+        queueCGIOutput(clientSocket, "", true);
+}
+
+/*
+Writes the request body to the script's stdin: first what came in with the headers, then the rest spliced
+from the client socket as it arrives, never past the Content-Length that was checked against
+client_max_body_size. Both are level-triggered, so only the side holding things up is watched: the pipe
+while the script doesn't keep up, the client while it has nothing more yet.
+*/
+void WebServer::feedCGIInput(CGIProcessInfo &cgiInfo)
+{
+    if (cgiInfo.bodySocket != -1 && !flushContinue(cgiInfo.bodySocket, cgiInfo.body ? 0u : uint32_t(EPOLLIN)))
+        return ;
+    while (cgiInfo.body && cgiInfo.bodyOffset < cgiInfo.body->size())
+    {
+        const ssize_t written = write(cgiInfo.writeToCgiFd, cgiInfo.body->data() + cgiInfo.bodyOffset,
+                                      cgiInfo.body->size() - cgiInfo.bodyOffset);
+
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return ;
+        if (written <= 0)
+        {
+            if (errno != EPIPE)
+                std::cerr << COLOR_RED_ERROR << "Error writing to CGI input pipe: " << strerror(errno) << "\n\n" << COLOR_RESET;
+            return closeCGIInput(cgiInfo);
+        }
+        cgiInfo.bodyOffset += written;
+    }
+    cgiInfo.body.reset();
+    while (cgiInfo.bodyRemaining > 0)
+    {
+        const ssize_t moved = splice(cgiInfo.bodySocket, nullptr, cgiInfo.writeToCgiFd, nullptr,
+                                     std::min<size_t>(cgiInfo.bodyRemaining, CGI_SPLICE_MAX),
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (moved > 0)
+        {
+            cgiInfo.bodyRemaining -= moved;
+            CGIHandler::resetTimeout(cgiInfo);
+            continue ;
+        }
+        if (moved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            int         unread = 0;
+            const bool  pipeFull = ioctl(cgiInfo.bodySocket, FIONREAD, &unread) == 0 && unread > 0;
+
+            _eventBackend->control(cgiInfo.writeToCgiFd, EPOLL_CTL_MOD, pipeFull ? uint32_t(EPOLLOUT) : 0u);
+            _eventBackend->control(cgiInfo.bodySocket, EPOLL_CTL_MOD, (pipeFull ? 0u : uint32_t(EPOLLIN)) | continueEvents(cgiInfo.bodySocket));
+            return ;
+        }
+        if (moved == 0 || errno != EPIPE)
+        {
+            const int clientSocket = cgiInfo.bodySocket;
+
+            std::cerr << COLOR_RED_ERROR << "Request body cut short, the CGI script is stopped\n\n" << COLOR_RESET;
+            return closeClientConnection(clientSocket);
+        }
+        break ; // the script closed its stdin, it has all it wants
+    }
+    closeCGIInput(cgiInfo);
+}
+
+/*
+The body is in, or no more of it is wanted; output held back meanwhile can go to the client now. What the
+script left of the body is still read, and dropped: closing the socket with it unread would reset the
+connection under the response.
+*/
+void WebServer::closeCGIInput(CGIProcessInfo &cgiInfo)
+{
+    const int       clientSocket = cgiInfo.bodySocket;
+    const size_t    unread = cgiInfo.bodyRemaining;
+
+    if (cgiInfo.writeToCgiFd != -1)
+        eventController(cgiInfo.writeToCgiFd, EPOLL_CTL_DEL, 0, FdType::CGI_PIPE);
+    cgiInfo.writeToCgiFd = -1;
+    cgiInfo.body.reset();
+    cgiInfo.bodySocket = -1;
+    cgiInfo.bodyRemaining = 0;
+    if (clientSocket == -1)
+        return ;
+    if (unread > 0)
+    {
+        ClientOutput &output = _clientOutputs[clientSocket];
+
+        output.discard = unread;
+        output.registered = true;
+        return _eventBackend->control(clientSocket, EPOLL_CTL_MOD, EPOLLIN | EVENT_RECV);
+    }
+    _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // Only delete from the event loop, don't close()
+    if (_clientOutputs.find(clientSocket) != _clientOutputs.end())
+        flushClientOutput(clientSocket);
+}
+
+void WebServer::discardRequestBody(int clientSocket)
+{
+    ClientOutput    &output = _clientOutputs[clientSocket];
+    char            buffer[16384];
+
+    while (output.discard > 0)
+    {
+        const ssize_t bytes = _eventBackend->recv(clientSocket, buffer, std::min(sizeof(buffer), output.discard));
+
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return ;
+        if (bytes <= 0)
+            return closeClientConnection(clientSocket);
+        output.discard -= bytes;
+    }
+    _eventBackend->control(clientSocket, EPOLL_CTL_MOD, EPOLLOUT);
+    flushClientOutput(clientSocket);
+}
+
+/*
+The headers of a request with a body still to come just arrived. For a cgi_pass location with a slot
+free the script starts right away, and CGIHandler::parent leaves the client in the event loop for
+feedCGIInput to splice the rest of the body into it, instead of the whole of it being buffered here.
+false for every other request, which is then read in full as before.
+*/
+bool WebServer::streamCGIRequest(int clientSocket)
+{
+    Request     request(_partialRequests[clientSocket], getClientVirtualHosts(clientSocket), _proxyInfoMap);
+    CGILimiter  *limiter = findCGILimiter(request.getLocation());
+
+    if (request.getLocation()->type != LocationType::CGI || request.getErrorCode() != 0
+        || (limiter && !limiter->acquire()))
+        return false;
+    std::cout << COLOR_MAGENTA_SERVER << "  Request to: " << request.getRequestData().originalUri
+              << ", streaming its body to the CGI script ✉️\n\n" << COLOR_RESET;
+    if (strcasecmp(ProxyCache::findHeader(request.getRequestData().headers, "Expect").c_str(), "100-continue") == 0)
+        sendContinue(clientSocket); // or the client waits a while before sending the body
+    _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0);
+    _partialRequests.erase(clientSocket);
+    _requestMap[clientSocket] = request;
+    startCGIScript(clientSocket);
+    for (const CGIProcessInfo &cgiInfo : _cgiInfoList)
+        if (cgiInfo.bodySocket == clientSocket && continueEvents(clientSocket) != 0)
+            _eventBackend->control(clientSocket, EPOLL_CTL_MOD, (cgiInfo.body ? 0u : uint32_t(EPOLLIN)) | EPOLLOUT);
+    return true;
+}
+
+/*
+The same for a proxy_pass location and a Content-Length of PROXY_SPLICE_MIN or more: the upstream request
+starts with the body in hand, and once its head is sent spliceProxyBody moves the rest from the client to
+the upstream through the client's output pipe, which the response gets for itself afterwards.
+*/
+bool WebServer::streamProxyRequest(int clientSocket)
+{
+    const std::string   &buffer = _partialRequests[clientSocket];
+    Request             request(buffer, getClientVirtualHosts(clientSocket), _proxyInfoMap);
+    const std::string   contentLength = WebParser::trimSpaces(request.getRequestData().content_length);
+    const size_t        inHand = buffer.size() - (buffer.find("\r\n\r\n") + 4);
+
+    if (request.getLocation()->type != LocationType::PROXY || request.getErrorCode() != 0
+        || contentLength.empty() || contentLength.find_first_not_of("0123456789") != std::string::npos
+        || contentLength.size() > 18 || std::stoull(contentLength) < PROXY_SPLICE_MIN)
+        return false;
+
+    const bool          fresh = _clientOutputs.find(clientSocket) == _clientOutputs.end();
+    ClientOutput        &output = _clientOutputs[clientSocket];
+
+    ProxyHandler::openSplicePipe(output);
+    if (!output.isSplicing()) // no pipe to spare, the body is buffered as before
+    {
+        if (fresh)
+            _clientOutputs.erase(clientSocket);
+        return false;
+    }
+    std::cout << COLOR_MAGENTA_SERVER << "  Request to: " << request.getRequestData().originalUri
+              << ", streaming its body to the upstream ✉️\n\n" << COLOR_RESET;
+    if (strcasecmp(ProxyCache::findHeader(request.getRequestData().headers, "Expect").c_str(), "100-continue") == 0)
+        sendContinue(clientSocket);
+    _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // back in the loop once the head is sent upstream
+    _proxyBodies[clientSocket] = std::stoull(contentLength) - inHand;
+    _partialRequests.erase(clientSocket);
+    _requestMap[clientSocket] = request;
+    startProxyRequest(clientSocket, request);
+    return true;
+}
+
+/*
+POST or PUT to a location with upload_folder: the body goes to disk as it arrives, see UploadHandler. The
+client stays in the event loop for it, and for the rest of a body the upload failed on.
+false for every other request.
+*/
+bool WebServer::startUpload(int clientSocket)
+{
+    const std::string   &buffer = _partialRequests[clientSocket];
+
+    if (buffer.compare(0, 5, "POST ") != 0 && buffer.compare(0, 4, "PUT ") != 0)
+        return false;
+
+    Request             request(buffer, getClientVirtualHosts(clientSocket), _proxyInfoMap);
+    const std::string   &method = request.getRequestData().method;
+
+    if (!request.getLocation() || !request.getLocation()->uploadOn || request.getErrorCode() != 0
+        || (method != "POST" && method != "PUT"))
+        return false;
+    std::cout << COLOR_MAGENTA_SERVER << "  Request to: " << request.getRequestData().originalUri
+              << ", storing its body in " << request.getLocation()->upload_folder << " ✉️\n\n" << COLOR_RESET;
+
+    auto            upload = std::make_unique<UploadHandler>(request);
+    const size_t    bodyStart = buffer.find("\r\n\r\n") + 4;
+    const bool      waitsForContinue = buffer.size() == bodyStart
+        && strcasecmp(ProxyCache::findHeader(request.getRequestData().headers, "Expect").c_str(), "100-continue") == 0;
+
+    if (waitsForContinue && !upload->isDone())
+        sendContinue(clientSocket);
+    if (continueEvents(clientSocket) != 0)
+        _eventBackend->control(clientSocket, EPOLL_CTL_MOD, EPOLLIN | EPOLLOUT);
+    upload->feed(buffer.data() + bodyStart, buffer.size() - bodyStart);
+    _partialRequests.erase(clientSocket);
+    _uploads[clientSocket] = std::move(upload);
+    if (_uploads[clientSocket]->isDone())
+        finishUpload(clientSocket, !waitsForContinue); // refused before the body was asked for, it won't come
+    return true;
+}
+
+/*
+The interim response to Expect: 100-continue, while the client is in the event loop for its body. What
+the socket doesn't take now stays in the client's output, ahead of the final response; the caller adds
+EPOLLOUT to what the client is watched for (continueEvents) so that it goes out before the body is sent.
+*/
+void WebServer::sendContinue(int clientSocket)
+{
+    static const std::string    response = "HTTP/1.1 100 Continue\r\n\r\n";
+    ClientOutput                &output = _clientOutputs[clientSocket];
+    const ssize_t               bytesSent = send(clientSocket, response.data(), response.size(), MSG_NOSIGNAL);
+
+    if (bytesSent == static_cast<ssize_t>(response.size()))
+        return ;
+    output.data.append(response, std::max<ssize_t>(bytesSent, 0));
+    output.interim = true;
+}
+
+//EPOLLOUT while the rest of a 100 Continue waits in the client's output
+uint32_t WebServer::continueEvents(int clientSocket) const
+{
+    auto it = _clientOutputs.find(clientSocket);
+
+    return it != _clientOutputs.end() && it->second.interim ? uint32_t(EPOLLOUT) : 0u;
+}
+
+/*
+Sends the rest of a 100 Continue on any event of a client whose body is being read; once it is out the
+client is watched for events again, without EPOLLOUT. False when the client is gone.
+*/
+bool WebServer::flushContinue(int clientSocket, uint32_t events)
+{
+    auto it = _clientOutputs.find(clientSocket);
+
+    if (it == _clientOutputs.end() || !it->second.interim)
+        return true;
+
+    ClientOutput    &output = it->second;
+    const ssize_t   bytesSent = send(clientSocket, output.data.data() + output.offset, output.data.size() - output.offset, MSG_NOSIGNAL);
+
+    if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;
+    if (bytesSent <= 0)
+    {
+        std::cerr << COLOR_RED_ERROR << "Error sending 100 Continue to client: " << strerror(errno) << "\n\n" << COLOR_RESET;
+        closeClientConnection(clientSocket);
+        return false;
+    }
+    output.offset += bytesSent;
+    if (output.offset < output.data.size())
+        return true;
+    output.data.clear();
+    output.offset = 0;
+    output.interim = false;
+    _eventBackend->control(clientSocket, EPOLL_CTL_MOD, events);
+    return true;
+}
+
+//up to UPLOAD_READ_MAX per event, so that one fast upload doesn't hold up the other clients
+void WebServer::receiveUpload(int clientSocket)
+{
+    UploadHandler   &upload = *_uploads[clientSocket];
+    char            buffer[65536];
+
+    if (!flushContinue(clientSocket, EPOLLIN | EVENT_RECV))
+        return ;
+    for (size_t received = 0; !upload.isDone() && received < UPLOAD_READ_MAX; )
+    {
+        const ssize_t bytes = _eventBackend->recv(clientSocket, buffer, std::min(sizeof(buffer), upload.getRemaining()));
+
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return ;
+        if (bytes <= 0)
+        {
+            std::cerr << COLOR_RED_ERROR << "Upload cut short, nothing stored from it\n\n" << COLOR_RESET;
+            return closeClientConnection(clientSocket);
+        }
+        upload.feed(buffer, bytes);
+        received += bytes;
+    }
+    if (upload.isDone())
+        finishUpload(clientSocket, true);
+}
+
+//the files are in place or removed before the response goes out; a body left unread is drained first
+void WebServer::finishUpload(int clientSocket, bool drain)
+{
+    const std::string   response = _uploads[clientSocket]->getResponse();
+    const size_t        unread = drain ? _uploads[clientSocket]->getRemaining() : 0;
+
+    _uploads.erase(clientSocket);
+    if (unread > 0)
+    {
+        ClientOutput &output = _clientOutputs[clientSocket];
+
+        output.discard = unread;
+        output.registered = true;
+    }
+    else
+        _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // Only delete from the event loop, don't close()
+    queueResponse(clientSocket, response);
+}
+
+/*
+The output is done, or given up on: the pipes are closed, a script still writing gets EPIPE. The entry
+goes once the script is reaped as well; one that closed its stdout and runs on is left to its timer.
+*/
+void WebServer::closeCGIPipes(cgiInfoList::iterator it)
+{
+    closeCGIInput(*it); // when it's done without reading all of its input
+    if (it->readFromCgiFd != -1 && it->paused)
+        close(it->readFromCgiFd);
+    else if (it->readFromCgiFd != -1)
+        eventController(it->readFromCgiFd, EPOLL_CTL_DEL, 0, FdType::CGI_PIPE);
+    it->readFromCgiFd = -1;
+    it->paused = false;
+    it->clientSocket = -1;
+    it->waiters.clear();
+    it->collapseKey.clear();
+    it->cacheKey.clear();
+    it->response.clear();
+    if (it->exited)
+        eraseCGIProcess(it);
+}
+
+//the script's stdout in or out of the event loop; a paused script blocks once the pipe is full
+void WebServer::pauseCGIOutput(CGIProcessInfo &cgiInfo, bool paused)
+{
+    if (cgiInfo.paused == paused || cgiInfo.readFromCgiFd == -1)
+        return ;
+    _eventBackend->control(cgiInfo.readFromCgiFd, paused ? EPOLL_CTL_DEL : EPOLL_CTL_ADD, EPOLLIN);
+    cgiInfo.paused = paused;
+}
+
+/*
+The pidfd is readable: the script exited. waitid() reaps our own children; a zygote child is not ours
+(ECHILD), the zygote has reaped it already. Output still in the pipe is read on as usual.
+*/
+void WebServer::reapCGIProcess(cgiInfoList::iterator it)
+{
+    siginfo_t   info = {};
+    const int   result = waitid(static_cast<idtype_t>(P_PIDFD), it->pidFd, &info, WEXITED | WNOHANG);
+
+    if (result == 0 && info.si_pid != 0)
+    {
+        it->exitStatus = info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status;
+        if (it->exitStatus != 0)
+            std::cout << COLOR_YELLOW_CGI << "  CGI Script exited with status " << it->exitStatus << " 🐍\n\n" << COLOR_RESET;
+    }
+    else if (result == -1 && errno != ECHILD)
+        std::cerr << COLOR_RED_ERROR << "Failed to reap CGI process: " << strerror(errno) << "\n\n" << COLOR_RESET;
+    eventController(it->pidFd, EPOLL_CTL_DEL, 0, FdType::CGI_PROCESS);
+    it->pidFd = -1;
+    it->exited = true;
+    if (it->readFromCgiFd == -1)
+        eraseCGIProcess(it);
+}
+
+//its cgi_max_concurrency slot, if any, goes to the next queued request
+void WebServer::eraseCGIProcess(cgiInfoList::iterator it)
+{
+    CGILimiter  *limiter = it->limiter;
+    const auto  latency = std::chrono::steady_clock::now() - it->startTime;
+
+    if (it->timerFd != -1)
+        eventController(it->timerFd, EPOLL_CTL_DEL, 0, FdType::CGI_PROCESS);
+    _cgiInfoList.erase(it);
+    if (!limiter)
+        return ;
+    limiter->release();
+    limiter->record(latency);
+    for (int clientSocket = limiter->dequeue(); clientSocket != -1; clientSocket = limiter->dequeue())
+        startCGIScript(clientSocket);
+}
+
+//with a cgi_max_concurrency slot already taken for it, given back if the script doesn't start (the
+//queue then moves on in CGIQueueChecker)
+void WebServer::startCGIScript(int clientSocket)
+{
+    const Request   &request = _requestMap[clientSocket];
+    CGIHandler      cgiHandler(request, *this, clientSocket);
+    CGILimiter      *limiter = findCGILimiter(request.getLocation());
+
+    if (cgiHandler.getCGIResponse().empty())
+        return ;
+    if (limiter)
+        limiter->release();
+    queueResponse(clientSocket, cgiHandler.getCGIResponse()); // the script could not be started
+}
+
+/*
+The zygote reported the pid of a script it forked, or -1 if it went away first; the script's entry
+then has no process to reap and is left to its output and its timer. A script whose entry is gone
+already (see CGIHandler::parent) is killed.
+*/
+void WebServer::watchZygoteChild(uint64_t ticket, pid_t pid)
+{
+    auto it = std::find_if(_cgiInfoList.begin(), _cgiInfoList.end(), [ticket](const CGIProcessInfo &cgiInfo)
+                           { return cgiInfo.zygoteTicket == ticket; });
+
+    if (it == _cgiInfoList.end())
+    {
+        if (pid > 0)
+            kill(pid, SIGKILL);
+        return ;
+    }
+    it->zygoteTicket = 0;
+    it->pid = pid;
+    if (pid > 0 && CGIHandler::watchProcess(*it) == -1)
+    {
+        std::cerr << COLOR_RED_ERROR << "Failed to watch CGI process: " << strerror(errno) << "\n\n" << COLOR_RESET;
+        kill(pid, SIGKILL);
+    }
+    if (it->pidFd != -1)
+        eventController(it->pidFd, EPOLL_CTL_ADD, EPOLLIN, FdType::CGI_PROCESS);
+    else
+        it->exited = true;
+    if (it->killPending)
+        CGIHandler::killScript(*it);
+    if (it->exited && it->readFromCgiFd == -1)
+        eraseCGIProcess(it);
+}
+
+//cgi_max_concurrency: no slot and no room in the queue, or waited in it for too long
+void WebServer::sendCGIBusy(int clientSocket, int retryAfter)
+{
+    std::string response;
+
+    ErrorHandler(_requestMap[clientSocket].getServer()).handleError(response, 503);
+    response.insert(response.find("\r\n") + 2, "Retry-After: " + std::to_string(retryAfter) + "\r\n");
+    _requestMap.erase(clientSocket);
+    queueResponse(clientSocket, std::move(response));
+}
+
+void WebServer::CGIQueueChecker(void)
+{
+    for (auto &entry : _cgiLimiters)
+    {
+        CGILimiter &limiter = entry.second;
+
+        for (int clientSocket = limiter.dequeue(); clientSocket != -1; clientSocket = limiter.dequeue())
+            startCGIScript(clientSocket);
+        for (int clientSocket : limiter.expire())
+        {
+            std::cout << COLOR_YELLOW_CGI << "  Waited too long for a CGI slot ⏰\n\n" << COLOR_RESET;
+            sendCGIBusy(clientSocket, limiter.retryAfter());
+        }
+        if (limiter.isReportDue())
+            std::cout << COLOR_YELLOW_CGI << "  CGI queue " << limiter.report(false) << "\n\n" << COLOR_RESET;
+    }
+}
+
+/*
+The script's output has nowhere to go; it is stopped unless a collapsed request still waits for it.
+true if the client was in the event loop for the body it was still sending, it is left there for the caller.
+*/
+bool WebServer::detachCGIClient(int clientSocket)
+{
+    bool sendingBody = false;
+
+    for (CGIProcessInfo &cgiInfo : _cgiInfoList)
+    {
+        cgiInfo.waiters.erase(std::remove(cgiInfo.waiters.begin(), cgiInfo.waiters.end(), clientSocket),
+                              cgiInfo.waiters.end());
+        if (cgiInfo.clientSocket != clientSocket)
+            continue ;
+        cgiInfo.clientSocket = -1;
+        pauseCGIOutput(cgiInfo, false); // read on to its end, for the waiters or until it is stopped
+        if (cgiInfo.bodySocket == clientSocket)
+        {
+            sendingBody = true;
+            cgiInfo.bodySocket = -1;
+            closeCGIInput(cgiInfo);
+        }
+        if (cgiInfo.waiters.empty())
+            CGIHandler::killScript(cgiInfo);
+    }
+    return sendingBody;
+}
+
+//cgi_collapse: a request identical to one whose script is still running waits for that output
+bool WebServer::collapseCgiRequest(int clientSocket, const Request &request)
+{
+    const std::string key = CGIHandler::collapseKey(request);
+
+    if (key.empty())
+        return false;
+    for (CGIProcessInfo &cgiInfo : _cgiInfoList)
+    {
+        if (cgiInfo.collapseKey == key)
+        {
+            cgiInfo.waiters.push_back(clientSocket);
+            std::cout << COLOR_YELLOW_CGI << "  Waiting for the running CGI Script 🐍\n\n" << COLOR_RESET;
+            return true;
+        }
+    }
+    return false;
+}
+
+//cgi_cache_valid: a request identical to one answered in the last cgi_cache_valid gets the same response
+bool WebServer::serveCachedCgiResponse(int clientSocket, const Request &request)
+{
+    CGICache            *cache = findCGICache(request.getLocation());
+    const std::string   key = cache ? cache->makeKey(request.getRequestData()) : "";
+    const std::string   *response = key.empty() ? nullptr : cache->lookup(key);
+
+    if (!response)
+        return false;
+    std::cout << COLOR_YELLOW_CGI << "  CGI response served from cache 🐍\n\n" << COLOR_RESET;
+    _requestMap.erase(clientSocket);
+    queueResponse(clientSocket, *response);
+    return true;
+}
+
+//the timerfd went off: the script is killed and, unless its output was all sent, the clients get a 504
+void WebServer::expireCGIProcess(cgiInfoList::iterator it)
+{
+    std::cout << COLOR_YELLOW_CGI << "  CGI Script Timed Out ⏰\n\n" << COLOR_RESET;
+    if (CGIHandler::killScript(*it) == -1)
+        std::cerr << COLOR_RED_ERROR << "Failed to kill CGI process: " << strerror(errno) << "\n\n" << COLOR_RESET;
+    eventController(it->timerFd, EPOLL_CTL_DEL, 0, FdType::CGI_PROCESS);
+    it->timerFd = -1;
+    if (it->readFromCgiFd == -1)
+        return ;
+
+    const int               clientSocket = it->clientSocket;
+    const std::vector<int>  waiters = std::move(it->waiters);
+
+    closeCGIPipes(it);
+    for (int waiter : waiters)
+        sendProxyError(waiter, 504);
+    if (clientSocket != -1)
+        sendCGIError(clientSocket, 504);
+}
+
+//a whole response produced outside of Response (CGI, proxy errors); the client closes once it is sent
+void WebServer::queueResponse(int clientSocket, std::string response)
+{
+    ClientOutput &output = _clientOutputs[clientSocket];
+
+    output.data.erase(0, output.offset); // what is left of a 100 Continue goes first
+    output.interim = false;
+    output.data += response;
+    output.offset = 0;
+    output.complete = true;
+    output.started = true;
+    output.upstreamFd = -1;
+    flushClientOutput(clientSocket);
+}
+
+void WebServer::handleProxyInteraction(int upstreamFd)
+{
+    auto it = _proxyConnections.find(upstreamFd);
+
+    if (it == _proxyConnections.end())
+        return ;
+
+    ProxyConnectionInfo &proxy = it->second;
+
     try
     {
-        for (auto it = _cgiInfoList.begin(); it != _cgiInfoList.end(); ++it)
+        proxy.lastActivity = std::chrono::steady_clock::now();
+        if (proxy.state == PROXY_CONNECTING)
+        {
+            ProxySocket::finishConnect(upstreamFd);
+            proxy.state = PROXY_SENDING;
+        }
+        if (proxy.state == PROXY_SENDING)
         {
-            if (it->readFromCgiFd == pipeFd)
+            if (ProxyHandler::sendRequest(proxy) && spliceProxyBody(proxy))
             {
-                char    buffer[4096];
-                ssize_t bytes = read(pipeFd, buffer, sizeof(buffer));
+                proxy.state = PROXY_READING;
+                _eventBackend->control(upstreamFd, EPOLL_CTL_MOD, EPOLLIN);
+            }
+        }
+        else
+        {
+            const int       clientSocket = proxy.clientSocket;
+            ClientOutput    *output = (clientSocket == -1) ? nullptr : &_clientOutputs[clientSocket];
 
-                if (bytes > 0)
-                    it->response.append(buffer, bytes);
-                else if (bytes == 0)
-                {
-                    const int clientSocket = it->clientSocket;
-                    epollController(pipeFd, EPOLL_CTL_DEL, 0, FdType::CGI_PIPE);
-                    const int   ret = send(clientSocket, it->response.c_str(), it->response.length(), 0);
-                    if (ret == -1)
-                        std::cerr << COLOR_RED_ERROR << "Error sending 504 response to client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-                    else if (ret == 0)
-                        std::cerr << COLOR_RED_ERROR << "Error sending Cgi response to client, Connection closed by the client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-                    close(clientSocket);
-                    _cgiInfoList.erase(it);
-                    _requestMap.erase(clientSocket);
-                }
-                else if (bytes == -1)
-                    throw std::runtime_error("Error reading from CGI output pipe");
-                break;
+            if (output)
+                output->upstreamFd = upstreamFd;
+            if (ProxyHandler::readResponse(proxy, output))
+                return finishProxyConnection(upstreamFd, 0);
+            if (!output || !flushClientOutput(clientSocket))
+                return ;
+            if (output->pending() >= PROXY_BUFFER_HIGH)
+            {
+                _eventBackend->control(upstreamFd, EPOLL_CTL_DEL, 0);
+                proxy.paused = true;
             }
         }
     }
-    catch (std::exception &e)
+    catch (const WebErrors::ProxyException &e)
     {
-        throw;
+        WebErrors::printerror("WebServer::handleProxyInteraction", e.what());
+        if (!retryProxyConnection(upstreamFd))
+            finishProxyConnection(upstreamFd, 502);
+    }
+}
+
+/*
+The rest of a body streamProxyRequest left at the client, client -> pipe -> upstream without a copy to
+user space. The pipe is emptied before more is taken from the client, so a splice that would block
+tells which side holds things up, and only that side is watched. True once all of it is upstream;
+false otherwise, also when the client went away and took the upstream connection with it.
+*/
+bool WebServer::spliceProxyBody(ProxyConnectionInfo &proxy)
+{
+    const int       clientSocket = proxy.clientSocket;
+    auto            body = _proxyBodies.find(clientSocket);
+
+    if (clientSocket == -1 || body == _proxyBodies.end())
+        return true;
+
+    ClientOutput    &output = _clientOutputs[clientSocket];
+
+    if (!output.registered)
+    {
+        _eventBackend->control(clientSocket, EPOLL_CTL_ADD, 0);
+        output.registered = true;
+        output.upstreamFd = proxy.upstreamFd; // its events come back to handleProxyInteraction
+    }
+    while (body->second > 0 || proxy.bodyPiped > 0)
+    {
+        const bool      toUpstream = proxy.bodyPiped > 0;
+        const ssize_t   moved = toUpstream
+            ? splice(output.pipeFds[0], nullptr, proxy.upstreamFd, nullptr, proxy.bodyPiped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+            : splice(clientSocket, nullptr, output.pipeFds[1], nullptr, std::min<size_t>(body->second, PROXY_BUFFER_HIGH),
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (moved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            struct pollfd upstream = {proxy.upstreamFd, 0, 0};
+
+            //an upstream that reset the connection would keep reporting it while the client is waited for
+            if (!toUpstream && poll(&upstream, 1, 0) > 0 && (upstream.revents & (POLLERR | POLLHUP)))
+                throw WebErrors::ProxyException("Proxy server closed the connection during the request body");
+            _eventBackend->control(proxy.upstreamFd, EPOLL_CTL_MOD, toUpstream ? uint32_t(EPOLLOUT) : 0u);
+            _eventBackend->control(clientSocket, EPOLL_CTL_MOD, (toUpstream ? 0u : uint32_t(EPOLLIN)) | continueEvents(clientSocket));
+            return false;
+        }
+        if (moved < 0 && toUpstream)
+            throw WebErrors::ProxyException("Error sending to proxy server");
+        if (moved <= 0)
+        {
+            std::cerr << COLOR_RED_ERROR << "Request body cut short, the proxied request is dropped\n\n" << COLOR_RESET;
+            closeClientConnection(clientSocket);
+            return false;
+        }
+        if (toUpstream)
+        {
+            proxy.bodyPiped -= moved;
+            proxy.requestSent += moved;
+        }
+        else
+        {
+            body->second -= moved;
+            proxy.bodySpliced += moved;
+            proxy.bodyPiped += moved;
+        }
+        proxy.lastActivity = std::chrono::steady_clock::now();
+    }
+    _proxyBodies.erase(body);
+    _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0); // Only delete from the event loop, don't close()
+    output.registered = false;
+    output.closePipe();
+    return true;
+}
+
+/*
+The client of a proxied request is answered before the body streamProxyRequest left at it was all taken:
+what is in the pipe is dropped and the rest is read and dropped before the response goes out, see
+discardRequestBody.
+*/
+void WebServer::dropProxyBody(int clientSocket)
+{
+    auto body = _proxyBodies.find(clientSocket);
+
+    if (body == _proxyBodies.end())
+        return ;
+
+    ClientOutput    &output = _clientOutputs[clientSocket];
+    const size_t    unread = body->second;
+
+    _proxyBodies.erase(body);
+    output.closePipe();
+    output.discard = unread;
+    if (unread > 0)
+        _eventBackend->control(clientSocket, output.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, EPOLLIN | EVENT_RECV);
+    else if (output.registered)
+        _eventBackend->control(clientSocket, EPOLL_CTL_DEL, 0);
+    output.registered = unread > 0;
+}
+
+/*
+Moves a failed proxied request to a new connection when nothing of it can have reached the upstream:
+a pooled connection the upstream closed before answering is replaced by a fresh one to the same
+server, a connect that failed or is taking too long moves on to the next address of the server,
+and a group server that could not be connected to is swapped for the next one the group picks.
+False when the failure is final and the caller has to answer with an error.
+*/
+bool WebServer::retryProxyConnection(int upstreamFd)
+{
+    auto it = _proxyConnections.find(upstreamFd);
+
+    if (it == _proxyConnections.end())
+        return false;
+
+    ProxyConnectionInfo &proxy = it->second;
+    const bool          staleConnection = proxy.reused && proxy.bytesReceived == 0;
+    const bool          nextAddress = proxy.state == PROXY_CONNECTING && proxy.upstreamAddress
+                                      && proxy.addressIndex + 1 < proxy.upstreamAddress->size();
+    const bool          failover = proxy.group && !proxy.healthProbe && proxy.state == PROXY_CONNECTING
+                                   && proxy.attempts < proxy.group->getPeers().size();
+
+    if ((!staleConnection && !nextAddress && !failover) || proxy.bodySpliced > 0) // that part of the body is gone
+        return false;
+
+    ProxyConnectionInfo retry = std::move(proxy);
+
+    _proxyConnections.erase(it);
+    eventController(upstreamFd, EPOLL_CTL_DEL, 0, FdType::PROXY_SOCKET);
+    if (nextAddress)
+        retry.addressIndex++;
+    else if (!staleConnection)
+    {
+        retry.group->release(*retry.peer, true);
+        retry.peer = retry.group->select(retry.uri);
+        if (!retry.peer)
+        {
+            sendProxyError(retry.clientSocket, 502);
+            resumeCollapsedRequests(retry.collapseCache, retry.cacheKey);
+            return true;
+        }
+        retry.upstreamKey = retry.peer->key;
+        retry.upstreamAddress = retry.peer->address;
+        retry.addressIndex = 0;
+        retry.attempts++;
+    }
+    try
+    {
+        ProxyHandler::connectUpstream(retry, *this, !staleConnection && !nextAddress);
+    }
+    catch (const WebErrors::ProxyException &e)
+    {
+        WebErrors::printerror("WebServer::retryProxyConnection", e.what());
+        if (retry.peer)
+            retry.group->release(*retry.peer, true);
+        sendProxyError(retry.clientSocket, 502);
+        resumeCollapsedRequests(retry.collapseCache, retry.cacheKey);
+    }
+    return true;
+}
+
+void WebServer::startProxyRequest(int clientSocket, const Request &request)
+{
+    try
+    {
+        ProxyHandler proxyHandler(request, *this, clientSocket);
+    }
+    catch (const WebErrors::ProxyException &e)
+    {
+        std::string response;
+
+        WebErrors::printerror("ProxyHandler::ProxyHandler", e.what());
+        dropProxyBody(clientSocket);
+        ErrorHandler(request.getServer()).handleError(response, 502);
+        queueResponse(clientSocket, std::move(response));
+    }
+}
+
+//the misses that waited for a collapsed request go through the proxy again, mostly to hit the cache now
+void WebServer::resumeCollapsedRequests(ProxyCache *cache, const std::string &key)
+{
+    if (!cache)
+        return ;
+    for (int clientSocket : cache->release(key))
+    {
+        auto it = _requestMap.find(clientSocket);
+
+        if (it == _requestMap.end())
+            continue ;
+
+        const Request request = it->second; // the map entry goes away once the client is answered
+        startProxyRequest(clientSocket, request);
+    }
+}
+
+/*
+CGI and FastCGI responses stream into the client's output like a proxied one. A CGI script is paused by
+handleCGIinteraction while the client lags; a FastCGI connection carries other requests and is read on.
+*/
+void WebServer::queueCGIOutput(int clientSocket, const std::string &data, bool complete)
+{
+    ClientOutput &output = _clientOutputs[clientSocket];
+
+    output.data.append(data);
+    output.started = true;
+    if (complete)
+    {
+        output.complete = true;
+        _requestMap.erase(clientSocket);
     }
+    flushClientOutput(clientSocket);
 }
 
-void WebServer::CGITimeoutChecker(void)
+void WebServer::sendCGIError(int clientSocket, int errorCode)
 {
-    try 
+    auto output = _clientOutputs.find(clientSocket);
+
+    if (output != _clientOutputs.end() && output->second.started)
+        closeClientConnection(clientSocket);
+    else
+        sendProxyError(clientSocket, errorCode);
+}
+
+void WebServer::sendProxyError(int clientSocket, int errorCode)
+{
+    std::string response;
+
+    if (clientSocket == -1)
+        return ;
+    dropProxyBody(clientSocket);
+    ErrorHandler(_requestMap[clientSocket].getServer()).handleError(response, errorCode);
+    _requestMap.erase(clientSocket);
+    queueResponse(clientSocket, std::move(response));
+}
+
+void WebServer::closeUpstream(const ProxyConnectionInfo &proxy)
+{
+    if (proxy.paused)
+        close(proxy.upstreamFd);
+    else
+        eventController(proxy.upstreamFd, EPOLL_CTL_DEL, 0, FdType::PROXY_SOCKET);
+}
+
+//the client went away mid-response: nothing to report, the upstream is just closed
+void WebServer::abortProxyConnection(int upstreamFd)
+{
+    auto it = _proxyConnections.find(upstreamFd);
+
+    if (it == _proxyConnections.end())
+        return ;
+
+    ProxyCache          *collapseCache = it->second.collapseCache;
+    const std::string   cacheKey = it->second.cacheKey;
+
+    if (it->second.peer)
+        it->second.group->release(*it->second.peer, false);
+    closeUpstream(it->second);
+    _proxyConnections.erase(it);
+    resumeCollapsedRequests(collapseCache, cacheKey);
+}
+
+/*
+Done with the upstream: it goes back to the pool or is closed, and a complete cacheable response
+is stored. The client's output is marked complete so it closes once drained; on an error it gets an
+error page if nothing was streamed yet, otherwise it is cut off. A 304 to a conditional request made
+for a stale cache entry refreshes the entry and the client gets the stored response.
+Misses collapsed into this request are resumed last, as they may start new upstream connections.
+*/
+void WebServer::finishProxyConnection(int upstreamFd, int errorCode)
+{
+    auto it = _proxyConnections.find(upstreamFd);
+
+    if (it == _proxyConnections.end())
+        return ;
+
+    ProxyConnectionInfo &proxy = it->second;
+    const int           clientSocket = proxy.clientSocket;
+    const bool          healthProbe = proxy.healthProbe;
+    const bool          notModified = errorCode == 0 && proxy.cacheEntry && proxy.framing.getStatusCode() == 304;
+    const auto          cacheEntry = std::move(proxy.cacheEntry);
+    ProxyCache          *collapseCache = proxy.collapseCache;
+    const std::string   cacheKey = proxy.cacheKey;
+    const bool          keep = errorCode == 0 && proxy.reusable && !healthProbe
+                               && _upstreamPool.release(proxy.upstreamKey, upstreamFd, proxy.requestsServed + 1);
+
+    if (healthProbe)
     {
-        auto now = std::chrono::steady_clock::now();
+        const int status = proxy.framing.getStatusCode();
+        proxy.group->setHealth(*proxy.peer, errorCode == 0 && status >= 200 && status < 400);
+    }
+    else if (proxy.peer)
+        proxy.group->release(*proxy.peer, errorCode != 0);
+    if (cacheEntry)
+        cacheEntry->revalidating = false;
+    if (notModified)
+        proxy.cache->refresh(cacheEntry, proxy.framing);
+    else if (errorCode == 0 && proxy.cache && proxy.framing.isComplete())
+        proxy.cache->store(proxy.cacheKey, proxy.cacheRequestHeaders, proxy.cacheCapture, proxy.framing);
+    if (keep)
+        _eventBackend->control(upstreamFd, EPOLL_CTL_MOD, EPOLLIN); // idle, only watched for the upstream closing it
+    else
+        closeUpstream(proxy);
+    _proxyConnections.erase(it);
+    if (clientSocket == -1) // health probes and background cache revalidations
+        return ;
+
+    ClientOutput &output = _clientOutputs[clientSocket];
 
-        for (auto it = _cgiInfoList.begin(); it != _cgiInfoList.end();)
+    output.upstreamFd = -1;
+    if (errorCode != 0 && !output.started)
+        sendProxyError(clientSocket, errorCode);
+    else if (errorCode != 0)
+        closeClientConnection(clientSocket);
+    else if (notModified)
+    {
+        _requestMap.erase(clientSocket);
+        queueResponse(clientSocket, ProxyCache::render(*cacheEntry, time(nullptr)));
+    }
+    else
+    {
+        output.complete = true;
+        _requestMap.erase(clientSocket);
+        flushClientOutput(clientSocket);
+    }
+    resumeCollapsedRequests(collapseCache, cacheKey);
+}
+
+void WebServer::ProxyTimeoutChecker(void)
+{
+    auto                now = std::chrono::steady_clock::now();
+    std::vector<int>    timedOut;
+
+    for (const auto &entry : _proxyConnections)
+    {
+        const ProxyConnectionInfo   &proxy = entry.second;
+        const bool                  moreAddresses = proxy.state == PROXY_CONNECTING && proxy.upstreamAddress
+                                                    && proxy.addressIndex + 1 < proxy.upstreamAddress->size();
+        const auto                  limit = std::chrono::seconds(moreAddresses ? PROXY_CONNECT_ATTEMPT_DELAY
+                                            : (proxy.state == PROXY_CONNECTING || proxy.healthProbe)
+                                            ? PROXY_CONNECT_TIMEOUT : PROXY_READ_TIMEOUT);
+
+        if (now - proxy.lastActivity > limit)
+            timedOut.push_back(entry.first);
+    }
+    for (int upstreamFd : timedOut)
+    {
+        //paused the whole time: it's the client that stopped reading
+        if (_proxyConnections[upstreamFd].paused)
         {
-            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - it->startTime).count();
+            closeClientConnection(_proxyConnections[upstreamFd].clientSocket);
+            continue ;
+        }
+        std::cout << COLOR_RED_ERROR << "  Proxy server timed out ⏰\n\n" << COLOR_RESET;
+        if (_proxyConnections[upstreamFd].state != PROXY_CONNECTING || !retryProxyConnection(upstreamFd))
+            finishProxyConnection(upstreamFd, 504);
+    }
+    _upstreamPool.expireIdle();
+}
 
-            if (elapsed > CGI_TIMEOUT_LIMIT)
+//takes what the resolver thread found; requests already under way keep the addresses they started with
+void WebServer::UpstreamAddressUpdater(void)
+{
+    for (auto &update : _resolver.collect())
+    {
+        std::cout << COLOR_GREEN_SERVER << "  Upstream " << update.first << " resolved to new addresses 🧭\n\n" << COLOR_RESET;
+        _proxyInfoMap[update.first] = update.second;
+        _upstreamPool.closeIdle(update.first);
+        for (auto &group : _upstreamGroups)
+        {
+            for (auto &peer : group.second.getPeers())
             {
-                std::cout << COLOR_YELLOW_CGI << "  CGI Script Timed Out ⏰\n\n" << COLOR_RESET;
-                if (kill(it->pid, SIGKILL) == -1)
-                    std::cerr << COLOR_RED_ERROR << "Failed to kill CGI process: " << strerror(errno) << "\n\n" << COLOR_RESET;
-                if (it->clientSocket >= 0 && fcntl(it->clientSocket, F_GETFD) != -1)
-                {  
-                    std::string response;
-                    ErrorHandler(_requestMap[it->clientSocket].getServer()).handleError(response, 504);
-                    const int   ret = send(it->clientSocket, response.c_str(), response.length(), 0);
-                    if (ret == -1)
-                        std::cerr << COLOR_RED_ERROR << "Error sending 504 response to client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-                    else if (ret == 0)
-                        std::cerr << COLOR_RED_ERROR << "Error sending 504 response to client, Connection closed by the client: " << strerror(errno) << "\n\n" << COLOR_RESET;
-                    close(it->clientSocket);
-                }
-                if (_requestMap[it->clientSocket].getRequestData().method == "POST" && it->writeToCgiFd != -1)
-                    epollController(it->writeToCgiFd, EPOLL_CTL_DEL, 0, FdType::CGI_PIPE);
-                epollController(it->readFromCgiFd, EPOLL_CTL_DEL, 0, FdType::CGI_PIPE);
-                _requestMap.erase(it->clientSocket);
-                it = _cgiInfoList.erase(it);
+                if (peer.key == update.first)
+                    peer.address = update.second;
             }
-            else
-                ++it;
         }
     }
-    catch (const std::exception &e)
+}
+
+void WebServer::UpstreamHealthChecker(void)
+{
+    for (auto &entry : _upstreamGroups)
     {
-        throw;
+        if (!entry.second.isProbeDue())
+            continue ;
+        for (auto &peer : entry.second.getPeers())
+        {
+            if (!peer.probing)
+                ProxyHandler::startHealthProbe(entry.second, peer, *this);
+        }
     }
 }
 
@@ -474,11 +1738,15 @@ void WebServer::handleEvents(int eventCount)
         auto isCgiFd = [this](int fd) -> bool {
             for (const auto& cgiInfo : _cgiInfoList)
             {
-                if (cgiInfo.readFromCgiFd == fd || cgiInfo.writeToCgiFd == fd)
+                if (cgiInfo.readFromCgiFd == fd || cgiInfo.writeToCgiFd == fd || cgiInfo.bodySocket == fd
+                    || cgiInfo.pidFd == fd || cgiInfo.timerFd == fd)
                     return true;
             }
             return false;
         };
+        auto isProxyFd = [this](int fd) -> bool {
+            return _proxyConnections.find(fd) != _proxyConnections.end();
+        };
 
         for (int i = 0; i < eventCount; ++i)
         {
@@ -488,17 +1756,38 @@ void WebServer::handleEvents(int eventCount)
             {
                 acceptAddClientToEpoll(_currentEventFd);
             }
+            else if (_cgiZygote && _currentEventFd == _cgiZygote->getFd())
+            {
+                _cgiZygote->handleEvent();
+            }
             else if (isCgiFd(_currentEventFd))
             {
                 handleCGIinteraction(_currentEventFd);
             }
+            else if (isProxyFd(_currentEventFd))
+            {
+                handleProxyInteraction(_currentEventFd);
+            }
+            else if (_proxyBodies.find(_currentEventFd) != _proxyBodies.end())
+            {
+                if (flushContinue(_currentEventFd, EPOLLIN))
+                    handleProxyInteraction(_clientOutputs[_currentEventFd].upstreamFd);
+            }
+            else if (_fastCGIClient.contains(_currentEventFd))
+            {
+                _fastCGIClient.handleEvent(_currentEventFd, _events[i].events);
+            }
+            else if (_upstreamPool.contains(_currentEventFd))
+            {
+                _upstreamPool.drop(_currentEventFd);
+            }
             else
             {
                 if (_events[i].events & EPOLLIN)
                 {
                     handleIncomingData(_currentEventFd);
                 }
-                else if (_events[i].events & EPOLLOUT)
+                else if (_events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
                 {
                     handleOutgoingData(_currentEventFd);
                 }
@@ -530,38 +1819,89 @@ void WebServer::start()
     {
         try
         {
-            int eventCount = epoll_wait(_epollFd, _events.data(), MAX_EVENTS, 500);
+            int eventCount = _eventBackend->wait(_events, 500);
             if (eventCount == -1)
             {
                 if (errno == EINTR) continue;
-                throw std::runtime_error("Epoll wait error");
+                throw std::runtime_error("Event wait error");
             }
             if (eventCount > 0)
                 handleEvents(eventCount);
-            CGITimeoutChecker();
+            CGIQueueChecker();
+            ProxyTimeoutChecker();
+            _fastCGIClient.checkTimeouts();
+            UpstreamHealthChecker();
+            UpstreamAddressUpdater();
         }
         catch (const std::exception &e)
         {
             WebErrors::printerror("WebServer::start", e.what());
         }
     }
+    for (auto &entry : _cgiLimiters)
+        std::cout << COLOR_YELLOW_CGI << "  CGI queue totals " << entry.second.report(true) << "\n\n" << COLOR_RESET;
     std::cout << COLOR_GREEN_SERVER << "[ SERVER STOPPED ] 🔌\n" << COLOR_RESET;
 }
 
 void  WebServer::signalHandler(int signal) { (void) signal; s_serverRunning = 0; }
 
-int WebServer::getEpollFd() const { return _epollFd; }
-
 cgiInfoList& WebServer::getCgiInfoList() { return _cgiInfoList; }
 
+proxyConnectionMap& WebServer::getProxyConnections() { return _proxyConnections; }
+
+UpstreamPool& WebServer::getUpstreamPool() { return _upstreamPool; }
+
+UpstreamGroup* WebServer::findUpstreamGroup(const std::string &name)
+{
+    auto it = _upstreamGroups.find(name);
+
+    return (it == _upstreamGroups.end()) ? nullptr : &it->second;
+}
+
+CGILimiter* WebServer::findCGILimiter(const Location *location)
+{
+    auto it = _cgiLimiters.find(location);
+
+    return (it == _cgiLimiters.end()) ? nullptr : &it->second;
+}
+
+CGICache* WebServer::findCGICache(const Location *location)
+{
+    auto it = _cgiCaches.find(location);
+
+    return (it == _cgiCaches.end()) ? nullptr : &it->second;
+}
+
+ProxyCache* WebServer::findProxyCache(const Location *location)
+{
+    auto it = _proxyCaches.find(location);
+
+    return (it == _proxyCaches.end()) ? nullptr : &it->second;
+}
+
+CGIZygote* WebServer::getCgiZygote() { return _cgiZygote.get(); }
+
 int WebServer::getCurrentEventFd() const { return _currentEventFd; }
 
+//falls back to the first listener, so a client whose mapping is gone still gets error pages
+const VirtualHostMap &WebServer::getClientVirtualHosts(int clientSocket) const
+{
+    auto it = _clientListeners.find(clientSocket);
+
+    if (it == _clientListeners.end())
+        return _serverSockets.front().getVirtualHosts();
+    return *it->second;
+}
+
+//close-on-exec is a descriptor flag, not a file status one: it takes F_SETFD
 void WebServer::setFdNonBlocking(int fd)
 {
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags == -1)
         throw std::runtime_error("Failed to get pipe flags");
-    flags |= O_NONBLOCK | FD_CLOEXEC;
+    flags |= O_NONBLOCK;
     if (fcntl(fd, F_SETFL, flags) == -1)
         throw std::runtime_error("Failed to set non-blocking mode");
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+        throw std::runtime_error("Failed to set close-on-exec");
 }
@@ -14,6 +14,20 @@
 #include <unordered_map>
 #include <vector>
 #include "Request.hpp"
+#include "EventBackend.hpp"
+#include "ResponseFraming.hpp"
+#include "UpstreamPool.hpp"
+#include "UpstreamGroup.hpp"
+#include "ProxyCache.hpp"
+#include "UpstreamResolver.hpp"
+#include "FastCGIClient.hpp"
+#include "CGIZygote.hpp"
+#include "CGIOutput.hpp"
+#include "CGILimiter.hpp"
+#include "CGICache.hpp"
+#include "UploadHandler.hpp"
+#include <chrono>
+#include <memory>
 
 #define MAX_EVENTS 100
 
@@ -24,18 +38,100 @@
 #define COLOR_YELLOW_CGI "\033[33m"
 #define COLOR_RESET "\033[0m"
 
+// One per script, from its start until both its output is done (readFromCgiFd -1) and it was reaped.
 struct CGIProcessInfo
 {
     int         readFromCgiFd;
     int         writeToCgiFd;
-    pid_t       pid;
-    int         clientSocket;
-    std::string response;
+    pid_t       pid;                // 0 while zygoteTicket is set
+    uint64_t    zygoteTicket = 0;   // forked by the zygote, its pid not reported yet
+    bool        killPending = false; // killScript() came before the pid, done once it is in
+    int         pidFd = -1;         // readable once the script has exited, -1 after that
+    int         timerFd = -1;       // readable after CGI_TIMEOUT_LIMIT
+    bool        exited = false;
+    int         exitStatus = -1;    // exit code, 128 + the signal if killed; -1 if the zygote reaped it
+    int         clientSocket;       // -1 once the client is gone
+    bool        paused = false;     // readFromCgiFd out of the event loop while the client's buffer is full
+    CGIOutput   output;
+    std::string response;           // what the client got so far, for the waiters
+    std::string collapseKey;        // cgi_collapse: identical requests arriving meanwhile
+    std::vector<int> waiters;       // get a copy of this response
+    CGICache    *cache = nullptr;   // cgi_cache_valid: the response is stored under cacheKey once complete
+    std::string cacheKey;
+    std::shared_ptr<const std::string> body;    // the raw request, written to the script from bodyOffset on
+    size_t      bodyOffset = 0;
+    int         bodySocket = -1;    // client the rest of the body is spliced from, after body
+    size_t      bodyRemaining = 0;  // bytes of it still to come, up to the Content-Length
+    CGILimiter  *limiter = nullptr; // cgi_max_concurrency: holds one of its slots until erased
     std::chrono::steady_clock::time_point startTime;
 };
 using cgiInfoList = std::list<CGIProcessInfo>;
 
-enum FdType  {SERVER, CLIENT, CGI_PIPE };
+enum ProxyState { PROXY_CONNECTING, PROXY_SENDING, PROXY_READING };
+
+struct ProxyConnectionInfo
+{
+    int             upstreamFd;
+    int             clientSocket;
+    std::string     upstreamKey;        // _proxyInfoMap / UpstreamPool key
+    AddressList     upstreamAddress;
+    size_t          addressIndex = 0;   // the one being connected to, the next ones are the fallbacks
+    size_t          requestsServed;     // earlier requests on this connection
+    bool            reused;             // came from the pool, may have been closed under us
+    bool            reusable;           // response left the connection fit for the pool
+    UpstreamGroup   *group = nullptr;   // set when proxy_pass names an upstream block
+    UpstreamGroup::Peer *peer = nullptr;
+    std::string     uri;                // uri_hash key
+    size_t          attempts = 1;       // servers of the group tried so far
+    bool            healthProbe = false; // no client, the result goes to UpstreamGroup::setHealth
+    ProxyState      state;
+    std::string     request;            // request line and headers, rebuilt for the upstream
+    std::shared_ptr<const std::string> requestBody; // the client's raw request, its body is sent from bodyOffset on
+    size_t          bodyOffset = 0;
+    size_t          requestSent;        // over both
+    size_t          bodySpliced = 0;    // taken from the client socket, see WebServer::spliceProxyBody
+    size_t          bodyPiped = 0;      // of that, still in the client's output pipe
+    std::string     response;           // held back until the headers are complete, then streamed
+    size_t          bytesReceived = 0;
+    bool            paused = false;     // out of the event loop while the client's buffer is full
+    ProxyCache      *cache = nullptr;   // the response is stored there once complete
+    std::string     cacheKey;
+    ProxyCache::Headers cacheRequestHeaders; // for Vary
+    ProxyCache::EntryPtr cacheEntry;    // stale entry the request was made conditional for
+    std::string     cacheCapture;       // response as received, while it may still be stored
+    ProxyCache      *collapseCache = nullptr; // other misses on cacheKey wait for this response
+    ResponseFraming framing;
+    std::chrono::steady_clock::time_point lastActivity;
+};
+using proxyConnectionMap = std::unordered_map<int, ProxyConnectionInfo>; // keyed by upstreamFd
+
+// Bytes waiting for a non-blocking client socket. A proxy appends to it while the upstream answers,
+// large bodies go through the pipe instead (spliced in from the upstream, out to the client after data).
+// Before that, a large request body may go through the same pipe the other way, see spliceProxyBody.
+struct ClientOutput
+{
+    std::string     data;
+    size_t          offset = 0;
+    int             pipeFds[2] = {-1, -1};
+    size_t          piped = 0;
+    bool            complete = false;   // nothing more will be appended, close once drained
+    bool            started = false;    // bytes were queued, an error page can't be sent anymore
+    bool            registered = false; // client fd is in the event loop (EPOLLOUT)
+    int             upstreamFd = -1;    // proxy feeding this buffer
+    size_t          discard = 0;        // request body its CGI script didn't take, read and dropped before sending
+    bool            interim = false;    // holds the rest of a 100 Continue, sent while the body is read
+
+    ClientOutput() = default;
+    ClientOutput(const ClientOutput &) = delete;
+    ClientOutput &operator=(const ClientOutput &) = delete;
+    ~ClientOutput();
+
+    size_t          pending() const { return data.size() - offset + piped; }
+    bool            isSplicing() const { return pipeFds[0] != -1; }
+    void            closePipe();
+};
+
+enum FdType  {SERVER, CLIENT, CGI_PIPE, CGI_PROCESS, PROXY_SOCKET, FASTCGI_SOCKET };
 
 class WebServer
 {
@@ -46,24 +142,46 @@ public:
     WebServer &operator=(const WebServer &) = delete;
 
     void                 start();
-    void                 epollController(int clientSocket, int operation, uint32_t events, FdType fdType);
-    int                  getEpollFd() const;
+    void                 eventController(int clientSocket, int operation, uint32_t events, FdType fdType);
+    void                 queueResponse(int clientSocket, std::string response);
+    void                 resumeCollapsedRequests(ProxyCache *cache, const std::string &key);
     cgiInfoList          &getCgiInfoList();
+    proxyConnectionMap   &getProxyConnections();
+    UpstreamPool         &getUpstreamPool();
+    UpstreamGroup        *findUpstreamGroup(const std::string &name);
+    ProxyCache           *findProxyCache(const Location *location);
+    CGILimiter           *findCGILimiter(const Location *location);
+    CGICache             *findCGICache(const Location *location);
+    CGIZygote            *getCgiZygote();
     int                  getCurrentEventFd() const;
+    const VirtualHostMap &getClientVirtualHosts(int clientSocket) const;
 
     static void          setFdNonBlocking(int fd);
 private:
     static volatile sig_atomic_t                s_serverRunning;
     std::vector<ServerSocket>                   _serverSockets = {};
-    int                                         _epollFd = -1;
+    std::unique_ptr<EventBackend>               _eventBackend;
     int                                         _currentEventFd = -1;
     WebParser                                   &_parser;
     std::vector<struct epoll_event>             _events = {};
 
     std::unordered_map<int, std::string>        _partialRequests;
     cgiInfoList                                  _cgiInfoList = {};
-    std::unordered_map<std::string, addrinfo*>  _proxyInfoMap = {};
+    proxyConnectionMap                          _proxyConnections = {};
+    UpstreamPool                                _upstreamPool;
+    UpstreamResolver                            _resolver;
+    FastCGIClient                               _fastCGIClient;
+    std::unique_ptr<CGIZygote>                  _cgiZygote;     // cgi_zygote on
+    std::unordered_map<std::string, UpstreamGroup> _upstreamGroups;
+    std::unordered_map<const Location *, ProxyCache> _proxyCaches;
+    std::unordered_map<const Location *, CGILimiter> _cgiLimiters;
+    std::unordered_map<const Location *, CGICache> _cgiCaches;
+    std::unordered_map<int, ClientOutput>       _clientOutputs;
+    std::unordered_map<int, std::unique_ptr<UploadHandler>> _uploads;
+    std::unordered_map<int, size_t>             _proxyBodies;   // streamProxyRequest: body bytes still at the client
+    std::unordered_map<std::string, AddressList>  _proxyInfoMap = {};
     std::unordered_map<int, Request>            _requestMap;
+    std::unordered_map<int, const VirtualHostMap*> _clientListeners;
 
     std::vector<ServerSocket>   createServerSockets(const std::vector<Server> &server_confs);
     void                        handleClient(int clientSocket);
@@ -74,7 +192,45 @@ private:
     void                        handleCGIinteraction(int pipeFd); // read() && send() for CGI
     void                        handleIncomingData(int clientSocket); // recv()
     void                        handleOutgoingData(int clientSocket); // send()
-    void                        CGITimeoutChecker(void);
+    void                        expireCGIProcess(cgiInfoList::iterator it);
+    void                        reapCGIProcess(cgiInfoList::iterator it);
+    void                        closeCGIPipes(cgiInfoList::iterator it);
+    void                        pauseCGIOutput(CGIProcessInfo &cgiInfo, bool paused);
+    void                        eraseCGIProcess(cgiInfoList::iterator it);
+    void                        startCGIScript(int clientSocket);
+    void                        watchZygoteChild(uint64_t ticket, pid_t pid);
+    void                        sendCGIBusy(int clientSocket, int retryAfter);
+    void                        CGIQueueChecker(void);
+    bool                        detachCGIClient(int clientSocket);
+    void                        feedCGIInput(CGIProcessInfo &cgiInfo);
+    void                        closeCGIInput(CGIProcessInfo &cgiInfo);
+    void                        discardRequestBody(int clientSocket);
+    bool                        streamCGIRequest(int clientSocket);
+    bool                        streamProxyRequest(int clientSocket);
+    bool                        spliceProxyBody(ProxyConnectionInfo &proxy);
+    void                        dropProxyBody(int clientSocket);
+    bool                        startUpload(int clientSocket);
+    void                        sendContinue(int clientSocket);
+    bool                        flushContinue(int clientSocket, uint32_t events);
+    uint32_t                    continueEvents(int clientSocket) const;
+    void                        receiveUpload(int clientSocket);
+    void                        finishUpload(int clientSocket, bool drain);
+    bool                        collapseCgiRequest(int clientSocket, const Request &request);
+    bool                        serveCachedCgiResponse(int clientSocket, const Request &request);
+    void                        handleProxyInteraction(int upstreamFd); // connect, send() and recv() for the upstream
+    void                        finishProxyConnection(int upstreamFd, int errorCode);
+    bool                        retryProxyConnection(int upstreamFd);
+    void                        sendProxyError(int clientSocket, int errorCode);
+    void                        startProxyRequest(int clientSocket, const Request &request);
+    void                        queueCGIOutput(int clientSocket, const std::string &data, bool complete);
+    void                        sendCGIError(int clientSocket, int errorCode);
+    void                        UpstreamHealthChecker(void);
+    void                        UpstreamAddressUpdater(void);
+    void                        ProxyTimeoutChecker(void);
+    bool                        flushClientOutput(int clientSocket);
+    void                        closeClientConnection(int clientSocket);
+    void                        abortProxyConnection(int upstreamFd);
+    void                        closeUpstream(const ProxyConnectionInfo &proxy);
     void                        cleanupClient(int clientSocket);
     void                        processRequest(int clientSocket, const std::string &requestStr);
     bool                        isRequestComplete(const std::string &request);
@@ -0,0 +1,57 @@
+#include "LocationTrie.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/*
+Location matching against 1000 locations: the linear scan RequestValidator used to do (every location
+tried with uri.find(location) == 0, the longest kept) against LocationTrie::findLongestPrefix.
+Prints nanoseconds per match for both. Build and run with `make bench && tests/bench/LocationTrieBench`.
+*/
+int main(void)
+{
+    std::vector<std::string>    locations;
+    std::vector<std::string>    uris;
+    std::mt19937                random(1);
+    LocationTrie                trie;
+    const int                   rounds = 100;
+    long                        sink = 0;
+
+    for (int i = 0; i < 1000; i++)
+        locations.push_back("/svc" + std::to_string(i % 97) + "/api" + std::to_string(i) + "/");
+    locations.push_back("/");
+    for (size_t i = 0; i < locations.size(); i++)
+        trie.insert(locations[i], i);
+    for (int i = 0; i < 10000; i++)
+    {
+        const int location = random() % 1000;
+
+        uris.push_back("/svc" + std::to_string(location % 97) + "/api" + std::to_string(location) + "/some/file.html");
+    }
+
+    const auto linearStart = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (const std::string &uri : uris)
+        {
+            ssize_t best = -1;
+
+            for (size_t i = 0; i < locations.size(); i++)
+                if (uri.find(locations[i]) == 0 && (best == -1 || locations[i].size() > locations[best].size()))
+                    best = i;
+            sink += best;
+        }
+    }
+    const auto trieStart = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++)
+        for (const std::string &uri : uris)
+            sink += trie.findLongestPrefix(uri);
+    const auto end = std::chrono::steady_clock::now();
+
+    const double matches = static_cast<double>(rounds) * uris.size();
+    std::cout << "locations: " << locations.size() << ", matches: " << matches << " (" << sink << ")\n";
+    std::cout << "linear scan: " << std::chrono::duration<double, std::nano>(trieStart - linearStart).count() / matches << " ns/match\n";
+    std::cout << "radix trie:  " << std::chrono::duration<double, std::nano>(end - trieStart).count() / matches << " ns/match\n";
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#define BLOCK_SIZE (64ul << 20)
+#define LAUNCHES 200
+
+extern char **environ;
+
+/*
+Launch latency against the parent's RSS: how long fork()+execve() and posix_spawn() (what CGIHandler
+and the zygote use) hold up the caller before it gets control back, with a touched heap of growing
+size standing in for a server that caches a lot. Every launch runs /bin/true and is waited for.
+usage: SpawnBench [max RSS in MB]
+*/
+static double launch(bool spawn)
+{
+    char        *argv[] = {const_cast<char *>("/bin/true"), nullptr};
+    pid_t       pid;
+    const auto  start = std::chrono::steady_clock::now();
+
+    if (spawn)
+    {
+        if (posix_spawn(&pid, argv[0], nullptr, nullptr, argv, environ) != 0)
+            return -1;
+    }
+    else if ((pid = fork()) == 0)
+    {
+        execve(argv[0], argv, environ);
+        _exit(1);
+    }
+    const double launched = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    waitpid(pid, nullptr, 0);
+    return launched;
+}
+
+int main(int argc, char **argv)
+{
+    const size_t        maxMb = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2048;
+    std::vector<char *> blocks;
+    size_t              mb = 0;
+
+    for (size_t target : {16ul, 256ul, 1024ul, 2048ul})
+    {
+        if (target > maxMb)
+            break;
+        for (; mb < target; mb += BLOCK_SIZE >> 20)
+        {
+            blocks.push_back(new char[BLOCK_SIZE]);
+            std::memset(blocks.back(), 1, BLOCK_SIZE);
+        }
+        for (bool spawn : {false, true})
+        {
+            std::vector<double> latencies;
+
+            for (int i = 0; i < LAUNCHES; i++)
+                latencies.push_back(launch(spawn));
+            std::sort(latencies.begin(), latencies.end());
+            std::cout << "RSS " << target << " MB, " << (spawn ? "posix_spawn: " : "fork+execve: ")
+                      << "p50 " << latencies[LAUNCHES / 2] << " ms, p99 " << latencies[LAUNCHES * 99 / 100] << " ms" << std::endl;
+        }
+    }
+    for (char *block : blocks)
+        delete[] block;
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#define BACKEND_PORT 4747
+#define BACKEND_PATH "/tmp/webserv-bench.sock"
+#define BACKEND_ABSTRACT "webserv-bench"
+
+/*
+Upstream hop latency, loopback TCP against Unix domain sockets. A child process plays a minimal
+keep-alive backend on 127.0.0.1:4747, BACKEND_PATH and @BACKEND_ABSTRACT (the targets of
+tests/bench/proxy.conf); the parent sends sequential GETs through webserv, one client connection
+each, to /tcp/, /unix/ and /abstract/ in turn and prints the p50/p99 latency of every target.
+Run through tests/bench/unix_upstream.sh, which starts webserv with and without upstream pooling.
+usage: UnixUpstreamBench <webserv port> [requests per target] [runs]
+*/
+static const char RESPONSE[] = "HTTP/1.1 200 OK\r\nContent-Length: 13\r\nConnection: keep-alive\r\n\r\nhello, world\n";
+
+static int listenOn(const struct sockaddr *address, socklen_t length)
+{
+    const int fd = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    const int one = 1;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (fd == -1 || bind(fd, address, length) == -1 || listen(fd, 512) == -1)
+    {
+        perror("backend");
+        exit(1);
+    }
+    return fd;
+}
+
+//answers every request head with RESPONSE, on as many connections as come
+static void runBackend(void)
+{
+    struct sockaddr_in  tcp = {};
+    struct sockaddr_un  path = {};
+    struct sockaddr_un  abstract = {};
+    char                buffer[65536];
+
+    tcp.sin_family = AF_INET;
+    tcp.sin_port = htons(BACKEND_PORT);
+    tcp.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    path.sun_family = AF_UNIX;
+    std::strcpy(path.sun_path, BACKEND_PATH);
+    unlink(BACKEND_PATH);
+    abstract.sun_family = AF_UNIX;
+    std::strcpy(abstract.sun_path + 1, BACKEND_ABSTRACT);
+
+    const int listeners[3] = {
+        listenOn(reinterpret_cast<struct sockaddr *>(&tcp), sizeof(tcp)),
+        listenOn(reinterpret_cast<struct sockaddr *>(&path), sizeof(path)),
+        listenOn(reinterpret_cast<struct sockaddr *>(&abstract), offsetof(struct sockaddr_un, sun_path) + 1 + std::strlen(BACKEND_ABSTRACT))
+    };
+    const int epollFd = epoll_create1(0);
+    struct epoll_event events[64];
+
+    for (int listener : listeners)
+    {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = listener;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listener, &event);
+    }
+    while (true)
+    {
+        const int count = epoll_wait(epollFd, events, 64, -1);
+
+        for (int i = 0; i < count; i++)
+        {
+            const int fd = events[i].data.fd;
+
+            if (std::find(listeners, listeners + 3, fd) != listeners + 3)
+            {
+                int client;
+                while ((client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK)) != -1)
+                {
+                    struct epoll_event event = {};
+                    event.events = EPOLLIN;
+                    event.data.fd = client;
+                    epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &event);
+                }
+                continue;
+            }
+            const ssize_t length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0)
+            {
+                close(fd);
+                continue;
+            }
+            for (ssize_t k = 3; k < length; k++)
+                if (std::memcmp(buffer + k - 3, "\r\n\r\n", 4) == 0 && write(fd, RESPONSE, sizeof(RESPONSE) - 1) == -1)
+                    break;
+        }
+    }
+}
+
+//one request on a new connection, in microseconds; -1 if the response isn't the backend's
+static double timeRequest(int port, const std::string &request)
+{
+    struct sockaddr_in  address = {};
+    char                buffer[8192];
+    size_t              received = 0;
+    ssize_t             length;
+    const auto          start = std::chrono::steady_clock::now();
+    const int           fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1
+        || write(fd, request.c_str(), request.length()) != static_cast<ssize_t>(request.length()))
+    {
+        close(fd);
+        return -1;
+    }
+    while (received < sizeof(buffer) && (length = read(fd, buffer + received, sizeof(buffer) - received)) > 0)
+    {
+        received += length;
+        if (memmem(buffer, received, "hello, world\n", 13))
+            break;
+    }
+    close(fd);
+    if (!memmem(buffer, received, "hello, world\n", 13))
+        return -1;
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <webserv port> [requests per target] [runs]" << std::endl;
+        return 1;
+    }
+    const int                       port = std::atoi(argv[1]);
+    const int                       requests = argc > 2 ? std::atoi(argv[2]) : 10000;
+    const int                       runs = argc > 3 ? std::atoi(argv[3]) : 5;
+    const std::vector<std::string>  targets = {"/tcp/", "/unix/", "/abstract/"};
+    std::vector<std::vector<double>> p50s(targets.size());
+    const pid_t                     backend = fork();
+
+    if (backend == 0)
+        runBackend();
+    usleep(200000);
+    // interleaved, so a noisy moment doesn't land on one target only
+    for (int run = 0; run < runs; run++)
+    {
+        for (size_t target = 0; target < targets.size(); target++)
+        {
+            const std::string   request = "GET " + targets[target] + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            std::vector<double> latencies;
+
+            for (int i = 0; i < requests; i++)
+            {
+                const double latency = timeRequest(port, request);
+                if (latency < 0)
+                {
+                    std::cerr << targets[target] << ": unexpected response" << std::endl;
+                    kill(backend, SIGTERM);
+                    return 1;
+                }
+                latencies.push_back(latency);
+            }
+            std::sort(latencies.begin(), latencies.end());
+            p50s[target].push_back(latencies[latencies.size() / 2]);
+            std::cout << "run " << run + 1 << " " << targets[target] << ": p50 " << latencies[latencies.size() / 2]
+                      << " us, p99 " << latencies[latencies.size() * 99 / 100] << " us" << std::endl;
+        }
+    }
+    for (size_t target = 0; target < targets.size(); target++)
+    {
+        std::sort(p50s[target].begin(), p50s[target].end());
+        std::cout << targets[target] << " median p50: " << p50s[target][p50s[target].size() / 2] << " us" << std::endl;
+    }
+    kill(backend, SIGTERM);
+    waitpid(backend, nullptr, 0);
+    unlink(BACKEND_PATH);
+    return 0;
+}
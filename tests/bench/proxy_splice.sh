@@ -0,0 +1,24 @@
+#!/bin/bash
+# Proxied response bodies: pushes a 1GB body from tests/bench/upstream.py through the proxy a few
+# times and prints the server's CPU time (from /proc/<pid>/stat) and the wall time per request.
+# Run from the repository root; pass another build to compare, e.g. one with splice() disabled.
+# usage: tests/bench/proxy_splice.sh [webserv binary] [runs] [bytes]
+BIN=${1:-./webserv}
+RUNS=${2:-4}
+BYTES=${3:-1073741824}
+TICK_MS=$((1000 / $(getconf CLK_TCK)))
+
+python3 tests/bench/upstream.py 4747 &
+UPSTREAM=$!
+"$BIN" tests/bench/proxy.conf > /dev/null 2>&1 &
+SERVER=$!
+trap 'kill $SERVER $UPSTREAM 2> /dev/null' EXIT
+sleep 1
+
+for run in $(seq "$RUNS"); do
+    read -r user0 sys0 < <(awk '{print $14, $15}' /proc/$SERVER/stat)
+    read -r code size wall < <(curl -s -o /dev/null -w '%{http_code} %{size_download} %{time_total}' localhost:7373/tcp/big/$BYTES)
+    read -r user1 sys1 < <(awk '{print $14, $15}' /proc/$SERVER/stat)
+    [ "$code" = 200 ] && [ "$size" = "$BYTES" ] || { echo "run $run: got $code with $size bytes" >&2; exit 1; }
+    echo "run $run: user $(((user1 - user0) * TICK_MS))ms sys $(((sys1 - sys0) * TICK_MS))ms wall ${wall}s"
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Upstream latency over loopback TCP, a Unix socket file and an abstract socket, with pooled upstream
+# connections (the default) and with proxy_keepalive 0. Run from the repository root.
+# usage: tests/bench/unix_upstream.sh [requests per target] [runs]
+make -s bench || exit 1
+CONF=$(mktemp --suffix=.conf)
+trap 'rm -f "$CONF"' EXIT
+
+for keepalive in 16 0; do
+    { echo "proxy_keepalive $keepalive;"; cat tests/bench/proxy.conf; } > "$CONF"
+    ./webserv "$CONF" > /dev/null 2>&1 &
+    SERVER=$!
+    sleep 1
+    echo "proxy_keepalive $keepalive"
+    tests/bench/UnixUpstreamBench 7373 "${1:-10000}" "${2:-5}"
+    kill $SERVER
+    wait $SERVER 2> /dev/null
+done
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Upload throughput: the same file posted to cgi-scripts/upload_handler.py, to a native upload_folder
+# location as multipart/form-data, and PUT there raw; prints curl's wall time for each and checks
+# that the native copies are identical. Everything is written to a temporary directory.
+# Run from the repository root.
+# usage: tests/bench/upload.sh [size in MB]...
+DIR=$(mktemp -d)
+trap 'kill $SERVER 2> /dev/null; rm -rf "$DIR"' EXIT
+mkdir "$DIR/native"
+cat > "$DIR/upload.conf" <<CONF
+server {
+    listen 7575;
+    server_name localhost;
+    client_max_body_size 4000M;
+
+    location /cgi/ {
+        allowed_methods POST;
+        cgi_pass /cgi-scripts/upload_handler.py;
+        upload_folder $DIR/cgi;
+    }
+
+    location /native/ {
+        allowed_methods POST PUT;
+        alias $DIR/native;
+        upload_folder $DIR/native;
+    }
+}
+CONF
+./webserv "$DIR/upload.conf" > /dev/null 2>&1 &
+SERVER=$!
+sleep 1
+
+SIZES=("$@")
+[ $# -eq 0 ] && SIZES=(8 50)
+for mb in "${SIZES[@]}"; do
+    head -c $((mb << 20)) /dev/urandom > "$DIR/body.bin"
+    cgi=$(curl -s -o /dev/null -w '%{http_code} %{time_total}s' -F "file=@$DIR/body.bin" localhost:7575/cgi/)
+    multipart=$(curl -s -o /dev/null -w '%{http_code} %{time_total}s' -F "file=@$DIR/body.bin" localhost:7575/native/)
+    cmp -s "$DIR/body.bin" "$DIR/native/body.bin" || multipart="$multipart (stored file differs)"
+    put=$(curl -s -o /dev/null -w '%{http_code} %{time_total}s' -T "$DIR/body.bin" localhost:7575/native/put.bin)
+    cmp -s "$DIR/body.bin" "$DIR/native/put.bin" || put="$put (stored file differs)"
+    echo "$mb MB: upload_handler.py $cgi, native multipart $multipart, native PUT $put"
+    rm -f "$DIR"/native/* "$DIR"/cgi/*
+done
@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+"""Stand-in upstream for the proxy benchmarks.
+GET /big/<bytes> answers that many bytes with a Content-Length, POST echoes its body,
+anything else a short text. usage: upstream.py <port>"""
+import sys
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+BLOCK = b"x" * (1 << 20)
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def reply(self, body):
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        if not self.path.startswith("/big/"):
+            return self.reply(b"upstream\n")
+        remaining = int(self.path.rsplit("/", 1)[1])
+        self.send_response(200)
+        self.send_header("Content-Length", str(remaining))
+        self.end_headers()
+        while remaining > 0:
+            chunk = BLOCK[:min(remaining, len(BLOCK))]
+            self.wfile.write(chunk)
+            remaining -= len(chunk)
+
+    def do_POST(self):
+        self.reply(self.rfile.read(int(self.headers.get("Content-Length", 0))))
+
+
+ThreadingHTTPServer(("127.0.0.1", int(sys.argv[1])), Handler).serve_forever()
@@ -0,0 +1,53 @@
+#include "LocationTrie.hpp"
+#include "UnitTest.hpp"
+
+//matches only end on a segment boundary, the longest one wins
+static void testSegmentBoundaries(void)
+{
+    LocationTrie trie;
+
+    trie.insert("/", 0);
+    trie.insert("/uploads", 1);
+    trie.insert("/list/", 2);
+    CHECK_EQ(trie.findLongestPrefix("/uploads"), 1);
+    CHECK_EQ(trie.findLongestPrefix("/uploads/a.txt"), 1);
+    CHECK_EQ(trie.findLongestPrefix("/uploadsX"), 0);
+    CHECK_EQ(trie.findLongestPrefix("/list/a"), 2);
+    CHECK_EQ(trie.findLongestPrefix("/list"), 0);
+    CHECK_EQ(trie.findLongestPrefix("/"), 0);
+}
+
+//inserting a prefix of an existing edge splits it, both ends keep their location
+static void testEdgeSplits(void)
+{
+    LocationTrie trie;
+
+    trie.insert("/api/v1/users/", 0);
+    trie.insert("/api/v1/", 1);
+    trie.insert("/api/v2/", 2);
+    trie.insert("/api/", 3);
+    CHECK_EQ(trie.findLongestPrefix("/api/v1/users/7"), 0);
+    CHECK_EQ(trie.findLongestPrefix("/api/v1/groups"), 1);
+    CHECK_EQ(trie.findLongestPrefix("/api/v2/x"), 2);
+    CHECK_EQ(trie.findLongestPrefix("/api/v3/x"), 3);
+    CHECK_EQ(trie.findLongestPrefix("/other"), -1);
+}
+
+static void testDuplicatesAndClear(void)
+{
+    LocationTrie trie;
+
+    trie.insert("/a/", 0);
+    trie.insert("/a/", 1);
+    CHECK_EQ(trie.findLongestPrefix("/a/b"), 0);
+    trie.clear();
+    CHECK_EQ(trie.findLongestPrefix("/a/b"), -1);
+}
+
+int main(void)
+{
+    testSegmentBoundaries();
+    testEdgeSplits();
+    testDuplicatesAndClear();
+    return unitTestResult("LocationTrie");
+}
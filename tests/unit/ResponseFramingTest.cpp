@@ -0,0 +1,132 @@
+#include "ResponseFraming.hpp"
+#include "UnitTest.hpp"
+#include <algorithm>
+#include <string>
+
+//feeds in pieces of at most step bytes, stops where the response ends; returns the bytes it took
+static size_t feedAll(ResponseFraming &framing, const std::string &data, size_t step)
+{
+    size_t offset = 0;
+
+    while (offset < data.length() && !framing.isComplete() && !framing.isMalformed())
+    {
+        const size_t length = std::min(step, data.length() - offset);
+        const size_t consumed = framing.feed(data.c_str() + offset, length);
+
+        offset += consumed;
+        if (consumed < length)
+            break;
+    }
+    return offset;
+}
+
+//the bytes after the response (a pipelined one here) are never taken, whatever the chunking
+static void testContentLength(void)
+{
+    const std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\ncontent-length:  5 \r\n\r\nhello";
+
+    for (size_t step : {1ul, 7ul, response.length() + 100})
+    {
+        ResponseFraming framing;
+
+        CHECK_EQ(feedAll(framing, response + "HTTP/1.1 200 OK\r\n", step), response.length());
+        CHECK(framing.isComplete());
+        CHECK_EQ(framing.getStatusCode(), 200);
+        CHECK_EQ(framing.getFraming(), ResponseFraming::FRAMING_LENGTH);
+        CHECK_EQ(framing.getHeaderValue("Content-Length"), std::string("5"));
+        CHECK_EQ(framing.getHeaderValue("Content-Type"), std::string("text/plain"));
+        CHECK_EQ(framing.getHeaderValue("Content"), std::string(""));
+    }
+}
+
+static void testChunked(void)
+{
+    const std::string response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: Chunked\r\nContent-Length: 3\r\n\r\n"
+                                 "5\r\nhello\r\na;ext=1\r\n0123456789\r\n0\r\nTrailer: x\r\n\r\n";
+
+    for (size_t step : {1ul, 3ul, response.length()})
+    {
+        ResponseFraming framing;
+
+        CHECK_EQ(feedAll(framing, response + "extra", step), response.length());
+        CHECK(framing.isComplete());
+        CHECK_EQ(framing.getFraming(), ResponseFraming::FRAMING_CHUNKED);
+        CHECK_EQ(framing.getPlainBodyRemaining(), 0ul);
+    }
+
+    ResponseFraming framing;
+    const std::string bad = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcX\r\n";
+    feedAll(framing, bad, 1);
+    CHECK(framing.isMalformed());
+}
+
+//HEAD, 204 and 304 end with the headers whatever they announce
+static void testNoBody(void)
+{
+    const std::string length = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\n";
+    ResponseFraming head(true);
+
+    CHECK_EQ(feedAll(head, length + "0123456789", 1), length.length());
+    CHECK(head.isComplete());
+    CHECK_EQ(head.getFraming(), ResponseFraming::FRAMING_NONE);
+
+    for (const char *status : {"204 No Content", "304 Not Modified"})
+    {
+        const std::string response = std::string("HTTP/1.1 ") + status + "\r\nContent-Length: 10\r\n\r\n";
+        ResponseFraming framing;
+
+        CHECK_EQ(feedAll(framing, response + "0123456789", 4), response.length());
+        CHECK(framing.isComplete());
+        CHECK_EQ(framing.getFraming(), ResponseFraming::FRAMING_NONE);
+    }
+}
+
+//a 100 Continue is dropped, the final response's headers are the ones kept
+static void testInterim(void)
+{
+    const std::string response = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok";
+    ResponseFraming framing;
+
+    CHECK_EQ(feedAll(framing, response, 1), response.length());
+    CHECK(framing.isComplete());
+    CHECK_EQ(framing.getStatusCode(), 201);
+    CHECK_EQ(framing.getHeaders().compare(0, 12, "HTTP/1.1 201"), 0);
+}
+
+static void testUntilCloseAndSkip(void)
+{
+    ResponseFraming close;
+    const std::string headers = "HTTP/1.0 200 OK\r\n\r\n";
+
+    CHECK_EQ(feedAll(close, headers + "body", 5), headers.length() + 4);
+    CHECK(!close.isComplete());
+    CHECK_EQ(close.getFraming(), ResponseFraming::FRAMING_CLOSE);
+    CHECK_EQ(close.getPlainBodyRemaining(), static_cast<size_t>(-1));
+    close.onEof();
+    CHECK(close.isComplete());
+
+    ResponseFraming length;
+    const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n";
+
+    CHECK_EQ(length.feed(response.c_str(), response.length()), response.length());
+    CHECK_EQ(length.getPlainBodyRemaining(), 100ul);
+    length.skipPlainBody(60);
+    CHECK_EQ(length.getPlainBodyRemaining(), 40ul);
+    length.skipPlainBody(60);
+    CHECK(length.isComplete());
+
+    ResponseFraming malformed;
+    const std::string garbage = "SSH-2.0-OpenSSH\r\n\r\n";
+    malformed.feed(garbage.c_str(), garbage.length());
+    CHECK(malformed.isMalformed());
+}
+
+int main(void)
+{
+    testContentLength();
+    testChunked();
+    testNoBody();
+    testInterim();
+    testUntilCloseAndSkip();
+    return unitTestResult("ResponseFraming");
+}
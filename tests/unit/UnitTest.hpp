@@ -0,0 +1,40 @@
+#pragma once
+
+#include <iostream>
+
+/*
+Just enough of a harness for tests/unit: every test file is a program of its own, linked against the
+server's objects by `make test`. A failed CHECK prints where it was and the program exits non-zero.
+*/
+inline int &unitTestFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            unitTestFailures()++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        const auto &checkActual = (actual); \
+        const auto &checkExpected = (expected); \
+        if (!(checkActual == checkExpected)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #actual ", " #expected ") got '" \
+                      << checkActual << "', expected '" << checkExpected << "'\n"; \
+            unitTestFailures()++; \
+        } \
+    } while (0)
+
+inline int unitTestResult(const char *name)
+{
+    std::cout << name << (unitTestFailures() == 0 ? ": ok\n" : ": FAILED\n");
+    return unitTestFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+#include "UploadHandler.hpp"
+#include "UnitTest.hpp"
+#include "VirtualHostMap.hpp"
+#include "WebParser.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+/*
+UploadHandler fed the way WebServer::startUpload and receiveUpload do: a Request made of the headers, then
+the body in pieces of every size, so that delimiters, part headers and padding get split anywhere.
+Everything runs in a temporary directory: the configuration, its root and the upload folder.
+*/
+struct Upload
+{
+    int         errorCode;
+    std::string response;
+};
+
+static std::string          g_directory;
+static std::string          g_folder;
+static VirtualHostMap       g_virtualHosts;
+static const std::unordered_map<std::string, AddressList> g_proxyInfoMap;
+
+static Upload upload(const std::string &method, const std::string &uri, const std::string &contentType,
+                     const std::string &body, size_t step)
+{
+    std::string request = method + " " + uri + " HTTP/1.1\r\nHost: localhost\r\nContent-Length: "
+                        + std::to_string(body.size()) + "\r\n";
+    std::streambuf  *out = std::cout.rdbuf(nullptr);  // the handler logs what it stores and why it fails
+    std::streambuf  *err = std::cerr.rdbuf(nullptr);
+
+    if (!contentType.empty())
+        request += "Content-Type: " + contentType + "\r\n";
+    request += "\r\n";
+
+    Request         parsed(request, g_virtualHosts, g_proxyInfoMap);
+    UploadHandler   handler(parsed);
+
+    for (size_t offset = 0; offset < body.size() && !handler.isDone(); offset += step)
+        handler.feed(body.data() + offset, std::min(step, body.size() - offset));
+
+    const Upload    result = {handler.getErrorCode(), handler.getResponse()};
+
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+    CHECK(handler.isDone());
+    return result;
+}
+
+static std::string readFile(const std::string &name)
+{
+    std::ifstream       file(g_folder + "/" + name, std::ios::binary);
+    std::stringstream   content;
+
+    content << file.rdbuf();
+    return file ? content.str() : "<missing>";
+}
+
+//nothing but the stored files, no temporary one left behind
+static size_t countFiles(void)
+{
+    size_t count = 0;
+
+    for (const auto &entry : std::filesystem::directory_iterator(g_folder))
+    {
+        CHECK(entry.path().filename().string().compare(0, 8, ".upload-") != 0);
+        count++;
+    }
+    return count;
+}
+
+static const size_t STEPS[] = {1, 2, 5, 13, 64, 4096};
+
+static void testParts(void)
+{
+    const std::string first = "line one\r\n--not-the-boundary\r\n--BOUNDAR";  // almost a delimiter, twice
+    const std::string second(100000, 'z');
+    const std::string body = "preamble, ignored\r\n--BOUNDARY\r\n"
+        "Content-Disposition: form-data; name=\"comment\"\r\n\r\nnot a file\r\n--BOUNDARY\r\n"
+        "Content-Disposition: form-data; name=\"a\"; filename=\"first.txt\"\r\nContent-Type: text/plain\r\n\r\n"
+        + first + "\r\n--BOUNDARY\r\n"
+        "content-disposition: form-data; name=b; filename=\"C:\\path\\second.bin\"\r\n\r\n"
+        + second + "\r\n--BOUNDARY--\r\nepilogue, ignored";
+
+    for (size_t step : STEPS)
+    {
+        const Upload result = upload("POST", "/upload/", "multipart/form-data; boundary=BOUNDARY", body, step);
+
+        CHECK_EQ(result.errorCode, 0);
+        CHECK(result.response.find("{\"files\":[{\"field\":\"a\",\"filename\":\"first.txt\",\"size\":"
+            + std::to_string(first.size()) + "},{\"field\":\"b\",\"filename\":\"second.bin\",\"size\":100000}]}") != std::string::npos);
+        CHECK(readFile("first.txt") == first);
+        CHECK(readFile("second.bin") == second);
+        CHECK_EQ(countFiles(), 2ul);
+    }
+}
+
+//spaces and tabs after a delimiter, a quoted boundary, an empty part
+static void testPaddingAndEmptyParts(void)
+{
+    const std::string body = "--b \t \r\nContent-Disposition: form-data; name=\"f\"; filename=\"empty\"\r\n\r\n"
+        "\r\n--b\t\r\n\r\nno headers, skipped\r\n--b  --";
+
+    for (size_t step : STEPS)
+    {
+        const Upload result = upload("POST", "/upload/", "multipart/form-data; boundary=\"b\"", body, step);
+
+        CHECK_EQ(result.errorCode, 0);
+        CHECK(result.response.find("\"filename\":\"empty\",\"size\":0") != std::string::npos);
+        CHECK(readFile("empty").empty());
+    }
+}
+
+//a part whose delimiter was seen is stored, the one being written when the body turns out wrong is not
+static void testMalformed(void)
+{
+    const std::string part = "--B\r\nContent-Disposition: form-data; name=\"f\"; filename=\"broken\"\r\n\r\ndata";
+
+    std::filesystem::remove_all(g_folder);
+    for (size_t step : STEPS)
+    {
+        for (const char *end : {"\r\n--BX\r\n", "\r\n--B\r\n"})
+        {
+            CHECK_EQ(upload("POST", "/upload/", "multipart/form-data; boundary=B", part + end, step).errorCode, 400);
+            CHECK(readFile("broken") == "data");
+            std::filesystem::remove(g_folder + "/broken");
+        }
+        CHECK_EQ(upload("POST", "/upload/", "multipart/form-data; boundary=B", part, step).errorCode, 400);
+        CHECK_EQ(upload("POST", "/upload/", "multipart/form-data; boundary=B",
+            "--B\r\nContent-Disposition: form-data; name=\"f\"; filename=\"..\"\r\n\r\nx\r\n--B--", step).errorCode, 400);
+        CHECK_EQ(countFiles(), 0ul);
+    }
+    CHECK_EQ(upload("POST", "/upload/", "multipart/form-data", "--B--", 1).errorCode, 400);
+    CHECK_EQ(upload("POST", "/upload/", "text/plain", "x", 1).errorCode, 415);
+}
+
+//the body as it is, 201 for a new file and 200 when it replaces one
+static void testPut(void)
+{
+    const std::string body = "--B\r\nnot multipart\r\n--B--";
+
+    CHECK_EQ(upload("PUT", "/upload/raw.txt", "", body, 3).response.compare(0, 12, "HTTP/1.1 201"), 0);
+    CHECK(readFile("raw.txt") == body);
+    CHECK_EQ(upload("PUT", "/upload/raw.txt", "", "shorter", 4096).response.compare(0, 12, "HTTP/1.1 200"), 0);
+    CHECK(readFile("raw.txt") == "shorter");
+    CHECK_EQ(upload("PUT", "/upload/", "", body, 1).errorCode, 400);
+}
+
+int main(void)
+{
+    char directory[] = "/tmp/upload-test-XXXXXX";
+
+    if (!mkdtemp(directory))
+        return perror("mkdtemp"), 1;
+    g_directory = directory;
+    g_folder = g_directory + "/store";
+    std::filesystem::create_directory(g_directory + "/upload");
+    std::ofstream(g_directory + "/upload.conf") << "server {\n    listen 7474;\n    server_name localhost;\n\n"
+        "    location /upload/ {\n        allowed_methods POST PUT;\n        root " << g_directory << ";\n"
+        "        upload_folder " << g_folder << ";\n    }\n}\n";
+
+    std::streambuf  *out = std::cout.rdbuf(nullptr);
+    WebParser       parser(g_directory + "/upload.conf");
+    const bool      parsed = parser.parse();
+
+    std::cout.rdbuf(out);
+    CHECK(parsed);
+    if (parsed)
+    {
+        g_virtualHosts.addServer(parser.getServers().front(), true);
+        testParts();
+        testPaddingAndEmptyParts();
+        testMalformed();
+        testPut();
+    }
+    std::filesystem::remove_all(g_directory);
+    return unitTestResult("UploadHandler");
+}